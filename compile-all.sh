@@ -1,16 +1,5 @@
 #!/bin/bash
 
-FILES=`ls ./src/*.c`
-BINDIR='bin/'
-
-if [ ! -d "$BINDIR" ]; then
-    mkdir $BINDIR && echo "Made directory $BINDIR"
-fi
-
-for file in $FILES
-do
-    base=$(basename $file .c)
-    mpicc $file -o $BINDIR$base
-done
-
-
+# Build all the example codes into bin/; see the Makefile for the
+# opt, debug and asan variants and the test and bench targets.
+exec make -j"$(nproc 2>/dev/null || echo 4)" all "$@"
@@ -125,6 +125,227 @@ Errors
 #include "mpi.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include "bench_util.h"
+
+/*
+* ring_allreduce is a bandwidth-optimal allreduce for large vectors.
+* The vector is cut into p blocks; a reduce-scatter ring (p-1 rounds)
+* leaves every rank with one fully reduced block and an allgather ring
+* (p-1 more rounds) circulates the reduced blocks. Every rank sends and
+* receives 2(p-1)/p of the vector in total, independent of p.
+*
+* Each block is further cut into segments of seg_bytes. All receives of
+* a round are posted up front and each segment is reduced (or stored) as
+* soon as it arrives and immediately forwarded to the right neighbour as
+* part of the next round, so the send, receive and reduce of different
+* segments overlap. The op must be commutative; datatype must be a
+* contiguous type. sendbuf may be MPI_IN_PLACE.
+*/
+
+#define RING_TAG 4242
+#define SEG_BYTES (1024*1024)
+
+static void ring_block(int b, int count, int size, int *off, int *len)
+{
+    int base = count / size, rem = count % size;
+    *len = base + (b < rem);
+    *off = b * base + (b < rem ? b : rem);
+}
+
+int ring_allreduce(void *sendbuf, void *recvbuf, int count, MPI_Datatype datatype,
+                   MPI_Op op, MPI_Comm comm, int seg_bytes)
+{
+    int rank, size, t, k, nrounds, seg, nseg, maxnseg, maxlen, len, off, slen, soff;
+    int rblk, right, left, cur = 0;
+    char *rbuf = (char *) recvbuf, *tmp;
+    MPI_Aint lb, extent;
+    MPI_Request *rreqs, *sreqs;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    MPI_Type_get_extent(datatype, &lb, &extent);
+
+    if (sendbuf != MPI_IN_PLACE)
+    {
+        memcpy(recvbuf, sendbuf, (size_t) count * extent);
+    }
+    if (size == 1 || count == 0) return MPI_SUCCESS;
+
+    seg = seg_bytes / (int) extent;
+    if (seg < 1) seg = 1;
+    maxlen  = count / size + (count % size != 0);
+    maxnseg = (maxlen + seg - 1) / seg;
+    tmp   = (char *) malloc((size_t) maxlen * extent);
+    rreqs = (MPI_Request *) malloc(maxnseg * sizeof(MPI_Request));
+    sreqs = (MPI_Request *) malloc(2 * maxnseg * sizeof(MPI_Request));
+    for (k=0; k<2*maxnseg; k++) sreqs[k] = MPI_REQUEST_NULL;
+
+    right = (rank + 1) % size;
+    left  = (rank - 1 + size) % size;
+    nrounds = 2 * (size - 1);
+
+    /* Round 0 sends this rank's own block as it stands */
+    ring_block(rank, count, size, &soff, &slen);
+    nseg = (slen + seg - 1) / seg;
+    for (k=0; k<nseg; k++)
+    {
+        int n = (slen - k*seg < seg) ? slen - k*seg : seg;
+        MPI_Isend(rbuf + (size_t) (soff + k*seg) * extent, n, datatype, right,
+                  RING_TAG, comm, &sreqs[k]);
+    }
+
+    for (t=0; t<nrounds; t++)
+    {
+        int reduce = (t < size - 1);
+        char *dst;
+
+        /* Block received this round: rank-t-1 while reducing, rank-(t-p+1) while gathering */
+        rblk = reduce ? (rank - t - 1 + size) % size
+                      : (rank - (t - size + 1) + size) % size;
+        ring_block(rblk, count, size, &off, &len);
+        nseg = (len + seg - 1) / seg;
+        dst  = reduce ? tmp : rbuf + (size_t) off * extent;
+
+        /*
+        * Sends of the previous round must drain before their slots are
+        * reused. While gathering, the block received may be one still
+        * being sent (at p=2 the block sent in round 0 comes back in
+        * round 1), so drain them before its receives are posted.
+        */
+        cur = 1 - cur;
+        if (!reduce) MPI_Waitall(maxnseg, sreqs + cur * maxnseg, MPI_STATUSES_IGNORE);
+
+        for (k=0; k<nseg; k++)
+        {
+            int n = (len - k*seg < seg) ? len - k*seg : seg;
+            MPI_Irecv(dst + (size_t) k * seg * extent, n, datatype, left,
+                      RING_TAG + t, comm, &rreqs[k]);
+        }
+        if (reduce) MPI_Waitall(maxnseg, sreqs + cur * maxnseg, MPI_STATUSES_IGNORE);
+
+        for (k=0; k<nseg; k++)
+        {
+            int n = (len - k*seg < seg) ? len - k*seg : seg;
+            char *blk = rbuf + (size_t) (off + k*seg) * extent;
+
+            MPI_Wait(&rreqs[k], MPI_STATUS_IGNORE);
+            if (reduce)
+            {
+                MPI_Reduce_local(tmp + (size_t) k * seg * extent, blk, n, datatype, op);
+            }
+            /* This block is what the right neighbour needs next round */
+            if (t + 1 < nrounds)
+            {
+                MPI_Isend(blk, n, datatype, right, RING_TAG + t + 1, comm,
+                          &sreqs[cur * maxnseg + k]);
+            }
+        }
+    }
+    MPI_Waitall(2 * maxnseg, sreqs, MPI_STATUSES_IGNORE);
+
+    free(sreqs);
+    free(rreqs);
+    free(tmp);
+    return MPI_SUCCESS;
+}
+
+/*
+* -bench sweeps MPI_FLOAT/MPI_SUM vectors from -min to -max elements
+* (default 1K to 256M, doubling) comparing MPI_Allreduce with
+* ring_allreduce. Times are the slowest rank; "busbw" scales the
+* algorithm bandwidth by 2(p-1)/p so it is comparable to link speed.
+*
+*   mpirun -n 8 ./MPI_Allreduce -bench [-min 1K] [-max 256M] [-reps 10]
+*                               [-warmup 2] [-seg 1M]
+*/
+
+#define NUM_REPS 10
+#define NUM_WARMUP 2
+#define MAX_COUNT (256*1024*1024)
+
+static int run_bench(int argc, char *argv[], int rank, int size)
+{
+    long long min_count, max_count, n;
+    int num_reps, num_warmup, seg_bytes, r, a, i, errs = 0;
+    float *in, *out, *ref;
+    double t0, t, sum, tmax[2];
+    char sbuf[32];
+    const char *names[2] = { "MPI_Allreduce", "ring" };
+
+    min_count  = bench_arg_size(argc, argv, "-min", 1024);
+    max_count  = bench_arg_size(argc, argv, "-max", MAX_COUNT);
+    num_reps   = bench_arg_int(argc, argv, "-reps", NUM_REPS);
+    num_warmup = bench_arg_int(argc, argv, "-warmup", NUM_WARMUP);
+    seg_bytes  = (int) bench_arg_size(argc, argv, "-seg", SEG_BYTES);
+    if (min_count < 1) min_count = 1;
+    if (max_count > MAX_COUNT) max_count = MAX_COUNT;
+    if (num_reps < 1) num_reps = 1;
+
+    in  = (float *) malloc(max_count * sizeof(float));
+    out = (float *) malloc(max_count * sizeof(float));
+    ref = (float *) malloc(max_count * sizeof(float));
+    if (in == NULL || out == NULL || ref == NULL)
+    {
+        fprintf(stderr, "(%d) Cannot allocate 3 x %lld floats\n", rank, max_count);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    /* Small integers keep the float sums exact in any order */
+    for (i=0; i<max_count; i++) in[i] = (float) ((i + rank) % 64);
+
+    if (rank == 0)
+    {
+        printf("# %d processes, %d reps (+%d warmup), ring segment %d bytes\n",
+               size, num_reps, num_warmup, seg_bytes);
+        printf("# %-10s %-14s %12s %12s %12s\n", "count", "algorithm", "time(us)",
+               "algbw(MB/s)", "busbw(MB/s)");
+        fflush(stdout);
+    }
+
+    for (n=min_count; n<=max_count; n*=2)
+    {
+        for (a=0; a<2; a++)
+        {
+            sum = 0.0;
+            for (r=0; r<num_warmup+num_reps; r++)
+            {
+                MPI_Barrier(MPI_COMM_WORLD);
+                t0 = MPI_Wtime();
+                if (a == 0)
+                    MPI_Allreduce(in, ref, (int) n, MPI_FLOAT, MPI_SUM, MPI_COMM_WORLD);
+                else
+                    ring_allreduce(in, out, (int) n, MPI_FLOAT, MPI_SUM, MPI_COMM_WORLD, seg_bytes);
+                t = MPI_Wtime() - t0;
+                if (r >= num_warmup) sum += t;
+            }
+            tmax[a] = bench_max_time(sum / num_reps, 0, MPI_COMM_WORLD);
+        }
+        if (memcmp(out, ref, n * sizeof(float)) != 0)
+        {
+            fprintf(stderr, "(%d) ring_allreduce differs from MPI_Allreduce for count %lld\n",
+                    rank, n);
+            fflush(stderr);
+            errs++;
+        }
+        if (rank == 0)
+        {
+            for (a=0; a<2; a++)
+            {
+                double algbw = bench_mbps((double) n * sizeof(float), tmax[a]);
+                printf("  %-10s %-14s %12.1f %12.1f %12.1f\n",
+                       bench_fmt_size(n, sbuf, sizeof(sbuf)), names[a], tmax[a] * 1e6,
+                       algbw, algbw * 2.0 * (size - 1) / size);
+            }
+            fflush(stdout);
+        }
+        if (n > max_count / 2) break;
+    }
+
+    free(in);
+    free(out);
+    free(ref);
+    return errs;
+}
 
 int main(int argc, char *argv[])
 {
@@ -139,6 +360,13 @@ int main(int argc, char *argv[])
 
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 
+    if (bench_flag(argc, argv, "-bench"))
+    {
+        fnderr = run_bench(argc, argv, rank, size);
+        MPI_Finalize();
+        return fnderr;
+    }
+
     in  = (int *) malloc( count * sizeof(int) );
     out = (int *) malloc( count * sizeof(int) );
     sol = (int *) malloc( count * sizeof(int) );
@@ -165,6 +393,24 @@ int main(int argc, char *argv[])
         fprintf( stderr, "(%d) Error for type MPI_INT and op MPI_SUM\n", rank );
         fflush(stderr);
     }
+
+    /* Same reduction through the ring, with segments small enough to pipeline */
+    for (i=0; i<count; i++) *(out + i) = 0;
+    ring_allreduce( in, out, count, MPI_INT, MPI_SUM, MPI_COMM_WORLD, 64*sizeof(int) );
+
+    for (i=0; i<count; i++)
+    {
+        if (*(out + i) != *(sol + i))
+        {
+            fnderr++;
+        }
+    }
+
+    if (fnderr)
+    {
+        fprintf( stderr, "(%d) Error for ring_allreduce with MPI_INT and op MPI_SUM\n", rank );
+        fflush(stderr);
+    }
     
     free( in );
     free( out );
@@ -173,4 +419,3 @@ int main(int argc, char *argv[])
     MPI_Finalize();
     return fnderr;
 }
-
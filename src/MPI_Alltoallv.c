@@ -154,6 +154,185 @@ Errors
 #include "mpi.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include "bench_util.h"
+#include "alltoallv_engine.h"
+
+/*
+* -bench times MPI_Alltoallv against the algorithms of
+* alltoallv_engine.h (pairwise, bruck, sparse and the automatic choice)
+* for three exchange patterns of MPI_DOUBLE messages:
+*
+*   sparse   every rank sends to its -nbrs nearest ranks (default 6),
+*            like particles migrating to neighbouring subdomains
+*   dense    every rank sends the same amount to every rank
+*   skew     every rank sends 0 to 7/4 times the message size to each
+*            rank, varying with sender and receiver
+*
+* Message sizes run from -min to -max bytes per peer (default 8 bytes to
+* 256K, quadrupling). Receive counts come from a2av_counts and every
+* algorithm's result is compared with MPI_Alltoallv. The root prints
+* min/median/p99 over all ranks and repetitions and marks the fastest.
+*
+*   mpirun -n 16 ./MPI_Alltoallv -bench [-pattern sparse|dense|skew]
+*                                [-min 8] [-max 256K] [-nbrs 6]
+*                                [-reps 10] [-warmup 2]
+*/
+
+#define NUM_REPS 10
+#define NUM_WARMUP 2
+#define MAX_BYTES (256*1024)
+#define NUM_NBRS 6
+#define NUM_ALGS 5
+
+static const char *pattern_names[3] = { "sparse", "dense", "skew" };
+
+static void fill_counts(int pattern, int n, int nbrs, int rank, int size, int *sendcounts)
+{
+    int i, k;
+
+    for (i=0; i<size; i++)
+    {
+        if (pattern == 1)      sendcounts[i] = n;
+        else if (pattern == 2) sendcounts[i] = n * ((rank * 31 + i * 17) % 8) / 4;
+        else                   sendcounts[i] = 0;
+    }
+    if (pattern == 0)
+    {
+        if (nbrs > size - 1) nbrs = size - 1;
+        for (k=1; k<=nbrs; k++)
+        {
+            /* rank+1, rank-1, rank+2, rank-2, ... */
+            i = (k % 2) ? rank + (k + 1) / 2 : rank - k / 2;
+            sendcounts[(i % size + size) % size] = n;
+        }
+    }
+}
+
+static int run_bench(int argc, char *argv[], int rank, int size)
+{
+    long long min_bytes, max_bytes, nb;
+    int num_reps, num_warmup, nbrs, pat, a, r, i, n, best, chosen, errs = 0;
+    int stotal, rtotal;
+    int *sendcounts, *recvcounts, *sdispls, *rdispls;
+    double *sbuf, *rbuf, *ref, *samples, t0;
+    const char *pattern;
+    char sizebuf[32], label[32];
+    bench_stats_t st[NUM_ALGS];
+    const int algs[NUM_ALGS] = { -1, A2AV_PAIRWISE, A2AV_BRUCK, A2AV_SPARSE, A2AV_AUTO };
+
+    min_bytes  = bench_arg_size(argc, argv, "-min", 8);
+    max_bytes  = bench_arg_size(argc, argv, "-max", MAX_BYTES);
+    num_reps   = bench_arg_int(argc, argv, "-reps", NUM_REPS);
+    num_warmup = bench_arg_int(argc, argv, "-warmup", NUM_WARMUP);
+    nbrs       = bench_arg_int(argc, argv, "-nbrs", NUM_NBRS);
+    pattern    = bench_arg(argc, argv, "-pattern");
+    if (min_bytes < (long long) sizeof(double)) min_bytes = sizeof(double);
+    if (num_reps < 1) num_reps = 1;
+
+    sendcounts = (int *) malloc(4 * size * sizeof(int));
+    recvcounts = sendcounts + size;
+    sdispls    = recvcounts + size;
+    rdispls    = sdispls + size;
+    samples    = (double *) malloc(num_reps * sizeof(double));
+
+    if (rank == 0)
+    {
+        printf("# %d processes, %d reps (+%d warmup), %d sparse neighbours\n",
+               size, num_reps, num_warmup, nbrs < size - 1 ? nbrs : size - 1);
+        printf("# %-7s %-8s %-16s %12s %12s %12s\n",
+               "pattern", "bytes", "algorithm", "min(us)", "median(us)", "p99(us)");
+        fflush(stdout);
+    }
+
+    for (pat=0; pat<3; pat++)
+    {
+        if (pattern && strcmp(pattern, pattern_names[pat]) != 0) continue;
+
+        for (nb=min_bytes; nb<=max_bytes; nb*=4)
+        {
+            n = (int) (nb / sizeof(double));
+            fill_counts(pat, n, nbrs, rank, size, sendcounts);
+            stotal = 0;
+            for (i=0; i<size; i++)
+            {
+                sdispls[i] = stotal;
+                stotal += sendcounts[i];
+            }
+            rtotal = a2av_counts(sendcounts, recvcounts, rdispls, MPI_COMM_WORLD);
+
+            sbuf = (double *) malloc((stotal + 1) * sizeof(double));
+            rbuf = (double *) malloc((rtotal + 1) * sizeof(double));
+            ref  = (double *) malloc((rtotal + 1) * sizeof(double));
+            if (sbuf == NULL || rbuf == NULL || ref == NULL)
+            {
+                fprintf(stderr, "(%d) Cannot allocate %d + 2 x %d doubles\n", rank, stotal, rtotal);
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+            for (i=0; i<stotal; i++) sbuf[i] = rank * 1e6 + i;
+            MPI_Alltoallv(sbuf, sendcounts, sdispls, MPI_DOUBLE,
+                          ref, recvcounts, rdispls, MPI_DOUBLE, MPI_COMM_WORLD);
+            chosen = a2av_choose(sendcounts, MPI_DOUBLE, MPI_COMM_WORLD);
+
+            for (a=0; a<NUM_ALGS; a++)
+            {
+                for (r=-1; r<num_warmup+num_reps; r++)
+                {
+                    /* r == -1 is the validated run */
+                    if (r < 0) memset(rbuf, 0, rtotal * sizeof(double));
+                    MPI_Barrier(MPI_COMM_WORLD);
+                    t0 = MPI_Wtime();
+                    if (algs[a] < 0)
+                        MPI_Alltoallv(sbuf, sendcounts, sdispls, MPI_DOUBLE,
+                                      rbuf, recvcounts, rdispls, MPI_DOUBLE, MPI_COMM_WORLD);
+                    else
+                        a2av_alltoallv(sbuf, sendcounts, sdispls, MPI_DOUBLE,
+                                       rbuf, recvcounts, rdispls, MPI_DOUBLE, MPI_COMM_WORLD, algs[a]);
+                    if (r >= num_warmup) samples[r - num_warmup] = MPI_Wtime() - t0;
+                    if (r < 0 && memcmp(rbuf, ref, rtotal * sizeof(double)) != 0)
+                    {
+                        fprintf(stderr, "(%d) %s differs from MPI_Alltoallv for %s, %lld bytes\n",
+                                rank, a2av_name(algs[a]), pattern_names[pat], nb);
+                        fflush(stderr);
+                        errs++;
+                    }
+                }
+                bench_reduce_stats(samples, num_reps, 0, MPI_COMM_WORLD, &st[a]);
+            }
+
+            if (rank == 0)
+            {
+                best = 0;
+                for (a=1; a<NUM_ALGS; a++)
+                {
+                    if (st[a].median < st[best].median) best = a;
+                }
+                for (a=0; a<NUM_ALGS; a++)
+                {
+                    if (algs[a] < 0)
+                        strcpy(label, "MPI_Alltoallv");
+                    else if (algs[a] == A2AV_AUTO)
+                        sprintf(label, "auto(%s)", a2av_name(chosen));
+                    else
+                        strcpy(label, a2av_name(algs[a]));
+                    printf("  %-7s %-8s %-16s %12.2f %12.2f %12.2f%s\n", pattern_names[pat],
+                           bench_fmt_size(nb, sizebuf, sizeof(sizebuf)), label,
+                           st[a].min * 1e6, st[a].median * 1e6, st[a].p99 * 1e6,
+                           (a == best) ? "  *" : "");
+                }
+                fflush(stdout);
+            }
+            free(sbuf);
+            free(rbuf);
+            free(ref);
+            if (nb > max_bytes / 4) break;
+        }
+    }
+
+    free(samples);
+    free(sendcounts);
+    return errs;
+}
 /*
 This program tests MPI_Alltoallv by having processor i send different
 amounts of data to each processor.
@@ -165,13 +344,18 @@ int main( int argc, char **argv )
     int *sbuf, *rbuf;
     int rank, size;
     int *sendcounts, *recvcounts, *rdispls, *sdispls;
-    int i, j, *p, err;
+    int i, j, a, *p, err;
     MPI_Init( &argc, &argv );
     err = 0;
     comm = MPI_COMM_WORLD;
     /* Create the buffer */
     MPI_Comm_size( comm, &size );
     MPI_Comm_rank( comm, &rank );
+    if (bench_flag( argc, argv, "-bench" )) {
+        err = run_bench( argc, argv, rank, size );
+        MPI_Finalize();
+        return err;
+    }
     sbuf = (int *)malloc( size * size * sizeof(int) );
     rbuf = (int *)malloc( size * size * sizeof(int) );
     if (!sbuf || !rbuf) {
@@ -213,6 +397,24 @@ int main( int argc, char **argv )
             }
         }
     }
+    /* Same exchange through each algorithm of alltoallv_engine.h */
+    for (a=A2AV_PAIRWISE; a<=A2AV_SPARSE; a++) {
+        for (i=0; i<size*size; i++) rbuf[i] = -i;
+        a2av_alltoallv( sbuf, sendcounts, sdispls, MPI_INT,
+                        rbuf, recvcounts, rdispls, MPI_INT, comm, a );
+        for (i=0; i<size; i++) {
+            p = rbuf + rdispls[i];
+            for (j=0; j<rank; j++) {
+                if (p[j] != i * 100 + (rank*(rank+1))/2 + j) {
+                    fprintf( stderr, "[%d] %s got %d expected %d for %dth\n",
+                                        rank, a2av_name(a), p[j],
+                                        i * 100 + (rank*(rank+1))/2 + j, j );
+                    fflush(stderr);
+                    err++;
+                }
+            }
+        }
+    }
     free( sdispls );
     free( rdispls );
     free( recvcounts );
@@ -220,6 +422,6 @@ int main( int argc, char **argv )
     free( rbuf );
     free( sbuf );
     MPI_Finalize();
-    return 0;
+    return err;
 }
 
@@ -122,90 +122,313 @@ Errors
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include "bench_util.h"
+
+/*
+* Timed broadcast sweep. Message sizes run from -min to -max bytes
+* (default 1 byte to 64 MiB, doubling) and every size is broadcast with
+* the library's MPI_Bcast and three user-level algorithms built from
+* point-to-point calls:
+*
+*   binomial   log2(p) rounds, whole message per round; best for small
+*              messages.
+*   scatter    van de Geijn: binomial scatter of p chunks followed by a
+*              ring allgather; moves ~2n bytes per rank instead of
+*              n*log2(p), so it wins for large messages.
+*   chain      pipelined chain root -> 1 -> 2 -> ... in -seg byte
+*              segments; bandwidth-optimal for very large messages but
+*              latency grows linearly with p.
+*
+* Each measurement is preceded by -warmup untimed broadcasts and the
+* timed repetitions of every rank are gathered to the root, which prints
+* min/median/p99 over all ranks and repetitions. The first timed
+* repetition of every (size, algorithm) pair is validated unless
+* -novalidate is given.
+*
+*   mpirun -n 8 ./MPI_Bcast [-min 1] [-max 64M] [-reps 20] [-warmup 5]
+*                           [-seg 64K] [-novalidate]
+*/
 
 #define ROOT 0
-#define NUM_REPS 5
-#define NUM_SIZES 3
+#define NUM_REPS 20
+#define NUM_WARMUP 5
+#define MAX_SIZE (64*1024*1024)
+#define SEG_SIZE (64*1024)
+#define TAG_BCAST 17
+
+typedef void (bcast_fn)(char *buf, int n, int root, MPI_Comm comm);
+
+static int seg_size = SEG_SIZE;
+
+static void bcast_library(char *buf, int n, int root, MPI_Comm comm)
+{
+    MPI_Bcast(buf, n, MPI_BYTE, root, comm);
+}
+
+static void bcast_binomial(char *buf, int n, int root, MPI_Comm comm)
+{
+    int rank, size, rel, mask;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    rel = (rank - root + size) % size;
+
+    /* Receive from the parent: the rank that differs in the lowest set bit */
+    mask = 1;
+    while (mask < size)
+    {
+        if (rel & mask)
+        {
+            MPI_Recv(buf, n, MPI_BYTE, (rank - mask + size) % size, TAG_BCAST,
+                     comm, MPI_STATUS_IGNORE);
+            break;
+        }
+        mask <<= 1;
+    }
+    /* Forward to the children below that bit */
+    mask >>= 1;
+    while (mask > 0)
+    {
+        if (rel + mask < size)
+        {
+            MPI_Send(buf, n, MPI_BYTE, (rank + mask) % size, TAG_BCAST, comm);
+        }
+        mask >>= 1;
+    }
+}
+
+static void bcast_scatter_allgather(char *buf, int n, int root, MPI_Comm comm)
+{
+    int rank, size, rel, mask, i;
+    int chunk, curr, recv_size, send_size;
+    int left, right, sblk, rblk, soff, roff, scnt, rcnt;
+    MPI_Status status;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    if (size == 1) return;
+    rel = (rank - root + size) % size;
+    chunk = (n + size - 1) / size;
+
+    /* Binomial scatter: relative rank r ends up owning [r*chunk, (r+1)*chunk) */
+    curr = (rel == 0) ? n : 0;
+    mask = 1;
+    while (mask < size)
+    {
+        if (rel & mask)
+        {
+            recv_size = n - rel * chunk;
+            if (recv_size > 0)
+            {
+                MPI_Recv(buf + rel * chunk, recv_size, MPI_BYTE, (rank - mask + size) % size,
+                         TAG_BCAST, comm, &status);
+                MPI_Get_count(&status, MPI_BYTE, &curr);
+            }
+            break;
+        }
+        mask <<= 1;
+    }
+    mask >>= 1;
+    while (mask > 0)
+    {
+        if (rel + mask < size)
+        {
+            send_size = curr - chunk * mask;
+            if (send_size > 0)
+            {
+                MPI_Send(buf + (rel + mask) * chunk, send_size, MPI_BYTE, (rank + mask) % size,
+                         TAG_BCAST, comm);
+                curr -= send_size;
+            }
+        }
+        mask >>= 1;
+    }
+
+    /* Ring allgather of the p chunks */
+    left  = (rank - 1 + size) % size;
+    right = (rank + 1) % size;
+    for (i=0; i<size-1; i++)
+    {
+        sblk = (rel - i + size) % size;
+        rblk = (rel - i - 1 + size) % size;
+        soff = sblk * chunk;
+        roff = rblk * chunk;
+        scnt = (soff < n) ? ((n - soff < chunk) ? n - soff : chunk) : 0;
+        rcnt = (roff < n) ? ((n - roff < chunk) ? n - roff : chunk) : 0;
+        MPI_Sendrecv(buf + (scnt ? soff : 0), scnt, MPI_BYTE, right, TAG_BCAST,
+                     buf + (rcnt ? roff : 0), rcnt, MPI_BYTE, left, TAG_BCAST,
+                     comm, MPI_STATUS_IGNORE);
+    }
+}
+
+static void bcast_chain(char *buf, int n, int root, MPI_Comm comm)
+{
+    int rank, size, rel, prev, next, nseg, k, off, len;
+    MPI_Request *reqs;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    if (size == 1) return;
+    rel  = (rank - root + size) % size;
+    prev = (rank - 1 + size) % size;
+    next = (rank + 1) % size;
+    nseg = (n + seg_size - 1) / seg_size;
+    if (nseg == 0) nseg = 1;
+
+    reqs = (MPI_Request *) malloc(nseg * sizeof(MPI_Request));
+    for (k=0; k<nseg; k++)
+    {
+        off = k * seg_size;
+        len = (n - off < seg_size) ? n - off : seg_size;
+        if (rel > 0)
+        {
+            MPI_Recv(buf + off, len, MPI_BYTE, prev, TAG_BCAST, comm, MPI_STATUS_IGNORE);
+        }
+        if (rel < size - 1)
+        {
+            MPI_Isend(buf + off, len, MPI_BYTE, next, TAG_BCAST, comm, &reqs[k]);
+        }
+        else
+        {
+            reqs[k] = MPI_REQUEST_NULL;
+        }
+    }
+    MPI_Waitall(nseg, reqs, MPI_STATUSES_IGNORE);
+    free(reqs);
+}
+
+#define NUM_ALGS 4
+static const char *alg_names[NUM_ALGS] = { "MPI_Bcast", "binomial", "scatter", "chain" };
+static bcast_fn *alg_fns[NUM_ALGS] = { bcast_library, bcast_binomial, bcast_scatter_allgather, bcast_chain };
+
+static void fill(char *buf, int n, int rank, int tag)
+{
+    int i;
+    if (rank == ROOT)
+    {
+        for (i=0; i<n; i++) buf[i] = (char) (i * 7 + tag);
+    }
+    else
+    {
+        memset(buf, 0xff, n);
+    }
+}
+
+static int check(const char *buf, int n, int rank, int tag, const char *alg)
+{
+    int i, num_errors = 0;
+    for (i=0; i<n; i++)
+    {
+        if (buf[i] != (char) (i * 7 + tag))
+        {
+            num_errors++;
+            if (num_errors < 10)
+            {
+                printf("Error: Rank=%d, alg=%s, n=%d, i=%d, buf[i]=%d expected=%d\n",
+                       rank, alg, n, i, buf[i], (char) (i * 7 + tag));
+                fflush(stdout);
+            }
+        }
+    }
+    if (num_errors >= 10)
+    {
+        printf("Error: Rank=%d, alg=%s, num_errors = %d\n", rank, alg, num_errors);
+        fflush(stdout);
+    }
+    return num_errors;
+}
 
 int main( int argc, char **argv)
 {
-    int *buf;
-    int i, rank, reps, n;
+    char *buf;
+    char sbuf[32];
+    int rank, size, reps, a, n, best;
     int bVerify = 1;
-    int sizes[NUM_SIZES] = { 100, 64*1024, 128*1024 };
+    int num_reps, num_warmup;
+    long long min_size, max_size;
     int num_errors=0, tot_errors;
+    double t0, *samples;
+    bench_stats_t st[NUM_ALGS];
 
     MPI_Init(&argc, &argv);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-
-    if (argc > 1)
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    if (bench_flag(argc, argv, "-novalidate") || bench_flag(argc, argv, "-noverify")) bVerify = 0;
+    min_size   = bench_arg_size(argc, argv, "-min", 1);
+    max_size   = bench_arg_size(argc, argv, "-max", MAX_SIZE);
+    seg_size   = (int) bench_arg_size(argc, argv, "-seg", SEG_SIZE);
+    num_reps   = bench_arg_int(argc, argv, "-reps", NUM_REPS);
+    num_warmup = bench_arg_int(argc, argv, "-warmup", NUM_WARMUP);
+    if (min_size < 1) min_size = 1;
+    if (max_size > MAX_SIZE) max_size = MAX_SIZE;
+    if (seg_size < 1) seg_size = SEG_SIZE;
+    if (num_reps < 1) num_reps = 1;
+
+    buf = (char *) malloc(max_size);
+    samples = (double *) malloc(num_reps * sizeof(double));
+    memset(buf, 0, max_size);
+
+    if (rank == ROOT)
     {
-        if (strcmp(argv[1], "-novalidate") == 0 || strcmp(argv[1],"-noverify") == 0) bVerify = 0;
+        printf("# %d processes, %d reps (+%d warmup), chain segment %d bytes\n",
+               size, num_reps, num_warmup, seg_size);
+        printf("# %-8s %-10s %12s %12s %12s %12s\n",
+               "bytes", "algorithm", "min(us)", "median(us)", "p99(us)", "MB/s");
+        fflush(stdout);
     }
-    
-    buf = (int *) malloc(sizes[NUM_SIZES-1]*sizeof(int));
-    memset(buf, 0, sizes[NUM_SIZES-1]*sizeof(int));
 
-    for (n=0; n<NUM_SIZES; n++)
+    for (n=(int) min_size; n<=max_size; n*=2)
     {
-        if (rank == ROOT)
+        for (a=0; a<NUM_ALGS; a++)
         {
-            printf("bcasting %d MPI_INTs %d times\n", sizes[n], NUM_REPS);
-            fflush(stdout);
-        }
-	
-        for (reps=0; reps < NUM_REPS; reps++)
-        {
-            if (bVerify)
+            for (reps=0; reps<num_warmup; reps++)
             {
-                if (rank == ROOT)
-                {
-                    for (i=0; i<sizes[n]; i++)
-                    {
-                        buf[i] = 1000000 * (n * NUM_REPS + reps) + i;
-                    }
-                }
-                else
-                {
-                    for (i=0; i<sizes[n]; i++)
-                    {
-                        buf[i] = -1 - (n * NUM_REPS + reps);
-                    }
-                }
+                alg_fns[a](buf, n, ROOT, MPI_COMM_WORLD);
             }
-            MPI_Bcast(buf, sizes[n], MPI_INT, ROOT, MPI_COMM_WORLD);
-            if (bVerify)
+            for (reps=0; reps<num_reps; reps++)
             {
-                num_errors = 0;
-                for (i=0; i<sizes[n]; i++)
+                if (bVerify && reps == 0)
                 {
-                    if (buf[i] != 1000000 * (n * NUM_REPS + reps) + i)
-                    {
-                        num_errors++;
-                        if (num_errors < 10)
-                        {
-                            printf("Error: Rank=%d, n=%d, reps=%d, i=%d, buf[i]=%d expected=%d\n",
-				   rank, n, reps, i, buf[i],1000000 * (n * NUM_REPS + reps) +i);
-                            fflush(stdout);
-                        }
-                    }
+                    fill(buf, n, rank, n + a);
                 }
-                if (num_errors >= 10)
+                MPI_Barrier(MPI_COMM_WORLD);
+                t0 = MPI_Wtime();
+                alg_fns[a](buf, n, ROOT, MPI_COMM_WORLD);
+                samples[reps] = MPI_Wtime() - t0;
+                if (bVerify && reps == 0)
                 {
-                    printf("Error: Rank=%d, num_errors = %d\n", rank, num_errors);
-                    fflush(stdout);
+                    num_errors += check(buf, n, rank, n + a, alg_names[a]);
                 }
             }
+            bench_reduce_stats(samples, num_reps, ROOT, MPI_COMM_WORLD, &st[a]);
         }
+        if (rank == ROOT)
+        {
+            best = 0;
+            for (a=1; a<NUM_ALGS; a++)
+            {
+                if (st[a].median < st[best].median) best = a;
+            }
+            for (a=0; a<NUM_ALGS; a++)
+            {
+                printf("  %-8s %-10s %12.2f %12.2f %12.2f %12.1f%s\n",
+                       bench_fmt_size(n, sbuf, sizeof(sbuf)), alg_names[a],
+                       st[a].min * 1e6, st[a].median * 1e6, st[a].p99 * 1e6,
+                       bench_mbps(n, st[a].median), (a == best) ? "  *" : "");
+            }
+            fflush(stdout);
+        }
+        if (n > max_size / 2) break;
     }
-    
+
     MPI_Reduce( &num_errors, &tot_errors, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD );
     if (rank == 0 && tot_errors == 0)  printf(" No Errors\n");
 
     fflush(stdout);
+    free(samples);
     free(buf);
 
     MPI_Finalize();
     return 0;
 }
-
@@ -41,6 +41,286 @@ Remarks
 #include "mpi.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include "bench_util.h"
+
+/*
+* -bench turns this example into an IOR-style collective I/O driver. A
+* global 2D array of doubles of about -size bytes is split over a 2D
+* process grid and written to, then read back from, -file through a
+* file view, for every combination of
+*
+*   method   independent MPI_File_write_at / read_at,
+*            collective MPI_File_write_at_all / read_at_all,
+*            nonblocking MPI_File_iwrite_at / iread_at
+*   hints    a fixed sweep of ROMIO hints set with MPI_Info_set:
+*            cb_buffer_size, cb_nodes, romio_cb_write/romio_cb_read and
+*            striping_factor/striping_unit, plus one set from -hint
+*
+* -decomp picks the file type: "subarray" (MPI_Type_create_subarray),
+* "darray" (MPI_Type_create_darray, block) or "cyclic" (darray,
+* block-cyclic in -cyclic element blocks). Each rank's data goes out in
+* -xfer byte transfers. Times run from open to close and the slowest rank
+* counts; the read pass checks every value.
+*
+* Hints an implementation does not know are ignored (Open MPI's default
+* OMPIO layer ignores the romio_* keys, and striping only matters on
+* Lustre-like file systems), which is itself worth seeing in the numbers.
+*
+*   mpirun -n 4 ./MPI_File_write_all -bench [-file ior.dat] [-size 256M]
+*          [-xfer 16M] [-decomp subarray|darray|cyclic] [-cyclic 64]
+*          [-hint key=value[,key=value...]]
+*/
+
+#define BENCH_SIZE (256*1024*1024)
+#define BENCH_XFER (16*1024*1024)
+#define BENCH_CYCLIC 64
+#define NUM_METHODS 3
+#define NUM_HINTS 7
+
+static const char *method_names[NUM_METHODS] = { "independent", "collective", "nonblocking" };
+static const char *hint_sets[NUM_HINTS+1] =
+{
+    "",
+    "romio_cb_write=enable,romio_cb_read=enable",
+    "romio_cb_write=disable,romio_cb_read=disable",
+    "cb_buffer_size=4194304",
+    "cb_buffer_size=67108864",
+    "cb_nodes=1",
+    "striping_factor=4,striping_unit=1048576",
+    NULL
+};
+
+static long long sqrt_ll(long long v)
+{
+    long long r = 0, b = 1LL << 31;
+    while (b > 0)
+    {
+        if ((r + b) * (r + b) <= v) r += b;
+        b >>= 1;
+    }
+    return r;
+}
+
+typedef struct
+{
+    int psizes[2], coords[2], gsizes[2], lsizes[2], cyclic;
+    long long nlocal;
+} io_decomp_t;
+
+/* Global index along dimension d of local index l */
+static long long io_global(const io_decomp_t *dc, int d, int l)
+{
+    if (dc->cyclic > 0)
+        return (long long) (l / dc->cyclic) * dc->cyclic * dc->psizes[d] +
+               (long long) dc->coords[d] * dc->cyclic + l % dc->cyclic;
+    return (long long) dc->coords[d] * dc->lsizes[d] + l;
+}
+
+static MPI_Info io_make_info(const char *spec)
+{
+    MPI_Info info;
+    char *copy, *tok, *save = NULL;
+
+    MPI_Info_create(&info);
+    copy = strdup(spec);
+    for (tok=strtok_r(copy, ",", &save); tok; tok=strtok_r(NULL, ",", &save))
+    {
+        char *eq = strchr(tok, '=');
+        if (eq == NULL) continue;
+        *eq = '\0';
+        MPI_Info_set(info, tok, eq + 1);
+    }
+    free(copy);
+    return info;
+}
+
+/* One pass over the file; returns open-to-close seconds of this rank */
+static double io_pass(int write, int method, const char *fname, MPI_Info info, MPI_Datatype ftype,
+                      double *buf, long long nlocal, int chunk, int nchunks, int *errs)
+{
+    MPI_File fh;
+    MPI_Request *reqs = NULL;
+    int k, err;
+    double t0 = MPI_Wtime();
+
+    err = MPI_File_open(MPI_COMM_WORLD, (char *) fname,
+                        write ? (MPI_MODE_WRONLY | MPI_MODE_CREATE) : MPI_MODE_RDONLY, info, &fh);
+    if (err)
+    {
+        MPI_Abort(MPI_COMM_WORLD, 911);
+    }
+    MPI_File_set_view(fh, 0, MPI_DOUBLE, ftype, "native", info);
+    if (method == 2) reqs = (MPI_Request *) malloc(nchunks * sizeof(MPI_Request));
+
+    for (k=0; k<nchunks; k++)
+    {
+        MPI_Offset off = (MPI_Offset) k * chunk;
+        long long left = nlocal - off;
+        int count = (left <= 0) ? 0 : (left < chunk) ? (int) left : chunk;
+        double *p = buf + ((left <= 0) ? 0 : off);
+
+        switch (method)
+        {
+        case 0:
+            if (count == 0) break;
+            err = write ? MPI_File_write_at(fh, off, p, count, MPI_DOUBLE, MPI_STATUS_IGNORE)
+                        : MPI_File_read_at(fh, off, p, count, MPI_DOUBLE, MPI_STATUS_IGNORE);
+            break;
+        case 1:
+            err = write ? MPI_File_write_at_all(fh, off, p, count, MPI_DOUBLE, MPI_STATUS_IGNORE)
+                        : MPI_File_read_at_all(fh, off, p, count, MPI_DOUBLE, MPI_STATUS_IGNORE);
+            break;
+        default:
+            err = write ? MPI_File_iwrite_at(fh, off, p, count, MPI_DOUBLE, &reqs[k])
+                        : MPI_File_iread_at(fh, off, p, count, MPI_DOUBLE, &reqs[k]);
+            break;
+        }
+        if (err) { (*errs)++; }
+    }
+    if (method == 2)
+    {
+        MPI_Waitall(nchunks, reqs, MPI_STATUSES_IGNORE);
+        free(reqs);
+    }
+    err = MPI_File_close(&fh);
+    if (err) { (*errs)++; }
+    return MPI_Wtime() - t0;
+}
+
+static int run_bench(int argc, char *argv[], int rank, int size)
+{
+    const char *fname = bench_arg(argc, argv, "-file");
+    const char *decomp = bench_arg(argc, argv, "-decomp");
+    const char *user_hint = bench_arg(argc, argv, "-hint");
+    long long total, i, gtotal;
+    int xfer, chunk, nchunks, lchunks, h, m, nhints, d, errs = 0;
+    int periods[2] = { 0, 0 }, distribs[2], dargs[2];
+    double *buf, tw, tr, gbytes;
+    io_decomp_t dc;
+    MPI_Datatype ftype;
+    MPI_Comm cart;
+    MPI_Info info;
+
+    if (fname == NULL) fname = "ior.dat";
+    if (decomp == NULL) decomp = "subarray";
+    total = bench_arg_size(argc, argv, "-size", BENCH_SIZE);
+    xfer  = (int) bench_arg_size(argc, argv, "-xfer", BENCH_XFER);
+    dc.cyclic = (strcmp(decomp, "cyclic") == 0) ? bench_arg_int(argc, argv, "-cyclic", BENCH_CYCLIC) : 0;
+    if (dc.cyclic < 0) dc.cyclic = BENCH_CYCLIC;
+    chunk = xfer / (int) sizeof(double);
+    if (chunk < 1) chunk = 1;
+
+    dc.psizes[0] = dc.psizes[1] = 0;
+    MPI_Dims_create(size, 2, dc.psizes);
+    MPI_Cart_create(MPI_COMM_WORLD, 2, dc.psizes, periods, 0, &cart);
+    MPI_Cart_coords(cart, rank, 2, dc.coords);
+    MPI_Comm_free(&cart);
+
+    /* Square-ish global array whose extents divide evenly over the grid */
+    for (d=0; d<2; d++)
+    {
+        long long unit = (long long) dc.psizes[d] * (dc.cyclic > 0 ? dc.cyclic : 1);
+        long long side = sqrt_ll(total / (long long) sizeof(double));
+        long long k = (side + unit / 2) / unit;
+        if (k < 1) k = 1;
+        dc.gsizes[d] = (int) (k * unit);
+        dc.lsizes[d] = dc.gsizes[d] / dc.psizes[d];
+    }
+    dc.nlocal = (long long) dc.lsizes[0] * dc.lsizes[1];
+    gtotal = (long long) dc.gsizes[0] * dc.gsizes[1] * sizeof(double);
+
+    if (strcmp(decomp, "subarray") == 0)
+    {
+        int starts[2] = { dc.coords[0] * dc.lsizes[0], dc.coords[1] * dc.lsizes[1] };
+        MPI_Type_create_subarray(2, dc.gsizes, dc.lsizes, starts, MPI_ORDER_C, MPI_DOUBLE, &ftype);
+    }
+    else
+    {
+        for (d=0; d<2; d++)
+        {
+            distribs[d] = (dc.cyclic > 0) ? MPI_DISTRIBUTE_CYCLIC : MPI_DISTRIBUTE_BLOCK;
+            dargs[d] = (dc.cyclic > 0) ? dc.cyclic : MPI_DISTRIBUTE_DFLT_DARG;
+        }
+        MPI_Type_create_darray(size, rank, 2, dc.gsizes, distribs, dargs, dc.psizes,
+                               MPI_ORDER_C, MPI_DOUBLE, &ftype);
+    }
+    MPI_Type_commit(&ftype);
+
+    buf = (double *) malloc(dc.nlocal * sizeof(double));
+    if (buf == NULL)
+    {
+        fprintf(stderr, "(%d) Cannot allocate %lld doubles\n", rank, dc.nlocal);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    lchunks = (int) ((dc.nlocal + chunk - 1) / chunk);
+    MPI_Allreduce(&lchunks, &nchunks, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+
+    nhints = NUM_HINTS;
+    if (user_hint != NULL) hint_sets[nhints++] = user_hint;
+    gbytes = (double) gtotal / 1e9;
+
+    if (rank == 0)
+    {
+        printf("# %d processes (%dx%d), %dx%d doubles = %.3f GB, %s, xfer %d bytes, file %s\n",
+               size, dc.psizes[0], dc.psizes[1], dc.gsizes[0], dc.gsizes[1], gbytes, decomp,
+               chunk * (int) sizeof(double), fname);
+        printf("# %-12s %10s %10s  %s\n", "method", "write GB/s", "read GB/s", "hints");
+        fflush(stdout);
+    }
+
+    for (h=0; h<nhints; h++)
+    {
+        info = io_make_info(hint_sets[h]);
+        for (m=0; m<NUM_METHODS; m++)
+        {
+            long long li;
+            int lj, bad = 0;
+
+            for (li=0; li<dc.lsizes[0]; li++)
+                for (lj=0; lj<dc.lsizes[1]; lj++)
+                    buf[li * dc.lsizes[1] + lj] =
+                        (double) (io_global(&dc, 0, (int) li) * dc.gsizes[1] + io_global(&dc, 1, lj));
+
+            if (rank == 0) MPI_File_delete((char *) fname, MPI_INFO_NULL);
+            MPI_Barrier(MPI_COMM_WORLD);
+            tw = io_pass(1, m, fname, info, ftype, buf, dc.nlocal, chunk, nchunks, &errs);
+            tw = bench_max_time(tw, 0, MPI_COMM_WORLD);
+
+            for (i=0; i<dc.nlocal; i++) buf[i] = -1.0;
+            MPI_Barrier(MPI_COMM_WORLD);
+            tr = io_pass(0, m, fname, info, ftype, buf, dc.nlocal, chunk, nchunks, &errs);
+            tr = bench_max_time(tr, 0, MPI_COMM_WORLD);
+
+            for (li=0; li<dc.lsizes[0] && !bad; li++)
+                for (lj=0; lj<dc.lsizes[1]; lj++)
+                    if (buf[li * dc.lsizes[1] + lj] !=
+                        (double) (io_global(&dc, 0, (int) li) * dc.gsizes[1] + io_global(&dc, 1, lj)))
+                    {
+                        fprintf(stderr, "%d: %s read back wrong value at local (%lld,%d)\n",
+                                rank, method_names[m], li, lj);
+                        fflush(stderr);
+                        bad = 1;
+                        errs++;
+                        break;
+                    }
+
+            if (rank == 0)
+            {
+                printf("  %-12s %10.3f %10.3f  %s\n", method_names[m], gbytes / tw, gbytes / tr,
+                       hint_sets[h][0] ? hint_sets[h] : "(none)");
+                fflush(stdout);
+            }
+        }
+        MPI_Info_free(&info);
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (rank == 0) MPI_File_delete((char *) fname, MPI_INFO_NULL);
+    MPI_Type_free(&ftype);
+    free(buf);
+    return errs;
+}
 
 /* Test set_view with DISPLACEMENT_CURRENT */
 int main( int argc, char *argv[] )
@@ -52,6 +332,14 @@ int main( int argc, char *argv[] )
     MPI_Comm comm;
     MPI_Status status;
     MPI_Init( &argc, &argv );
+    if (bench_flag(argc, argv, "-bench"))
+    {
+        MPI_Comm_size( MPI_COMM_WORLD, &size );
+        MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+        errs = run_bench( argc, argv, rank, size );
+        MPI_Finalize();
+        return errs;
+    }
     /* This test reads a header then sets the view to every "size" int,
         using set view and current displacement. The file is first written
         using a combination of collective and ordered writes */
@@ -0,0 +1,299 @@
+/*
+allgather_engine.h
+
+   User-level MPI_Allgather and MPI_Allgatherv with three algorithms and
+   an automatic choice between them, for any communicator size:
+
+   AG_RING    p-1 steps; in step k every rank passes block rank-k to
+              rank+1 and receives block rank-k-1 from rank-1. Only
+              neighbour traffic and every block crosses each link once,
+              so it wins for long messages, but costs p-1 latencies.
+   AG_RECDBL  recursive doubling: log2(p) MPI_Sendrecv steps, each
+              exchanging everything gathered so far with rank^2^k. A
+              non-power-of-two p first folds 2*(p - 2^k) ranks pairwise
+              and sends the folded ranks the result at the end.
+   AG_BRUCK   ceil(log2(p)) steps for any p; in step k every rank sends
+              the min(2^k, p-2^k) blocks it holds, starting at its own,
+              to rank-2^k and receives as many from rank+2^k.
+
+Usage
+
+   ag_allgather(sendbuf, n, MPI_DOUBLE, recvbuf, n, MPI_DOUBLE, comm,
+                AG_AUTO);
+   ag_allgatherv(sendbuf, n, MPI_DOUBLE, recvbuf, recvcounts, displs,
+                 MPI_DOUBLE, comm, AG_AUTO);
+
+Remarks
+
+   The arguments have the meaning they have for MPI_Allgather(v),
+   including MPI_IN_PLACE as sendbuf (each rank's block is then already
+   at its place in recvbuf). Zero counts are allowed; zero-length
+   messages are not sent.
+
+   All algorithms work in recvbuf itself: the blocks of a step, which
+   are not contiguous in general (displs are arbitrary, and Bruck's
+   blocks wrap around the end of the communicator), are described by an
+   MPI_Type_create_hindexed of recvtype, so nothing is staged through
+   temporary buffers or rotated at the end.
+
+   AG_AUTO decides from the total bytes gathered and the communicator
+   size, which are the same on every rank: below AG_SHORT_BYTES
+   recursive doubling on powers of two and Bruck otherwise, recursive
+   doubling on powers of two below AG_LONG_BYTES, and the ring beyond.
+
+   Messages use tag AG_TAG on comm.
+*/
+
+#ifndef ALLGATHER_ENGINE_H
+#define ALLGATHER_ENGINE_H
+
+#include "mpi.h"
+#include <stdlib.h>
+
+#define AG_AUTO   0
+#define AG_RING   1
+#define AG_RECDBL 2
+#define AG_BRUCK  3
+
+#define AG_TAG         8383
+#define AG_SHORT_BYTES (80*1024)
+#define AG_LONG_BYTES  (512*1024)
+
+static inline const char *ag_name(int alg)
+{
+    switch (alg)
+    {
+    case AG_RING:   return "ring";
+    case AG_RECDBL: return "recdbl";
+    case AG_BRUCK:  return "bruck";
+    default:        return "auto";
+    }
+}
+
+static inline int ag_choose(const int *recvcounts, MPI_Datatype type, MPI_Comm comm)
+{
+    int i, size, tsize, pof2;
+    long long total = 0;
+
+    MPI_Comm_size(comm, &size);
+    MPI_Type_size(type, &tsize);
+    for (i=0; i<size; i++) total += recvcounts[i];
+    total *= tsize;
+    pof2 = !(size & (size - 1));
+    if (total < AG_SHORT_BYTES) return pof2 ? AG_RECDBL : AG_BRUCK;
+    if (total < AG_LONG_BYTES && pof2) return AG_RECDBL;
+    return AG_RING;
+}
+
+/*
+* One message of the blocks of ranks list[0..n-1] in recvbuf (*blocks is
+* MPI_DATATYPE_NULL if they are all empty), using the caller's scratch
+* arrays blen and bdisp of n entries.
+*/
+static inline void ag_blocks(const int *list, int n, const int *recvcounts, const int *displs, MPI_Aint extent,
+                             MPI_Datatype type, int *blen, MPI_Aint *bdisp, MPI_Datatype *blocks)
+{
+    int i, m = 0;
+    for (i=0; i<n; i++)
+    {
+        if (recvcounts[list[i]] == 0) continue;
+        blen[m] = recvcounts[list[i]];
+        bdisp[m++] = displs[list[i]] * extent;
+    }
+    *blocks = MPI_DATATYPE_NULL;
+    if (m == 0) return;
+    MPI_Type_create_hindexed(m, blen, bdisp, type, blocks);
+    MPI_Type_commit(blocks);
+}
+
+/* Exchange the blocks of slist with dst for those of rlist from src, in recvbuf */
+static inline void ag_exchange(void *recvbuf, const int *slist, int ns, int dst, const int *rlist, int nr, int src,
+                               const int *recvcounts, const int *displs, MPI_Aint extent, MPI_Datatype type,
+                               int *blen, MPI_Aint *bdisp, MPI_Comm comm)
+{
+    MPI_Datatype st, rt;
+
+    ag_blocks(slist, ns, recvcounts, displs, extent, type, blen, bdisp, &st);
+    ag_blocks(rlist, nr, recvcounts, displs, extent, type, blen, bdisp, &rt);
+    MPI_Sendrecv(recvbuf, st != MPI_DATATYPE_NULL, st != MPI_DATATYPE_NULL ? st : MPI_BYTE,
+                 st != MPI_DATATYPE_NULL ? dst : MPI_PROC_NULL, AG_TAG,
+                 recvbuf, rt != MPI_DATATYPE_NULL, rt != MPI_DATATYPE_NULL ? rt : MPI_BYTE,
+                 rt != MPI_DATATYPE_NULL ? src : MPI_PROC_NULL, AG_TAG, comm, MPI_STATUS_IGNORE);
+    if (st != MPI_DATATYPE_NULL) MPI_Type_free(&st);
+    if (rt != MPI_DATATYPE_NULL) MPI_Type_free(&rt);
+}
+
+static inline int ag_ring(void *recvbuf, const int *recvcounts, const int *displs, MPI_Datatype type,
+                          MPI_Comm comm)
+{
+    int k, rank, size, left, right, sb, rb;
+    MPI_Aint lb, extent;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    MPI_Type_get_extent(type, &lb, &extent);
+    left = (rank - 1 + size) % size;
+    right = (rank + 1) % size;
+    for (k=0; k<size-1; k++)
+    {
+        sb = (rank - k + size) % size;
+        rb = (rank - k - 1 + size) % size;
+        MPI_Sendrecv((char *) recvbuf + displs[sb] * extent, recvcounts[sb], type,
+                     recvcounts[sb] ? right : MPI_PROC_NULL, AG_TAG,
+                     (char *) recvbuf + displs[rb] * extent, recvcounts[rb], type,
+                     recvcounts[rb] ? left : MPI_PROC_NULL, AG_TAG, comm, MPI_STATUS_IGNORE);
+    }
+    return MPI_SUCCESS;
+}
+
+/* Old ranks of new ranks lo..hi-1 after folding the first 2*rem ranks pairwise; returns their number */
+static inline int ag_unfold(int lo, int hi, int rem, int *list)
+{
+    int i, n = 0;
+    for (i=lo; i<hi; i++)
+    {
+        if (i < rem)
+        {
+            list[n++] = 2 * i;
+            list[n++] = 2 * i + 1;
+        }
+        else
+        {
+            list[n++] = i + rem;
+        }
+    }
+    return n;
+}
+
+static inline int ag_recdbl(void *recvbuf, const int *recvcounts, const int *displs, MPI_Datatype type,
+                            MPI_Comm comm)
+{
+    int i, rank, size, pof2, rem, newrank, newdst, mask, base, ns, nr, *list, *blen;
+    MPI_Aint lb, extent, *bdisp;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    MPI_Type_get_extent(type, &lb, &extent);
+    list = (int *) malloc(3 * (size_t) size * sizeof(int));
+    blen = list + 2 * size;
+    bdisp = (MPI_Aint *) malloc(size * sizeof(MPI_Aint));
+
+    /* Fold the first 2*rem ranks pairwise: the odd one takes the even one's block */
+    for (pof2=1; pof2*2<=size; pof2*=2);
+    rem = size - pof2;
+    newrank = (rank < 2 * rem) ? ((rank % 2) ? rank / 2 : -1) : rank - rem;
+    if (rank < 2 * rem)
+    {
+        list[0] = rank - rank % 2;
+        if (rank % 2) ag_exchange(recvbuf, NULL, 0, 0, list, 1, rank - 1, recvcounts, displs, extent, type,
+                                  blen, bdisp, comm);
+        else ag_exchange(recvbuf, list, 1, rank + 1, NULL, 0, 0, recvcounts, displs, extent, type,
+                         blen, bdisp, comm);
+    }
+
+    if (newrank != -1)
+    {
+        /* Step mask: my 'mask' new ranks' blocks for those of the partner's group */
+        for (mask=1; mask<pof2; mask<<=1)
+        {
+            newdst = newrank ^ mask;
+            base = newrank & ~(mask - 1);
+            ns = ag_unfold(base, base + mask, rem, list);
+            base = newdst & ~(mask - 1);
+            nr = ag_unfold(base, base + mask, rem, list + ns);
+            ag_exchange(recvbuf, list, ns, (newdst < rem) ? 2 * newdst + 1 : newdst + rem, list + ns, nr,
+                        (newdst < rem) ? 2 * newdst + 1 : newdst + rem, recvcounts, displs, extent, type,
+                        blen, bdisp, comm);
+        }
+    }
+
+    /* Unfold: the odd rank of a pair sends the even one everything but its own block */
+    if (rank < 2 * rem)
+    {
+        for (i=0, ns=0; i<size; i++)
+            if (i != rank - rank % 2) list[ns++] = i;
+        if (rank % 2) ag_exchange(recvbuf, list, ns, rank - 1, NULL, 0, 0, recvcounts, displs, extent, type,
+                                  blen, bdisp, comm);
+        else ag_exchange(recvbuf, NULL, 0, 0, list, ns, rank + 1, recvcounts, displs, extent, type,
+                         blen, bdisp, comm);
+    }
+    free(list);
+    free(bdisp);
+    return MPI_SUCCESS;
+}
+
+static inline int ag_bruck(void *recvbuf, const int *recvcounts, const int *displs, MPI_Datatype type,
+                           MPI_Comm comm)
+{
+    int j, rank, size, dist, cnt, *list, *blen;
+    MPI_Aint lb, extent, *bdisp;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    MPI_Type_get_extent(type, &lb, &extent);
+    list = (int *) malloc(2 * (size_t) size * sizeof(int));
+    blen = list + size;
+    bdisp = (MPI_Aint *) malloc(size * sizeof(MPI_Aint));
+
+    /* Before the step at distance dist I hold blocks rank .. rank+dist-1 (mod p) */
+    for (dist=1; dist<size; dist<<=1)
+    {
+        cnt = (size - dist < dist) ? size - dist : dist;
+        for (j=0; j<cnt; j++)
+        {
+            list[j] = (rank + j) % size;
+            list[cnt+j] = (rank + dist + j) % size;
+        }
+        ag_exchange(recvbuf, list, cnt, (rank - dist + size) % size, list + cnt, cnt, (rank + dist) % size,
+                    recvcounts, displs, extent, type, blen, bdisp, comm);
+    }
+    free(list);
+    free(bdisp);
+    return MPI_SUCCESS;
+}
+
+static inline int ag_allgatherv(const void *sendbuf, int sendcnt, MPI_Datatype sendtype, void *recvbuf,
+                                const int *recvcounts, const int *displs, MPI_Datatype recvtype, MPI_Comm comm,
+                                int alg)
+{
+    int rank;
+    MPI_Aint lb, extent;
+
+    MPI_Comm_rank(comm, &rank);
+    if (alg == AG_AUTO) alg = ag_choose(recvcounts, recvtype, comm);
+    if (alg != AG_RING && alg != AG_RECDBL && alg != AG_BRUCK) return MPI_ERR_ARG;
+    if (sendbuf != MPI_IN_PLACE)
+    {
+        MPI_Type_get_extent(recvtype, &lb, &extent);
+        MPI_Sendrecv(sendbuf, sendcnt, sendtype, 0, AG_TAG, (char *) recvbuf + displs[rank] * extent,
+                     recvcounts[rank], recvtype, 0, AG_TAG, MPI_COMM_SELF, MPI_STATUS_IGNORE);
+    }
+    switch (alg)
+    {
+    case AG_RING:
+        return ag_ring(recvbuf, recvcounts, displs, recvtype, comm);
+    case AG_RECDBL:
+        return ag_recdbl(recvbuf, recvcounts, displs, recvtype, comm);
+    default:
+        return ag_bruck(recvbuf, recvcounts, displs, recvtype, comm);
+    }
+}
+
+static inline int ag_allgather(const void *sendbuf, int sendcnt, MPI_Datatype sendtype, void *recvbuf, int recvcnt,
+                               MPI_Datatype recvtype, MPI_Comm comm, int alg)
+{
+    int i, size, err, *counts;
+
+    MPI_Comm_size(comm, &size);
+    counts = (int *) malloc(2 * (size_t) size * sizeof(int));
+    for (i=0; i<size; i++)
+    {
+        counts[i] = recvcnt;
+        counts[size+i] = i * recvcnt;
+    }
+    err = ag_allgatherv(sendbuf, sendcnt, sendtype, recvbuf, counts, counts + size, recvtype, comm, alg);
+    free(counts);
+    return err;
+}
+
+#endif /* ALLGATHER_ENGINE_H */
@@ -0,0 +1,336 @@
+/*
+alltoallv_engine.h
+
+   User-level MPI_Alltoallv with three algorithms and an automatic
+   choice between them:
+
+   A2AV_PAIRWISE  p steps; in step k every rank sends to rank+k and
+                  receives from rank-k with MPI_Sendrecv. Each message is
+                  sent once, straight from the user buffer, so it is the
+                  choice for medium and large messages.
+   A2AV_BRUCK     ceil(log2(p)) steps; in step k every rank forwards all
+                  blocks whose relative index has bit k set to rank+2^k,
+                  together with their lengths. Blocks travel up to
+                  log2(p) times, so it only pays off for small messages
+                  where per-message latency dominates.
+   A2AV_SPARSE    Irecv/Isend only for the ranks with nonzero counts, so
+                  the cost follows the number of real peers rather than
+                  the communicator size.
+
+Usage
+
+   a2av_alltoallv(sendbuf, sendcounts, sdispls, MPI_DOUBLE,
+                  recvbuf, recvcounts, rdispls, MPI_DOUBLE,
+                  comm, A2AV_AUTO);
+
+   When the receiving side does not know what it will get (e.g. particle
+   redistribution), exchange the counts first:
+
+   total = a2av_counts(sendcounts, recvcounts, rdispls, comm);
+   recvbuf = malloc(total * sizeof(double));
+   a2av_alltoallv(..., comm, A2AV_SPARSE);
+
+Remarks
+
+   The arguments have the meaning they have for MPI_Alltoallv; recvcounts
+   must match what the peers send, which is what lets the pairwise and
+   sparse algorithms skip zero-length messages on both sides.
+
+   A2AV_AUTO calls a2av_choose, which costs one MPI_Allreduce of two ints
+   so that every rank picks the same algorithm. A caller whose pattern
+   does not change between calls can call a2av_choose once and pass the
+   result. The sparse algorithm is chosen when no rank has more than
+   size/A2AV_SPARSE_DENSITY peers, Bruck when the largest message is at
+   most A2AV_BRUCK_BYTES, pairwise otherwise.
+
+   Bruck packs with MPI_Pack, so it works for any send and receive types;
+   a block is packed and unpacked once and otherwise copied only by the
+   occasional compaction of the working buffer (see a2av_bruck). Messages use tag
+   A2AV_TAG on comm; no other traffic with that tag may be pending on
+   comm during the call. MPI_IN_PLACE is not supported.
+*/
+
+#ifndef ALLTOALLV_ENGINE_H
+#define ALLTOALLV_ENGINE_H
+
+#include "mpi.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define A2AV_AUTO     0
+#define A2AV_PAIRWISE 1
+#define A2AV_BRUCK    2
+#define A2AV_SPARSE   3
+
+#define A2AV_TAG            4343
+#define A2AV_BRUCK_BYTES    256
+#define A2AV_SPARSE_DENSITY 8
+
+static inline const char *a2av_name(int alg)
+{
+    switch (alg)
+    {
+    case A2AV_PAIRWISE: return "pairwise";
+    case A2AV_BRUCK:    return "bruck";
+    case A2AV_SPARSE:   return "sparse";
+    default:            return "auto";
+    }
+}
+
+/* One MPI_Alltoall of counts; fills recvcounts (and rdispls if not NULL), returns the total */
+static inline int a2av_counts(const int *sendcounts, int *recvcounts, int *rdispls, MPI_Comm comm)
+{
+    int i, size, total = 0;
+
+    MPI_Comm_size(comm, &size);
+    MPI_Alltoall(sendcounts, 1, MPI_INT, recvcounts, 1, MPI_INT, comm);
+    for (i=0; i<size; i++)
+    {
+        if (rdispls) rdispls[i] = total;
+        total += recvcounts[i];
+    }
+    return total;
+}
+
+/* Collective: every rank of comm returns the same algorithm */
+static inline int a2av_choose(const int *sendcounts, MPI_Datatype sendtype, MPI_Comm comm)
+{
+    int i, rank, size, tsize, local[2] = { 0, 0 }, global[2];
+    long long bytes;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    MPI_Type_size(sendtype, &tsize);
+    for (i=0; i<size; i++)
+    {
+        if (sendcounts[i] == 0) continue;
+        if (i != rank) local[0]++;
+        bytes = (long long) sendcounts[i] * tsize;
+        if (bytes > local[1]) local[1] = (bytes > 0x7fffffff) ? 0x7fffffff : (int) bytes;
+    }
+    MPI_Allreduce(local, global, 2, MPI_INT, MPI_MAX, comm);
+
+    if (size > 2 && global[0] * A2AV_SPARSE_DENSITY <= size) return A2AV_SPARSE;
+    if (size > 2 && global[1] <= A2AV_BRUCK_BYTES) return A2AV_BRUCK;
+    return A2AV_PAIRWISE;
+}
+
+static inline int a2av_pairwise(const void *sendbuf, const int *sendcounts, const int *sdispls,
+                                MPI_Datatype sendtype, void *recvbuf, const int *recvcounts,
+                                const int *rdispls, MPI_Datatype recvtype, MPI_Comm comm)
+{
+    int k, rank, size, dst, src;
+    MPI_Aint lb, sext, rext;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    MPI_Type_get_extent(sendtype, &lb, &sext);
+    MPI_Type_get_extent(recvtype, &lb, &rext);
+
+    for (k=0; k<size; k++)
+    {
+        dst = (rank + k) % size;
+        src = (rank - k + size) % size;
+        MPI_Sendrecv((const char *) sendbuf + sdispls[dst] * sext, sendcounts[dst], sendtype,
+                     sendcounts[dst] ? dst : MPI_PROC_NULL, A2AV_TAG,
+                     (char *) recvbuf + rdispls[src] * rext, recvcounts[src], recvtype,
+                     recvcounts[src] ? src : MPI_PROC_NULL, A2AV_TAG, comm, MPI_STATUS_IGNORE);
+    }
+    return MPI_SUCCESS;
+}
+
+static inline int a2av_sparse(const void *sendbuf, const int *sendcounts, const int *sdispls,
+                              MPI_Datatype sendtype, void *recvbuf, const int *recvcounts,
+                              const int *rdispls, MPI_Datatype recvtype, MPI_Comm comm)
+{
+    int i, k, rank, size, nreq = 0;
+    MPI_Aint lb, sext, rext;
+    MPI_Request *reqs;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    MPI_Type_get_extent(sendtype, &lb, &sext);
+    MPI_Type_get_extent(recvtype, &lb, &rext);
+
+    for (i=0; i<size; i++) nreq += (recvcounts[i] != 0) + (sendcounts[i] != 0);
+    reqs = (MPI_Request *) malloc((nreq + 1) * sizeof(MPI_Request));
+    if (reqs == NULL) return MPI_ERR_NO_MEM;
+
+    /* Visit peers starting next to ourselves so that not everyone hits rank 0 first */
+    nreq = 0;
+    for (k=0; k<size; k++)
+    {
+        i = (rank - k + size) % size;
+        if (recvcounts[i])
+        {
+            MPI_Irecv((char *) recvbuf + rdispls[i] * rext, recvcounts[i], recvtype, i,
+                      A2AV_TAG, comm, &reqs[nreq++]);
+        }
+    }
+    for (k=0; k<size; k++)
+    {
+        i = (rank + k) % size;
+        if (sendcounts[i])
+        {
+            MPI_Isend((const char *) sendbuf + sdispls[i] * sext, sendcounts[i], sendtype, i,
+                      A2AV_TAG, comm, &reqs[nreq++]);
+        }
+    }
+    MPI_Waitall(nreq, reqs, MPI_STATUSES_IGNORE);
+    free(reqs);
+    return MPI_SUCCESS;
+}
+
+/*
+* Block j of the working buffer starts out as the packed data for rank+j.
+* In the step for bit d, blocks with j & d move to rank+d, keeping their
+* index; once every bit of j has been handled the block has travelled j
+* ranks, so at the end block j holds what rank-j sent us.
+*
+* The buffer is an arena: moved blocks are sent from where they are with
+* an indexed type, received ones are appended at end, and blocks that
+* stay are not touched. When the arena is full its live blocks are
+* compacted into a new one of twice their size, so compaction copies
+* at most as many bytes as the steps have moved.
+*/
+static inline int a2av_bruck(const void *sendbuf, const int *sendcounts, const int *sdispls,
+                             MPI_Datatype sendtype, void *recvbuf, const int *recvcounts,
+                             const int *rdispls, MPI_Datatype recvtype, MPI_Comm comm)
+{
+    int rank, size, j, d, n, nsel, pos, live = 0, end, cap, rbytes, dst, src;
+    int *boff, *blen, *slen, *rlen, *sidx;
+    char *cur, *next;
+    MPI_Aint lb, sext, rext;
+    MPI_Datatype stype;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    MPI_Type_get_extent(sendtype, &lb, &sext);
+    MPI_Type_get_extent(recvtype, &lb, &rext);
+
+    boff = (int *) malloc(5 * size * sizeof(int));
+    if (boff == NULL) return MPI_ERR_NO_MEM;
+    blen = boff + size;
+    slen = blen + size;
+    rlen = slen + size;
+    sidx = rlen + size;
+
+    for (j=0; j<size; j++)
+    {
+        MPI_Pack_size(sendcounts[(rank + j) % size], sendtype, comm, &n);
+        live += n;
+    }
+    cap = 2 * live + 1;
+    cur = (char *) malloc(cap);
+    if (cur == NULL)
+    {
+        free(boff);
+        return MPI_ERR_NO_MEM;
+    }
+    pos = 0;
+    for (j=0; j<size; j++)
+    {
+        dst = (rank + j) % size;
+        boff[j] = pos;
+        MPI_Pack((const char *) sendbuf + sdispls[dst] * sext, sendcounts[dst], sendtype,
+                 cur, cap, &pos, comm);
+        blen[j] = pos - boff[j];
+    }
+    live = end = pos;
+
+    for (d=1; d<size; d<<=1)
+    {
+        dst = (rank + d) % size;
+        src = (rank - d + size) % size;
+
+        nsel = 0;
+        for (j=0; j<size; j++)
+        {
+            if (j & d)
+            {
+                sidx[nsel] = j;
+                slen[nsel++] = blen[j];
+            }
+        }
+        MPI_Sendrecv(slen, nsel, MPI_INT, dst, A2AV_TAG, rlen, nsel, MPI_INT, src, A2AV_TAG,
+                     comm, MPI_STATUS_IGNORE);
+        rbytes = 0;
+        for (j=0; j<nsel; j++) rbytes += rlen[j];
+
+        if (end + rbytes > cap)
+        {
+            /* Compact the live blocks, the ones about to be sent included */
+            cap = 2 * (live + rbytes) + 1;
+            next = (char *) malloc(cap);
+            if (next == NULL)
+            {
+                free(cur);
+                free(boff);
+                return MPI_ERR_NO_MEM;
+            }
+            for (j=0, pos=0; j<size; j++)
+            {
+                memcpy(next + pos, cur + boff[j], blen[j]);
+                boff[j] = pos;
+                pos += blen[j];
+            }
+            free(cur);
+            cur = next;
+            end = pos;
+        }
+
+        for (j=0; j<nsel; j++) sidx[j] = boff[sidx[j]];
+        MPI_Type_indexed(nsel, slen, sidx, MPI_PACKED, &stype);
+        MPI_Type_commit(&stype);
+        MPI_Sendrecv(cur, 1, stype, dst, A2AV_TAG, cur + end, rbytes, MPI_PACKED, src,
+                     A2AV_TAG, comm, MPI_STATUS_IGNORE);
+        MPI_Type_free(&stype);
+
+        /* The received blocks replace the sent ones; the space those held is garbage now */
+        n = 0;
+        for (j=0; j<size; j++)
+        {
+            if (j & d)
+            {
+                live += rlen[n] - blen[j];
+                boff[j] = end;
+                blen[j] = rlen[n++];
+                end += blen[j];
+            }
+        }
+    }
+
+    for (j=0; j<size; j++)
+    {
+        src = (rank - j + size) % size;
+        pos = boff[j];
+        MPI_Unpack(cur, end, &pos, (char *) recvbuf + rdispls[src] * rext, recvcounts[src],
+                   recvtype, comm);
+    }
+    free(cur);
+    free(boff);
+    return MPI_SUCCESS;
+}
+
+static inline int a2av_alltoallv(const void *sendbuf, const int *sendcounts, const int *sdispls,
+                                 MPI_Datatype sendtype, void *recvbuf, const int *recvcounts,
+                                 const int *rdispls, MPI_Datatype recvtype, MPI_Comm comm, int alg)
+{
+    if (alg == A2AV_AUTO) alg = a2av_choose(sendcounts, sendtype, comm);
+    switch (alg)
+    {
+    case A2AV_PAIRWISE:
+        return a2av_pairwise(sendbuf, sendcounts, sdispls, sendtype,
+                             recvbuf, recvcounts, rdispls, recvtype, comm);
+    case A2AV_BRUCK:
+        return a2av_bruck(sendbuf, sendcounts, sdispls, sendtype,
+                          recvbuf, recvcounts, rdispls, recvtype, comm);
+    case A2AV_SPARSE:
+        return a2av_sparse(sendbuf, sendcounts, sdispls, sendtype,
+                           recvbuf, recvcounts, rdispls, recvtype, comm);
+    default:
+        return MPI_ERR_ARG;
+    }
+}
+
+#endif /* ALLTOALLV_ENGINE_H */
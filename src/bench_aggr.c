@@ -0,0 +1,224 @@
+/*
+bench_aggr
+
+   Many tiny MPI_Accumulate updates, one call each, against the same
+   updates collected and flushed by the aggregation layer in rma_aggr.h.
+
+Usage
+
+   mpirun -n 4 ./bench_aggr [-updates 256K] [-m 64K] [-threshold 4096]
+
+Remarks
+
+   Every rank exposes -m doubles and issues -updates single-element
+   MPI_SUM updates to random elements of random ranks, like the
+   scatter-add of a sparse matrix assembly. The updates are generated
+   once, so each mode replays the same sequence:
+
+   direct   one MPI_Accumulate per update inside MPI_Win_lock_all,
+            MPI_Win_flush_all at the end
+   aggr     aggr_add inside MPI_Win_lock_all (AGGR_PASSIVE), flushing a
+            target every -threshold updates, aggr_flush at the end
+   fence    aggr_add between two fences (AGGR_ACTIVE), aggr_fence
+
+   The rate is all ranks' updates over the slowest rank's time; calls
+   is the number of MPI_Accumulate calls per rank, elements the number
+   of elements they carried after updates of the same element were
+   combined, and padding the zeros added to bridge gaps (AGGR_GAP).
+
+   Every window is compared with the expected sums (from an
+   MPI_Reduce_scatter_block of what each rank sent) after each mode; an
+   MPI_REPLACE pass with repeated writes to the same elements then
+   checks that the last value wins.
+*/
+
+#include "mpi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "bench_util.h"
+#include "rma_aggr.h"
+
+#define NUM_UPDATES (256*1024)
+#define WIN_ELEMS (64*1024)
+#define THRESHOLD 4096
+
+#define NUM_MODES 3
+enum { M_DIRECT, M_AGGR, M_FENCE };
+static const char *mode_names[NUM_MODES] = { "direct", "aggr", "fence" };
+
+static uint64_t next_rand(uint64_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+static int check_window(MPI_Win win, const double *base, const double *expect, int m, int rank,
+                        const char *what)
+{
+    int i, errs = 0;
+
+    MPI_Win_lock(MPI_LOCK_SHARED, rank, 0, win);
+    for (i=0; i<m; i++)
+    {
+        if (base[i] == expect[i]) continue;
+        if (errs++ < 5)
+        {
+            fprintf(stderr, "(%d) %s: element %d is %g, expected %g\n", rank, what, i, base[i], expect[i]);
+            fflush(stderr);
+        }
+    }
+    MPI_Win_unlock(rank, win);
+    return errs;
+}
+
+int main( int argc, char **argv )
+{
+    int rank, size, m, threshold, mode, i, r, errs = 0, tot_errs;
+    int *target;
+    long long nupd, k, calls, elements, padding;
+    MPI_Aint *disp;
+    double *value, *base, *contrib, *expect, t, tmax, v;
+    uint64_t seed;
+    MPI_Win win;
+    aggr_t a;
+
+    MPI_Init( &argc, &argv );
+    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+    MPI_Comm_size( MPI_COMM_WORLD, &size );
+
+    nupd      = bench_arg_size(argc, argv, "-updates", NUM_UPDATES);
+    m         = (int) bench_arg_size(argc, argv, "-m", WIN_ELEMS);
+    threshold = bench_arg_int(argc, argv, "-threshold", THRESHOLD);
+    if (m < size) m = size;
+
+    MPI_Alloc_mem(m * sizeof(double), MPI_INFO_NULL, &base);
+    MPI_Win_create(base, m * sizeof(double), sizeof(double), MPI_INFO_NULL, MPI_COMM_WORLD, &win);
+
+    /* The update sequence and, per target element, what this rank adds to it */
+    target  = (int *) malloc(nupd * sizeof(int));
+    disp    = (MPI_Aint *) malloc(nupd * sizeof(MPI_Aint));
+    value   = (double *) malloc(nupd * sizeof(double));
+    contrib = (double *) calloc((size_t) size * m, sizeof(double));
+    expect  = (double *) malloc(m * sizeof(double));
+    seed = 0x2545f4914f6cdd1dULL + rank;
+    for (k=0; k<nupd; k++)
+    {
+        target[k] = (int) (next_rand(&seed) % size);
+        disp[k] = (MPI_Aint) (next_rand(&seed) % m);
+        value[k] = (double) (1 + next_rand(&seed) % 4);
+        contrib[(size_t) target[k] * m + disp[k]] += value[k];
+    }
+    MPI_Reduce_scatter_block(contrib, expect, m, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+
+    if (rank == 0)
+    {
+        printf("# %d processes, %lld updates per rank over %d doubles per rank, threshold %d\n",
+               size, nupd, m, threshold);
+        printf("# %-6s %10s %14s %12s %12s %12s\n", "mode", "time(s)", "updates/s", "calls",
+               "elements", "padding");
+        fflush(stdout);
+    }
+
+    for (mode=0; mode<NUM_MODES; mode++)
+    {
+        MPI_Win_lock(MPI_LOCK_EXCLUSIVE, rank, 0, win);
+        memset(base, 0, m * sizeof(double));
+        MPI_Win_unlock(rank, win);
+        MPI_Barrier(MPI_COMM_WORLD);
+
+        calls = elements = nupd;
+        padding = 0;
+        t = MPI_Wtime();
+        switch (mode)
+        {
+        case M_DIRECT:
+            MPI_Win_lock_all(0, win);
+            for (k=0; k<nupd; k++)
+                MPI_Accumulate(&value[k], 1, MPI_DOUBLE, target[k], disp[k], 1, MPI_DOUBLE, MPI_SUM, win);
+            MPI_Win_flush_all(win);
+            MPI_Win_unlock_all(win);
+            break;
+        case M_AGGR:
+            aggr_init(win, MPI_DOUBLE, MPI_SUM, threshold, AGGR_PASSIVE, &a);
+            MPI_Win_lock_all(0, win);
+            for (k=0; k<nupd; k++) aggr_add(&a, target[k], disp[k], &value[k]);
+            aggr_flush(&a);
+            MPI_Win_unlock_all(win);
+            break;
+        case M_FENCE:
+            aggr_init(win, MPI_DOUBLE, MPI_SUM, threshold, AGGR_ACTIVE, &a);
+            MPI_Win_fence(MPI_MODE_NOPRECEDE, win);
+            for (k=0; k<nupd; k++) aggr_add(&a, target[k], disp[k], &value[k]);
+            aggr_fence(&a, MPI_MODE_NOSUCCEED);
+            break;
+        }
+        t = MPI_Wtime() - t;
+        if (mode != M_DIRECT)
+        {
+            calls = a.calls;
+            elements = a.elements;
+            padding = a.padding;
+            aggr_free(&a);
+        }
+        tmax = bench_max_time(t, 0, MPI_COMM_WORLD);
+        MPI_Barrier(MPI_COMM_WORLD);
+        errs += check_window(win, base, expect, m, rank, mode_names[mode]);
+        if (rank == 0)
+        {
+            printf("  %-6s %10.4f %14.0f %12lld %12lld %12lld\n", mode_names[mode], tmax,
+                   tmax > 0.0 ? (double) nupd * size / tmax : 0.0, calls, elements, padding);
+            fflush(stdout);
+        }
+    }
+
+    /*
+    * MPI_REPLACE: rank o writes every element d with d % size == o on
+    * every rank, first o + 1001 and then o + 1, through a threshold small
+    * enough that the two writes of an element often go out in different
+    * flushes. Each element must end up as (d % size) + 1.
+    */
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, rank, 0, win);
+    memset(base, 0, m * sizeof(double));
+    MPI_Win_unlock(rank, win);
+    MPI_Barrier(MPI_COMM_WORLD);
+    aggr_init(win, MPI_DOUBLE, MPI_REPLACE, 7, AGGR_PASSIVE, &a);
+    MPI_Win_lock_all(0, win);
+    for (r=0; r<size; r++)
+    {
+        for (i=rank; i<m; i+=size)
+        {
+            v = rank + 1001;
+            aggr_add(&a, r, i, &v);
+        }
+        for (i=rank; i<m; i+=size)
+        {
+            v = rank + 1;
+            aggr_add(&a, r, i, &v);
+        }
+    }
+    aggr_flush(&a);
+    MPI_Win_unlock_all(win);
+    aggr_free(&a);
+    MPI_Barrier(MPI_COMM_WORLD);
+    for (i=0; i<m; i++) expect[i] = i % size + 1;
+    errs += check_window(win, base, expect, m, rank, "replace");
+
+    MPI_Win_free(&win);
+    MPI_Free_mem(base);
+    free(target);
+    free(disp);
+    free(value);
+    free(contrib);
+    free(expect);
+
+    MPI_Reduce( &errs, &tot_errs, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD );
+    if (rank == 0 && tot_errs == 0) printf(" No Errors\n");
+    fflush(stdout);
+
+    MPI_Finalize();
+    return errs;
+}
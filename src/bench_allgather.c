@@ -0,0 +1,196 @@
+/*
+bench_allgather
+
+   MPI_Allgather and MPI_Allgatherv against the ring, recursive-doubling
+   and Bruck algorithms of allgather_engine.h, at any number of ranks.
+
+Usage
+
+   mpirun -n 6 ./bench_allgather [-dist uniform|skewed|sparse|all]
+                                 [-min 8] [-max 256K] [-reps 20]
+
+Remarks
+
+   Sizes are the bytes of doubles per rank on average; -dist sets the
+   blocks:
+
+   uniform   the same block everywhere, with MPI_Allgather/ag_allgather
+   skewed    the last rank contributes half of the data, the others
+             share the rest (MPI_Allgatherv/ag_allgatherv)
+   sparse    ranks r % 3 == 0 contribute nothing, the others 1.5x the
+             average (MPI_Allgatherv/ag_allgatherv)
+
+   The table gives the bytes gathered per rank and the time per call in
+   us (slowest rank, averaged over -reps) of the MPI function, AG_RING,
+   AG_RECDBL, AG_BRUCK and AG_AUTO, and the algorithm AG_AUTO picked.
+   Blocks are placed in recvbuf in reverse rank order with a gap after
+   each, so displs are neither contiguous nor increasing. Every
+   algorithm's result is checked at each size before timing, with and
+   without MPI_IN_PLACE.
+*/
+
+#include "mpi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench_util.h"
+#include "allgather_engine.h"
+
+#define MIN_BYTES 8
+#define MAX_BYTES (256*1024)
+#define REPS 20
+
+#define NUM_DISTS 3
+enum { D_UNIFORM, D_SKEWED, D_SPARSE };
+static const char *dist_names[NUM_DISTS] = { "uniform", "skewed", "sparse" };
+
+#define NUM_ALGS 5
+static const int algs[NUM_ALGS] = { -1, AG_RING, AG_RECDBL, AG_BRUCK, AG_AUTO };
+
+static int count_of(int dist, int n, int r, int p)
+{
+    switch (dist)
+    {
+    case D_SKEWED: return (p == 1) ? n : (r == p - 1) ? n * p / 2 : (n * p - n * p / 2) / (p - 1);
+    case D_SPARSE: return (r % 3 == 0) ? 0 : n * 3 / 2;
+    default:       return n;
+    }
+}
+
+/* Element i of rank r's block */
+static double value(int r, int i)
+{
+    return (double) r * 1048576.0 + i;
+}
+
+static void run(int dist, int alg, const double *in, double *out, const int *counts, const int *displs, int rank,
+                int inplace)
+{
+    const void *sbuf = inplace ? MPI_IN_PLACE : in;
+
+    if (dist == D_UNIFORM)
+    {
+        if (alg < 0) MPI_Allgather(sbuf, counts[rank], MPI_DOUBLE, out, counts[rank], MPI_DOUBLE, MPI_COMM_WORLD);
+        else ag_allgather(sbuf, counts[rank], MPI_DOUBLE, out, counts[rank], MPI_DOUBLE, MPI_COMM_WORLD, alg);
+    }
+    else
+    {
+        if (alg < 0)
+            MPI_Allgatherv(sbuf, counts[rank], MPI_DOUBLE, out, counts, displs, MPI_DOUBLE, MPI_COMM_WORLD);
+        else ag_allgatherv(sbuf, counts[rank], MPI_DOUBLE, out, counts, displs, MPI_DOUBLE, MPI_COMM_WORLD, alg);
+    }
+}
+
+static int check(int dist, int alg, const double *in, double *out, const int *counts, const int *displs,
+                 int rank, int size, int span, int inplace)
+{
+    int r, i;
+
+    for (i=0; i<span; i++) out[i] = -1.0;
+    if (inplace)
+        for (i=0; i<counts[rank]; i++) out[displs[rank] + i] = in[i];
+    run(dist, alg, in, out, counts, displs, rank, inplace);
+    for (r=0; r<size; r++)
+        for (i=0; i<counts[r]; i++)
+        {
+            if (out[displs[r] + i] == value(r, i)) continue;
+            fprintf(stderr, "(%d) %s %s%s: rank %d [%d] = %g, expected %g\n", rank, dist_names[dist],
+                    alg < 0 ? "MPI" : ag_name(alg), inplace ? " in place" : "", r, i, out[displs[r] + i],
+                    value(r, i));
+            fflush(stderr);
+            return 1;
+        }
+    return 0;
+}
+
+int main( int argc, char **argv )
+{
+    int rank, size, reps, dist, first, last, a, r, i, n, span, *counts, *displs, errs = 0, tot_errs;
+    long long bytes, minb, maxb, total;
+    const char *distname;
+    double *in, *out, t, tmax[NUM_ALGS];
+
+    MPI_Init( &argc, &argv );
+    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+    MPI_Comm_size( MPI_COMM_WORLD, &size );
+
+    distname = bench_arg(argc, argv, "-dist");
+    minb = bench_arg_size(argc, argv, "-min", MIN_BYTES);
+    maxb = bench_arg_size(argc, argv, "-max", MAX_BYTES);
+    reps = bench_arg_int(argc, argv, "-reps", REPS);
+    if (minb < (long long) sizeof(double)) minb = sizeof(double);
+    if (maxb < minb) maxb = minb;
+    if (reps < 1) reps = 1;
+    first = 0;
+    last = NUM_DISTS - 1;
+    for (dist=0; distname && dist<NUM_DISTS; dist++)
+        if (strcmp(distname, dist_names[dist]) == 0) first = last = dist;
+
+    counts = (int *) malloc(size * sizeof(int));
+    displs = (int *) malloc(size * sizeof(int));
+    in = out = NULL;
+
+    if (rank == 0)
+    {
+        printf("# %d processes, -reps %d\n", size, reps);
+        printf("# %-8s %12s %12s %12s %12s %12s %12s %9s\n", "dist", "bytes", "MPI", "ring", "recdbl", "bruck",
+               "auto", "picked");
+        fflush(stdout);
+    }
+
+    for (dist=first; dist<=last; dist++)
+    {
+        for (bytes=minb; bytes<=maxb; bytes*=4)
+        {
+            n = (int) (bytes / sizeof(double));
+            for (r=0, total=0; r<size; r++)
+            {
+                counts[r] = count_of(dist, n, r, size);
+                total += counts[r];
+            }
+            /* Reverse rank order with a gap of one element, except for MPI_Allgather's fixed layout */
+            for (r=size-1, span=0; r>=0; r--)
+            {
+                displs[r] = (dist == D_UNIFORM) ? r * n : span;
+                span += counts[r] + (dist != D_UNIFORM);
+            }
+            in  = (double *) realloc(in, ((size_t) counts[rank] + 1) * sizeof(double));
+            out = (double *) realloc(out, ((size_t) span + 1) * sizeof(double));
+            for (i=0; i<counts[rank]; i++) in[i] = value(rank, i);
+
+            for (a=0; a<NUM_ALGS; a++)
+            {
+                errs += check(dist, algs[a], in, out, counts, displs, rank, size, span, 0);
+                errs += check(dist, algs[a], in, out, counts, displs, rank, size, span, 1);
+            }
+
+            for (a=0; a<NUM_ALGS; a++)
+            {
+                run(dist, algs[a], in, out, counts, displs, rank, 0);
+                MPI_Barrier(MPI_COMM_WORLD);
+                t = MPI_Wtime();
+                for (r=0; r<reps; r++) run(dist, algs[a], in, out, counts, displs, rank, 0);
+                tmax[a] = bench_max_time((MPI_Wtime() - t) / reps, 0, MPI_COMM_WORLD);
+            }
+            if (rank == 0)
+            {
+                printf("  %-8s %12lld", dist_names[dist], total * (long long) sizeof(double));
+                for (a=0; a<NUM_ALGS; a++) printf(" %12.2f", tmax[a] * 1e6);
+                printf(" %9s\n", ag_name(ag_choose(counts, MPI_DOUBLE, MPI_COMM_WORLD)));
+                fflush(stdout);
+            }
+        }
+    }
+
+    free(counts);
+    free(displs);
+    free(in);
+    free(out);
+
+    MPI_Reduce( &errs, &tot_errs, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD );
+    if (rank == 0 && tot_errs == 0) printf(" No Errors\n");
+    fflush(stdout);
+
+    MPI_Finalize();
+    return errs;
+}
@@ -0,0 +1,162 @@
+/*
+bench_bsend
+
+   Burst traffic through the managed buffered-send arena of
+   bsend_arena.h.
+
+Usage
+
+   mpirun -n 4 ./bench_bsend [-steps 200] [-burst 64] [-large 16K]
+
+Remarks
+
+   Even ranks produce bursts of events, odd ranks consume them (rank r
+   sends to r+1). Every step a producer sends a random number (up to
+   -burst) of events, mostly small (64 doubles) with one in eight large
+   (-large doubles), then a zero-byte end marker, and calls
+   bsend_arena_sync as its safe point. Consumers probe and receive until
+   they see the marker, so they keep draining while producers burst.
+
+   The arena is declared for 16 small and 2 large events in flight,
+   which the bursts overrun. The same event sequence is run with three
+   policies:
+
+   grow       declared sizing, growing by detach/reattach (up to 256 MiB)
+   fixed      declared sizing, never grows: every overrun is a stall
+   overalloc  a 256 MiB buffer attached up front
+
+   Producers print the arena statistics for each policy; the time per
+   step is the slowest rank's.
+*/
+
+#include "mpi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench_util.h"
+#include "bsend_arena.h"
+
+#define NUM_STEPS 200
+#define MAX_BURST 64
+#define SMALL 64
+#define LARGE (16*1024)
+#define MAX_ARENA (256*1024*1024)
+#define TAG_EVENT 1
+#define TAG_END 2
+#define NUM_POLICIES 3
+
+static const char *policy_names[NUM_POLICIES] = { "grow", "fixed", "overalloc" };
+
+int main( int argc, char **argv )
+{
+    int rank, size, steps, burst, large, p, s, k, n, errs = 0, tot_errs;
+    int producer, peer;
+    double *sbuf, *rbuf, t0, t;
+    MPI_Status status;
+    bsend_arena_t a;
+
+    MPI_Init( &argc, &argv );
+    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+    MPI_Comm_size( MPI_COMM_WORLD, &size );
+
+    steps = bench_arg_int(argc, argv, "-steps", NUM_STEPS);
+    burst = bench_arg_int(argc, argv, "-burst", MAX_BURST);
+    large = (int) bench_arg_size(argc, argv, "-large", LARGE);
+    if (burst < 1) burst = 1;
+    if (large < SMALL) large = SMALL;
+
+    producer = (rank % 2 == 0);
+    peer = producer ? rank + 1 : rank - 1;
+    if (peer >= size) peer = MPI_PROC_NULL;
+
+    sbuf = (double *) malloc(large * sizeof(double));
+    rbuf = (double *) malloc(large * sizeof(double));
+    for (k=0; k<large; k++) sbuf[k] = k;
+
+    for (p=0; p<NUM_POLICIES; p++)
+    {
+        srand(1234 + rank);
+        bsend_arena_init(&a, MPI_COMM_WORLD, (p == 1) ? 0 : MAX_ARENA);
+        if (p == 2)
+        {
+            bsend_arena_declare(&a, MAX_ARENA - MPI_BSEND_OVERHEAD, MPI_BYTE, 1);
+        }
+        else
+        {
+            bsend_arena_declare(&a, SMALL, MPI_DOUBLE, 16);
+            bsend_arena_declare(&a, large, MPI_DOUBLE, 2);
+        }
+        if (producer) bsend_arena_attach(&a);
+
+        MPI_Barrier( MPI_COMM_WORLD );
+        t0 = MPI_Wtime();
+        for (s=0; s<steps && peer != MPI_PROC_NULL; s++)
+        {
+            if (producer)
+            {
+                int nev = 1 + rand() % burst;
+                for (k=0; k<nev; k++)
+                {
+                    n = (rand() % 8 == 0) ? large : SMALL;
+                    sbuf[0] = s * 1000.0 + k;
+                    if (bsend_arena_send(&a, sbuf, n, MPI_DOUBLE, peer, TAG_EVENT, MPI_COMM_WORLD)
+                        != MPI_SUCCESS)
+                    {
+                        errs++;
+                    }
+                }
+                bsend_arena_send(&a, NULL, 0, MPI_BYTE, peer, TAG_END, MPI_COMM_WORLD);
+                bsend_arena_sync(&a);
+            }
+            else
+            {
+                k = 0;
+                for (;;)
+                {
+                    MPI_Probe(peer, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+                    if (status.MPI_TAG == TAG_END)
+                    {
+                        MPI_Recv(NULL, 0, MPI_BYTE, peer, TAG_END, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                        break;
+                    }
+                    MPI_Get_count(&status, MPI_DOUBLE, &n);
+                    MPI_Recv(rbuf, n, MPI_DOUBLE, peer, TAG_EVENT, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                    if (rbuf[0] != s * 1000.0 + k || (n > 1 && rbuf[n-1] != n - 1))
+                    {
+                        if (errs < 5)
+                        {
+                            fprintf(stderr, "[%d] step %d event %d: got %g\n", rank, s, k, rbuf[0]);
+                            fflush(stderr);
+                        }
+                        errs++;
+                    }
+                    k++;
+                }
+            }
+        }
+        t = (MPI_Wtime() - t0) / steps;
+        t = bench_max_time(t, 0, MPI_COMM_WORLD);
+
+        if (rank == 0)
+        {
+            printf("# policy %s: %.2f us/step\n", policy_names[p], t * 1e6);
+            fflush(stdout);
+        }
+        if (producer && peer != MPI_PROC_NULL)
+        {
+            char label[64];
+            snprintf(label, sizeof(label), "  [%d] %s", rank, policy_names[p]);
+            bsend_arena_print(&a, stdout, label);
+        }
+        bsend_arena_free(&a);
+        MPI_Barrier( MPI_COMM_WORLD );
+    }
+
+    MPI_Reduce( &errs, &tot_errs, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD );
+    if (rank == 0 && tot_errs == 0) printf(" No Errors\n");
+    fflush(stdout);
+
+    free(sbuf);
+    free(rbuf);
+    MPI_Finalize();
+    return errs;
+}
@@ -0,0 +1,239 @@
+/*
+bench_cart_plan
+
+   Halo exchange on the MPI_Dims_create decomposition against the one
+   chosen by cart_plan.h, with the planner's predicted cost next to the
+   measured time for both.
+
+Usage
+
+   mpirun -n 8 ./bench_cart_plan [-n 1024,128,32] [-ghost 1] [-ppn 0]
+                                 [-steps 100]
+
+Remarks
+
+   -n gives the global grid extents; two values make a 2D grid, three
+   a 3D one. The grid is periodic and holds doubles. -ppn groups
+   consecutive ranks into pretend nodes (0: real shared-memory nodes).
+
+   default   MPI_Dims_create(size, ndims) and MPI_Cart_create without
+             reordering, i.e. ranks in row-major order over the grid
+   planned   cart_plan with a model calibrated by cart_model_calibrate,
+             built with cart_plan_create
+
+   For each layout the table gives the process grid, the halo bytes of
+   the busiest rank, the bytes crossing node boundaries in one exchange
+   (all ranks), the model's prediction for the slowest rank and the
+   measured time per face exchange with halo.h (slowest rank, -steps
+   exchanges). Every rank's ghost faces are checked against the global
+   cell values after the first exchange. A layout whose blocks are
+   thinner than the ghost width is reported but not run.
+
+   The model knows nothing of ranks competing for cores or memory
+   bandwidth, so on an oversubscribed machine the measured times are
+   far above the prediction; the ratio between the layouts is the part
+   to compare.
+*/
+
+#include "mpi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench_util.h"
+#include "halo.h"
+#include "cart_plan.h"
+
+#define NUM_STEPS 100
+
+static int ndims, ng[3], nl[3], off[3], full[3], ghost;
+
+/* "1024,128,32" -> { 1024, 128, 32 }; returns how many (at most 3) */
+static int parse_extents(const char *str, int *list)
+{
+    int n = 0;
+    char *end;
+    while (str && *str && n < 3)
+    {
+        list[n++] = (int) strtol(str, &end, 10);
+        if (end == str) return n - 1;
+        str = (*end == ',') ? end + 1 : end;
+    }
+    return n;
+}
+
+/* Global index of the cell at local position l (ghosts included), periodic */
+static double value(const int *l)
+{
+    int d;
+    double v = 0.0;
+    for (d=0; d<ndims; d++) v = v * ng[d] + (off[d] + l[d] - ghost + ng[d]) % ng[d];
+    return v;
+}
+
+/* Fill (init) or check the field: interior and face ghosts; edges and corners stay -1 */
+static int field_pass(double *u, int init, int rank, const char *name)
+{
+    int l[3] = { 0, 0, 0 }, d, out, errs = 0;
+    size_t i, ncells = 1;
+    double want;
+
+    for (d=0; d<ndims; d++) ncells *= full[d];
+    for (i=0; i<ncells; i++)
+    {
+        size_t t = i;
+        for (d=ndims-1, out=0; d>=0; d--)
+        {
+            l[d] = (int) (t % full[d]);
+            t /= full[d];
+            out += (l[d] < ghost || l[d] >= ghost + nl[d]);
+        }
+        want = (out <= 1) ? value(l) : -1.0;
+        if (init)
+        {
+            u[i] = (out == 0) ? want : -1.0;
+        }
+        else if (u[i] != want)
+        {
+            if (errs++ < 5)
+            {
+                fprintf(stderr, "(%d) %s: cell %zu = %g, expected %g\n", rank, name, i, u[i], want);
+                fflush(stderr);
+            }
+        }
+    }
+    return errs;
+}
+
+/* One layout: check an exchange, then time steps of them */
+static int run_layout(MPI_Comm cart, int steps, double *tstep)
+{
+    int rank, d, s, coords[3], dims[3], periods[3], ok = 1, all_ok, errs = 0;
+    size_t ncells = 1;
+    double *u, t;
+    halo_t h;
+
+    MPI_Comm_rank(cart, &rank);
+    MPI_Cart_get(cart, ndims, dims, periods, coords);
+    for (d=0; d<ndims; d++)
+    {
+        nl[d] = cart_block(ng[d], dims[d], coords[d]);
+        off[d] = coords[d] * (ng[d] / dims[d]) + (coords[d] < ng[d] % dims[d] ? coords[d] : ng[d] % dims[d]);
+        full[d] = nl[d] + 2 * ghost;
+        ncells *= full[d];
+        if (nl[d] < ghost) ok = 0;
+    }
+    MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_LAND, cart);
+    *tstep = -1.0;
+    if (!all_ok) return 0;
+
+    u = (double *) malloc(ncells * sizeof(double));
+    halo_create(cart, nl, ghost, MPI_DOUBLE, u, HALO_FACES_ONLY, &h);
+    field_pass(u, 1, rank, NULL);
+    halo_exchange(&h);
+    errs += field_pass(u, 0, rank, "first exchange");
+
+    MPI_Barrier(cart);
+    t = MPI_Wtime();
+    for (s=0; s<steps; s++) halo_exchange(&h);
+    t = (MPI_Wtime() - t) / steps;
+    MPI_Allreduce(&t, tstep, 1, MPI_DOUBLE, MPI_MAX, cart);
+
+    halo_free(&h);
+    free(u);
+    return errs;
+}
+
+static void report(const char *name, const int *dims, const int *node_dims, double halo, double inter,
+                   double predicted, double measured)
+{
+    char grid[64], nodes[64];
+    if (ndims == 3)
+    {
+        snprintf(grid, sizeof(grid), "%dx%dx%d", dims[0], dims[1], dims[2]);
+        if (node_dims) snprintf(nodes, sizeof(nodes), "%dx%dx%d", node_dims[0], node_dims[1], node_dims[2]);
+    }
+    else
+    {
+        snprintf(grid, sizeof(grid), "%dx%d", dims[0], dims[1]);
+        if (node_dims) snprintf(nodes, sizeof(nodes), "%dx%d", node_dims[0], node_dims[1]);
+    }
+    if (!node_dims) snprintf(nodes, sizeof(nodes), "-");
+    printf("  %-8s %10s %10s %10.1f %10.3f %12.2f ", name, grid, nodes, halo / 1024.0, inter / 1048576.0,
+           predicted * 1e6);
+    if (measured < 0.0) printf("%12s\n", "-");
+    else printf("%12.2f\n", measured * 1e6);
+    fflush(stdout);
+}
+
+int main( int argc, char **argv )
+{
+    int rank, size, steps, ppn, r, d, errs = 0, tot_errs;
+    int dims[3] = { 0, 0, 0 }, periods[3] = { 1, 1, 1 }, *coords, *node_of;
+    double pred_default, halo_default, inter_default, t_default, t_planned;
+    cart_model_t model;
+    cart_plan_t plan;
+    MPI_Comm cart_default, cart_planned;
+
+    MPI_Init( &argc, &argv );
+    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+    MPI_Comm_size( MPI_COMM_WORLD, &size );
+
+    ng[0] = 1024; ng[1] = 128; ng[2] = 32;
+    ndims = bench_arg(argc, argv, "-n") ? parse_extents(bench_arg(argc, argv, "-n"), ng) : 3;
+    ghost = bench_arg_int(argc, argv, "-ghost", 1);
+    ppn   = bench_arg_int(argc, argv, "-ppn", 0);
+    steps = bench_arg_int(argc, argv, "-steps", NUM_STEPS);
+    if (ndims < 2)
+    {
+        if (rank == 0) fprintf(stderr, "-n needs two or three extents\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    if (ghost < 1) ghost = 1;
+    if (steps < 1) steps = 1;
+
+    cart_model_calibrate(MPI_COMM_WORLD, ppn, &model);
+
+    /* Default: balanced dims, row-major ranks, costed with the same model */
+    MPI_Dims_create(size, ndims, dims);
+    MPI_Cart_create(MPI_COMM_WORLD, ndims, dims, periods, 0, &cart_default);
+    coords  = (int *) malloc(size * ndims * sizeof(int));
+    node_of = (int *) malloc(size * sizeof(int));
+    cart_find_nodes(MPI_COMM_WORLD, ppn, node_of);
+    for (r=0; r<size; r++) cart_unravel(r, ndims, dims, coords + r * ndims);
+    pred_default = cart_plan_cost(ndims, ng, dims, periods, ghost, sizeof(double), size, coords,
+                                  node_of, &model, &halo_default, &inter_default);
+
+    cart_plan(MPI_COMM_WORLD, ndims, ng, periods, ghost, sizeof(double), ppn, &model, &plan);
+    cart_plan_create(MPI_COMM_WORLD, &plan, periods, &cart_planned);
+
+    errs += run_layout(cart_default, steps, &t_default);
+    errs += run_layout(cart_planned, steps, &t_planned);
+
+    if (rank == 0)
+    {
+        printf("# %d processes, %d nodes of %d, grid", size, plan.nnodes, plan.ppn);
+        for (d=0; d<ndims; d++) printf("%s%d", d ? "x" : " ", ng[d]);
+        printf(" doubles, ghost %d, %d steps\n", ghost, steps);
+        printf("# model: intra %.2f us + %.2f GB/s, inter %.2f us + %.2f GB/s\n",
+               model.alpha_intra * 1e6, model.beta_intra / 1e9, model.alpha_inter * 1e6,
+               model.beta_inter / 1e9);
+        printf("# %-8s %10s %10s %10s %10s %12s %12s\n", "layout", "dims", "node_dims", "halo(KB)",
+               "inter(MB)", "predicted", "measured");
+        report("default", dims, NULL, halo_default, inter_default, pred_default, t_default);
+        report("planned", plan.dims, plan.node_dims, plan.halo_bytes, plan.inter_bytes,
+               plan.predicted, t_planned);
+    }
+
+    cart_plan_free(&plan);
+    free(coords);
+    free(node_of);
+    MPI_Comm_free(&cart_default);
+    MPI_Comm_free(&cart_planned);
+
+    MPI_Reduce( &errs, &tot_errs, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD );
+    if (rank == 0 && tot_errs == 0) printf(" No Errors\n");
+    fflush(stdout);
+
+    MPI_Finalize();
+    return errs;
+}
@@ -0,0 +1,390 @@
+/*
+bench_completion
+
+   Completion latency and CPU cost of the request completion calls with
+   many receives in flight.
+
+Usage
+
+   mpirun -n 2 ./bench_completion [-min 1K] [-max 100K] [-gap 1]
+                                  [-spin 1000]
+
+Remarks
+
+   Ranks are paired (even rank r receives from r+1; an odd last rank
+   idles). For each count N from -min to -max (x10) the receiver posts N
+   MPI_Irecv at once and its partner sends N small messages, one every
+   -gap microseconds, each carrying its send time. The receiver notes the
+   time at which it learns about every completion; the latency of a
+   message is that time minus its send time, corrected by a clock offset
+   measured with ping-pongs beforehand. CPU cost is process CPU time
+   (getrusage, all threads) divided by the wall time of the receive loop:
+   1.0 means one core was busy the whole time.
+
+   Strategies:
+
+   waitany    MPI_Waitany until every request is done
+   waitsome   MPI_Waitsome
+   testsome   busy loop on MPI_Testsome
+   testall    busy loop on MPI_Testall; all messages are learned about
+              at once, when the last one lands
+   adaptive   MPI_Testsome spinning -spin times without progress, then
+              sched_yield between polls until something completes
+   thread     a progress thread blocked in MPI_Waitsome hands completed
+              indices to the main thread through a mutex-protected queue;
+              the main thread sleeps on a condition variable and consumes
+              them. The row gives the latency at which the main thread
+              consumes each message and the main thread's own CPU
+              share (CLOCK_THREAD_CPUTIME_ID); the "progress" row below it
+              gives the progress thread's detection latency and CPU
+              share. Needs MPI_THREAD_MULTIPLE; skipped otherwise.
+
+   Calls that scan the whole request array (waitany, testall) cost O(N)
+   per call, so expect them to fall behind quickly at 100K.
+*/
+
+#include "mpi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "bench_util.h"
+
+#define MIN_COUNT 1024
+#define MAX_COUNT (100*1024)
+#define GAP_US 1
+#define SPIN 1000
+#define TAG_MSG 7
+#define NUM_STRATEGIES 6
+
+enum { S_WAITANY, S_WAITSOME, S_TESTSOME, S_TESTALL, S_ADAPTIVE, S_THREAD };
+static const char *strategy_names[NUM_STRATEGIES] =
+    { "waitany", "waitsome", "testsome", "testall", "adaptive", "thread" };
+
+typedef struct
+{
+    int n;
+    MPI_Request *reqs;
+    int *idx;
+    double *det;
+    /* S_THREAD: completions queued by the progress thread for the main thread */
+    double *pdet;                       /* when the progress thread saw them */
+    int *queue, qhead, qtail;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    double main_cpu, progress_cpu;      /* CPU seconds of each thread */
+} recv_state_t;
+
+static int spin_limit = SPIN;
+
+static double cpu_seconds(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6 +
+           ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6;
+}
+
+static double thread_cpu_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void mark(recv_state_t *st, int outcount)
+{
+    int k;
+    double now = MPI_Wtime();
+    for (k=0; k<outcount; k++) st->det[st->idx[k]] = now;
+}
+
+static void loop_waitsome(recv_state_t *st)
+{
+    int done = 0, outcount;
+    while (done < st->n)
+    {
+        MPI_Waitsome(st->n, st->reqs, &outcount, st->idx, MPI_STATUSES_IGNORE);
+        mark(st, outcount);
+        done += outcount;
+    }
+}
+
+static void *progress_thread(void *arg)
+{
+    recv_state_t *st = (recv_state_t *) arg;
+    int done = 0, outcount, k;
+    double c0 = thread_cpu_seconds(), now;
+
+    while (done < st->n)
+    {
+        MPI_Waitsome(st->n, st->reqs, &outcount, st->idx, MPI_STATUSES_IGNORE);
+        now = MPI_Wtime();
+        pthread_mutex_lock(&st->lock);
+        for (k=0; k<outcount; k++)
+        {
+            st->pdet[st->idx[k]] = now;
+            st->queue[st->qtail++] = st->idx[k];
+        }
+        pthread_cond_signal(&st->ready);
+        pthread_mutex_unlock(&st->lock);
+        done += outcount;
+    }
+    st->progress_cpu = thread_cpu_seconds() - c0;
+    return NULL;
+}
+
+/* Main thread side of S_THREAD: consume queued completions until all n are in */
+static void consume_queue(recv_state_t *st)
+{
+    int j, end;
+    double c0 = thread_cpu_seconds(), now;
+
+    while (st->qhead < st->n)
+    {
+        pthread_mutex_lock(&st->lock);
+        while (st->qhead == st->qtail) pthread_cond_wait(&st->ready, &st->lock);
+        end = st->qtail;
+        pthread_mutex_unlock(&st->lock);
+        now = MPI_Wtime();
+        for (j=st->qhead; j<end; j++) st->det[st->queue[j]] = now;
+        st->qhead = end;
+    }
+    st->main_cpu = thread_cpu_seconds() - c0;
+}
+
+static void receive_loop(int strategy, recv_state_t *st)
+{
+    int done = 0, outcount, k, flag, idle = 0;
+    pthread_t th;
+
+    switch (strategy)
+    {
+    case S_WAITANY:
+        while (done < st->n)
+        {
+            MPI_Waitany(st->n, st->reqs, &k, MPI_STATUS_IGNORE);
+            st->det[k] = MPI_Wtime();
+            done++;
+        }
+        break;
+    case S_WAITSOME:
+        loop_waitsome(st);
+        break;
+    case S_TESTSOME:
+        while (done < st->n)
+        {
+            MPI_Testsome(st->n, st->reqs, &outcount, st->idx, MPI_STATUSES_IGNORE);
+            mark(st, outcount);
+            done += outcount;
+        }
+        break;
+    case S_TESTALL:
+        flag = 0;
+        while (!flag) MPI_Testall(st->n, st->reqs, &flag, MPI_STATUSES_IGNORE);
+        for (k=0; k<st->n; k++) st->det[k] = MPI_Wtime();
+        break;
+    case S_ADAPTIVE:
+        while (done < st->n)
+        {
+            MPI_Testsome(st->n, st->reqs, &outcount, st->idx, MPI_STATUSES_IGNORE);
+            if (outcount > 0)
+            {
+                mark(st, outcount);
+                done += outcount;
+                idle = 0;
+            }
+            else if (++idle > spin_limit)
+            {
+                sched_yield();
+            }
+        }
+        break;
+    default:
+        st->qhead = st->qtail = 0;
+        pthread_create(&th, NULL, progress_thread, st);
+        consume_queue(st);
+        pthread_join(th, NULL);
+        break;
+    }
+}
+
+/* Sender clock minus receiver clock, from the ping-pong with the smallest round trip */
+static double clock_offset(int receiver, int partner, MPI_Comm comm)
+{
+    int i;
+    double t1, t2, ts, best_rtt = 1e30, offset = 0.0;
+
+    for (i=0; i<20; i++)
+    {
+        if (receiver)
+        {
+            t1 = MPI_Wtime();
+            MPI_Send(&t1, 1, MPI_DOUBLE, partner, 0, comm);
+            MPI_Recv(&ts, 1, MPI_DOUBLE, partner, 0, comm, MPI_STATUS_IGNORE);
+            t2 = MPI_Wtime();
+            if (t2 - t1 < best_rtt)
+            {
+                best_rtt = t2 - t1;
+                offset = ts - 0.5 * (t1 + t2);
+            }
+        }
+        else
+        {
+            MPI_Recv(&t1, 1, MPI_DOUBLE, partner, 0, comm, MPI_STATUS_IGNORE);
+            ts = MPI_Wtime();
+            MPI_Send(&ts, 1, MPI_DOUBLE, partner, 0, comm);
+        }
+    }
+    return offset;
+}
+
+int main( int argc, char **argv )
+{
+    int rank, size, provided, receiver, partner, n, s, i, nstrat;
+    long long min_count, max_count;
+    double gap, offset = 0.0, t0, c0, wall, cpu, stats[3], pstats[3], *lat, *msgs;
+    recv_state_t st;
+    bench_stats_t ls, ps;
+    char sbuf[32];
+
+    MPI_Init_thread( &argc, &argv, MPI_THREAD_MULTIPLE, &provided );
+    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+    MPI_Comm_size( MPI_COMM_WORLD, &size );
+
+    if (size < 2)
+    {
+        printf("This benchmark requires at least 2 processes\n");
+        fflush(stdout);
+        MPI_Finalize();
+        return 1;
+    }
+
+    min_count  = bench_arg_size(argc, argv, "-min", MIN_COUNT);
+    max_count  = bench_arg_size(argc, argv, "-max", MAX_COUNT);
+    gap        = bench_arg_int(argc, argv, "-gap", GAP_US) * 1e-6;
+    spin_limit = bench_arg_int(argc, argv, "-spin", SPIN);
+    if (min_count < 1) min_count = 1;
+    nstrat = (provided == MPI_THREAD_MULTIPLE) ? NUM_STRATEGIES : NUM_STRATEGIES - 1;
+
+    receiver = (rank % 2 == 0);
+    partner  = receiver ? rank + 1 : rank - 1;
+    if (partner >= size) partner = MPI_PROC_NULL;
+
+    if (partner != MPI_PROC_NULL) offset = clock_offset(receiver, partner, MPI_COMM_WORLD);
+
+    st.reqs = (MPI_Request *) malloc(max_count * sizeof(MPI_Request));
+    st.idx  = (int *) malloc(max_count * sizeof(int));
+    st.det  = (double *) malloc(max_count * sizeof(double));
+    st.pdet = (double *) malloc(max_count * sizeof(double));
+    st.queue = (int *) malloc(max_count * sizeof(int));
+    pthread_mutex_init(&st.lock, NULL);
+    pthread_cond_init(&st.ready, NULL);
+    msgs    = (double *) malloc(max_count * sizeof(double));
+    lat     = (double *) malloc(max_count * sizeof(double));
+
+    if (rank == 0)
+    {
+        printf("# %d pairs, gap %.1f us, spin %d%s\n", size / 2, gap * 1e6, spin_limit,
+               (provided == MPI_THREAD_MULTIPLE) ? "" : ", no MPI_THREAD_MULTIPLE: thread skipped");
+        printf("# %-8s %-10s %12s %12s %12s %10s\n", "inflight", "strategy",
+               "med lat(us)", "p99 lat(us)", "loop(ms)", "cpu/wall");
+        fflush(stdout);
+    }
+
+    for (n=(int) min_count; n<=max_count; n*=10)
+    {
+        for (s=0; s<nstrat; s++)
+        {
+            wall = cpu = 0.0;
+            memset(&ls, 0, sizeof(ls));
+            memset(&ps, 0, sizeof(ps));
+            st.progress_cpu = 0.0;
+            if (partner != MPI_PROC_NULL && receiver)
+            {
+                st.n = n;
+                for (i=0; i<n; i++)
+                {
+                    MPI_Irecv(&msgs[i], 1, MPI_DOUBLE, partner, TAG_MSG, MPI_COMM_WORLD, &st.reqs[i]);
+                }
+            }
+            MPI_Barrier( MPI_COMM_WORLD );
+
+            if (partner != MPI_PROC_NULL && receiver)
+            {
+                t0 = MPI_Wtime();
+                c0 = cpu_seconds();
+                receive_loop(s, &st);
+                wall = MPI_Wtime() - t0;
+                cpu  = cpu_seconds() - c0;
+                for (i=0; i<n; i++) lat[i] = st.det[i] - (msgs[i] - offset);
+                bench_stats_local(lat, n, &ls);
+                if (s == S_THREAD)
+                {
+                    /* The main thread's share here; the progress thread's in pstats */
+                    cpu = st.main_cpu;
+                    for (i=0; i<n; i++) lat[i] = st.pdet[i] - (msgs[i] - offset);
+                    bench_stats_local(lat, n, &ps);
+                }
+            }
+            else if (partner != MPI_PROC_NULL)
+            {
+                double start = MPI_Wtime(), ts;
+                for (i=0; i<n; i++)
+                {
+                    while ((ts = MPI_Wtime()) < start + i * gap) ;
+                    MPI_Send(&ts, 1, MPI_DOUBLE, partner, TAG_MSG, MPI_COMM_WORLD);
+                }
+            }
+
+            /* Worst pair: largest median, p99 and cpu share */
+            stats[0] = ls.median;
+            stats[1] = ls.p99;
+            stats[2] = (wall > 0.0) ? cpu / wall : 0.0;
+            if (rank == 0)
+                MPI_Reduce( MPI_IN_PLACE, stats, 3, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD );
+            else
+                MPI_Reduce( stats, NULL, 3, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD );
+            pstats[0] = ps.median;
+            pstats[1] = ps.p99;
+            pstats[2] = (wall > 0.0) ? st.progress_cpu / wall : 0.0;
+            if (s == S_THREAD)
+            {
+                if (rank == 0)
+                    MPI_Reduce( MPI_IN_PLACE, pstats, 3, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD );
+                else
+                    MPI_Reduce( pstats, NULL, 3, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD );
+            }
+            wall = bench_max_time(wall, 0, MPI_COMM_WORLD);
+
+            if (rank == 0)
+            {
+                printf("  %-8s %-10s %12.2f %12.2f %12.2f %10.2f\n",
+                       bench_fmt_size(n, sbuf, sizeof(sbuf)), strategy_names[s],
+                       stats[0] * 1e6, stats[1] * 1e6, wall * 1e3, stats[2]);
+                if (s == S_THREAD)
+                    printf("  %-8s %-10s %12.2f %12.2f %12.2f %10.2f\n",
+                           bench_fmt_size(n, sbuf, sizeof(sbuf)), "progress",
+                           pstats[0] * 1e6, pstats[1] * 1e6, wall * 1e3, pstats[2]);
+                fflush(stdout);
+            }
+        }
+        if (n > max_count / 10) break;
+    }
+
+    free(st.reqs);
+    free(st.idx);
+    free(st.det);
+    free(st.pdet);
+    free(st.queue);
+    pthread_mutex_destroy(&st.lock);
+    pthread_cond_destroy(&st.ready);
+    free(msgs);
+    free(lat);
+    MPI_Finalize();
+    return 0;
+}
@@ -0,0 +1,458 @@
+/*
+bench_datatype
+
+   Pack/unpack and send throughput of derived datatypes built with every
+   type constructor at MB scale, against a hand-written memcpy loop over
+   the same blocks.
+
+Usage
+
+   mpirun -n 2 ./bench_datatype [-size 16M] [-bl 8] [-reps 10]
+                                [-case vector]
+
+Remarks
+
+   Every case describes -size bytes of payload scattered through a
+   larger buffer. Except for contiguous and struct, the layout follows
+   the block length bl (in doubles), which runs over 1, 8, 64 and 512
+   unless -bl is given:
+
+   contiguous      MPI_Type_contiguous; the reference
+   vector          MPI_Type_vector, blocks of bl with stride 2*bl
+   indexed         MPI_Type_indexed, lengths 1..2*bl and gaps 1..bl+1,
+                   varying from block to block
+   hindexed        MPI_Type_create_hindexed, lengths 1..4*bl and byte
+                   gaps of 8..8*bl
+   indexed_block   MPI_Type_create_indexed_block, bl per block at
+                   scattered (permuted) positions, like a cell list
+   struct          MPI_Type_create_struct of { char c; double d[6];
+                   char b[7]; } as in MPI_Type_create_struct.c, resized
+                   to sizeof and repeated
+   subarray        MPI_Type_create_subarray, a [A][B/2][bl] box out of
+                   [A][B][2*bl]
+   darray          MPI_Type_create_darray, rank 0's piece of a G x G
+                   array distributed cyclic(bl) x cyclic(bl) on 2 x 2
+
+   Rank 0 measures MPI_Pack and MPI_Unpack of one instance of the type
+   and a memcpy loop over the same (offset, length) list, adjacent blocks
+   merged, in both directions. With two or more processes, ranks 0 and 1
+   also ping-pong the type (sent and received with the datatype) and the
+   same payload as contiguous bytes. All figures are GB/s of payload
+   (10^9 bytes per second) from the median repetition; pack/man is
+   MPI_Pack over the memcpy gather. Each case is first checked by
+   receiving one instance through a contiguous type of the same
+   signature and comparing it with the memcpy gather.
+*/
+
+#include "mpi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+#include "bench_util.h"
+
+#define NUM_REPS 10
+#define PAYLOAD (16*1024*1024)
+#define NUM_CASES 8
+#define TAG_PING 21
+
+struct Partstruct
+{
+    char c;
+    double d[6];
+    char b[7];
+};
+
+typedef struct
+{
+    MPI_Datatype type;      /* one instance describes the whole layout */
+    MPI_Datatype flat;      /* same type signature, no gaps */
+    int nflat;
+    size_t extent;          /* bytes of buffer the layout spans */
+    size_t payload;
+    int nblocks, maxblocks;
+    size_t *boff, *blen;    /* byte blocks in type map order */
+} dt_case_t;
+
+static const char *case_names[NUM_CASES] = {
+    "contiguous", "vector", "indexed", "hindexed", "indexed_block", "struct", "subarray", "darray"
+};
+
+static void add_block(dt_case_t *c, size_t off, size_t len)
+{
+    int k = c->nblocks, maxblocks;
+    size_t *boff, *blen;
+
+    c->payload += len;
+    if (k > 0 && c->boff[k-1] + c->blen[k-1] == off)
+    {
+        c->blen[k-1] += len;
+        return;
+    }
+    if (k == c->maxblocks)
+    {
+        maxblocks = c->maxblocks ? 2 * c->maxblocks : 1024;
+        boff = (size_t *) realloc(c->boff, maxblocks * sizeof(size_t));
+        if (boff) c->boff = boff;
+        blen = (size_t *) realloc(c->blen, maxblocks * sizeof(size_t));
+        if (blen) c->blen = blen;
+        if (!boff || !blen)
+        {
+            fprintf(stderr, "Cannot grow the block list to %d blocks\n", maxblocks);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        c->maxblocks = maxblocks;
+    }
+    c->boff[k] = off;
+    c->blen[k] = len;
+    c->extent = (off + len > c->extent) ? off + len : c->extent;
+    c->nblocks++;
+}
+
+static void flat_doubles(dt_case_t *c)
+{
+    c->nflat = (int) (c->payload / sizeof(double));
+    c->flat = MPI_DOUBLE;
+}
+
+static int gcd(int a, int b)
+{
+    while (b) { int t = a % b; a = b; b = t; }
+    return a;
+}
+
+/* Build case k for about n doubles of payload with block length bl */
+static void build_case(int k, long long n, int bl, dt_case_t *c)
+{
+    int i, j, count, *lens = NULL, *idx = NULL;
+    MPI_Aint *bdisp = NULL;
+    size_t pos;
+
+    memset(c, 0, sizeof(*c));
+    switch (k)
+    {
+    case 0:
+        MPI_Type_contiguous((int) n, MPI_DOUBLE, &c->type);
+        add_block(c, 0, n * sizeof(double));
+        flat_doubles(c);
+        break;
+
+    case 1:
+        count = (n / bl > 0) ? (int) (n / bl) : 1;
+        MPI_Type_vector(count, bl, 2 * bl, MPI_DOUBLE, &c->type);
+        for (i=0; i<count; i++) add_block(c, (size_t) i * 2 * bl * sizeof(double), bl * sizeof(double));
+        flat_doubles(c);
+        break;
+
+    case 2:
+    case 3:
+        /* Varying lengths and gaps until n doubles are covered */
+        lens  = (int *) malloc((n + 1) * sizeof(int));
+        idx   = (int *) malloc((n + 1) * sizeof(int));
+        bdisp = (MPI_Aint *) malloc((n + 1) * sizeof(MPI_Aint));
+        pos = 0;
+        for (count=0, j=0; j<n; count++)
+        {
+            int len = (k == 2) ? 1 + (count * 37) % (2 * bl) : 1 + (count * 61) % (4 * bl);
+            int gap = (k == 2) ? 1 + (count * 53) % (bl + 1) : 1 + (count * 29) % bl;
+            if (len > n - j) len = (int) (n - j);
+            lens[count]  = len;
+            idx[count]   = (int) pos;
+            bdisp[count] = (MPI_Aint) (pos * sizeof(double));
+            add_block(c, pos * sizeof(double), len * sizeof(double));
+            pos += len + gap;
+            j += len;
+        }
+        if (k == 2) MPI_Type_indexed(count, lens, idx, MPI_DOUBLE, &c->type);
+        else        MPI_Type_create_hindexed(count, lens, bdisp, MPI_DOUBLE, &c->type);
+        flat_doubles(c);
+        break;
+
+    case 4:
+    {
+        int nblk = (n / bl > 0) ? (int) (n / bl) : 1, p = 7919 % nblk;
+        idx = (int *) malloc(nblk * sizeof(int));
+        if (p == 0) p = 1;
+        while (gcd(p, nblk) != 1) p++;
+        for (i=0; i<nblk; i++)
+        {
+            idx[i] = (int) (((long long) i * p) % nblk) * 2 * bl;
+            add_block(c, (size_t) idx[i] * sizeof(double), bl * sizeof(double));
+        }
+        MPI_Type_create_indexed_block(nblk, bl, idx, MPI_DOUBLE, &c->type);
+        flat_doubles(c);
+        break;
+    }
+
+    case 5:
+    {
+        MPI_Datatype types[3] = { MPI_CHAR, MPI_DOUBLE, MPI_CHAR }, part, packed;
+        int blocklen[3] = { 1, 6, 7 };
+        MPI_Aint disp[3] = { offsetof(struct Partstruct, c), offsetof(struct Partstruct, d),
+                             offsetof(struct Partstruct, b) };
+        MPI_Aint pdisp[3] = { 0, 1, 1 + 6 * sizeof(double) };
+
+        count = (int) (n * sizeof(double) / (1 + 6 * sizeof(double) + 7));
+        MPI_Type_create_struct(3, blocklen, disp, types, &part);
+        MPI_Type_create_resized(part, 0, sizeof(struct Partstruct), &c->type);
+        MPI_Type_free(&part);
+        MPI_Type_contiguous(count, c->type, &part);
+        MPI_Type_free(&c->type);
+        c->type = part;
+        for (i=0; i<count; i++)
+        {
+            size_t base = (size_t) i * sizeof(struct Partstruct);
+            add_block(c, base + disp[0], 1);
+            add_block(c, base + disp[1], 6 * sizeof(double));
+            add_block(c, base + disp[2], 7);
+        }
+        c->extent = (size_t) count * sizeof(struct Partstruct);
+        /* The same fields back to back, no padding */
+        MPI_Type_create_struct(3, blocklen, pdisp, types, &part);
+        MPI_Type_create_resized(part, 0, pdisp[2] + 7, &packed);
+        MPI_Type_free(&part);
+        MPI_Type_commit(&packed);
+        c->flat = packed;
+        c->nflat = count;
+        break;
+    }
+
+    case 6:
+    {
+        int a = (int) sqrt(2.0 * n / bl), sizes[3], subs[3], starts[3];
+        if (a < 4) a = 4;
+        a &= ~3;
+        sizes[0] = a;  sizes[1] = a;      sizes[2] = 2 * bl;
+        subs[0]  = a;  subs[1]  = a / 2;  subs[2]  = bl;
+        starts[0] = 0; starts[1] = a / 4; starts[2] = bl / 2;
+        MPI_Type_create_subarray(3, sizes, subs, starts, MPI_ORDER_C, MPI_DOUBLE, &c->type);
+        for (i=0; i<subs[0]; i++)
+            for (j=0; j<subs[1]; j++)
+                add_block(c, (((size_t) i * sizes[1] + starts[1] + j) * sizes[2] + starts[2]) * sizeof(double),
+                          bl * sizeof(double));
+        c->extent = (size_t) sizes[0] * sizes[1] * sizes[2] * sizeof(double);
+        flat_doubles(c);
+        break;
+    }
+
+    case 7:
+    {
+        int g = (int) (2.0 * sqrt((double) n)), gsizes[2], distribs[2], dargs[2], psizes[2] = { 2, 2 };
+        g = (g + 2 * bl - 1) / (2 * bl) * (2 * bl);
+        gsizes[0] = gsizes[1] = g;
+        distribs[0] = distribs[1] = MPI_DISTRIBUTE_CYCLIC;
+        dargs[0] = dargs[1] = bl;
+        MPI_Type_create_darray(4, 0, 2, gsizes, distribs, dargs, psizes, MPI_ORDER_C,
+                               MPI_DOUBLE, &c->type);
+        for (i=0; i<g; i++)
+        {
+            if ((i / bl) % 2) continue;
+            for (j=0; j<g; j+=2*bl) add_block(c, ((size_t) i * g + j) * sizeof(double), bl * sizeof(double));
+        }
+        c->extent = (size_t) g * g * sizeof(double);
+        flat_doubles(c);
+        break;
+    }
+    }
+    MPI_Type_commit(&c->type);
+    free(lens);
+    free(idx);
+    free(bdisp);
+}
+
+static void free_case(dt_case_t *c)
+{
+    MPI_Type_free(&c->type);
+    if (c->flat != MPI_DOUBLE) MPI_Type_free(&c->flat);
+    free(c->boff);
+    free(c->blen);
+}
+
+static void gather_blocks(const dt_case_t *c, const char *src, char *dst)
+{
+    int i;
+    for (i=0; i<c->nblocks; i++)
+    {
+        memcpy(dst, src + c->boff[i], c->blen[i]);
+        dst += c->blen[i];
+    }
+}
+
+static void scatter_blocks(const dt_case_t *c, const char *src, char *dst)
+{
+    int i;
+    for (i=0; i<c->nblocks; i++)
+    {
+        memcpy(dst + c->boff[i], src, c->blen[i]);
+        src += c->blen[i];
+    }
+}
+
+static double median(double *samples, int n)
+{
+    bench_stats_t st;
+    bench_stats_local(samples, n, &st);
+    return st.median;
+}
+
+/* GB/s for op 0..5: pack, unpack, gather, scatter, send type, send contiguous */
+static int run_case(int k, dt_case_t *c, int reps, int rank, int size, double *gbs)
+{
+    char *src, *dst, *pbuf, *chk;
+    int r, op, pos, psize, errs = 0;
+    double *samples, t0;
+    size_t i;
+
+    src  = (char *) malloc(c->extent);
+    dst  = (char *) malloc(c->extent);
+    chk  = (char *) malloc(c->payload);
+    MPI_Pack_size(1, c->type, MPI_COMM_WORLD, &psize);
+    pbuf = (char *) malloc(psize);
+    samples = (double *) malloc(reps * sizeof(double));
+    if (src == NULL || dst == NULL || chk == NULL || pbuf == NULL)
+    {
+        fprintf(stderr, "(%d) Cannot allocate buffers for %s (%lld bytes)\n",
+                rank, case_names[k], (long long) c->extent);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    for (i=0; i<c->extent; i++) src[i] = (char) (i * 131 + 7);
+    memset(dst, 0, c->extent);
+
+    /* Check: the type's data in type map order must equal the memcpy gather */
+    MPI_Sendrecv(src, 1, c->type, rank, TAG_PING, chk, c->nflat, c->flat, rank, TAG_PING,
+                 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    gather_blocks(c, src, pbuf);
+    if (memcmp(chk, pbuf, c->payload) != 0)
+    {
+        fprintf(stderr, "(%d) %s: datatype and block list disagree\n", rank, case_names[k]);
+        fflush(stderr);
+        errs++;
+    }
+
+    for (op=0; op<6; op++)
+    {
+        gbs[op] = 0.0;
+        if (op < 4 && rank != 0) continue;
+        if (op >= 4 && (size < 2 || rank > 1)) continue;
+        for (r=0; r<reps; r++)
+        {
+            t0 = MPI_Wtime();
+            switch (op)
+            {
+            case 0:
+                pos = 0;
+                MPI_Pack(src, 1, c->type, pbuf, psize, &pos, MPI_COMM_WORLD);
+                break;
+            case 1:
+                pos = 0;
+                MPI_Unpack(pbuf, psize, &pos, dst, 1, c->type, MPI_COMM_WORLD);
+                break;
+            case 2:
+                gather_blocks(c, src, chk);
+                break;
+            case 3:
+                scatter_blocks(c, chk, dst);
+                break;
+            case 4:
+            case 5:
+                /* Round trip between ranks 0 and 1; half of it counts */
+                if (rank == 0)
+                {
+                    if (op == 4) MPI_Send(src, 1, c->type, 1, TAG_PING, MPI_COMM_WORLD);
+                    else         MPI_Send(chk, (int) c->payload, MPI_BYTE, 1, TAG_PING, MPI_COMM_WORLD);
+                    if (op == 4) MPI_Recv(dst, 1, c->type, 1, TAG_PING, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                    else         MPI_Recv(chk, (int) c->payload, MPI_BYTE, 1, TAG_PING, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                }
+                else
+                {
+                    if (op == 4) MPI_Recv(dst, 1, c->type, 0, TAG_PING, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                    else         MPI_Recv(chk, (int) c->payload, MPI_BYTE, 0, TAG_PING, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                    if (op == 4) MPI_Send(dst, 1, c->type, 0, TAG_PING, MPI_COMM_WORLD);
+                    else         MPI_Send(chk, (int) c->payload, MPI_BYTE, 0, TAG_PING, MPI_COMM_WORLD);
+                }
+                break;
+            }
+            samples[r] = MPI_Wtime() - t0;
+            if (op >= 4) samples[r] /= 2;
+        }
+        gbs[op] = c->payload / median(samples, reps) / 1e9;
+    }
+
+    free(samples);
+    free(pbuf);
+    free(chk);
+    free(dst);
+    free(src);
+    return errs;
+}
+
+int main( int argc, char **argv )
+{
+    int rank, size, reps, k, b, nbl, errs = 0, tot_errs;
+    int bls[4] = { 1, 8, 64, 512 };
+    long long payload;
+    const char *only;
+    char sbuf[32], blbuf[16];
+    double gbs[6];
+    dt_case_t c;
+
+    MPI_Init( &argc, &argv );
+    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+    MPI_Comm_size( MPI_COMM_WORLD, &size );
+
+    payload = bench_arg_size(argc, argv, "-size", PAYLOAD);
+    reps    = bench_arg_int(argc, argv, "-reps", NUM_REPS);
+    only    = bench_arg(argc, argv, "-case");
+    nbl     = 4;
+    if (bench_arg(argc, argv, "-bl"))
+    {
+        bls[0] = bench_arg_int(argc, argv, "-bl", 8);
+        nbl = 1;
+    }
+    if (payload < 1024) payload = 1024;
+    if (reps < 1) reps = 1;
+
+    if (rank == 0)
+    {
+        printf("# %d processes, %s payload, %d reps, GB/s of payload\n",
+               size, bench_fmt_size(payload, sbuf, sizeof(sbuf)), reps);
+        printf("# %-14s %5s %9s %9s %9s %9s %9s %9s %9s %9s %8s\n", "case", "bl", "blocks", "bytes",
+               "pack", "unpack", "gather", "scatter", "send", "contig", "pack/man");
+        fflush(stdout);
+    }
+
+    for (k=0; k<NUM_CASES; k++)
+    {
+        if (only && strcmp(only, case_names[k]) != 0) continue;
+        for (b=0; b<nbl; b++)
+        {
+            /* contiguous and struct do not depend on bl */
+            if ((k == 0 || k == 5) && b > 0) break;
+            if (bls[b] < 1) bls[b] = 1;
+
+            build_case(k, payload / (long long) sizeof(double), bls[b], &c);
+            errs += run_case(k, &c, reps, rank, size, gbs);
+            if (rank == 0)
+            {
+                if (k == 0 || k == 5) strcpy(blbuf, "-");
+                else snprintf(blbuf, sizeof(blbuf), "%d", bls[b]);
+                printf("  %-14s %5s %9d %9s %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f %8.2f\n",
+                       case_names[k], blbuf, c.nblocks,
+                       bench_fmt_size((long long) c.payload, sbuf, sizeof(sbuf)),
+                       gbs[0], gbs[1], gbs[2], gbs[3], gbs[4], gbs[5],
+                       gbs[2] > 0.0 ? gbs[0] / gbs[2] : 0.0);
+                fflush(stdout);
+            }
+            free_case(&c);
+            MPI_Barrier(MPI_COMM_WORLD);
+        }
+    }
+
+    MPI_Reduce( &errs, &tot_errs, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD );
+    if (rank == 0 && tot_errs == 0) printf(" No Errors\n");
+    fflush(stdout);
+
+    MPI_Finalize();
+    return errs;
+}
@@ -0,0 +1,207 @@
+/*
+bench_dht
+
+   Throughput of the one-sided distributed hash table in rma_dht.h for
+   a range of batch sizes and read/write mixes.
+
+Usage
+
+   mpirun -n 4 ./bench_dht [-keys 256K] [-vlen 32] [-ops 20000]
+                           [-batch 1,16,256] [-read 100,90,50]
+
+Remarks
+
+   The table gets enough buckets for -keys keys at half of DHT_SLOTS
+   per bucket, and every key of 0 .. keys-1 is inserted first, each rank
+   inserting its share in batches. Then, for every batch size and read
+   percentage, each rank issues -ops operations on uniformly random
+   keys, -batch at a time; a batch holds reads or writes, chosen at
+   random with the given read percentage. The reported rate is the sum
+   of all ranks' operations divided by the slowest rank's time, so the
+   column to compare across runs with different -n is ops/s; per rank
+   shows how well the owners keep up with the extra load.
+
+   The value of key k is a fixed function of k, which writers store
+   again, so every hit is checked. Misses are keys evicted from a full
+   bucket, during the fill (reported) or by a later write; they are
+   counted but not an error.
+
+   Each rank serves its slice of the table without doing anything; with
+   implementations whose passive target progress needs the target to
+   call MPI, the ranks' own traffic provides that.
+*/
+
+#include "mpi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "bench_util.h"
+#include "rma_dht.h"
+
+#define NUM_KEYS (256*1024)
+#define VLEN 32
+#define NUM_OPS 20000
+#define MAX_LIST 16
+#define FILL_BATCH 256
+
+static void value_of(uint64_t key, int vlen, unsigned char *v)
+{
+    int i;
+    for (i=0; i<vlen; i++) v[i] = (unsigned char) (key * 131 + i * 7 + (key >> 8));
+}
+
+static uint64_t next_rand(uint64_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+/* "1,16,256" -> { 1, 16, 256 }; returns how many */
+static int parse_list(const char *str, int *list)
+{
+    int n = 0;
+    char *end;
+    while (str && *str && n < MAX_LIST)
+    {
+        list[n++] = (int) strtol(str, &end, 10);
+        if (end == str) return n - 1;
+        str = (*end == ',') ? end + 1 : end;
+    }
+    return n;
+}
+
+int main( int argc, char **argv )
+{
+    int rank, size, vlen, ops, nbatch, nread, b, r, i, k, n, errs = 0, tot_errs;
+    int batches[MAX_LIST] = { 1, 16, 256 }, reads[MAX_LIST] = { 100, 90, 50 };
+    long long nkeys, misses, tot_misses, evicted;
+    long nbuckets;
+    double t, tmax;
+    uint64_t *keys, seed;
+    unsigned char *values, *expect;
+    int *found;
+    dht_t d;
+
+    MPI_Init( &argc, &argv );
+    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+    MPI_Comm_size( MPI_COMM_WORLD, &size );
+
+    nkeys = bench_arg_size(argc, argv, "-keys", NUM_KEYS);
+    vlen  = (int) bench_arg_size(argc, argv, "-vlen", VLEN);
+    ops   = bench_arg_int(argc, argv, "-ops", NUM_OPS);
+    nbatch = bench_arg(argc, argv, "-batch") ? parse_list(bench_arg(argc, argv, "-batch"), batches) : 3;
+    nread  = bench_arg(argc, argv, "-read") ? parse_list(bench_arg(argc, argv, "-read"), reads) : 3;
+    if (nkeys < 1) nkeys = 1;
+
+    nbuckets = (long) ((nkeys * 2 / DHT_SLOTS + size - 1) / size);
+    if (dht_create(MPI_COMM_WORLD, nbuckets > 0 ? nbuckets : 1, vlen, &d) != MPI_SUCCESS)
+    {
+        fprintf(stderr, "(%d) dht_create failed\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    n = FILL_BATCH;
+    for (b=0; b<nbatch; b++) if (batches[b] > n) n = batches[b];
+    keys   = (uint64_t *) malloc(n * sizeof(uint64_t));
+    values = (unsigned char *) malloc((size_t) n * vlen + 1);
+    expect = (unsigned char *) malloc(vlen + 1);
+    found  = (int *) malloc(n * sizeof(int));
+
+    /* Fill: rank r inserts keys r, r+size, ... */
+    t = MPI_Wtime();
+    for (k=rank; k<nkeys; )
+    {
+        for (i=0; i<FILL_BATCH && k<nkeys; i++, k+=size)
+        {
+            keys[i] = (uint64_t) k;
+            value_of(keys[i], vlen, values + (size_t) i * vlen);
+        }
+        if (dht_put_batch(&d, i, keys, values) != MPI_SUCCESS)
+        {
+            fprintf(stderr, "(%d) dht_put_batch failed during fill\n", rank);
+            fflush(stderr);
+            errs++;
+        }
+    }
+    t = MPI_Wtime() - t;
+    tmax = bench_max_time(t, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&d.evictions, &evicted, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (rank == 0)
+    {
+        printf("# %d processes, %lld keys, %d-byte values, %ld buckets of %d per rank\n",
+               size, nkeys, vlen, nbuckets, DHT_SLOTS);
+        printf("# fill: %.0f puts/s in batches of %d, %lld evicted\n",
+               tmax > 0.0 ? nkeys / tmax : 0.0, FILL_BATCH, evicted);
+        printf("# %5s %6s %5s %12s %12s %10s %8s\n", "ranks", "batch", "read%",
+               "ops/s", "ops/s/rank", "us/op", "misses");
+        fflush(stdout);
+    }
+
+    seed = 0x9e3779b97f4a7c15ULL ^ ((uint64_t) rank << 32 | 1);
+    for (b=0; b<nbatch; b++)
+    {
+        for (r=0; r<nread; r++)
+        {
+            int batch = batches[b] > 0 ? batches[b] : 1, done;
+
+            misses = 0;
+            MPI_Barrier(MPI_COMM_WORLD);
+            t = MPI_Wtime();
+            for (done=0; done<ops; done+=n)
+            {
+                n = (ops - done < batch) ? ops - done : batch;
+                for (i=0; i<n; i++) keys[i] = next_rand(&seed) % (uint64_t) nkeys;
+                if ((int) (next_rand(&seed) % 100) < reads[r])
+                {
+                    if (dht_get_batch(&d, n, keys, values, found) < 0) errs++;
+                    for (i=0; i<n; i++)
+                    {
+                        if (!found[i]) { misses++; continue; }
+                        value_of(keys[i], vlen, expect);
+                        if (memcmp(values + (size_t) i * vlen, expect, vlen) != 0)
+                        {
+                            if (errs < 10)
+                            {
+                                fprintf(stderr, "(%d) wrong value for key %llu\n", rank,
+                                        (unsigned long long) keys[i]);
+                                fflush(stderr);
+                            }
+                            errs++;
+                        }
+                    }
+                }
+                else
+                {
+                    for (i=0; i<n; i++) value_of(keys[i], vlen, values + (size_t) i * vlen);
+                    if (dht_put_batch(&d, n, keys, values) != MPI_SUCCESS) errs++;
+                }
+            }
+            t = MPI_Wtime() - t;
+            tmax = bench_max_time(t, 0, MPI_COMM_WORLD);
+            MPI_Reduce(&misses, &tot_misses, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+            if (rank == 0)
+            {
+                double rate = tmax > 0.0 ? (double) ops * size / tmax : 0.0;
+                printf("  %5d %6d %5d %12.0f %12.0f %10.2f %8lld\n", size, batch, reads[r],
+                       rate, rate / size, tmax * 1e6 / ops, tot_misses);
+                fflush(stdout);
+            }
+        }
+    }
+
+    dht_free(&d);
+    free(keys);
+    free(values);
+    free(expect);
+    free(found);
+
+    MPI_Reduce( &errs, &tot_errs, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD );
+    if (rank == 0 && tot_errs == 0) printf(" No Errors\n");
+    fflush(stdout);
+
+    MPI_Finalize();
+    return errs;
+}
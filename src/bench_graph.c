@@ -0,0 +1,398 @@
+/*
+bench_graph
+
+   Ghost-cell exchange of an unstructured mesh partition over an
+   MPI_Graph_create topology: the persistent per-edge datatypes of
+   graph_exchange.h against a hand-packed Isend/Irecv exchange and
+   MPI_Neighbor_alltoallw.
+
+Usage
+
+   mpirun -n 4 ./bench_graph [-mesh file] [-part file] [-grid 256]
+                             [-reps 200]
+
+Remarks
+
+   The mesh is given as its cell adjacency: -mesh names a text file
+   with one edge "u v" per line (cell ids from 0, '#' starts a comment,
+   each edge listed once or in both directions). -part names a file
+   with the owning rank of cell i on line i, as written by METIS
+   gpmetis for the same numbering; without it cells are split into
+   contiguous blocks by id. Without -mesh the mesh is a non-periodic
+   -grid x -grid triangulated grid (right, down and diagonal
+   neighbours) cut into MPI_Dims_create tiles. Rank 0 reads the files
+   and broadcasts them.
+
+   Every rank stores its own cells followed by its ghost cells, i.e.
+   the neighbours' cells adjacent to its own; the ghosts of a neighbour
+   are contiguous and ordered by cell id, which both sides agree on
+   without talking. The process graph connects ranks that share a mesh
+   edge.
+
+   persistent  gx_create once, then gx_exchange (MPI_Startall and
+               MPI_Waitall over per-edge indexed datatypes)
+   packed      per step: copy the cells to send into a buffer per
+               neighbour, MPI_Irecv straight into the ghost range,
+               MPI_Isend, MPI_Waitall - the usual hand-written exchange
+   alltoallw   MPI_Neighbor_alltoallw on the graph communicator with the
+               same datatypes as persistent
+
+   Times are per exchange of one double per cell, slowest rank, over
+   -reps exchanges. Every mode's ghosts are checked against the owners'
+   cell ids before timing.
+*/
+
+#include "mpi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench_util.h"
+#include "graph_exchange.h"
+
+#define NUM_REPS 200
+#define GRID_N 256
+
+#define NUM_MODES 3
+enum { M_PERSISTENT, M_PACKED, M_ALLTOALLW };
+static const char *mode_names[NUM_MODES] = { "persistent", "packed", "alltoallw" };
+
+/* (rank, cell) pair: a cell to send to or receive from rank */
+struct gcell
+{
+    int rank, gid;
+};
+
+static int gcell_cmp(const void *x, const void *y)
+{
+    const struct gcell *p = (const struct gcell *) x, *q = (const struct gcell *) y;
+    if (p->rank != q->rank) return p->rank - q->rank;
+    return p->gid - q->gid;
+}
+
+/* Sort and drop duplicates; returns the new count */
+static int gcell_unique(struct gcell *c, int n)
+{
+    int i, m = 0;
+    qsort(c, n, sizeof(struct gcell), gcell_cmp);
+    for (i=0; i<n; i++)
+        if (m == 0 || gcell_cmp(&c[i], &c[m-1]) != 0) c[m++] = c[i];
+    return m;
+}
+
+/* Rank 0: read "u v" lines into a growing array of pairs; returns the edge count or -1 */
+static int read_edges(const char *path, int **edges, int *ncells)
+{
+    FILE *f = fopen(path, "r");
+    char line[256];
+    int n = 0, cap = 0, u, v;
+
+    if (f == NULL) return -1;
+    *edges = NULL;
+    *ncells = 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        if (sscanf(line, "%d %d", &u, &v) != 2 || u < 0 || v < 0) continue;
+        if (n == cap)
+        {
+            cap = cap ? 2 * cap : 1024;
+            *edges = (int *) realloc(*edges, 2 * (size_t) cap * sizeof(int));
+        }
+        (*edges)[2*n] = u;
+        (*edges)[2*n+1] = v;
+        n++;
+        if (u >= *ncells) *ncells = u + 1;
+        if (v >= *ncells) *ncells = v + 1;
+    }
+    fclose(f);
+    return n;
+}
+
+/* Rank 0: one rank per line; returns 0 on success */
+static int read_part(const char *path, int *part, int ncells, int size)
+{
+    FILE *f = fopen(path, "r");
+    int i;
+
+    if (f == NULL) return -1;
+    for (i=0; i<ncells; i++)
+    {
+        if (fscanf(f, "%d", &part[i]) != 1 || part[i] < 0 || part[i] >= size)
+        {
+            fclose(f);
+            return -1;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+static int grid_edges(int n, int **edges)
+{
+    int i, j, m = 0;
+    *edges = (int *) malloc(6 * (size_t) n * n * sizeof(int));
+    for (i=0; i<n; i++)
+    {
+        for (j=0; j<n; j++)
+        {
+            int c = i * n + j;
+            if (j + 1 < n) { (*edges)[m++] = c; (*edges)[m++] = c + 1; }
+            if (i + 1 < n) { (*edges)[m++] = c; (*edges)[m++] = c + n; }
+            if (i + 1 < n && j + 1 < n) { (*edges)[m++] = c; (*edges)[m++] = c + n + 1; }
+        }
+    }
+    return m / 2;
+}
+
+static int check_ghosts(const double *u, const int *ghost_gid, int nowned, int nghost, int rank,
+                        const char *name)
+{
+    int i, errs = 0;
+    for (i=0; i<nghost; i++)
+    {
+        if (u[nowned + i] == (double) ghost_gid[i]) continue;
+        if (errs++ < 5)
+        {
+            fprintf(stderr, "(%d) %s: ghost %d is %g, expected %d\n", rank, name, i, u[nowned + i],
+                    ghost_gid[i]);
+            fflush(stderr);
+        }
+    }
+    return errs;
+}
+
+int main( int argc, char **argv )
+{
+    int rank, size, reps, gridn, ncells = 0, nedges = 0, *edges = NULL, *part, *local;
+    int nowned, nsend, nrecv, nnbrs, *nbrs, *slot, *sendcnt, *recvcnt, **sendidx, **recvidx;
+    int *ghost_gid, *sendoff, mode, i, k, e, r, errs = 0, tot_errs;
+    int stats[3], maxstats[3], sumstats[3];
+    const char *mesh, *partfile;
+    struct gcell *sendc, *recvc;
+    double *u, *sendbuf, t = 0.0, tmax;
+    MPI_Request *reqs;
+    MPI_Comm graph;
+    gx_t g;
+
+    MPI_Init( &argc, &argv );
+    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+    MPI_Comm_size( MPI_COMM_WORLD, &size );
+
+    mesh     = bench_arg(argc, argv, "-mesh");
+    partfile = bench_arg(argc, argv, "-part");
+    gridn    = bench_arg_int(argc, argv, "-grid", GRID_N);
+    reps     = bench_arg_int(argc, argv, "-reps", NUM_REPS);
+    if (reps < 1) reps = 1;
+
+    /* Mesh and partition, read or generated on rank 0 */
+    if (rank == 0)
+    {
+        if (mesh)
+        {
+            nedges = read_edges(mesh, &edges, &ncells);
+            if (nedges < 0) fprintf(stderr, "cannot read %s\n", mesh);
+        }
+        else
+        {
+            ncells = gridn * gridn;
+            nedges = grid_edges(gridn, &edges);
+        }
+    }
+    MPI_Bcast(&nedges, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&ncells, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (nedges < 0) MPI_Abort(MPI_COMM_WORLD, 1);
+    if (rank != 0) edges = (int *) malloc((2 * (size_t) nedges + 1) * sizeof(int));
+    MPI_Bcast(edges, 2 * nedges, MPI_INT, 0, MPI_COMM_WORLD);
+
+    part = (int *) malloc((ncells + 1) * sizeof(int));
+    if (partfile)
+    {
+        int ok = 0;
+        if (rank == 0)
+        {
+            ok = (read_part(partfile, part, ncells, size) == 0);
+            if (!ok) fprintf(stderr, "cannot read %d ranks below %d from %s\n", ncells, size, partfile);
+        }
+        MPI_Bcast(&ok, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        if (!ok) MPI_Abort(MPI_COMM_WORLD, 1);
+        MPI_Bcast(part, ncells, MPI_INT, 0, MPI_COMM_WORLD);
+    }
+    else if (mesh)
+    {
+        for (i=0; i<ncells; i++) part[i] = (int) ((long long) i * size / ncells);
+    }
+    else
+    {
+        int dims[2] = { 0, 0 };
+        MPI_Dims_create(size, 2, dims);
+        for (i=0; i<ncells; i++)
+            part[i] = (int) ((long long) (i / gridn) * dims[0] / gridn) * dims[1] +
+                      (int) ((long long) (i % gridn) * dims[1] / gridn);
+    }
+
+    /* Own cells get local ids 0..nowned-1 in id order */
+    local = (int *) malloc((ncells + 1) * sizeof(int));
+    for (i=0, nowned=0; i<ncells; i++) local[i] = (part[i] == rank) ? nowned++ : -1;
+
+    /* Cells on either side of a cut edge: sends of the own end, ghosts of the other */
+    sendc = (struct gcell *) malloc((2 * (size_t) nedges + 1) * sizeof(struct gcell));
+    recvc = (struct gcell *) malloc((2 * (size_t) nedges + 1) * sizeof(struct gcell));
+    nsend = nrecv = 0;
+    for (e=0; e<nedges; e++)
+    {
+        for (k=0; k<2; k++)
+        {
+            int a = edges[2*e+k], b = edges[2*e+1-k];
+            if (part[a] != rank || part[b] == rank) continue;
+            sendc[nsend].rank = part[b];
+            sendc[nsend++].gid = a;
+            recvc[nrecv].rank = part[b];
+            recvc[nrecv++].gid = b;
+        }
+    }
+    nsend = gcell_unique(sendc, nsend);
+    nrecv = gcell_unique(recvc, nrecv);
+
+    /* Neighbours are the ranks on the other side of cut edges (the same set both ways) */
+    nbrs = (int *) malloc((size + 1) * sizeof(int));
+    for (i=0, nnbrs=0; i<nrecv; i++)
+        if (nnbrs == 0 || recvc[i].rank != nbrs[nnbrs-1]) nbrs[nnbrs++] = recvc[i].rank;
+    gx_graph_create(MPI_COMM_WORLD, nnbrs, nbrs, 0, &graph);
+
+    /* Per-edge lists in MPI_Graph_neighbors order */
+    MPI_Graph_neighbors(graph, rank, nnbrs, nbrs);
+    slot    = (int *) malloc(size * sizeof(int));
+    sendcnt = (int *) calloc(nnbrs + 1, sizeof(int));
+    recvcnt = (int *) calloc(nnbrs + 1, sizeof(int));
+    sendidx = (int **) malloc((nnbrs + 1) * sizeof(int *));
+    recvidx = (int **) malloc((nnbrs + 1) * sizeof(int *));
+    sendoff = (int *) malloc((nnbrs + 1) * sizeof(int));
+    for (k=0; k<nnbrs; k++) slot[nbrs[k]] = k;
+    for (i=0; i<nsend; i++) sendcnt[slot[sendc[i].rank]]++;
+    for (i=0; i<nrecv; i++) recvcnt[slot[recvc[i].rank]]++;
+    for (k=0; k<nnbrs; k++)
+    {
+        sendidx[k] = (int *) malloc((sendcnt[k] + 1) * sizeof(int));
+        recvidx[k] = (int *) malloc((recvcnt[k] + 1) * sizeof(int));
+        sendoff[k] = k ? sendoff[k-1] + sendcnt[k-1] : 0;
+    }
+    for (k=0; k<nnbrs; k++) sendcnt[k] = recvcnt[k] = 0;
+    for (i=0; i<nsend; i++)
+    {
+        k = slot[sendc[i].rank];
+        sendidx[k][sendcnt[k]++] = local[sendc[i].gid];
+    }
+
+    /* Ghosts follow the own cells, grouped by neighbour in graph order */
+    ghost_gid = (int *) malloc((nrecv + 1) * sizeof(int));
+    for (k=0, r=0; k<nnbrs; k++)
+    {
+        for (i=0; i<nrecv; i++)
+        {
+            if (recvc[i].rank != nbrs[k]) continue;
+            recvidx[k][recvcnt[k]++] = nowned + r;
+            ghost_gid[r++] = recvc[i].gid;
+        }
+    }
+
+    u = (double *) malloc(((size_t) nowned + nrecv + 1) * sizeof(double));
+    sendbuf = (double *) malloc(((size_t) nsend + 1) * sizeof(double));
+    reqs = (MPI_Request *) malloc((2 * nnbrs + 1) * sizeof(MPI_Request));
+    for (i=0; i<ncells; i++)
+        if (local[i] >= 0) u[local[i]] = (double) i;
+    gx_create(graph, sendcnt, sendidx, recvcnt, recvidx, MPI_DOUBLE, u, u, &g);
+
+    stats[0] = nnbrs;
+    stats[1] = nrecv;
+    stats[2] = nowned;
+    MPI_Reduce(stats, maxstats, 3, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(stats, sumstats, 3, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (rank == 0)
+    {
+        printf("# %d processes, %d cells, %d edges (%s), %d reps\n", size, ncells, nedges,
+               mesh ? mesh : "grid", reps);
+        printf("# neighbours: max %d, avg %.1f; ghosts: max %d, total %d; cells: max %d\n",
+               maxstats[0], (double) sumstats[0] / size, maxstats[1], sumstats[1], maxstats[2]);
+        printf("# %-10s %12s %12s\n", "mode", "us/exchange", "MB/s");
+        fflush(stdout);
+    }
+
+    for (mode=0; mode<NUM_MODES; mode++)
+    {
+        for (r=0; r<=reps; r++)
+        {
+            if (r == 1)
+            {
+                /* The first exchange is checked, the rest timed */
+                errs += check_ghosts(u, ghost_gid, nowned, nrecv, rank, mode_names[mode]);
+                MPI_Barrier(MPI_COMM_WORLD);
+                t = MPI_Wtime();
+            }
+            if (r == 0)
+                for (i=0; i<nrecv; i++) u[nowned + i] = -1.0;
+            switch (mode)
+            {
+            case M_PERSISTENT:
+                gx_exchange(&g);
+                break;
+            case M_PACKED:
+                for (k=0; k<nnbrs; k++)
+                {
+                    double *b = sendbuf + sendoff[k];
+                    for (i=0; i<sendcnt[k]; i++) b[i] = u[sendidx[k][i]];
+                }
+                for (k=0; k<nnbrs; k++)
+                    MPI_Irecv(u + recvidx[k][0], recvcnt[k], MPI_DOUBLE, nbrs[k], GX_TAG, graph, &reqs[k]);
+                for (k=0; k<nnbrs; k++)
+                    MPI_Isend(sendbuf + sendoff[k], sendcnt[k], MPI_DOUBLE, nbrs[k], GX_TAG, graph,
+                              &reqs[nnbrs + k]);
+                MPI_Waitall(2 * nnbrs, reqs, MPI_STATUSES_IGNORE);
+                break;
+            case M_ALLTOALLW:
+                MPI_Neighbor_alltoallw(u, g.counts, g.displs, g.stypes, u, g.counts, g.displs, g.rtypes,
+                                       graph);
+                break;
+            }
+        }
+        t = (MPI_Wtime() - t) / reps;
+        tmax = bench_max_time(t, 0, MPI_COMM_WORLD);
+        if (rank == 0)
+        {
+            printf("  %-10s %12.2f %12.2f\n", mode_names[mode], tmax * 1e6,
+                   bench_mbps((double) sumstats[1] * sizeof(double), tmax));
+            fflush(stdout);
+        }
+    }
+
+    gx_free(&g);
+    MPI_Comm_free(&graph);
+    for (k=0; k<nnbrs; k++)
+    {
+        free(sendidx[k]);
+        free(recvidx[k]);
+    }
+    free(sendidx);
+    free(recvidx);
+    free(sendcnt);
+    free(recvcnt);
+    free(sendoff);
+    free(slot);
+    free(nbrs);
+    free(sendc);
+    free(recvc);
+    free(ghost_gid);
+    free(u);
+    free(sendbuf);
+    free(reqs);
+    free(local);
+    free(part);
+    free(edges);
+
+    MPI_Reduce( &errs, &tot_errs, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD );
+    if (rank == 0 && tot_errs == 0) printf(" No Errors\n");
+    fflush(stdout);
+
+    MPI_Finalize();
+    return errs;
+}
@@ -0,0 +1,220 @@
+/*
+bench_halo
+
+   Compares the persistent-request halo exchange of halo.h with building
+   the exchange every timestep.
+
+Usage
+
+   mpirun -n 8 ./bench_halo [-dims 3] [-n 64] [-ghost 1] [-steps 1000]
+                            [-faces]
+
+Remarks
+
+   The processes are arranged in a periodic Cartesian grid from
+   MPI_Dims_create and every process owns an n^dims block of doubles
+   with ghost cells on each side. Four variants exchange the same
+   faces, edges and corners (faces only with -faces):
+
+   persistent
+          halo.h with subarray datatypes; MPI_Startall/MPI_Waitall only.
+
+   persistent-packed
+          halo.h with HALO_PACKED; row memcpy into contiguous buffers.
+
+   isend-irecv
+          MPI_Irecv/MPI_Isend with the same committed datatypes, posted
+          fresh each step.
+
+   rebuild
+          halo_create/halo_free around every step, i.e. datatypes and
+          requests rebuilt each iteration.
+
+   Every variant is checked once against the expected ghost values and
+   then timed for -steps exchanges; the time per step is the slowest
+   rank's.
+*/
+
+#include "mpi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench_util.h"
+#include "halo.h"
+
+#define NUM_STEPS 1000
+#define LOCAL_N 64
+#define NUM_MODES 4
+
+static const char *mode_names[NUM_MODES] = { "persistent", "persistent-packed", "isend-irecv", "rebuild" };
+
+static int ndims, nl[3], ghost, gdims[3], coords[3], full[3];
+static double *u;
+
+static size_t cell(int i, int j, int k)
+{
+    return (ndims == 3) ? ((size_t) i * full[1] + j) * full[2] + k : (size_t) i * full[1] + j;
+}
+
+/* Value of the global cell holding local cell (i,j,k), with periodic wrap */
+static double value(int i, int j, int k)
+{
+    int l[3] = { i, j, k }, d;
+    double v = 0.0;
+    for (d=0; d<ndims; d++)
+    {
+        int ext = gdims[d] * nl[d];
+        int g = (coords[d] * nl[d] + l[d] - ghost + ext) % ext;
+        v = v * ext + g;
+    }
+    return v;
+}
+
+static void init_field(void)
+{
+    int i, j, k, kmax = (ndims == 3) ? full[2] : 1;
+    for (i=0; i<full[0]; i++)
+        for (j=0; j<full[1]; j++)
+            for (k=0; k<kmax; k++)
+            {
+                int interior = i >= ghost && i < ghost + nl[0] && j >= ghost && j < ghost + nl[1] &&
+                               (ndims == 2 || (k >= ghost && k < ghost + nl[2]));
+                u[cell(i, j, k)] = interior ? value(i, j, k) : -1.0;
+            }
+}
+
+/* Ghosts that the exchange should have filled; corners only when exchanged */
+static int check_field(int faces_only, int rank, const char *name)
+{
+    int i, j, k, errs = 0, kmax = (ndims == 3) ? full[2] : 1;
+    for (i=0; i<full[0]; i++)
+        for (j=0; j<full[1]; j++)
+            for (k=0; k<kmax; k++)
+            {
+                int out = (i < ghost || i >= ghost + nl[0]) + (j < ghost || j >= ghost + nl[1]) +
+                          (ndims == 3 && (k < ghost || k >= ghost + nl[2]));
+                double want = (out == 0 || !faces_only || out == 1) ? value(i, j, k) : -1.0;
+                if (u[cell(i, j, k)] != want)
+                {
+                    if (errs < 5)
+                    {
+                        fprintf(stderr, "[%d] %s: cell (%d,%d,%d) = %g, expected %g\n",
+                                rank, name, i, j, k, u[cell(i, j, k)], want);
+                        fflush(stderr);
+                    }
+                    errs++;
+                }
+            }
+    return errs;
+}
+
+static void exchange_isend(halo_t *h)
+{
+    MPI_Request reqs[2*HALO_MAX_NBRS];
+    int i, ntot = (h->ndims == 3) ? 27 : 9;
+
+    for (i=0; i<h->nnbr; i++)
+    {
+        int tag = halo_dir_index(h->dir[i], h->ndims);
+        MPI_Irecv(h->field, 1, h->rtype[i], h->nbr[i], ntot - 1 - tag, h->comm, &reqs[i]);
+    }
+    for (i=0; i<h->nnbr; i++)
+    {
+        int tag = halo_dir_index(h->dir[i], h->ndims);
+        MPI_Isend(h->field, 1, h->stype[i], h->nbr[i], tag, h->comm, &reqs[h->nnbr + i]);
+    }
+    MPI_Waitall(2 * h->nnbr, reqs, MPI_STATUSES_IGNORE);
+}
+
+static void step(int mode, halo_t *hd, halo_t *hp, MPI_Comm cart, int flags)
+{
+    halo_t tmp;
+    switch (mode)
+    {
+    case 0: halo_exchange(hd); break;
+    case 1: halo_exchange(hp); break;
+    case 2: exchange_isend(hd); break;
+    default:
+        halo_create(cart, nl, ghost, MPI_DOUBLE, u, flags, &tmp);
+        halo_exchange(&tmp);
+        halo_free(&tmp);
+        break;
+    }
+}
+
+int main( int argc, char **argv )
+{
+    int rank, size, steps, faces, flags, m, s, d, errs = 0, tot_errs, n;
+    int periods[3] = { 1, 1, 1 };
+    size_t ncells = 1;
+    double t0, t, tmax[NUM_MODES];
+    MPI_Comm cart;
+    halo_t hd, hp;
+
+    MPI_Init( &argc, &argv );
+    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+    MPI_Comm_size( MPI_COMM_WORLD, &size );
+
+    ndims = bench_arg_int(argc, argv, "-dims", 3);
+    n     = bench_arg_int(argc, argv, "-n", LOCAL_N);
+    ghost = bench_arg_int(argc, argv, "-ghost", 1);
+    steps = bench_arg_int(argc, argv, "-steps", NUM_STEPS);
+    faces = bench_flag(argc, argv, "-faces");
+    if (ndims != 2) ndims = 3;
+    if (ghost < 1) ghost = 1;
+    if (n < ghost) n = ghost;
+    flags = faces ? HALO_FACES_ONLY : 0;
+
+    gdims[0] = gdims[1] = gdims[2] = 0;
+    MPI_Dims_create( size, ndims, gdims );
+    MPI_Cart_create( MPI_COMM_WORLD, ndims, gdims, periods, 1, &cart );
+    MPI_Comm_rank( cart, &rank );
+    MPI_Cart_coords( cart, rank, ndims, coords );
+
+    for (d=0; d<ndims; d++)
+    {
+        nl[d] = n;
+        full[d] = n + 2 * ghost;
+        ncells *= full[d];
+    }
+    u = (double *) malloc(ncells * sizeof(double));
+
+    halo_create( cart, nl, ghost, MPI_DOUBLE, u, flags, &hd );
+    halo_create( cart, nl, ghost, MPI_DOUBLE, u, flags | HALO_PACKED, &hp );
+
+    for (m=0; m<NUM_MODES; m++)
+    {
+        init_field();
+        step(m, &hd, &hp, cart, flags);
+        errs += check_field(faces, rank, mode_names[m]);
+
+        MPI_Barrier( cart );
+        t0 = MPI_Wtime();
+        for (s=0; s<steps; s++) step(m, &hd, &hp, cart, flags);
+        t = (MPI_Wtime() - t0) / steps;
+        tmax[m] = bench_max_time(t, 0, cart);
+    }
+
+    MPI_Reduce( &errs, &tot_errs, 1, MPI_INT, MPI_SUM, 0, cart );
+    if (rank == 0)
+    {
+        printf("# %d processes as %dx%d", size, gdims[0], gdims[1]);
+        if (ndims == 3) printf("x%d", gdims[2]);
+        printf(", local %d^%d doubles, ghost %d, %d neighbours, %d steps\n",
+               n, ndims, ghost, hd.nnbr, steps);
+        printf("# %-18s %12s %10s\n", "variant", "us/step", "speedup");
+        for (m=0; m<NUM_MODES; m++)
+        {
+            printf("  %-18s %12.2f %10.2f\n", mode_names[m], tmax[m] * 1e6, tmax[NUM_MODES-1] / tmax[m]);
+        }
+        if (tot_errs == 0) printf(" No Errors\n");
+        fflush(stdout);
+    }
+
+    halo_free( &hd );
+    halo_free( &hp );
+    free(u);
+    MPI_Comm_free( &cart );
+    MPI_Finalize();
+    return errs;
+}
@@ -0,0 +1,183 @@
+/*
+bench_hier
+
+   Flat MPI_Bcast, MPI_Reduce, MPI_Allreduce and MPI_Barrier against the
+   node-aware versions in hier_coll.h.
+
+Usage
+
+   mpirun -n 8 ./bench_hier [-op bcast|reduce|allreduce|barrier|all]
+                            [-min 8] [-max 1M] [-reps 100] [-ppn 0]
+                            [-root 0]
+
+Remarks
+
+   -ppn groups consecutive ranks into pretend nodes (0: real nodes,
+   found by host name), so a single machine can stand in for a
+   cluster; the inter-node stage then runs through the same shared
+   memory as everything else and the numbers show the cost of the
+   extra stages rather than the network traffic they save.
+
+   For each size (doubles, MPI_SUM for the reductions) the table gives
+   the time per call in us of the flat collective and of the
+   hierarchical one, slowest rank averaged over -reps, and flat/hier.
+   Before timing, every operation is checked at each size with the
+   last rank as root, which is off its node's leader whenever nodes
+   have more than one rank. Barrier has one row.
+
+   The header line shows the node layout: number of nodes, ranks per
+   node, and whether the intra-node stages use the shared segment.
+*/
+
+#include "mpi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench_util.h"
+#include "hier_coll.h"
+
+#define MIN_BYTES 8
+#define MAX_BYTES (1024*1024)
+#define REPS 100
+
+#define NUM_OPS 4
+enum { OP_BCAST, OP_REDUCE, OP_ALLREDUCE, OP_BARRIER };
+static const char *op_names[NUM_OPS] = { "bcast", "reduce", "allreduce", "barrier" };
+
+/* One call of op, flat or hierarchical */
+static void run_op(int op, int hier, hier_t *h, double *in, double *out, int n, int root)
+{
+    switch (op)
+    {
+    case OP_BCAST:
+        if (hier) hier_bcast(h, out, n, MPI_DOUBLE, root);
+        else MPI_Bcast(out, n, MPI_DOUBLE, root, h->comm);
+        break;
+    case OP_REDUCE:
+        if (hier) hier_reduce(h, in, out, n, MPI_DOUBLE, MPI_SUM, root);
+        else MPI_Reduce(in, out, n, MPI_DOUBLE, MPI_SUM, root, h->comm);
+        break;
+    case OP_ALLREDUCE:
+        if (hier) hier_allreduce(h, in, out, n, MPI_DOUBLE, MPI_SUM);
+        else MPI_Allreduce(in, out, n, MPI_DOUBLE, MPI_SUM, h->comm);
+        break;
+    case OP_BARRIER:
+        if (hier) hier_barrier(h);
+        else MPI_Barrier(h->comm);
+        break;
+    }
+}
+
+/* Check op at n elements with root size-1 */
+static int check_op(int op, hier_t *h, double *in, double *out, int n)
+{
+    int i, errs = 0, root = h->size - 1, mine;
+    double want;
+
+    for (i=0; i<n; i++)
+    {
+        in[i] = h->rank + i;
+        out[i] = (op == OP_BCAST && h->rank == root) ? 7.0 * i : -1.0;
+    }
+    run_op(op, 1, h, in, out, n, root);
+    mine = (op == OP_BCAST || op == OP_ALLREDUCE || h->rank == root);
+    for (i=0; i<n && mine && op != OP_BARRIER; i++)
+    {
+        want = (op == OP_BCAST) ? 7.0 * i : (double) h->size * (h->size - 1) / 2 + (double) h->size * i;
+        if (out[i] == want) continue;
+        if (errs++ < 5)
+        {
+            fprintf(stderr, "(%d) %s, %d doubles: [%d] = %g, expected %g\n", h->rank, op_names[op], n, i,
+                    out[i], want);
+            fflush(stderr);
+        }
+    }
+    return errs;
+}
+
+static double time_op(int op, int hier, hier_t *h, double *in, double *out, int n, int root, int reps)
+{
+    int r;
+    double t;
+
+    run_op(op, hier, h, in, out, n, root);
+    MPI_Barrier(h->comm);
+    t = MPI_Wtime();
+    for (r=0; r<reps; r++) run_op(op, hier, h, in, out, n, root);
+    t = (MPI_Wtime() - t) / reps;
+    return bench_max_time(t, 0, h->comm);
+}
+
+int main( int argc, char **argv )
+{
+    int rank, size, reps, ppn, root, op, first, last, n, maxn, ppn_max, errs = 0, tot_errs;
+    long long bytes, minb, maxb;
+    const char *opname;
+    double *in, *out, tflat, thier;
+    hier_t h;
+
+    MPI_Init( &argc, &argv );
+    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+    MPI_Comm_size( MPI_COMM_WORLD, &size );
+
+    opname = bench_arg(argc, argv, "-op");
+    minb   = bench_arg_size(argc, argv, "-min", MIN_BYTES);
+    maxb   = bench_arg_size(argc, argv, "-max", MAX_BYTES);
+    reps   = bench_arg_int(argc, argv, "-reps", REPS);
+    ppn    = bench_arg_int(argc, argv, "-ppn", 0);
+    root   = bench_arg_int(argc, argv, "-root", 0);
+    if (minb < (long long) sizeof(double)) minb = sizeof(double);
+    if (maxb < minb) maxb = minb;
+    if (reps < 1) reps = 1;
+    if (root < 0 || root >= size) root = 0;
+    first = 0;
+    last = NUM_OPS - 1;
+    for (op=0; opname && op<NUM_OPS; op++)
+        if (strcmp(opname, op_names[op]) == 0) first = last = op;
+
+    hier_create(MPI_COMM_WORLD, ppn, 0, &h);
+    maxn = (int) (maxb / sizeof(double));
+    in  = (double *) malloc(maxn * sizeof(double));
+    out = (double *) malloc(maxn * sizeof(double));
+    memset(in, 0, maxn * sizeof(double));
+    memset(out, 0, maxn * sizeof(double));
+
+    MPI_Reduce(&h.node_size, &ppn_max, 1, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD);
+    if (rank == 0)
+    {
+        printf("# %d processes, %d nodes of up to %d ranks%s, root %d, -reps %d\n", size, h.nnodes, ppn_max,
+               h.shm ? ", shared segment" : "", root, reps);
+        printf("# %-9s %10s %12s %12s %10s\n", "op", "bytes", "flat(us)", "hier(us)", "flat/hier");
+        fflush(stdout);
+    }
+
+    for (op=first; op<=last; op++)
+    {
+        for (bytes=minb; bytes<=maxb; bytes*=4)
+        {
+            n = (op == OP_BARRIER) ? 0 : (int) (bytes / sizeof(double));
+            errs += check_op(op, &h, in, out, n);
+            tflat = time_op(op, 0, &h, in, out, n, root, reps);
+            thier = time_op(op, 1, &h, in, out, n, root, reps);
+            if (rank == 0)
+            {
+                printf("  %-9s %10lld %12.2f %12.2f %10.2f\n", op_names[op],
+                       (long long) n * (long long) sizeof(double), tflat * 1e6, thier * 1e6,
+                       thier > 0.0 ? tflat / thier : 0.0);
+                fflush(stdout);
+            }
+            if (op == OP_BARRIER) break;
+        }
+    }
+
+    hier_free(&h);
+    free(in);
+    free(out);
+
+    MPI_Reduce( &errs, &tot_errs, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD );
+    if (rank == 0 && tot_errs == 0) printf(" No Errors\n");
+    fflush(stdout);
+
+    MPI_Finalize();
+    return errs;
+}
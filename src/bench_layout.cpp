@@ -0,0 +1,198 @@
+/*
+bench_layout
+
+   Compares the library datatype path with the compile-time specialized
+   pack/unpack of mpi_layout.hpp for small-struct and strided messages.
+
+Usage
+
+   mpirun -n 2 ./bench_layout [-max 16384] [-bytes 16M]
+
+Remarks
+
+   Three layouts are measured for message counts from 1 up to -max
+   instances, quadrupling:
+
+   particle   struct Partstruct { char c; double d[6]; char b[7]; } from
+              MPI_Type_create_struct.c, all three members
+   column     vector_layout<double, 3, 8>, 3 doubles out of every 8
+   box        box_layout<double, 8, 8, 8, 32, 32>, an 8^3 box of a
+              8 x 32 x 32 array
+
+   On rank 0, "pack" is the specialized pack and "MPI_Pack" the library
+   packing the same datatype, both in GB/s of payload. Ranks 0 and 1
+   then ping-pong the messages with mpi_layout::send/recv, once as the
+   datatype and once packed, and report the one-way time in us. Each
+   measurement repeats until about -bytes of payload have been moved
+   (at least 20 and at most 20000 times). Both transfers are checked
+   by packing what arrived and comparing it with the original, and by
+   receiving a message of half the count, which must leave the other
+   half of the buffer as it was.
+*/
+
+#include "mpi.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "bench_util.h"
+#include "mpi_layout.hpp"
+
+#define MAX_COUNT 16384
+#define TARGET_BYTES (16*1024*1024)
+#define TAG_LAYOUT 31
+
+struct Partstruct
+{
+    char c;
+    double d[6];
+    char b[7];
+};
+
+using particle_layout = mpi_layout::struct_layout<Partstruct,
+    MPI_LAYOUT_FIELD(Partstruct, c),
+    MPI_LAYOUT_FIELD(Partstruct, d),
+    MPI_LAYOUT_FIELD(Partstruct, b)>;
+using column_layout = mpi_layout::vector_layout<double, 3, 8>;
+using box8_layout = mpi_layout::box_layout<double, 8, 8, 8, 32, 32>;
+
+static int iterations(std::size_t bytes, long long target)
+{
+    long long n = target / (bytes ? (long long) bytes : 1);
+    return (int) (n < 20 ? 20 : n > 20000 ? 20000 : n);
+}
+
+template <typename L>
+static int run_layout(const char *name, int max_count, long long target, int rank, int size)
+{
+    using T = typename L::value_type;
+    mpi_layout::transfer modes[2] = { mpi_layout::transfer::datatype, mpi_layout::transfer::packed };
+    int errs = 0;
+
+    for (int count = 1; count <= max_count; count *= 4)
+    {
+        std::size_t n = (std::size_t) count * L::stride, bytes = count * L::packed_size;
+        std::vector<T> src(n), dst(n);
+        std::vector<char> pbuf(bytes), qbuf(bytes);
+        int iters = iterations(bytes, target), psize, pos;
+        double t0, gbs[2] = { 0.0, 0.0 }, us[2] = { 0.0, 0.0 };
+
+        /* Fill every byte, padding included, so that stray copies show */
+        for (std::size_t i = 0; i < n * sizeof(T); i++)
+            reinterpret_cast<unsigned char *>(src.data())[i] = (unsigned char) (i * 37 + 11);
+        L::pack(src.data(), count, pbuf.data());
+
+        if (rank == 0)
+        {
+            std::vector<char> mbuf;
+            MPI_Pack_size(count, L::datatype(), MPI_COMM_WORLD, &psize);
+            mbuf.resize(psize);
+
+            t0 = MPI_Wtime();
+            for (int it = 0; it < iters; it++) L::pack(src.data(), count, qbuf.data());
+            gbs[0] = (double) bytes * iters / (MPI_Wtime() - t0) / 1e9;
+
+            t0 = MPI_Wtime();
+            for (int it = 0; it < iters; it++)
+            {
+                pos = 0;
+                MPI_Pack(src.data(), count, L::datatype(), mbuf.data(), psize, &pos, MPI_COMM_WORLD);
+            }
+            gbs[1] = (double) bytes * iters / (MPI_Wtime() - t0) / 1e9;
+        }
+
+        for (int m = 0; m < 2 && size > 1; m++)
+        {
+            if (rank > 1) continue;
+            std::memset(dst.data(), 0, n * sizeof(T));
+            t0 = MPI_Wtime();
+            for (int it = 0; it < iters; it++)
+            {
+                if (rank == 0)
+                {
+                    mpi_layout::send<L>(src.data(), count, 1, TAG_LAYOUT, MPI_COMM_WORLD, modes[m]);
+                    mpi_layout::recv<L>(dst.data(), count, 1, TAG_LAYOUT, MPI_COMM_WORLD, modes[m],
+                                        MPI_STATUS_IGNORE);
+                }
+                else
+                {
+                    mpi_layout::recv<L>(dst.data(), count, 0, TAG_LAYOUT, MPI_COMM_WORLD, modes[m],
+                                        MPI_STATUS_IGNORE);
+                    mpi_layout::send<L>(dst.data(), count, 0, TAG_LAYOUT, MPI_COMM_WORLD, modes[m]);
+                }
+            }
+            us[m] = (MPI_Wtime() - t0) / iters / 2 * 1e6;
+
+            L::pack(dst.data(), count, qbuf.data());
+            if (std::memcmp(qbuf.data(), pbuf.data(), bytes) != 0)
+            {
+                fprintf(stderr, "(%d) %s, count %d: %s transfer corrupted the data\n", rank, name, count,
+                        m == 0 ? "datatype" : "packed");
+                fflush(stderr);
+                errs++;
+            }
+
+            /* A message of half the count must leave the rest of the receive buffer untouched */
+            int half = count / 2;
+            if (half == 0) continue;
+            if (rank == 0)
+            {
+                mpi_layout::send<L>(src.data(), half, 1, TAG_LAYOUT, MPI_COMM_WORLD, modes[m]);
+                continue;
+            }
+            std::memset(dst.data(), 0, n * sizeof(T));
+            mpi_layout::recv<L>(dst.data(), count, 0, TAG_LAYOUT, MPI_COMM_WORLD, modes[m], MPI_STATUS_IGNORE);
+            L::pack(dst.data(), count, qbuf.data());
+            std::size_t hbytes = half * L::packed_size;
+            bool untouched = true;
+            for (std::size_t i = hbytes; i < bytes; i++) untouched = untouched && qbuf[i] == 0;
+            if (std::memcmp(qbuf.data(), pbuf.data(), hbytes) != 0 || !untouched)
+            {
+                fprintf(stderr, "(%d) %s, count %d: short %s message wrote the wrong elements\n", rank, name,
+                        count, m == 0 ? "datatype" : "packed");
+                fflush(stderr);
+                errs++;
+            }
+        }
+
+        if (rank == 0)
+        {
+            printf("  %-9s %7d %9zu %10.2f %10.2f %12.2f %12.2f %8.2f\n", name, count, bytes,
+                   gbs[0], gbs[1], us[0], us[1], us[1] > 0.0 ? us[0] / us[1] : 0.0);
+            fflush(stdout);
+        }
+        MPI_Barrier(MPI_COMM_WORLD);
+    }
+    return errs;
+}
+
+int main( int argc, char **argv )
+{
+    int rank, size, max_count, errs = 0, tot_errs;
+    long long target;
+
+    MPI_Init( &argc, &argv );
+    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+    MPI_Comm_size( MPI_COMM_WORLD, &size );
+
+    max_count = bench_arg_int(argc, argv, "-max", MAX_COUNT);
+    target    = bench_arg_size(argc, argv, "-bytes", TARGET_BYTES);
+
+    if (rank == 0)
+    {
+        printf("# %d processes; pack in GB/s, transfers one-way in us\n", size);
+        printf("# %-9s %7s %9s %10s %10s %12s %12s %8s\n", "layout", "count", "bytes",
+               "pack", "MPI_Pack", "datatype(us)", "packed(us)", "speedup");
+        fflush(stdout);
+    }
+    errs += run_layout<particle_layout>("particle", max_count, target, rank, size);
+    errs += run_layout<column_layout>("column", max_count, target, rank, size);
+    errs += run_layout<box8_layout>("box", max_count / 64 > 0 ? max_count / 64 : 1, target, rank, size);
+
+    MPI_Reduce( &errs, &tot_errs, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD );
+    if (rank == 0 && tot_errs == 0) printf(" No Errors\n");
+    fflush(stdout);
+
+    MPI_Finalize();
+    return errs;
+}
@@ -0,0 +1,226 @@
+/*
+bench_overlap
+
+   Overlap of communication with thread-pool tasks returned as
+   generalized requests (grequest_pool.h).
+
+Usage
+
+   mpirun -n 4 ./bench_overlap [-size 8M] [-tasks 4] [-threads 2]
+                               [-steps 20]
+
+Remarks
+
+   Each step every rank exchanges -size bytes with both ring neighbours
+   (MPI_Irecv/MPI_Isend) and "compresses" a -size byte checkpoint buffer
+   split into -tasks tasks on a pool of -threads workers. The
+   compression is a delta encoding of doubles with a running checksum,
+   standing in for a real codec. All requests, messages and tasks alike,
+   are completed by one MPI_Waitsome loop.
+
+   Three phases are timed: communication only, tasks only, and both
+   together. Overlap efficiency is the fraction of the shorter phase
+   hidden behind the longer one:
+
+       (t_comm + t_task - t_both) / min(t_comm, t_task)
+
+   1.0 is perfect overlap, 0.0 none. The workers need cores of their own
+   for this to approach 1; on an oversubscribed node expect little.
+
+   Requires MPI_THREAD_MULTIPLE.
+*/
+
+#include "mpi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "bench_util.h"
+#include "grequest_pool.h"
+
+#define MSG_SIZE (8*1024*1024)
+#define NUM_TASKS 4
+#define NUM_THREADS 2
+#define NUM_STEPS 20
+
+typedef struct
+{
+    const double *in;
+    int64_t *out;
+    int n;
+    uint64_t checksum;
+} compress_job_t;
+
+static void compress(void *arg)
+{
+    compress_job_t *job = (compress_job_t *) arg;
+    int64_t prev = 0, cur;
+    uint64_t sum = 0;
+    int i;
+
+    for (i=0; i<job->n; i++)
+    {
+        memcpy(&cur, &job->in[i], sizeof(cur));
+        job->out[i] = cur - prev;
+        prev = cur;
+        sum = sum * 31 + (uint64_t) job->out[i];
+    }
+    job->checksum = sum;
+}
+
+/* Run one step: phase 1 = messages, 2 = tasks, 3 = both; returns seconds */
+static double step(int phase, task_pool_t *pool, compress_job_t *jobs, int ntasks,
+                   char *sbuf, char *rbuf, int bytes, int left, int right,
+                   int *ntask_done, int *nmsg_done)
+{
+    MPI_Request reqs[4 + 64];
+    int idx[4 + 64];
+    int n = 0, done = 0, outcount, k, nmsg = 0;
+    double t0 = MPI_Wtime();
+
+    if (phase & 1)
+    {
+        MPI_Irecv(rbuf, bytes, MPI_BYTE, left, 0, MPI_COMM_WORLD, &reqs[n++]);
+        MPI_Irecv(rbuf + bytes, bytes, MPI_BYTE, right, 1, MPI_COMM_WORLD, &reqs[n++]);
+        MPI_Isend(sbuf, bytes, MPI_BYTE, right, 0, MPI_COMM_WORLD, &reqs[n++]);
+        MPI_Isend(sbuf, bytes, MPI_BYTE, left, 1, MPI_COMM_WORLD, &reqs[n++]);
+        nmsg = n;
+    }
+    if (phase & 2)
+    {
+        for (k=0; k<ntasks; k++) task_pool_submit(pool, compress, &jobs[k], &reqs[n++]);
+    }
+
+    /* One completion loop for both kinds of request */
+    while (done < n)
+    {
+        MPI_Waitsome(n, reqs, &outcount, idx, MPI_STATUSES_IGNORE);
+        for (k=0; k<outcount; k++)
+        {
+            if (idx[k] < nmsg) (*nmsg_done)++;
+            else (*ntask_done)++;
+        }
+        done += outcount;
+    }
+    return MPI_Wtime() - t0;
+}
+
+int main( int argc, char **argv )
+{
+    int rank, size, provided, bytes, ntasks, nthreads, steps, s, p, k, i, n;
+    int left, right, errs = 0, tot_errs, ntask_done = 0, nmsg_done = 0;
+    double t[4], *ckpt;
+    int64_t *packed;
+    uint64_t *expect;
+    char *sbuf, *rbuf;
+    compress_job_t *jobs;
+    task_pool_t pool;
+
+    MPI_Init_thread( &argc, &argv, MPI_THREAD_MULTIPLE, &provided );
+    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+    MPI_Comm_size( MPI_COMM_WORLD, &size );
+
+    bytes    = (int) bench_arg_size(argc, argv, "-size", MSG_SIZE);
+    ntasks   = bench_arg_int(argc, argv, "-tasks", NUM_TASKS);
+    nthreads = bench_arg_int(argc, argv, "-threads", NUM_THREADS);
+    steps    = bench_arg_int(argc, argv, "-steps", NUM_STEPS);
+    if (ntasks < 1) ntasks = 1;
+    if (ntasks > 64) ntasks = 64;
+    if (steps < 1) steps = 1;
+
+    if (task_pool_init(&pool, nthreads) != MPI_SUCCESS)
+    {
+        if (rank == 0) printf("MPI_THREAD_MULTIPLE is required (provided %d)\n", provided);
+        fflush(stdout);
+        MPI_Finalize();
+        return 1;
+    }
+
+    left  = (rank - 1 + size) % size;
+    right = (rank + 1) % size;
+    sbuf  = (char *) malloc(bytes);
+    rbuf  = (char *) malloc(2 * (size_t) bytes);
+    for (i=0; i<bytes; i++) sbuf[i] = (char) (rank + i);
+
+    n      = bytes / sizeof(double);
+    ckpt   = (double *) malloc(n * sizeof(double));
+    packed = (int64_t *) malloc(n * sizeof(int64_t));
+    jobs   = (compress_job_t *) malloc(ntasks * sizeof(compress_job_t));
+    expect = (uint64_t *) malloc(ntasks * sizeof(uint64_t));
+    for (i=0; i<n; i++) ckpt[i] = rank + 0.001 * i;
+    for (k=0; k<ntasks; k++)
+    {
+        int lo = (int) ((long long) n * k / ntasks), hi = (int) ((long long) n * (k + 1) / ntasks);
+        jobs[k].in  = ckpt + lo;
+        jobs[k].out = packed + lo;
+        jobs[k].n   = hi - lo;
+        compress(&jobs[k]);
+        expect[k] = jobs[k].checksum;
+    }
+
+    for (p=1; p<=3; p++)
+    {
+        t[p] = 0.0;
+        step(p, &pool, jobs, ntasks, sbuf, rbuf, bytes, left, right, &ntask_done, &nmsg_done);
+        MPI_Barrier( MPI_COMM_WORLD );
+        for (s=0; s<steps; s++)
+        {
+            for (k=0; k<ntasks; k++) jobs[k].checksum = 0;
+            t[p] += step(p, &pool, jobs, ntasks, sbuf, rbuf, bytes, left, right,
+                         &ntask_done, &nmsg_done);
+        }
+        t[p] = bench_max_time(t[p] / steps, 0, MPI_COMM_WORLD);
+
+        if (p & 2)
+        {
+            for (k=0; k<ntasks; k++)
+            {
+                if (jobs[k].checksum != expect[k])
+                {
+                    fprintf(stderr, "[%d] task %d checksum mismatch\n", rank, k);
+                    fflush(stderr);
+                    errs++;
+                }
+            }
+        }
+        if (p & 1)
+        {
+            for (i=0; i<bytes; i++)
+            {
+                if (rbuf[i] != (char) (left + i) || rbuf[bytes + i] != (char) (right + i))
+                {
+                    fprintf(stderr, "[%d] message byte %d wrong\n", rank, i);
+                    fflush(stderr);
+                    errs++;
+                    break;
+                }
+            }
+        }
+    }
+
+    MPI_Reduce( &errs, &tot_errs, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD );
+    if (rank == 0)
+    {
+        double hidden = t[1] + t[2] - t[3];
+        double shorter = (t[1] < t[2]) ? t[1] : t[2];
+        printf("# %d processes, %d bytes per neighbour, %d tasks on %d threads, %d steps\n",
+               size, bytes, ntasks, nthreads, steps);
+        printf("  comm only      %10.3f ms\n", t[1] * 1e3);
+        printf("  tasks only     %10.3f ms\n", t[2] * 1e3);
+        printf("  overlapped     %10.3f ms\n", t[3] * 1e3);
+        printf("  efficiency     %10.2f\n", (shorter > 0.0) ? hidden / shorter : 0.0);
+        printf("  completions    %d messages, %d tasks on rank 0\n", nmsg_done, ntask_done);
+        if (tot_errs == 0) printf(" No Errors\n");
+        fflush(stdout);
+    }
+
+    task_pool_finalize(&pool);
+    free(sbuf);
+    free(rbuf);
+    free(ckpt);
+    free(packed);
+    free(jobs);
+    free(expect);
+    MPI_Finalize();
+    return errs;
+}
@@ -0,0 +1,367 @@
+/*
+bench_p2p
+
+   Point-to-point latency and bandwidth for the five send modes:
+   standard (MPI_Send), synchronous (MPI_Ssend), ready (MPI_Rsend),
+   buffered (MPI_Bsend) and nonblocking (MPI_Isend).
+
+Usage
+
+   mpirun -n 2 ./bench_p2p [-min 0] [-max 128M] [-reps 100] [-window 64]
+                           [-delay 5000] [-peer <rank>]
+
+Remarks
+
+   Rank 0 talks to rank -peer (default the last rank, so that with a
+   block rank mapping the pair spans two nodes). Other ranks idle.
+
+   Three patterns are measured for every mode and every message size
+   (0 bytes, then powers of two from 1 byte to -max):
+
+   pingpong
+          Half the round-trip time of one message bounced back and forth.
+
+   stream
+          Rank 0 sends a window of -window messages back to back to the
+          peer; reports the achieved bandwidth.
+
+   bidir
+          Both ranks send a window to each other at the same time;
+          reports the aggregate bandwidth.
+
+   The receiver always pre-posts its receives and tells the sender with
+   a zero-byte message, which is what makes MPI_Rsend legal and keeps
+   MPI_Ssend from deadlocking in the bidirectional case. The same
+   handshake is used for every mode so the numbers stay comparable.
+   Windows shrink for large messages so that one window never exceeds
+   128 MiB of receive buffer.
+
+   The eager-to-rendezvous crossover is found by having the peer wait
+   -delay microseconds before posting its receive: a standard MPI_Send
+   that returns well before that delay was sent eagerly, one that
+   blocks for the delay waited for the receive (rendezvous). The
+   largest eager size and the first rendezvous size are reported, along
+   with the fastest mode for each size in every table.
+*/
+
+#include "mpi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench_util.h"
+
+#define MAX_SIZE (128*1024*1024)
+#define WINDOW_BYTES (128*1024*1024)
+#define NUM_REPS 100
+#define NUM_WINDOW 64
+#define DELAY_US 5000
+#define TAG_DATA 1
+#define TAG_READY 2
+
+enum { MODE_STD, MODE_SYNC, MODE_READY, MODE_BUF, MODE_NB, NUM_MODES };
+static const char *mode_names[NUM_MODES] = { "standard", "sync", "ready", "buffered", "nonblock" };
+
+enum { PAT_PINGPONG, PAT_STREAM, PAT_BIDIR, NUM_PATS };
+static const char *pat_names[NUM_PATS] = { "pingpong", "stream", "bidir" };
+
+static char *sbuf, *rbuf;
+static int max_window;
+
+static void send_mode(int mode, void *buf, int n, int dest, MPI_Comm comm, MPI_Request *req)
+{
+    *req = MPI_REQUEST_NULL;
+    switch (mode)
+    {
+    case MODE_STD:   MPI_Send(buf, n, MPI_BYTE, dest, TAG_DATA, comm); break;
+    case MODE_SYNC:  MPI_Ssend(buf, n, MPI_BYTE, dest, TAG_DATA, comm); break;
+    case MODE_READY: MPI_Rsend(buf, n, MPI_BYTE, dest, TAG_DATA, comm); break;
+    case MODE_BUF:   MPI_Bsend(buf, n, MPI_BYTE, dest, TAG_DATA, comm); break;
+    default:         MPI_Isend(buf, n, MPI_BYTE, dest, TAG_DATA, comm, req); break;
+    }
+}
+
+static int window_for(int n)
+{
+    int w = (n > 0) ? WINDOW_BYTES / n : max_window;
+    if (w > max_window) w = max_window;
+    return (w < 1) ? 1 : w;
+}
+
+/* Seconds per one-way message */
+static double pingpong(int mode, int n, int iters, int me, MPI_Comm comm)
+{
+    int i, other = 1 - me;
+    double t0;
+    MPI_Request sreq, rreq;
+
+    if (me == 1)
+    {
+        MPI_Irecv(rbuf, n, MPI_BYTE, other, TAG_DATA, comm, &rreq);
+        MPI_Send(NULL, 0, MPI_BYTE, other, TAG_READY, comm);
+    }
+    else
+    {
+        MPI_Recv(NULL, 0, MPI_BYTE, other, TAG_READY, comm, MPI_STATUS_IGNORE);
+    }
+
+    t0 = MPI_Wtime();
+    for (i=0; i<iters; i++)
+    {
+        if (me == 0)
+        {
+            MPI_Irecv(rbuf, n, MPI_BYTE, other, TAG_DATA, comm, &rreq);
+            send_mode(mode, sbuf, n, other, comm, &sreq);
+            MPI_Wait(&sreq, MPI_STATUS_IGNORE);
+            MPI_Wait(&rreq, MPI_STATUS_IGNORE);
+        }
+        else
+        {
+            MPI_Wait(&rreq, MPI_STATUS_IGNORE);
+            /* The next ping's receive is posted before the pong leaves */
+            if (i + 1 < iters)
+            {
+                MPI_Irecv(rbuf, n, MPI_BYTE, other, TAG_DATA, comm, &rreq);
+            }
+            send_mode(mode, sbuf, n, other, comm, &sreq);
+            MPI_Wait(&sreq, MPI_STATUS_IGNORE);
+        }
+    }
+    return (MPI_Wtime() - t0) / (2.0 * iters);
+}
+
+/* Seconds for iters windows; bidir sends in both directions at once */
+static double windows(int mode, int n, int iters, int me, int bidir, MPI_Comm comm)
+{
+    int i, k, w = window_for(n), other = 1 - me;
+    double t0;
+    MPI_Request *sreqs, *rreqs;
+
+    sreqs = (MPI_Request *) malloc(w * sizeof(MPI_Request));
+    rreqs = (MPI_Request *) malloc(w * sizeof(MPI_Request));
+
+    MPI_Barrier(comm);
+    t0 = MPI_Wtime();
+    for (i=0; i<iters; i++)
+    {
+        int recving = bidir || me == 1;
+        int sending = bidir || me == 0;
+
+        if (recving)
+        {
+            for (k=0; k<w; k++)
+            {
+                MPI_Irecv(rbuf + (size_t) k * n, n, MPI_BYTE, other, TAG_DATA, comm, &rreqs[k]);
+            }
+        }
+        if (bidir)
+        {
+            MPI_Sendrecv(NULL, 0, MPI_BYTE, other, TAG_READY, NULL, 0, MPI_BYTE, other,
+                         TAG_READY, comm, MPI_STATUS_IGNORE);
+        }
+        else if (me == 1)
+        {
+            MPI_Send(NULL, 0, MPI_BYTE, other, TAG_READY, comm);
+        }
+        else
+        {
+            MPI_Recv(NULL, 0, MPI_BYTE, other, TAG_READY, comm, MPI_STATUS_IGNORE);
+        }
+        if (sending)
+        {
+            for (k=0; k<w; k++)
+            {
+                send_mode(mode, sbuf, n, other, comm, &sreqs[k]);
+            }
+            MPI_Waitall(w, sreqs, MPI_STATUSES_IGNORE);
+        }
+        if (recving)
+        {
+            MPI_Waitall(w, rreqs, MPI_STATUSES_IGNORE);
+        }
+    }
+    /* Data has arrived only once the receiver says so */
+    if (!bidir)
+    {
+        if (me == 1) MPI_Send(NULL, 0, MPI_BYTE, other, TAG_READY, comm);
+        else MPI_Recv(NULL, 0, MPI_BYTE, other, TAG_READY, comm, MPI_STATUS_IGNORE);
+    }
+    t0 = MPI_Wtime() - t0;
+
+    free(sreqs);
+    free(rreqs);
+    return t0;
+}
+
+/* Time a standard MPI_Send whose receive is posted delay seconds late */
+static double late_receive_send(int n, double delay, int me, MPI_Comm comm)
+{
+    double t0, t = 0.0;
+
+    MPI_Barrier(comm);
+    if (me == 0)
+    {
+        t0 = MPI_Wtime();
+        MPI_Send(sbuf, n, MPI_BYTE, 1, TAG_DATA, comm);
+        t = MPI_Wtime() - t0;
+    }
+    else
+    {
+        t0 = MPI_Wtime();
+        while (MPI_Wtime() - t0 < delay) ;
+        MPI_Recv(rbuf, n, MPI_BYTE, 0, TAG_DATA, comm, MPI_STATUS_IGNORE);
+    }
+    MPI_Barrier(comm);
+    return t;
+}
+
+static int iters_for(int n, int reps)
+{
+    int it = reps;
+    if (n > 64*1024) it = (int) ((long long) reps * 64 * 1024 / n);
+    return (it < 3) ? 3 : it;
+}
+
+int main( int argc, char **argv )
+{
+    int rank, size, peer, me, m, p, n, reps, best, found_rdv = 0;
+    long long min_size, max_size, rbytes, last_eager = -1, first_rdv = -1;
+    double delay, res[NUM_MODES];
+    char s1[32], s2[32];
+    void *bbuf;
+    int bsize, pack;
+    MPI_Comm pair;
+
+    MPI_Init( &argc, &argv );
+    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+    MPI_Comm_size( MPI_COMM_WORLD, &size );
+
+    if (size < 2)
+    {
+        printf("This benchmark requires at least 2 processes\n");
+        fflush(stdout);
+        MPI_Finalize();
+        return 1;
+    }
+
+    min_size   = bench_arg_size(argc, argv, "-min", 0);
+    max_size   = bench_arg_size(argc, argv, "-max", MAX_SIZE);
+    reps       = bench_arg_int(argc, argv, "-reps", NUM_REPS);
+    max_window = bench_arg_int(argc, argv, "-window", NUM_WINDOW);
+    delay      = bench_arg_int(argc, argv, "-delay", DELAY_US) * 1e-6;
+    peer       = bench_arg_int(argc, argv, "-peer", size - 1);
+    if (max_size > MAX_SIZE) max_size = MAX_SIZE;
+    if (reps < 1) reps = 1;
+    if (max_window < 1) max_window = 1;
+    if (peer < 1 || peer >= size) peer = size - 1;
+
+    MPI_Comm_split( MPI_COMM_WORLD, (rank == 0 || rank == peer) ? 0 : MPI_UNDEFINED, rank, &pair );
+
+    if (pair != MPI_COMM_NULL)
+    {
+        MPI_Comm_rank( pair, &me );
+
+        /* Receive slots for a full window, one send buffer reused by every send */
+        rbytes = (long long) max_window * max_size;
+        if (rbytes > WINDOW_BYTES) rbytes = WINDOW_BYTES;
+        if (rbytes < max_size) rbytes = max_size;
+        if (rbytes < 1) rbytes = 1;
+        sbuf = (char *) malloc(max_size > 0 ? max_size : 1);
+        rbuf = (char *) malloc(rbytes);
+        memset(sbuf, 1, max_size > 0 ? max_size : 1);
+
+        /* Room for two windows of buffered sends in flight */
+        MPI_Pack_size((int) rbytes, MPI_BYTE, pair, &pack);
+        bsize = 2 * (pack + max_window * MPI_BSEND_OVERHEAD);
+        bbuf = malloc(bsize);
+        MPI_Buffer_attach(bbuf, bsize);
+
+        if (me == 0)
+        {
+            printf("# ranks 0 <-> %d, window %d, reps %d\n", peer, max_window, reps);
+            fflush(stdout);
+        }
+
+        for (p=0; p<NUM_PATS; p++)
+        {
+            if (me == 0)
+            {
+                printf("\n# %s: %s\n# %-8s", pat_names[p],
+                       (p == PAT_PINGPONG) ? "one-way latency (us)" : "bandwidth (MB/s)", "bytes");
+                for (m=0; m<NUM_MODES; m++) printf(" %10s", mode_names[m]);
+                printf("  best\n");
+                fflush(stdout);
+            }
+            for (n=(int) min_size; n<=max_size; n=(n ? 2*n : 1))
+            {
+                int iters = iters_for(n, reps);
+                for (m=0; m<NUM_MODES; m++)
+                {
+                    if (p == PAT_PINGPONG)
+                    {
+                        pingpong(m, n, 2, me, pair);
+                        res[m] = pingpong(m, n, iters, me, pair) * 1e6;
+                    }
+                    else
+                    {
+                        double bytes = (double) n * window_for(n) * iters * ((p == PAT_BIDIR) ? 2 : 1);
+                        windows(m, n, 1, me, p == PAT_BIDIR, pair);
+                        res[m] = bench_mbps(bytes, windows(m, n, iters, me, p == PAT_BIDIR, pair));
+                    }
+                }
+                if (me == 0)
+                {
+                    best = 0;
+                    for (m=1; m<NUM_MODES; m++)
+                    {
+                        if ((p == PAT_PINGPONG) ? res[m] < res[best] : res[m] > res[best]) best = m;
+                    }
+                    printf("  %-8s", bench_fmt_size(n, s1, sizeof(s1)));
+                    for (m=0; m<NUM_MODES; m++) printf(" %10.2f", res[m]);
+                    printf("  %s\n", mode_names[best]);
+                    fflush(stdout);
+                }
+                if (n > max_size / 2) break;
+            }
+        }
+
+        /* Eager/rendezvous crossover of standard sends */
+        for (n=(int) min_size; n<=max_size; n=(n ? 2*n : 1))
+        {
+            double t = late_receive_send(n, delay, me, pair);
+            int eager = (t < delay / 2);
+
+            MPI_Bcast(&eager, 1, MPI_INT, 0, pair);
+            if (eager && !found_rdv) last_eager = n;
+            if (!eager && !found_rdv)
+            {
+                first_rdv = n;
+                found_rdv = 1;
+            }
+            if (found_rdv || n > max_size / 2) break;
+        }
+        if (me == 0)
+        {
+            printf("\n");
+            if (last_eager < 0)
+                printf("# eager/rendezvous: every size waited for the receiver (no eager path)\n");
+            else if (first_rdv < 0)
+                printf("# eager/rendezvous: all sizes up to %s sent eagerly\n",
+                       bench_fmt_size(last_eager, s1, sizeof(s1)));
+            else
+                printf("# eager/rendezvous: eager up to %s bytes, rendezvous from %s bytes\n",
+                       bench_fmt_size(last_eager, s1, sizeof(s1)),
+                       bench_fmt_size(first_rdv, s2, sizeof(s2)));
+            fflush(stdout);
+        }
+
+        MPI_Buffer_detach(&bbuf, &bsize);
+        free(bbuf);
+        free(sbuf);
+        free(rbuf);
+        MPI_Comm_free(&pair);
+    }
+
+    MPI_Barrier( MPI_COMM_WORLD );
+    MPI_Finalize();
+    return 0;
+}
@@ -0,0 +1,258 @@
+/*
+bench_partition
+
+   Global offsets, rebalancing and stream compaction with partition.h,
+   next to the gather-to-root offset computation they replace.
+
+Usage
+
+   mpirun -n 4 ./bench_partition [-n 256K] [-reps 20]
+
+Remarks
+
+   Rank r starts with n * (1 + r % 4) / 2 items, so the largest share
+   is 1.6x the average. An item is four doubles: its global index (in
+   rank order), a weight 1 + index % 8, and two doubles of payload.
+
+   offsets    part_offsets (MPI_Exscan + MPI_Allreduce)
+   gather     MPI_Gather of the counts to rank 0, prefix sum there,
+              MPI_Scatter of the offsets and MPI_Bcast of the total
+   block      part_plan_block + part_move: equal counts per rank
+   weighted   part_plan_weighted + part_move: equal weight per rank
+   compact    part_compact keeping every third index, in place on a copy
+
+   Times are per call in us, slowest rank, averaged over -reps. imbal
+   is the largest rank's count (or weight, for weighted) over the
+   average afterwards, and moved the fraction of items that changed
+   rank. Offsets are checked against the closed form of the initial
+   counts, rebalanced items for the expected index ranges and weight
+   balance, and compacted items for their global numbering.
+*/
+
+#include "mpi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench_util.h"
+#include "partition.h"
+
+#define NUM_ITEMS (256*1024)
+#define REPS 20
+#define ITEM_DOUBLES 4
+
+static int initial_count(int r, int n)
+{
+    return (int) ((long long) n * (1 + r % 4) / 2);
+}
+
+static int report_err(int rank, const char *phase, const char *what, long long got, long long want)
+{
+    fprintf(stderr, "(%d) %s: %s is %lld, expected %lld\n", rank, phase, what, got, want);
+    fflush(stderr);
+    return 1;
+}
+
+static void report(const char *phase, double t, double imbal, double moved)
+{
+    printf("  %-9s %12.2f", phase, t * 1e6);
+    if (imbal > 0.0) printf(" %8.3f %8.3f\n", imbal, moved);
+    else printf(" %8s %8s\n", "-", "-");
+    fflush(stdout);
+}
+
+/* Largest over average of x across comm (on rank 0) */
+static double imbalance(double x, MPI_Comm comm)
+{
+    double v[2] = { x, x }, r[2];
+    int size;
+    MPI_Comm_size(comm, &size);
+    MPI_Reduce(&v[0], &r[0], 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+    MPI_Reduce(&v[1], &r[1], 1, MPI_DOUBLE, MPI_SUM, 0, comm);
+    return r[1] > 0.0 ? r[0] * size / r[1] : 0.0;
+}
+
+/* Items kept by their index range after a move, in order and contiguous */
+static int check_moved(const double *items, int m, long long first, int rank, const char *phase)
+{
+    int i;
+    for (i=0; i<m; i++)
+        if (items[i * ITEM_DOUBLES] != (double) (first + i))
+            return report_err(rank, phase, "index", (long long) items[i * ITEM_DOUBLES], first + i);
+    return 0;
+}
+
+int main( int argc, char **argv )
+{
+    int rank, size, n, nmine, reps, r, s, i, m, *counts = NULL, errs = 0, tot_errs;
+    long long offset, total, want_offset, want_total, *goff = NULL, lo, first;
+    double *items, *moved, *scratch, *w, t, tmax, mywt, mv, allmv;
+    char *keep;
+    MPI_Datatype item_type;
+    part_plan_t p;
+
+    MPI_Init( &argc, &argv );
+    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+    MPI_Comm_size( MPI_COMM_WORLD, &size );
+
+    n    = (int) bench_arg_size(argc, argv, "-n", NUM_ITEMS);
+    reps = bench_arg_int(argc, argv, "-reps", REPS);
+    if (reps < 1) reps = 1;
+
+    MPI_Type_contiguous(ITEM_DOUBLES, MPI_DOUBLE, &item_type);
+    MPI_Type_commit(&item_type);
+
+    /* Initial items; the offset is computed here independently of MPI */
+    nmine = initial_count(rank, n);
+    want_offset = want_total = 0;
+    for (s=0; s<size; s++)
+    {
+        if (s < rank) want_offset += initial_count(s, n);
+        want_total += initial_count(s, n);
+    }
+    items   = (double *) malloc(((size_t) nmine + 1) * ITEM_DOUBLES * sizeof(double));
+    scratch = (double *) malloc(((size_t) nmine + 1) * ITEM_DOUBLES * sizeof(double));
+    w       = (double *) malloc(((size_t) nmine + 1) * sizeof(double));
+    keep    = (char *) malloc((size_t) nmine + 1);
+    for (i=0; i<nmine; i++)
+    {
+        long long g = want_offset + i;
+        items[i * ITEM_DOUBLES] = (double) g;
+        items[i * ITEM_DOUBLES + 1] = w[i] = (double) (1 + g % 8);
+        items[i * ITEM_DOUBLES + 2] = (double) rank;
+        items[i * ITEM_DOUBLES + 3] = -(double) g;
+        keep[i] = (g % 3 == 0);
+    }
+
+    t = imbalance((double) nmine, MPI_COMM_WORLD);
+    if (rank == 0)
+    {
+        printf("# %d processes, %lld items of %d doubles, %d reps, initial imbal %.3f\n", size,
+               want_total, ITEM_DOUBLES, reps, t);
+        printf("# %-9s %12s %8s %8s\n", "phase", "us/call", "imbal", "moved");
+        fflush(stdout);
+    }
+
+    /* offsets */
+    MPI_Barrier(MPI_COMM_WORLD);
+    t = MPI_Wtime();
+    for (r=0; r<reps; r++) part_offsets(nmine, &offset, &total, MPI_COMM_WORLD);
+    tmax = bench_max_time((MPI_Wtime() - t) / reps, 0, MPI_COMM_WORLD);
+    if (offset != want_offset) errs += report_err(rank, "offsets", "offset", offset, want_offset);
+    if (total != want_total) errs += report_err(rank, "offsets", "total", total, want_total);
+    if (rank == 0) report("offsets", tmax, 0.0, 0.0);
+
+    /* gather: the root-based version */
+    if (rank == 0)
+    {
+        counts = (int *) malloc(size * sizeof(int));
+        goff = (long long *) malloc(size * sizeof(long long));
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    t = MPI_Wtime();
+    for (r=0; r<reps; r++)
+    {
+        MPI_Gather(&nmine, 1, MPI_INT, counts, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        if (rank == 0)
+            for (s=0, total=0; s<size; s++)
+            {
+                goff[s] = total;
+                total += counts[s];
+            }
+        MPI_Scatter(goff, 1, MPI_LONG_LONG, &offset, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+        MPI_Bcast(&total, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    }
+    tmax = bench_max_time((MPI_Wtime() - t) / reps, 0, MPI_COMM_WORLD);
+    if (offset != want_offset) errs += report_err(rank, "gather", "offset", offset, want_offset);
+    if (rank == 0) report("gather", tmax, 0.0, 0.0);
+
+    /* block */
+    moved = NULL;
+    MPI_Barrier(MPI_COMM_WORLD);
+    t = MPI_Wtime();
+    for (r=0; r<reps; r++)
+    {
+        part_plan_block(nmine, &p, MPI_COMM_WORLD);
+        moved = (double *) realloc(moved, ((size_t) p.nrecv + 1) * ITEM_DOUBLES * sizeof(double));
+        part_move(&p, items, item_type, moved);
+        if (r < reps - 1) part_plan_free(&p);
+    }
+    tmax = bench_max_time((MPI_Wtime() - t) / reps, 0, MPI_COMM_WORLD);
+    first = part_block_start(rank, want_total, size);
+    m = (int) (part_block_start(rank + 1, want_total, size) - first);
+    if (p.nrecv != m) errs += report_err(rank, "block", "count", p.nrecv, m);
+    else errs += check_moved(moved, m, first, rank, "block");
+    mv = (double) (nmine - p.sendcounts[rank]);
+    MPI_Reduce(&mv, &allmv, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    t = imbalance((double) p.nrecv, MPI_COMM_WORLD);
+    if (rank == 0) report("block", tmax, t, allmv / want_total);
+    part_plan_free(&p);
+
+    /* weighted */
+    MPI_Barrier(MPI_COMM_WORLD);
+    t = MPI_Wtime();
+    for (r=0; r<reps; r++)
+    {
+        part_plan_weighted(nmine, w, &p, MPI_COMM_WORLD);
+        moved = (double *) realloc(moved, ((size_t) p.nrecv + 1) * ITEM_DOUBLES * sizeof(double));
+        part_move(&p, items, item_type, moved);
+        if (r < reps - 1) part_plan_free(&p);
+    }
+    tmax = bench_max_time((MPI_Wtime() - t) / reps, 0, MPI_COMM_WORLD);
+    first = 0;
+    lo = p.nrecv;
+    MPI_Exscan(&lo, &first, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) first = 0;
+    errs += check_moved(moved, p.nrecv, first, rank, "weighted");
+    for (i=0, mywt=0.0; i<p.nrecv; i++) mywt += moved[i * ITEM_DOUBLES + 1];
+    {
+        /* Within the heaviest item (8) of an equal share */
+        double allwt, share;
+        MPI_Allreduce(&mywt, &allwt, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+        share = allwt / size;
+        if (mywt > share + 8.0 || mywt < share - 8.0)
+            errs += report_err(rank, "weighted", "weight", (long long) mywt, (long long) share);
+    }
+    mv = (double) (nmine - p.sendcounts[rank]);
+    MPI_Reduce(&mv, &allmv, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    t = imbalance(mywt, MPI_COMM_WORLD);
+    if (rank == 0) report("weighted", tmax, t, allmv / want_total);
+    part_plan_free(&p);
+
+    /* compact */
+    MPI_Barrier(MPI_COMM_WORLD);
+    t = MPI_Wtime();
+    for (r=0; r<reps; r++)
+    {
+        memcpy(scratch, items, (size_t) nmine * ITEM_DOUBLES * sizeof(double));
+        m = part_compact(scratch, nmine, item_type, keep, scratch, &offset, &total, MPI_COMM_WORLD);
+    }
+    tmax = bench_max_time((MPI_Wtime() - t) / reps, 0, MPI_COMM_WORLD);
+    if (total != (want_total + 2) / 3) errs += report_err(rank, "compact", "total", total, (want_total + 2) / 3);
+    for (i=0; i<m; i++)
+    {
+        long long g = (long long) scratch[i * ITEM_DOUBLES];
+        if (g % 3 != 0 || g / 3 != offset + i)
+        {
+            errs += report_err(rank, "compact", "global index", offset + i, g / 3);
+            break;
+        }
+    }
+    t = imbalance((double) m, MPI_COMM_WORLD);
+    if (rank == 0) report("compact", tmax, t, 0.0);
+
+    MPI_Type_free(&item_type);
+    free(items);
+    free(scratch);
+    free(moved);
+    free(w);
+    free(keep);
+    free(counts);
+    free(goff);
+
+    MPI_Reduce( &errs, &tot_errs, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD );
+    if (rank == 0 && tot_errs == 0) printf(" No Errors\n");
+    fflush(stdout);
+
+    MPI_Finalize();
+    return errs;
+}
@@ -0,0 +1,241 @@
+/*
+bench_reduce_scatter
+
+   MPI_Reduce_scatter against the halving, pairwise and ring algorithms
+   of reduce_scatter_engine.h, for balanced and irregular block sizes.
+
+Usage
+
+   mpirun -n 4 ./bench_reduce_scatter [-dist balanced|skewed|zipf|sparse|all]
+                                      [-min 1K] [-max 4M] [-reps 20]
+
+Remarks
+
+   Sizes are the total bytes of doubles every rank contributes (the sum
+   of recvcounts), split into blocks by -dist:
+
+   balanced  size/p doubles per rank
+   skewed    half of the data to rank 0, the rest evenly to the others
+   zipf      block i proportional to 1/(i+1)
+   sparse    only the even ranks receive; odd ranks get zero doubles
+
+   The table gives the time per call in us (slowest rank, averaged over
+   -reps) of MPI_Reduce_scatter, RS_HALVING, RS_PAIRWISE, RS_RING and
+   RS_AUTO with MPI_SUM, and the algorithm RS_AUTO picked. Every
+   algorithm's result is checked at each size before timing. Once, at
+   the first size of each distribution, every algorithm is also run
+   with MPI_IN_PLACE and with a non-commutative user operation (affine
+   map composition on pairs of doubles), whose results must match
+   MPI_Reduce_scatter's exactly.
+*/
+
+#include "mpi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench_util.h"
+#include "reduce_scatter_engine.h"
+
+#define MIN_BYTES 1024
+#define MAX_BYTES (4*1024*1024)
+#define REPS 20
+
+#define NUM_DISTS 4
+enum { D_BALANCED, D_SKEWED, D_ZIPF, D_SPARSE };
+static const char *dist_names[NUM_DISTS] = { "balanced", "skewed", "zipf", "sparse" };
+
+#define NUM_ALGS 5
+static const int algs[NUM_ALGS] = { -1, RS_HALVING, RS_PAIRWISE, RS_RING, RS_AUTO };
+
+/* Split total elements into size blocks following dist; the last block takes the rounding */
+static void make_counts(int dist, int total, int size, int *counts)
+{
+    int i, used = 0;
+    double hsum = 0.0;
+
+    for (i=1; i<=size; i++) hsum += 1.0 / i;
+    for (i=0; i<size; i++)
+    {
+        switch (dist)
+        {
+        case D_SKEWED:
+            counts[i] = (size == 1) ? total : (i == 0) ? total / 2 : (total - total / 2) / (size - 1);
+            break;
+        case D_ZIPF:
+            counts[i] = (int) (total / hsum / (i + 1));
+            break;
+        case D_SPARSE:
+            counts[i] = (i % 2 == 0) ? total / ((size + 1) / 2) : 0;
+            break;
+        default:
+            counts[i] = total / size;
+            break;
+        }
+        used += counts[i];
+    }
+    for (i=size-1; i>=0 && used < total; i--)
+    {
+        if (dist == D_SPARSE && i % 2) continue;
+        counts[i] += total - used;
+        used = total;
+    }
+}
+
+static void run(int alg, const void *in, void *out, const int *counts, MPI_Datatype type, MPI_Op op)
+{
+    if (alg < 0) MPI_Reduce_scatter(in, out, counts, type, op, MPI_COMM_WORLD);
+    else rs_reduce_scatter(in, out, counts, type, op, MPI_COMM_WORLD, alg);
+}
+
+static int compare(const double *got, const double *want, int n, int rank, const char *dist, int alg,
+                   const char *what)
+{
+    int i;
+    for (i=0; i<n; i++)
+    {
+        if (got[i] == want[i]) continue;
+        fprintf(stderr, "(%d) %s %s %s: [%d] = %g, expected %g\n", rank, dist, rs_name(alg), what, i, got[i],
+                want[i]);
+        fflush(stderr);
+        return 1;
+    }
+    return 0;
+}
+
+/* MPI_IN_PLACE and a non-commutative op for every algorithm, against MPI_Reduce_scatter */
+static int check_extras(const int *counts, int total, int rank, const char *dist, MPI_Datatype pair,
+                        MPI_Op op_affine)
+{
+    int i, a, errs = 0;
+    double *in = (double *) malloc(2 * ((size_t) total + 1) * sizeof(double));
+    double *ref = (double *) malloc(2 * ((size_t) total + 1) * sizeof(double));
+    double *out = (double *) malloc(2 * ((size_t) total + 1) * sizeof(double));
+
+    for (i=0; i<total; i++)
+    {
+        in[2*i] = ((rank + i) % 3 == 0) ? -1.0 : 1.0;
+        in[2*i+1] = (double) ((rank * 5 + i) % 7);
+    }
+    run(-1, in, ref, counts, pair, op_affine);
+    for (a=1; a<NUM_ALGS; a++)
+    {
+        memset(out, 0, 2 * (size_t) counts[rank] * sizeof(double));
+        run(algs[a], in, out, counts, pair, op_affine);
+        errs += compare(out, ref, 2 * counts[rank], rank, dist, algs[a], "non-commutative");
+    }
+
+    for (i=0; i<total; i++) in[i] = (double) ((rank + i) % 5);
+    run(-1, in, ref, counts, MPI_DOUBLE, MPI_SUM);
+    for (a=1; a<NUM_ALGS; a++)
+    {
+        for (i=0; i<total; i++) out[i] = (double) ((rank + i) % 5);
+        run(algs[a], MPI_IN_PLACE, out, counts, MPI_DOUBLE, MPI_SUM);
+        errs += compare(out, ref, counts[rank], rank, dist, algs[a], "in place");
+    }
+    free(in);
+    free(ref);
+    free(out);
+    return errs;
+}
+
+int main( int argc, char **argv )
+{
+    int rank, size, reps, dist, first, last, a, r, i, s, total, maxtotal, *counts, errs = 0, tot_errs;
+    long long bytes, minb, maxb;
+    const char *distname;
+    double *in, *out, *want, t, tmax[NUM_ALGS];
+    MPI_Datatype pair;
+    MPI_Op op_affine;
+
+    MPI_Init( &argc, &argv );
+    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+    MPI_Comm_size( MPI_COMM_WORLD, &size );
+
+    distname = bench_arg(argc, argv, "-dist");
+    minb = bench_arg_size(argc, argv, "-min", MIN_BYTES);
+    maxb = bench_arg_size(argc, argv, "-max", MAX_BYTES);
+    reps = bench_arg_int(argc, argv, "-reps", REPS);
+    if (minb < (long long) sizeof(double)) minb = sizeof(double);
+    if (maxb < minb) maxb = minb;
+    if (reps < 1) reps = 1;
+    first = 0;
+    last = NUM_DISTS - 1;
+    for (dist=0; distname && dist<NUM_DISTS; dist++)
+        if (strcmp(distname, dist_names[dist]) == 0) first = last = dist;
+
+    MPI_Type_contiguous(2, MPI_DOUBLE, &pair);
+    MPI_Type_commit(&pair);
+    MPI_Op_create(bench_affine_op, 0, &op_affine);
+
+    maxtotal = (int) (maxb / sizeof(double));
+    counts = (int *) malloc(size * sizeof(int));
+    in   = (double *) malloc(((size_t) maxtotal + 1) * sizeof(double));
+    out  = (double *) malloc(((size_t) maxtotal + 1) * sizeof(double));
+    want = (double *) malloc(((size_t) maxtotal + 1) * sizeof(double));
+
+    if (rank == 0)
+    {
+        printf("# %d processes, MPI_SUM on doubles, -reps %d\n", size, reps);
+        printf("# %-8s %10s %10s %12s %12s %12s %12s %12s %9s\n", "dist", "bytes", "max block",
+               "MPI_RS", "halving", "pairwise", "ring", "auto", "picked");
+        fflush(stdout);
+    }
+
+    for (dist=first; dist<=last; dist++)
+    {
+        for (bytes=minb; bytes<=maxb; bytes*=4)
+        {
+            int maxc = 0, off = 0;
+
+            total = (int) (bytes / sizeof(double));
+            make_counts(dist, total, size, counts);
+            for (i=0; i<size; i++)
+            {
+                if (counts[i] > maxc) maxc = counts[i];
+                if (i < rank) off += counts[i];
+            }
+            if (bytes == minb) errs += check_extras(counts, total, rank, dist_names[dist], pair, op_affine);
+
+            /* Element j of rank s is (s + j) % 5; my block of the sum is known in closed form */
+            for (i=0; i<total; i++) in[i] = (double) ((rank + i) % 5);
+            for (i=0; i<counts[rank]; i++)
+                for (s=0, want[i]=0.0; s<size; s++) want[i] += (double) ((s + off + i) % 5);
+            for (a=0; a<NUM_ALGS; a++)
+            {
+                memset(out, 0, ((size_t) counts[rank] + 1) * sizeof(double));
+                run(algs[a], in, out, counts, MPI_DOUBLE, MPI_SUM);
+                errs += compare(out, want, counts[rank], rank, dist_names[dist], algs[a], "sum");
+            }
+
+            for (a=0; a<NUM_ALGS; a++)
+            {
+                MPI_Barrier(MPI_COMM_WORLD);
+                t = MPI_Wtime();
+                for (r=0; r<reps; r++) run(algs[a], in, out, counts, MPI_DOUBLE, MPI_SUM);
+                tmax[a] = bench_max_time((MPI_Wtime() - t) / reps, 0, MPI_COMM_WORLD);
+            }
+            if (rank == 0)
+            {
+                printf("  %-8s %10lld %10lld", dist_names[dist], (long long) total * (long long) sizeof(double),
+                       (long long) maxc * (long long) sizeof(double));
+                for (a=0; a<NUM_ALGS; a++) printf(" %12.2f", tmax[a] * 1e6);
+                printf(" %9s\n", rs_name(rs_choose(counts, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD)));
+                fflush(stdout);
+            }
+        }
+    }
+
+    MPI_Op_free(&op_affine);
+    MPI_Type_free(&pair);
+    free(counts);
+    free(in);
+    free(out);
+    free(want);
+
+    MPI_Reduce( &errs, &tot_errs, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD );
+    if (rank == 0 && tot_errs == 0) printf(" No Errors\n");
+    fflush(stdout);
+
+    MPI_Finalize();
+    return errs;
+}
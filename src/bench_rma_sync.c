@@ -0,0 +1,286 @@
+/*
+bench_rma_sync
+
+   Cost of the RMA synchronization modes for one neighbor exchange:
+   fence, post/start/complete/wait and passive-target locks, with the
+   same puts, gets or accumulates issued in every epoch.
+
+Usage
+
+   mpirun -n 4 ./bench_rma_sync [-op put|get|acc|all] [-min 8] [-max 1M]
+                                [-reps 100] [-warmup 10]
+
+Remarks
+
+   The ranks form a periodic ring. In every epoch each rank moves one
+   message of the current size (doubles) to or from each of its two
+   neighbors: into the right neighbor's slot 0 and the left neighbor's
+   slot 1 (put, acc with MPI_SUM), or out of the left neighbor's slot 0
+   and the right neighbor's slot 1 (get). The window is created on
+   MPI_Alloc_mem memory.
+
+   fence     MPI_Win_fence(0) closes one epoch and opens the next
+   pscw      MPI_Win_post/start to the neighbors, MPI_Win_complete/wait
+   lock      MPI_Win_lock(MPI_LOCK_SHARED)/MPI_Win_unlock per neighbor
+   lockall   one MPI_Win_lock_all for the run, MPI_Win_flush_all per epoch
+
+   fence and pscw also tell the target that its data has arrived; the
+   passive modes do not, so a halo exchange built on them needs a
+   notification on top (a barrier, a flag put, or a message), which
+   this benchmark does not add. The lock epochs use MPI_LOCK_SHARED,
+   which is enough here because no two origins touch the same slot.
+
+   The first table is the time of an epoch with no operations, the bare
+   synchronization cost of each mode. Then for each size: the time per
+   epoch in us (slowest rank, averaged over -reps after -warmup) and
+   the bandwidth per rank in MB/s, counting both neighbor messages.
+   The window contents are checked after every run.
+*/
+
+#include "mpi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench_util.h"
+
+#define MIN_BYTES 8
+#define MAX_BYTES (1024*1024)
+#define REPS 100
+#define WARMUP 10
+
+#define NUM_MODES 4
+enum { M_FENCE, M_PSCW, M_LOCK, M_LOCKALL };
+static const char *mode_names[NUM_MODES] = { "fence", "pscw", "lock", "lockall" };
+
+#define NUM_OPS 3
+enum { OP_PUT, OP_GET, OP_ACC };
+static const char *op_names[NUM_OPS] = { "put", "get", "acc" };
+
+typedef struct
+{
+    MPI_Win win;
+    MPI_Group nbrs;
+    double *base;               /* window: slot 0 and slot 1, maxn doubles each */
+    double *obuf, *gbuf;        /* origin data and get targets (2 x maxn) */
+    int rank, size, left, right, maxn;
+} ring_t;
+
+/* Operations of one epoch aimed at target t: as its left neighbor, its right, or both */
+static void issue(ring_t *g, int op, int n, int t)
+{
+    if (t == g->right)
+    {
+        if (op == OP_PUT) MPI_Put(g->obuf, n, MPI_DOUBLE, t, 0, n, MPI_DOUBLE, g->win);
+        if (op == OP_ACC) MPI_Accumulate(g->obuf, n, MPI_DOUBLE, t, 0, n, MPI_DOUBLE, MPI_SUM, g->win);
+        if (op == OP_GET) MPI_Get(g->gbuf + g->maxn, n, MPI_DOUBLE, t, g->maxn, n, MPI_DOUBLE, g->win);
+    }
+    if (t == g->left)
+    {
+        if (op == OP_PUT) MPI_Put(g->obuf, n, MPI_DOUBLE, t, g->maxn, n, MPI_DOUBLE, g->win);
+        if (op == OP_ACC) MPI_Accumulate(g->obuf, n, MPI_DOUBLE, t, g->maxn, n, MPI_DOUBLE, MPI_SUM, g->win);
+        if (op == OP_GET) MPI_Get(g->gbuf, n, MPI_DOUBLE, t, 0, n, MPI_DOUBLE, g->win);
+    }
+}
+
+/* Run iters epochs of n doubles per neighbor in the given mode; n == 0 means empty epochs */
+static double run_epochs(ring_t *g, int mode, int op, int n, int iters)
+{
+    int it;
+    double t;
+
+    if (iters == 0) return 0.0;
+    MPI_Barrier(MPI_COMM_WORLD);
+    t = MPI_Wtime();
+    switch (mode)
+    {
+    case M_FENCE:
+        MPI_Win_fence(MPI_MODE_NOPRECEDE, g->win);
+        for (it=0; it<iters; it++)
+        {
+            if (n) { issue(g, op, n, g->right); if (g->left != g->right) issue(g, op, n, g->left); }
+            MPI_Win_fence(it == iters - 1 ? MPI_MODE_NOSUCCEED : 0, g->win);
+        }
+        break;
+    case M_PSCW:
+        for (it=0; it<iters; it++)
+        {
+            MPI_Win_post(g->nbrs, 0, g->win);
+            MPI_Win_start(g->nbrs, 0, g->win);
+            if (n) { issue(g, op, n, g->right); if (g->left != g->right) issue(g, op, n, g->left); }
+            MPI_Win_complete(g->win);
+            MPI_Win_wait(g->win);
+        }
+        break;
+    case M_LOCK:
+        for (it=0; it<iters; it++)
+        {
+            MPI_Win_lock(MPI_LOCK_SHARED, g->right, 0, g->win);
+            if (n) issue(g, op, n, g->right);
+            MPI_Win_unlock(g->right, g->win);
+            if (g->left == g->right) continue;
+            MPI_Win_lock(MPI_LOCK_SHARED, g->left, 0, g->win);
+            if (n) issue(g, op, n, g->left);
+            MPI_Win_unlock(g->left, g->win);
+        }
+        break;
+    case M_LOCKALL:
+        MPI_Win_lock_all(0, g->win);
+        for (it=0; it<iters; it++)
+        {
+            if (n) { issue(g, op, n, g->right); if (g->left != g->right) issue(g, op, n, g->left); }
+            MPI_Win_flush_all(g->win);
+        }
+        MPI_Win_unlock_all(g->win);
+        break;
+    }
+    t = MPI_Wtime() - t;
+    MPI_Barrier(MPI_COMM_WORLD);
+    return t;
+}
+
+/* Window of this rank set to v, through an epoch on ourselves */
+static void reset_window(ring_t *g, double v)
+{
+    int i;
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, g->rank, 0, g->win);
+    for (i=0; i<2*g->maxn; i++) g->base[i] = v;
+    MPI_Win_unlock(g->rank, g->win);
+    for (i=0; i<2*g->maxn; i++) g->gbuf[i] = -1.0;
+    MPI_Barrier(MPI_COMM_WORLD);
+}
+
+static int check(ring_t *g, int op, int n, int epochs)
+{
+    int i, s, errs = 0;
+    double want[2], got;
+
+    /* Slot 0 is written by the left neighbor, slot 1 by the right; gets read them back */
+    want[0] = (op == OP_ACC) ? (double) epochs * (g->left + 1) : g->left + 1;
+    want[1] = (op == OP_ACC) ? (double) epochs * (g->right + 1) : g->right + 1;
+    MPI_Win_lock(MPI_LOCK_SHARED, g->rank, 0, g->win);
+    for (s=0; s<2; s++)
+    {
+        for (i=0; i<n; i++)
+        {
+            got = (op == OP_GET) ? g->gbuf[s * g->maxn + i] : g->base[s * g->maxn + i];
+            if (got != want[s])
+            {
+                if (errs++ < 5)
+                {
+                    fprintf(stderr, "(%d) %s, %d doubles, slot %d [%d]: %g, expected %g\n",
+                            g->rank, op_names[op], n, s, i, got, want[s]);
+                    fflush(stderr);
+                }
+            }
+        }
+    }
+    MPI_Win_unlock(g->rank, g->win);
+    return errs;
+}
+
+int main( int argc, char **argv )
+{
+    int rank, size, m, op, i, n, reps, warmup, errs = 0, tot_errs, nn, nbr[2];
+    long long minb, maxb, bytes;
+    const char *opname;
+    double t[NUM_MODES];
+    MPI_Group world_group;
+    ring_t g;
+
+    MPI_Init( &argc, &argv );
+    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+    MPI_Comm_size( MPI_COMM_WORLD, &size );
+
+    minb   = bench_arg_size(argc, argv, "-min", MIN_BYTES);
+    maxb   = bench_arg_size(argc, argv, "-max", MAX_BYTES);
+    reps   = bench_arg_int(argc, argv, "-reps", REPS);
+    warmup = bench_arg_int(argc, argv, "-warmup", WARMUP);
+    opname = bench_arg(argc, argv, "-op");
+    if (minb < (long long) sizeof(double)) minb = sizeof(double);
+    if (maxb < minb) maxb = minb;
+    if (reps < 1) reps = 1;
+    if (warmup < 0) warmup = 0;
+
+    g.rank = rank;
+    g.size = size;
+    g.left = (rank - 1 + size) % size;
+    g.right = (rank + 1) % size;
+    g.maxn = (int) (maxb / sizeof(double));
+    if (MPI_Alloc_mem(2 * g.maxn * sizeof(double), MPI_INFO_NULL, &g.base) != MPI_SUCCESS)
+    {
+        fprintf(stderr, "(%d) MPI_Alloc_mem failed\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    g.obuf = (double *) malloc(g.maxn * sizeof(double));
+    g.gbuf = (double *) malloc(2 * g.maxn * sizeof(double));
+    for (i=0; i<g.maxn; i++) g.obuf[i] = rank + 1;
+    MPI_Win_create(g.base, 2 * g.maxn * sizeof(double), sizeof(double), MPI_INFO_NULL,
+                   MPI_COMM_WORLD, &g.win);
+
+    nbr[0] = g.left;
+    nbr[1] = g.right;
+    nn = (g.left == g.right) ? 1 : 2;
+    MPI_Comm_group(MPI_COMM_WORLD, &world_group);
+    MPI_Group_incl(world_group, nn, nbr, &g.nbrs);
+    MPI_Group_free(&world_group);
+
+    for (m=0; m<NUM_MODES; m++)
+    {
+        run_epochs(&g, m, OP_PUT, 0, warmup);
+        t[m] = bench_max_time(run_epochs(&g, m, OP_PUT, 0, reps), 0, MPI_COMM_WORLD) / reps;
+    }
+    if (rank == 0)
+    {
+        printf("# %d processes in a ring; -reps %d, -warmup %d\n", size, reps, warmup);
+        printf("# empty epoch (us):");
+        for (m=0; m<NUM_MODES; m++) printf(" %s %.2f", mode_names[m], t[m] * 1e6);
+        printf("\n");
+        fflush(stdout);
+    }
+
+    for (op=0; op<NUM_OPS; op++)
+    {
+        if (opname && strcmp(opname, "all") != 0 && strcmp(opname, op_names[op]) != 0) continue;
+        if (rank == 0)
+        {
+            printf("# %-4s %8s", op_names[op], "bytes");
+            for (m=0; m<NUM_MODES; m++) printf(" %9s", mode_names[m]);
+            for (m=0; m<NUM_MODES; m++) printf(" %9s", "MB/s");
+            printf("\n");
+            fflush(stdout);
+        }
+        for (bytes=minb; bytes<=maxb; bytes*=4)
+        {
+            n = (int) (bytes / sizeof(double));
+            for (m=0; m<NUM_MODES; m++)
+            {
+                reset_window(&g, op == OP_GET ? rank + 1 : 0.0);
+                run_epochs(&g, m, op, n, warmup);
+                t[m] = bench_max_time(run_epochs(&g, m, op, n, reps), 0, MPI_COMM_WORLD) / reps;
+                errs += check(&g, op, n, warmup + reps);
+            }
+            if (rank == 0)
+            {
+                printf("  %-4s %8lld", op_names[op], (long long) n * (long long) sizeof(double));
+                for (m=0; m<NUM_MODES; m++) printf(" %9.2f", t[m] * 1e6);
+                for (m=0; m<NUM_MODES; m++)
+                    printf(" %9.1f", bench_mbps(2.0 * n * sizeof(double), t[m]));
+                printf("\n");
+                fflush(stdout);
+            }
+        }
+    }
+
+    MPI_Group_free(&g.nbrs);
+    MPI_Win_free(&g.win);
+    MPI_Free_mem(g.base);
+    free(g.obuf);
+    free(g.gbuf);
+
+    MPI_Reduce( &errs, &tot_errs, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD );
+    if (rank == 0 && tot_errs == 0) printf(" No Errors\n");
+    fflush(stdout);
+
+    MPI_Finalize();
+    return errs;
+}
@@ -0,0 +1,321 @@
+/*
+bench_rooted
+
+   MPI_Gather, MPI_Gatherv, MPI_Scatter and MPI_Scatterv against the
+   binomial and linear algorithms of rooted_coll.h, on growing
+   communicators and for balanced and skewed block sizes.
+
+Usage
+
+   mpirun -n 16 ./bench_rooted [-n 1K] [-reps 20] [-root 0]
+
+Remarks
+
+   Every row runs on the first p ranks of MPI_COMM_WORLD, p = 2, 4, 8, ...
+   and finally all of them. Blocks hold doubles; -n is the per-rank
+   block of gather and scatter and sets the v-variants' counts by -dist:
+
+   uniform   n per rank
+   skewed    n*p/2 for the last rank, n/2 for the others: one rank
+             holds about half of the data
+   tiny      0 to 3 doubles per rank (n is ignored), the many-tiny-
+             blocks case of diagnostics gathered from every rank
+
+   The table gives the total bytes and the time per call in us (slowest
+   rank, averaged over -reps) of the MPI function, RC_BINOMIAL,
+   RC_LINEAR and RC_AUTO, and the algorithm RC_AUTO picked. Before
+   timing, every algorithm's result is checked, with and without
+   MPI_IN_PLACE at the root, and gather is also run with a strided
+   MPI_Type_vector send type into contiguous memory at the root. A
+   binomial gatherv of RC_CHUNK/2-byte blocks checks that the root
+   never stages more than one chunk (rc_staged_max) on any p.
+*/
+
+#include "mpi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench_util.h"
+#include "rooted_coll.h"
+
+#define BLOCK 1024
+#define REPS 20
+
+#define NUM_OPS 4
+enum { OP_GATHER, OP_GATHERV, OP_SCATTER, OP_SCATTERV };
+static const char *op_names[NUM_OPS] = { "gather", "gatherv", "scatter", "scatterv" };
+
+#define NUM_DISTS 3
+enum { D_UNIFORM, D_SKEWED, D_TINY };
+static const char *dist_names[NUM_DISTS] = { "uniform", "skewed", "tiny" };
+
+#define NUM_ALGS 4
+static const int algs[NUM_ALGS] = { -1, RC_BINOMIAL, RC_LINEAR, RC_AUTO };
+
+typedef struct
+{
+    MPI_Comm comm;
+    int rank, size, root, n;
+    int *counts, *displs, total;
+    double *mine, *all;         /* my block; everyone's, at the root */
+} data_t;
+
+static int count_of(int dist, int n, int r, int p)
+{
+    switch (dist)
+    {
+    case D_SKEWED: return (r == p - 1) ? n * p / 2 : n / 2;
+    case D_TINY:   return (r * 7 + 3) % 4;
+    default:       return n;
+    }
+}
+
+/* Element i of rank r's block */
+static double value(int r, int i)
+{
+    return (double) r * 1048576.0 + i;
+}
+
+static void setup(data_t *d, int dist)
+{
+    int r;
+    for (r=0, d->total=0; r<d->size; r++)
+    {
+        d->counts[r] = count_of(dist, d->n, r, d->size);
+        d->displs[r] = d->total;
+        d->total += d->counts[r];
+    }
+    d->mine = (double *) realloc(d->mine, ((size_t) d->counts[d->rank] + 1) * sizeof(double));
+    d->all  = (double *) realloc(d->all, ((size_t) d->total + 1) * sizeof(double));
+}
+
+static void run(int op, int alg, data_t *d, int inplace)
+{
+    int c = d->counts[d->rank];
+    int at_root = inplace && d->rank == d->root;
+    double *mine = at_root ? MPI_IN_PLACE : d->mine, *all = d->all;
+
+    switch (op)
+    {
+    case OP_GATHER:
+        if (alg < 0) MPI_Gather(mine, c, MPI_DOUBLE, all, d->n, MPI_DOUBLE, d->root, d->comm);
+        else rc_gather(mine, c, MPI_DOUBLE, all, d->n, MPI_DOUBLE, d->root, d->comm, alg);
+        break;
+    case OP_GATHERV:
+        if (alg < 0) MPI_Gatherv(mine, c, MPI_DOUBLE, all, d->counts, d->displs, MPI_DOUBLE, d->root, d->comm);
+        else rc_gatherv(mine, c, MPI_DOUBLE, all, d->counts, d->displs, MPI_DOUBLE, d->root, d->comm, alg);
+        break;
+    case OP_SCATTER:
+        if (alg < 0) MPI_Scatter(all, d->n, MPI_DOUBLE, mine, c, MPI_DOUBLE, d->root, d->comm);
+        else rc_scatter(all, d->n, MPI_DOUBLE, mine, c, MPI_DOUBLE, d->root, d->comm, alg);
+        break;
+    default:
+        if (alg < 0)
+            MPI_Scatterv(all, d->counts, d->displs, MPI_DOUBLE, mine, c, MPI_DOUBLE, d->root, d->comm);
+        else rc_scatterv(all, d->counts, d->displs, MPI_DOUBLE, mine, c, MPI_DOUBLE, d->root, d->comm, alg);
+        break;
+    }
+}
+
+static int report_err(const data_t *d, int op, const char *dist, int alg, int inplace, int r, int i,
+                      double got)
+{
+    fprintf(stderr, "(%d) %s %s %s%s, p=%d: rank %d [%d] = %g, expected %g\n", d->rank, op_names[op], dist,
+            alg < 0 ? "MPI" : rc_name(alg), inplace ? " in place" : "", d->size, r, i, got, value(r, i));
+    fflush(stderr);
+    return 1;
+}
+
+static int check(int op, int alg, data_t *d, const char *dist, int inplace)
+{
+    int r, i, c = d->counts[d->rank];
+    int gather = (op == OP_GATHER || op == OP_GATHERV);
+
+    /* Inputs hold the values, outputs -1; an in-place root block starts (and must end) in place */
+    for (i=0; i<c; i++) d->mine[i] = gather ? value(d->rank, i) : -1.0;
+    for (r=0; r<d->size; r++)
+        for (i=0; i<d->counts[r]; i++)
+            d->all[d->displs[r] + i] = (!gather || (inplace && r == d->root)) ? value(r, i) : -1.0;
+    run(op, alg, d, inplace);
+
+    if (gather)
+    {
+        if (d->rank != d->root) return 0;
+        for (r=0; r<d->size; r++)
+            for (i=0; i<d->counts[r]; i++)
+                if (d->all[d->displs[r] + i] != value(r, i))
+                    return report_err(d, op, dist, alg, inplace, r, i, d->all[d->displs[r] + i]);
+        return 0;
+    }
+    if (inplace && d->rank == d->root) return 0;
+    for (i=0; i<c; i++)
+        if (d->mine[i] != value(d->rank, i)) return report_err(d, op, dist, alg, inplace, d->rank, i, d->mine[i]);
+    return 0;
+}
+
+/* Gather n doubles at stride 2 from every rank into contiguous memory at the root */
+static int check_strided(int alg, data_t *d)
+{
+    int r, i, errs = 0;
+    double *in = (double *) malloc(2 * ((size_t) d->n + 1) * sizeof(double));
+    double *out = (double *) malloc(((size_t) d->n * d->size + 1) * sizeof(double));
+    MPI_Datatype vec;
+
+    MPI_Type_vector(d->n, 1, 2, MPI_DOUBLE, &vec);
+    MPI_Type_commit(&vec);
+    for (i=0; i<2*d->n; i++) in[i] = (i % 2) ? -2.0 : value(d->rank, i / 2);
+    for (i=0; i<d->n*d->size; i++) out[i] = -1.0;
+    rc_gather(in, 1, vec, out, d->n, MPI_DOUBLE, d->root, d->comm, alg);
+    if (d->rank == d->root)
+        for (r=0; r<d->size && !errs; r++)
+            for (i=0; i<d->n; i++)
+                if (out[r * d->n + i] != value(r, i))
+                {
+                    errs = report_err(d, OP_GATHER, "strided", alg, 0, r, i, out[r * d->n + i]);
+                    break;
+                }
+    MPI_Type_free(&vec);
+    free(in);
+    free(out);
+    return errs;
+}
+
+/* Binomial gatherv of half-chunk blocks: the root must stage at most one chunk, whatever p is */
+static int check_staging(data_t *d)
+{
+    int r, i, hdr, n = RC_CHUNK / 2 / (int) sizeof(double), errs = 0;
+    int *counts = (int *) malloc(d->size * sizeof(int));
+    int *displs = (int *) malloc(d->size * sizeof(int));
+    double *in = (double *) malloc((size_t) n * sizeof(double));
+    double *out = (double *) malloc((size_t) n * d->size * sizeof(double));
+
+    for (r=0; r<d->size; r++)
+    {
+        counts[r] = n;
+        displs[r] = r * n;
+    }
+    for (i=0; i<n; i++) in[i] = value(d->rank, i);
+    for (i=0; i<n*d->size; i++) out[i] = -1.0;
+    rc_staged_max = 0;
+    rc_gatherv(in, n, MPI_DOUBLE, out, counts, displs, MPI_DOUBLE, d->root, d->comm, RC_BINOMIAL);
+    if (d->rank == d->root)
+    {
+        MPI_Pack_size(1, MPI_INT, d->comm, &hdr);
+        for (r=0; r<d->size && !errs; r++)
+            for (i=0; i<n; i++)
+                if (out[r * n + i] != value(r, i))
+                {
+                    errs = report_err(d, OP_GATHERV, "staging", RC_BINOMIAL, 0, r, i, out[r * n + i]);
+                    break;
+                }
+        if (rc_staged_max > hdr + RC_CHUNK)
+        {
+            fprintf(stderr, "(%d) gatherv binomial, p=%d: root staged %lld bytes, limit %d\n", d->rank,
+                    d->size, rc_staged_max, hdr + RC_CHUNK);
+            fflush(stderr);
+            errs++;
+        }
+    }
+    free(counts);
+    free(displs);
+    free(in);
+    free(out);
+    return errs;
+}
+
+static int bench(int op, int dist, data_t *d, int reps, int world_rank)
+{
+    int a, r, errs = 0, picked;
+    double t, tmax[NUM_ALGS];
+
+    setup(d, dist);
+    for (a=0; a<NUM_ALGS; a++)
+    {
+        errs += check(op, algs[a], d, dist_names[dist], 0);
+        errs += check(op, algs[a], d, dist_names[dist], 1);
+    }
+    for (a=0; a<NUM_ALGS; a++)
+    {
+        run(op, algs[a], d, 0);
+        MPI_Barrier(d->comm);
+        t = MPI_Wtime();
+        for (r=0; r<reps; r++) run(op, algs[a], d, 0);
+        tmax[a] = bench_max_time((MPI_Wtime() - t) / reps, 0, d->comm);
+    }
+    if (op == OP_GATHERV || op == OP_SCATTERV) picked = rc_choose(0, 1, d->comm);
+    else picked = rc_choose((long long) d->n * sizeof(double), 0, d->comm);
+    if (world_rank == 0)
+    {
+        printf("  %-8s %-7s %6d %12lld", op_names[op], dist_names[dist], d->size,
+               (long long) d->total * (long long) sizeof(double));
+        for (a=0; a<NUM_ALGS; a++) printf(" %12.2f", tmax[a] * 1e6);
+        printf(" %9s\n", rc_name(picked));
+        fflush(stdout);
+    }
+    return errs;
+}
+
+int main( int argc, char **argv )
+{
+    int rank, size, reps, root, n, p, op, dist, errs = 0, tot_errs;
+    data_t d;
+
+    MPI_Init( &argc, &argv );
+    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+    MPI_Comm_size( MPI_COMM_WORLD, &size );
+
+    n    = (int) bench_arg_size(argc, argv, "-n", BLOCK);
+    reps = bench_arg_int(argc, argv, "-reps", REPS);
+    root = bench_arg_int(argc, argv, "-root", 0);
+    if (n < 1) n = 1;
+    if (reps < 1) reps = 1;
+    if (root < 0) root = 0;
+
+    memset(&d, 0, sizeof(d));
+    d.counts = (int *) malloc(size * sizeof(int));
+    d.displs = (int *) malloc(size * sizeof(int));
+    d.n = n;
+
+    if (rank == 0)
+    {
+        printf("# %d processes, blocks of %d doubles, -reps %d, window %d\n", size, n, reps, RC_WINDOW);
+        printf("# %-8s %-7s %6s %12s %12s %12s %12s %12s %9s\n", "op", "dist", "procs", "bytes", "MPI",
+               "binomial", "linear", "auto", "picked");
+        fflush(stdout);
+    }
+
+    for (p=2; ; p*=2)
+    {
+        if (p > size) p = size;
+        MPI_Comm_split(MPI_COMM_WORLD, rank < p ? 0 : MPI_UNDEFINED, rank, &d.comm);
+        if (d.comm != MPI_COMM_NULL)
+        {
+            MPI_Comm_rank(d.comm, &d.rank);
+            MPI_Comm_size(d.comm, &d.size);
+            d.root = root % p;
+            for (op=0; op<NUM_OPS; op++)
+            {
+                if (op == OP_GATHER || op == OP_SCATTER) errs += bench(op, D_UNIFORM, &d, reps, rank);
+                else for (dist=0; dist<NUM_DISTS; dist++) errs += bench(op, dist, &d, reps, rank);
+            }
+            setup(&d, D_UNIFORM);
+            errs += check_strided(RC_BINOMIAL, &d);
+            errs += check_strided(RC_LINEAR, &d);
+            errs += check_staging(&d);
+            MPI_Comm_free(&d.comm);
+        }
+        if (p == size) break;
+    }
+
+    free(d.counts);
+    free(d.displs);
+    free(d.mine);
+    free(d.all);
+
+    MPI_Reduce( &errs, &tot_errs, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD );
+    if (rank == 0 && tot_errs == 0) printf(" No Errors\n");
+    fflush(stdout);
+
+    MPI_Finalize();
+    return errs;
+}
@@ -0,0 +1,230 @@
+/*
+bench_scan
+
+   MPI_Scan against the recursive-doubling and pipelined scans of
+   scan_engine.h, for a predefined, a commutative user and a
+   non-commutative user operation, plus the segmented scan.
+
+Usage
+
+   mpirun -n 4 ./bench_scan [-min 8] [-max 4M] [-reps 20]
+
+Remarks
+
+   sum      MPI_SUM on doubles
+   usum     the same sum as an MPI_Op_create(commute=1) function
+   affine   composition of affine maps x -> a*x + b, one (a, b) pair of
+            doubles per element: associative, not commutative, the
+            operator of a linear recurrence y[t] = a[t]*y[t-1] + b[t]
+   segsum   segmented sum: flags set where (rank + i) % 3 == 0;
+            the MPI_Scan column runs a (flag, value) pair operator
+            through MPI_Scan, the others scan_segmented
+
+   For each size (bytes of data per rank) the table gives the time per
+   call in us of MPI_Scan, SCAN_RECDBL, SCAN_PIPELINE and SCAN_AUTO
+   (slowest rank, averaged over -reps) and the algorithm SCAN_AUTO
+   picked. Values are small integers (a = +-1 for affine), so every
+   algorithm must reproduce MPI_Scan's result exactly; each is checked
+   once per size before timing.
+*/
+
+#include "mpi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench_util.h"
+#include "scan_engine.h"
+
+#define MIN_BYTES 8
+#define MAX_BYTES (4*1024*1024)
+#define REPS 20
+
+#define NUM_OPS 4
+enum { OP_SUM, OP_USUM, OP_AFFINE, OP_SEGSUM };
+static const char *op_names[NUM_OPS] = { "sum", "usum", "affine", "segsum" };
+
+#define NUM_ALGS 4
+static const int algs[NUM_ALGS] = { -1, SCAN_RECDBL, SCAN_PIPELINE, SCAN_AUTO };
+
+static void usum(void *in, void *inout, int *len, MPI_Datatype *dtype)
+{
+    const double *a = (const double *) in;
+    double *b = (double *) inout;
+    int i;
+
+    (void) dtype;
+    for (i=0; i<*len; i++) b[i] += a[i];
+}
+
+/* (flag, value) pairs: a set flag on the higher operand stops the sum */
+static void segsum(void *in, void *inout, int *len, MPI_Datatype *dtype)
+{
+    const double *p = (const double *) in;
+    double *q = (double *) inout;
+    int i;
+
+    (void) dtype;
+    for (i=0; i<*len; i++)
+    {
+        if (q[2*i] == 0.0) q[2*i+1] += p[2*i+1];
+        if (p[2*i] != 0.0) q[2*i] = 1.0;
+    }
+}
+
+typedef struct
+{
+    MPI_Datatype type;          /* element type for the engine */
+    MPI_Op op;
+    MPI_Datatype ref_type;      /* for the MPI_Scan column */
+    MPI_Op ref_op;
+    int doubles;                /* doubles per element in the MPI_Scan column */
+} op_setup_t;
+
+/* Data for n elements of op: in (engine layout), ref_in (MPI_Scan layout) and flags */
+static void fill(int op, int n, int rank, double *in, double *ref_in, char *flags)
+{
+    int i;
+    for (i=0; i<n; i++)
+    {
+        double v = (double) ((rank + 3 * i) % 7);
+        switch (op)
+        {
+        case OP_AFFINE:
+            in[2*i] = ref_in[2*i] = ((rank + i) % 3 == 0) ? -1.0 : 1.0;
+            in[2*i+1] = ref_in[2*i+1] = v;
+            break;
+        case OP_SEGSUM:
+            flags[i] = ((rank + i) % 3 == 0);
+            in[i] = v;
+            ref_in[2*i] = flags[i];
+            ref_in[2*i+1] = v;
+            break;
+        default:
+            in[i] = ref_in[i] = v;
+            break;
+        }
+    }
+}
+
+static void run(int alg, int op, const op_setup_t *o, int n, const double *in, const double *ref_in,
+                const char *flags, double *out)
+{
+    if (alg < 0) MPI_Scan(ref_in, out, n, o->ref_type, o->ref_op, MPI_COMM_WORLD);
+    else if (op == OP_SEGSUM) scan_segmented(in, flags, out, n, o->type, o->op, MPI_COMM_WORLD, alg);
+    else scan_scan(in, out, n, o->type, o->op, MPI_COMM_WORLD, alg);
+}
+
+int main( int argc, char **argv )
+{
+    int rank, size, reps, op, a, r, i, n, maxn, stride, errs = 0, tot_errs;
+    long long bytes, minb, maxb;
+    double *in, *ref_in, *ref, *out, t, tmax[NUM_ALGS];
+    char *flags;
+    MPI_Datatype pair;
+    MPI_Op op_usum, op_affine, op_segsum;
+    op_setup_t setup[NUM_OPS];
+
+    MPI_Init( &argc, &argv );
+    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+    MPI_Comm_size( MPI_COMM_WORLD, &size );
+
+    minb = bench_arg_size(argc, argv, "-min", MIN_BYTES);
+    maxb = bench_arg_size(argc, argv, "-max", MAX_BYTES);
+    reps = bench_arg_int(argc, argv, "-reps", REPS);
+    if (minb < (long long) sizeof(double)) minb = sizeof(double);
+    if (maxb < minb) maxb = minb;
+    if (reps < 1) reps = 1;
+
+    MPI_Type_contiguous(2, MPI_DOUBLE, &pair);
+    MPI_Type_commit(&pair);
+    MPI_Op_create(usum, 1, &op_usum);
+    MPI_Op_create(bench_affine_op, 0, &op_affine);
+    MPI_Op_create(segsum, 0, &op_segsum);
+    setup[OP_SUM]    = (op_setup_t) { MPI_DOUBLE, MPI_SUM, MPI_DOUBLE, MPI_SUM, 1 };
+    setup[OP_USUM]   = (op_setup_t) { MPI_DOUBLE, op_usum, MPI_DOUBLE, op_usum, 1 };
+    setup[OP_AFFINE] = (op_setup_t) { pair, op_affine, pair, op_affine, 2 };
+    setup[OP_SEGSUM] = (op_setup_t) { MPI_DOUBLE, MPI_SUM, pair, op_segsum, 2 };
+
+    /* Room for maxb bytes of doubles, twice over for the pair layouts */
+    maxn = (int) (maxb / sizeof(double));
+    in     = (double *) malloc(2 * (size_t) maxn * sizeof(double));
+    ref_in = (double *) malloc(2 * (size_t) maxn * sizeof(double));
+    ref    = (double *) malloc(2 * (size_t) maxn * sizeof(double));
+    out    = (double *) malloc(2 * (size_t) maxn * sizeof(double));
+    flags  = (char *) malloc((size_t) maxn + 1);
+
+    if (rank == 0)
+    {
+        printf("# %d processes, -reps %d, segments of %d bytes\n", size, reps, SCAN_SEG_BYTES);
+        printf("# %-7s %10s %12s %12s %12s %12s %9s\n", "op", "bytes", "MPI_Scan", "recdbl", "pipeline",
+               "auto", "picked");
+        fflush(stdout);
+    }
+
+    for (op=0; op<NUM_OPS; op++)
+    {
+        const op_setup_t *o = &setup[op];
+        int esize = (op == OP_AFFINE) ? 2 : 1;
+
+        for (bytes=minb; bytes<=maxb; bytes*=4)
+        {
+            n = (int) (bytes / (esize * sizeof(double)));
+            if (n < 1) continue;
+            fill(op, n, rank, in, ref_in, flags);
+
+            /* Reference from MPI_Scan; the engine must match it exactly */
+            run(-1, op, o, n, in, ref_in, flags, ref);
+            stride = o->doubles;
+            for (a=1; a<NUM_ALGS; a++)
+            {
+                memset(out, 0, (size_t) n * esize * sizeof(double));
+                run(algs[a], op, o, n, in, ref_in, flags, out);
+                for (i=0; i<n * esize; i++)
+                {
+                    double want = (op == OP_SEGSUM) ? ref[i * stride + 1] : ref[i];
+                    if (out[i] == want) continue;
+                    if (errs++ < 5)
+                    {
+                        fprintf(stderr, "(%d) %s %s, %d elements: [%d] = %g, expected %g\n", rank,
+                                op_names[op], scan_name(algs[a]), n, i, out[i], want);
+                        fflush(stderr);
+                    }
+                    break;
+                }
+            }
+
+            for (a=0; a<NUM_ALGS; a++)
+            {
+                run(algs[a], op, o, n, in, ref_in, flags, out);
+                MPI_Barrier(MPI_COMM_WORLD);
+                t = MPI_Wtime();
+                for (r=0; r<reps; r++) run(algs[a], op, o, n, in, ref_in, flags, out);
+                tmax[a] = bench_max_time((MPI_Wtime() - t) / reps, 0, MPI_COMM_WORLD);
+            }
+            if (rank == 0)
+            {
+                printf("  %-7s %10lld", op_names[op], (long long) n * esize * (long long) sizeof(double));
+                for (a=0; a<NUM_ALGS; a++) printf(" %12.2f", tmax[a] * 1e6);
+                printf(" %9s\n", scan_name(scan_choose(n, o->type, MPI_COMM_WORLD)));
+                fflush(stdout);
+            }
+        }
+    }
+
+    MPI_Op_free(&op_usum);
+    MPI_Op_free(&op_affine);
+    MPI_Op_free(&op_segsum);
+    MPI_Type_free(&pair);
+    free(in);
+    free(ref_in);
+    free(ref);
+    free(out);
+    free(flags);
+
+    MPI_Reduce( &errs, &tot_errs, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD );
+    if (rank == 0 && tot_errs == 0) printf(" No Errors\n");
+    fflush(stdout);
+
+    MPI_Finalize();
+    return errs;
+}
@@ -0,0 +1,325 @@
+/*
+bench_transpose
+
+   Compares the zero-copy MPI_Alltoallw transpose of transpose.h with
+   the usual manual pack, MPI_Alltoall and unpack-with-local-transpose.
+
+Usage
+
+   mpirun -n 8 ./bench_transpose [-dims 2|3] [-n 4096|256] [-reps 20]
+                                 [-warmup 3]
+
+Remarks
+
+   2D: an n x n matrix of doubles with its rows split over all processes
+   is transposed into n x n with the columns' data as rows (a slab
+   transpose). 3D: an n^3 field on a p1 x p2 process grid from
+   MPI_Dims_create goes from x pencils (x contiguous) to y pencils
+   within each row of the grid and then to z pencils within each
+   column, as between the 1D FFT passes of a pencil-decomposed 3D FFT.
+   Without -dims both cases run; n defaults to 4096 in 2D and 256 in 3D
+   and is rounded up so that every block has the same size, which
+   MPI_Alltoall needs.
+
+   alltoallw
+          transpose_execute: one MPI_Alltoallw per transpose with
+          subarray send types and resized column receive types.
+
+   pack+alltoall
+          copy every destination's block into a contiguous send buffer,
+          MPI_Alltoall, then copy out of the receive buffer into the
+          transposed positions: two local copy passes per transpose.
+
+   The first run of each method is checked against the expected global
+   positions. Times are min/median/p99 over all ranks and repetitions;
+   GB/s is the global data volume moved per transpose (pass) divided by
+   the median time.
+*/
+
+#include "mpi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench_util.h"
+#include "transpose.h"
+
+#define NUM_REPS 20
+#define NUM_WARMUP 3
+#define N_2D 4096
+#define N_3D 256
+#define NUM_METHODS 2
+
+static const char *method_names[NUM_METHODS] = { "alltoallw", "pack+alltoall" };
+
+/* Gather each rank's share of the from axis into sbuf, rank by rank */
+static void pack_blocks(const transpose_t *t, const double *in, double *sbuf)
+{
+    int r, i0, i1, i2, off, len, sub[3], start[3], a;
+    const int *n = t->n;
+
+    for (r=0; r<t->size; r++)
+    {
+        transpose_block(n[t->from], t->size, r, &off, &len);
+        for (a=0; a<3; a++)
+        {
+            sub[a] = (a == t->from) ? len : n[a];
+            start[a] = (a == t->from) ? off : 0;
+        }
+        for (i0=0; i0<sub[0]; i0++)
+            for (i1=0; i1<sub[1]; i1++)
+            {
+                const double *src = in + ((size_t) (start[0] + i0) * n[1] + start[1] + i1) * n[2] + start[2];
+                for (i2=0; i2<sub[2]; i2++) *sbuf++ = src[i2];
+            }
+    }
+}
+
+/* Scatter every rank's block from rbuf into its transposed position in out */
+static void unpack_blocks(const transpose_t *t, const double *rbuf, double *out)
+{
+    int r, i0, i1, i2, off, len, mylen, sub[3], a;
+    const int *os = t->out_stride;
+
+    transpose_block(t->n[t->from], t->size, t->rank, &off, &mylen);
+    for (r=0; r<t->size; r++)
+    {
+        transpose_block(t->nto, t->size, r, &off, &len);
+        for (a=0; a<3; a++) sub[a] = (a == t->from) ? mylen : (a == t->to) ? len : t->n[a];
+        for (i0=0; i0<sub[0]; i0++)
+            for (i1=0; i1<sub[1]; i1++)
+            {
+                double *dst = out + (size_t) off * os[t->to] + (size_t) i0 * os[0] + (size_t) i1 * os[1];
+                for (i2=0; i2<sub[2]; i2++) dst[(size_t) i2 * os[2]] = *rbuf++;
+            }
+    }
+}
+
+static void transpose_pack(transpose_t *t, const double *in, double *out, double *sbuf, double *rbuf)
+{
+    int count = (int) (t->in_count / t->size);
+
+    pack_blocks(t, in, sbuf);
+    MPI_Alltoall(sbuf, count, MPI_DOUBLE, rbuf, count, MPI_DOUBLE, t->comm);
+    unpack_blocks(t, rbuf, out);
+}
+
+static double value(int x, int y, int z, int n)
+{
+    return ((double) z * n + y) * n + x;
+}
+
+static void report(int rank, const char *label, int m, double *samples, int reps, double bytes)
+{
+    bench_stats_t st;
+
+    bench_reduce_stats(samples, reps, 0, MPI_COMM_WORLD, &st);
+    if (rank == 0)
+    {
+        printf("  %-12s %-14s %12.1f %12.1f %12.1f %10.2f\n", label, method_names[m],
+               st.min * 1e6, st.median * 1e6, st.p99 * 1e6, bytes / st.median / 1e9);
+        fflush(stdout);
+    }
+}
+
+static int run_2d(int n, int reps, int warmup, int rank, int size)
+{
+    transpose_t t;
+    int m, r, i, j, xoff, xl, yoff, yl, errs = 0;
+    double *in, *out, *sbuf, *rbuf, *samples, t0;
+    char label[32];
+
+    n = (n + size - 1) / size * size;
+    transpose_create_2d(MPI_COMM_WORLD, n, n, MPI_DOUBLE, &t);
+    transpose_block(n, size, rank, &xoff, &xl);
+    transpose_block(n, size, rank, &yoff, &yl);
+
+    in   = (double *) malloc(t.in_count * sizeof(double));
+    out  = (double *) malloc(t.out_count * sizeof(double));
+    sbuf = (double *) malloc(t.in_count * sizeof(double));
+    rbuf = (double *) malloc(t.out_count * sizeof(double));
+    samples = (double *) malloc(reps * sizeof(double));
+    if (in == NULL || out == NULL || sbuf == NULL || rbuf == NULL)
+    {
+        fprintf(stderr, "(%d) Cannot allocate 4 x %lld doubles\n", rank, t.in_count);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    for (i=0; i<xl; i++)
+        for (j=0; j<n; j++) in[(size_t) i * n + j] = value(j, xoff + i, 0, n);
+
+    snprintf(label, sizeof(label), "2d %d^2", n);
+    for (m=0; m<NUM_METHODS; m++)
+    {
+        memset(out, 0, t.out_count * sizeof(double));
+        for (r=-1; r<warmup+reps; r++)
+        {
+            MPI_Barrier(MPI_COMM_WORLD);
+            t0 = MPI_Wtime();
+            if (m == 0) transpose_execute(&t, in, out);
+            else        transpose_pack(&t, in, out, sbuf, rbuf);
+            if (r >= warmup) samples[r - warmup] = MPI_Wtime() - t0;
+            if (r < 0)
+            {
+                /* Row j of the output is column yoff+j of the input */
+                int bad = 0;
+                for (j=0; j<yl; j++)
+                    for (i=0; i<n; i++)
+                        bad += (out[(size_t) j * n + i] != value(yoff + j, i, 0, n));
+                if (bad)
+                {
+                    fprintf(stderr, "(%d) %s: %d wrong elements in 2D transpose\n",
+                            rank, method_names[m], bad);
+                    fflush(stderr);
+                    errs++;
+                }
+            }
+        }
+        report(rank, label, m, samples, reps, (double) n * n * sizeof(double));
+    }
+
+    transpose_free(&t);
+    free(samples);
+    free(rbuf);
+    free(sbuf);
+    free(out);
+    free(in);
+    return errs;
+}
+
+static int run_3d(int n, int reps, int warmup, int rank, int size)
+{
+    transpose_t xy, yz;
+    int pdims[2] = { 0, 0 }, periods[2] = { 0, 0 }, c[2], m, r, ix, iy, iz, errs = 0;
+    int yoff, yl, zoff, zl, xoff, xl, y2off, y2l, xp[3];
+    const int x2y[3] = { 0, 2, 1 }, y2z[3] = { 2, 1, 0 };
+    double *in, *mid, *out, *sbuf, *rbuf, *samples, t0;
+    size_t maxcount;
+    MPI_Comm cart, row, col;
+    char label[32];
+
+    MPI_Dims_create(size, 2, pdims);
+    MPI_Cart_create(MPI_COMM_WORLD, 2, pdims, periods, 0, &cart);
+    MPI_Cart_coords(cart, rank, 2, c);
+    MPI_Comm_split(cart, c[1], c[0], &row);
+    MPI_Comm_split(cart, c[0], c[1], &col);
+
+    n = (n + pdims[0] * pdims[1] - 1) / (pdims[0] * pdims[1]) * (pdims[0] * pdims[1]);
+    transpose_block(n, pdims[0], c[0], &yoff, &yl);
+    transpose_block(n, pdims[1], c[1], &zoff, &zl);
+    transpose_block(n, pdims[0], c[0], &xoff, &xl);
+    transpose_block(n, pdims[1], c[1], &y2off, &y2l);
+
+    /* x pencil (z, y, x) -> y pencil (z, x, y) -> z pencil (y, x, z) */
+    xp[0] = zl;
+    xp[1] = yl;
+    xp[2] = n;
+    transpose_create(row, xp, 2, 1, n, x2y, MPI_DOUBLE, &xy);
+    transpose_create(col, xy.out_n, 2, 0, n, y2z, MPI_DOUBLE, &yz);
+
+    maxcount = xy.in_count;
+    if ((size_t) xy.out_count > maxcount) maxcount = xy.out_count;
+    if ((size_t) yz.out_count > maxcount) maxcount = yz.out_count;
+    in   = (double *) malloc(maxcount * sizeof(double));
+    mid  = (double *) malloc(maxcount * sizeof(double));
+    out  = (double *) malloc(maxcount * sizeof(double));
+    sbuf = (double *) malloc(maxcount * sizeof(double));
+    rbuf = (double *) malloc(maxcount * sizeof(double));
+    samples = (double *) malloc(reps * sizeof(double));
+    if (in == NULL || mid == NULL || out == NULL || sbuf == NULL || rbuf == NULL)
+    {
+        fprintf(stderr, "(%d) Cannot allocate 5 x %lld doubles\n", rank, (long long) maxcount);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    for (iz=0; iz<zl; iz++)
+        for (iy=0; iy<yl; iy++)
+            for (ix=0; ix<n; ix++)
+                in[((size_t) iz * yl + iy) * n + ix] = value(ix, yoff + iy, zoff + iz, n);
+
+    snprintf(label, sizeof(label), "3d %d^3", n);
+    if (rank == 0)
+    {
+        printf("# 3d pencils on a %dx%d grid\n", pdims[0], pdims[1]);
+        fflush(stdout);
+    }
+    for (m=0; m<NUM_METHODS; m++)
+    {
+        memset(out, 0, maxcount * sizeof(double));
+        for (r=-1; r<warmup+reps; r++)
+        {
+            MPI_Barrier(MPI_COMM_WORLD);
+            t0 = MPI_Wtime();
+            if (m == 0)
+            {
+                transpose_execute(&xy, in, mid);
+                transpose_execute(&yz, mid, out);
+            }
+            else
+            {
+                transpose_pack(&xy, in, mid, sbuf, rbuf);
+                transpose_pack(&yz, mid, out, sbuf, rbuf);
+            }
+            if (r >= warmup) samples[r - warmup] = MPI_Wtime() - t0;
+            if (r < 0)
+            {
+                int bad = 0;
+                for (iy=0; iy<y2l; iy++)
+                    for (ix=0; ix<xl; ix++)
+                        for (iz=0; iz<n; iz++)
+                            bad += (out[((size_t) iy * xl + ix) * n + iz] !=
+                                    value(xoff + ix, y2off + iy, iz, n));
+                if (bad)
+                {
+                    fprintf(stderr, "(%d) %s: %d wrong elements in 3D pencil transpose\n",
+                            rank, method_names[m], bad);
+                    fflush(stderr);
+                    errs++;
+                }
+            }
+        }
+        report(rank, label, m, samples, reps, 2.0 * n * n * n * sizeof(double));
+    }
+
+    transpose_free(&xy);
+    transpose_free(&yz);
+    free(samples);
+    free(rbuf);
+    free(sbuf);
+    free(out);
+    free(mid);
+    free(in);
+    MPI_Comm_free(&row);
+    MPI_Comm_free(&col);
+    MPI_Comm_free(&cart);
+    return errs;
+}
+
+int main( int argc, char **argv )
+{
+    int rank, size, dims, n, reps, warmup, errs = 0, tot_errs;
+
+    MPI_Init( &argc, &argv );
+    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+    MPI_Comm_size( MPI_COMM_WORLD, &size );
+
+    dims   = bench_arg_int(argc, argv, "-dims", 0);
+    n      = bench_arg_int(argc, argv, "-n", 0);
+    reps   = bench_arg_int(argc, argv, "-reps", NUM_REPS);
+    warmup = bench_arg_int(argc, argv, "-warmup", NUM_WARMUP);
+    if (reps < 1) reps = 1;
+
+    if (rank == 0)
+    {
+        printf("# %d processes, %d reps (+%d warmup), doubles\n", size, reps, warmup);
+        printf("# %-12s %-14s %12s %12s %12s %10s\n",
+               "case", "method", "min(us)", "median(us)", "p99(us)", "GB/s");
+        fflush(stdout);
+    }
+    if (dims != 3) errs += run_2d(n > 0 ? n : N_2D, reps, warmup, rank, size);
+    if (dims != 2) errs += run_3d(n > 0 ? n : N_3D, reps, warmup, rank, size);
+
+    MPI_Reduce( &errs, &tot_errs, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD );
+    if (rank == 0 && tot_errs == 0) printf(" No Errors\n");
+    fflush(stdout);
+
+    MPI_Finalize();
+    return errs;
+}
@@ -0,0 +1,221 @@
+/*
+bench_user_ops
+
+   Validates and times the vectorized user reduction operators of
+   user_ops.h.
+
+Usage
+
+   mpirun -n 4 ./bench_user_ops [-n 4M] [-reps 20]
+
+Remarks
+
+   Every (op, type) pair is first checked with MPI_Allreduce against the
+   matching predefined operation (MPI_SUM, MPI_PROD, MPI_MIN, MPI_MAX,
+   MPI_MAXLOC, and MPI_SUM on the flattened pairs for sum+sumsq).
+
+   Rank 0 then times each kernel locally on -n elements for every
+   instruction set the CPU supports, and compares the best one with
+   MPI_Reduce_local using the predefined op (the library's own kernel)
+   and with MPI_Reduce_local through the registered user op (the kernel
+   plus *dtype dispatch). Bandwidth counts the three streams a reduction
+   touches: read in, read inout, write inout.
+*/
+
+#include "mpi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench_util.h"
+#include "user_ops.h"
+
+#define NUM_ELEMS (4*1024*1024)
+#define NUM_REPS 20
+#define CHECK_ELEMS 1000
+
+static const MPI_Op predefined[USER_OP_COUNT] = { MPI_SUM, MPI_PROD, MPI_MIN, MPI_MAX, MPI_MAXLOC, MPI_SUM };
+
+/* Fill n elements of (op, t) with values whose reductions are exact */
+static void fill(user_op_kind op, user_type_kind t, void *buf, int n, int rank)
+{
+    int i;
+    for (i=0; i<n; i++)
+    {
+        int v = (op == USER_OP_PROD) ? ((i + rank) % 3 == 0 ? -1 : 1) : (i * 7 + rank * 13) % 101;
+        switch (t)
+        {
+        case USER_T_INT32:
+            if (op == USER_OP_MAXLOC) { ((user_pair_int32 *) buf)[i].v = v; ((user_pair_int32 *) buf)[i].i = rank; }
+            else if (op == USER_OP_SUMSQ) { ((int32_t *) buf)[2*i] = v; ((int32_t *) buf)[2*i+1] = v * v; }
+            else ((int32_t *) buf)[i] = v;
+            break;
+        case USER_T_INT64:
+            if (op == USER_OP_MAXLOC) { ((user_pair_int64 *) buf)[i].v = v; ((user_pair_int64 *) buf)[i].i = rank; }
+            else if (op == USER_OP_SUMSQ) { ((int64_t *) buf)[2*i] = v; ((int64_t *) buf)[2*i+1] = v * v; }
+            else ((int64_t *) buf)[i] = v;
+            break;
+        case USER_T_FLOAT:
+            if (op == USER_OP_MAXLOC) { ((user_pair_float *) buf)[i].v = v; ((user_pair_float *) buf)[i].i = rank; }
+            else if (op == USER_OP_SUMSQ) { ((float *) buf)[2*i] = v; ((float *) buf)[2*i+1] = v * v; }
+            else ((float *) buf)[i] = v;
+            break;
+        default:
+            if (op == USER_OP_MAXLOC) { ((user_pair_double *) buf)[i].v = v; ((user_pair_double *) buf)[i].i = rank; }
+            else if (op == USER_OP_SUMSQ) { ((double *) buf)[2*i] = v; ((double *) buf)[2*i+1] = v * v; }
+            else ((double *) buf)[i] = v;
+            break;
+        }
+    }
+}
+
+static int validate(int rank)
+{
+    int op, t, errs = 0;
+    MPI_Aint lb, extent;
+    char *in, *out, *ref;
+
+    /* Largest element is a double pair: 16 bytes */
+    in  = (char *) malloc(CHECK_ELEMS * 16);
+    out = (char *) malloc(CHECK_ELEMS * 16);
+    ref = (char *) malloc(CHECK_ELEMS * 16);
+
+    for (op=0; op<USER_OP_COUNT; op++)
+    {
+        for (t=0; t<USER_T_COUNT; t++)
+        {
+            MPI_Datatype dt = user_ops_type(op, t);
+            MPI_Type_get_extent(dt, &lb, &extent);
+            memset(in, 0, CHECK_ELEMS * 16);
+            memset(out, 0, CHECK_ELEMS * 16);
+            memset(ref, 0, CHECK_ELEMS * 16);
+            fill(op, t, in, CHECK_ELEMS, rank);
+
+            MPI_Allreduce(in, out, CHECK_ELEMS, dt, user_ops_get(op), MPI_COMM_WORLD);
+            if (op == USER_OP_SUMSQ)
+                MPI_Allreduce(in, ref, 2 * CHECK_ELEMS, user_ops_type(USER_OP_SUM, t),
+                              MPI_SUM, MPI_COMM_WORLD);
+            else
+                MPI_Allreduce(in, ref, CHECK_ELEMS, dt, predefined[op], MPI_COMM_WORLD);
+
+            if (memcmp(out, ref, CHECK_ELEMS * extent) != 0)
+            {
+                fprintf(stderr, "[%d] Error: user %s on %s differs from predefined op\n",
+                        rank, user_op_names[op], user_type_names[t]);
+                fflush(stderr);
+                errs++;
+            }
+        }
+    }
+    free(in);
+    free(out);
+    free(ref);
+    return errs;
+}
+
+static double time_kernel(user_kernel_fn *fn, void *in, void *inout, int n, int reps)
+{
+    int r;
+    double t0;
+
+    fn(in, inout, n);
+    t0 = MPI_Wtime();
+    for (r=0; r<reps; r++) fn(in, inout, n);
+    return (MPI_Wtime() - t0) / reps;
+}
+
+static double time_local(MPI_Op mop, MPI_Datatype dt, void *in, void *inout, int n, int reps)
+{
+    int r;
+    double t0;
+
+    MPI_Reduce_local(in, inout, n, dt, mop);
+    t0 = MPI_Wtime();
+    for (r=0; r<reps; r++) MPI_Reduce_local(in, inout, n, dt, mop);
+    return (MPI_Wtime() - t0) / reps;
+}
+
+static void throughput(int n, int reps)
+{
+    int op, t, isa, nisa;
+    MPI_Aint lb, extent;
+    char *in, *inout;
+    user_isa_kind best = user_ops_isa_best();
+
+    nisa = (int) best;
+
+    in    = (char *) malloc((size_t) n * 16);
+    inout = (char *) malloc((size_t) n * 16);
+
+    printf("# %d elements, %d reps, GB/s (3 streams); best ISA %s\n", n, reps, user_isa_names[best]);
+    printf("# %-7s %-7s", "op", "type");
+    for (isa=0; isa<=nisa; isa++) printf(" %9s", user_isa_names[isa]);
+    printf(" %9s %9s\n", "lib-op", "user-op");
+
+    for (op=0; op<USER_OP_COUNT; op++)
+    {
+        for (t=0; t<USER_T_COUNT; t++)
+        {
+            MPI_Datatype dt = user_ops_type(op, t);
+            double bytes, sec;
+            int kn = (op == USER_OP_SUMSQ) ? 2 * n : n;
+
+            MPI_Type_get_extent(dt, &lb, &extent);
+            bytes = 3.0 * n * extent;
+            fill(op, t, in, n, 0);
+            fill(op, t, inout, n, 1);
+
+            printf("  %-7s %-7s", user_op_names[op], user_type_names[t]);
+            for (isa=0; isa<=nisa; isa++)
+            {
+#ifndef USER_OPS_X86
+                if (isa != USER_ISA_GENERIC) { printf(" %9s", "-"); continue; }
+#endif
+                user_ops_force_isa(isa);
+                sec = time_kernel(user_ops_kernel(op, t), in, inout, kn, reps);
+                printf(" %9.2f", bytes / sec / 1e9);
+            }
+            user_ops_force_isa(best);
+
+            if (op == USER_OP_SUMSQ)
+                sec = time_local(MPI_SUM, user_ops_type(USER_OP_SUM, t), in, inout, 2 * n, reps);
+            else
+                sec = time_local(predefined[op], dt, in, inout, n, reps);
+            printf(" %9.2f", bytes / sec / 1e9);
+            sec = time_local(user_ops_get(op), dt, in, inout, n, reps);
+            printf(" %9.2f\n", bytes / sec / 1e9);
+            fflush(stdout);
+        }
+    }
+    free(in);
+    free(inout);
+}
+
+int main( int argc, char **argv )
+{
+    int rank, n, reps, errs, tot_errs;
+
+    MPI_Init( &argc, &argv );
+    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+
+    n    = (int) bench_arg_size(argc, argv, "-n", NUM_ELEMS);
+    reps = bench_arg_int(argc, argv, "-reps", NUM_REPS);
+    if (n < 1) n = NUM_ELEMS;
+    if (reps < 1) reps = 1;
+
+    user_ops_init();
+
+    errs = validate(rank);
+    MPI_Reduce( &errs, &tot_errs, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD );
+
+    if (rank == 0)
+    {
+        throughput(n, reps);
+        if (tot_errs == 0) printf(" No Errors\n");
+        fflush(stdout);
+    }
+    MPI_Barrier( MPI_COMM_WORLD );
+
+    user_ops_finalize();
+    MPI_Finalize();
+    return errs;
+}
@@ -0,0 +1,216 @@
+/*
+bench_util.h
+
+   Small header-only helpers shared by the timed examples in this
+   directory: message-size parsing, timing sample reduction across ranks
+   and a few formatting routines. Nothing here calls MPI_Init; every
+   routine assumes the caller has already initialized MPI.
+
+Usage
+
+   #include "bench_util.h"
+
+   bench_stats_t st;
+   double *samples = malloc(reps * sizeof(double));
+   ... fill samples[0..reps-1] with per-repetition times in seconds ...
+   bench_reduce_stats(samples, reps, 0, MPI_COMM_WORLD, &st);
+   if (rank == 0) printf("%g %g %g\n", st.min, st.median, st.p99);
+
+Remarks
+
+   bench_reduce_stats gathers every sample of every rank to the root and
+   computes order statistics there, so min/median/p99 are taken across
+   all ranks and all repetitions. Only the root's bench_stats_t is
+   filled in; the other ranks get zeros.
+
+   bench_affine_op is a non-commutative MPI_User_function for checking
+   user-level collectives against the library's with exact results.
+
+   Sizes accept an optional K, M or G suffix (powers of 1024), with or
+   without a trailing "iB" or "B", e.g. "64K", "1MiB", "4096".
+*/
+
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include "mpi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+typedef struct
+{
+    double min;
+    double median;
+    double p99;
+    double max;
+    double mean;
+    int    nsamples;
+} bench_stats_t;
+
+static inline int bench_cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/* Order statistic at fraction q (0..1) of an already sorted array */
+static inline double bench_quantile(const double *sorted, int n, double q)
+{
+    int idx;
+    if (n <= 0) return 0.0;
+    idx = (int) (q * (n - 1) + 0.5);
+    if (idx < 0) idx = 0;
+    if (idx > n - 1) idx = n - 1;
+    return sorted[idx];
+}
+
+static inline void bench_stats_local(double *samples, int n, bench_stats_t *st)
+{
+    int i;
+    double sum = 0.0;
+
+    memset(st, 0, sizeof(*st));
+    if (n <= 0) return;
+    qsort(samples, n, sizeof(double), bench_cmp_double);
+    for (i=0; i<n; i++) sum += samples[i];
+    st->min      = samples[0];
+    st->max      = samples[n-1];
+    st->median   = bench_quantile(samples, n, 0.5);
+    st->p99      = bench_quantile(samples, n, 0.99);
+    st->mean     = sum / n;
+    st->nsamples = n;
+}
+
+/* Gather nsamples timings from every rank to root and reduce them there.
+   nsamples must be the same on every rank. */
+static inline void bench_reduce_stats(const double *samples, int nsamples, int root,
+                                      MPI_Comm comm, bench_stats_t *st)
+{
+    int rank, size;
+    double *all = NULL;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    memset(st, 0, sizeof(*st));
+
+    if (rank == root)
+    {
+        all = (double *) malloc((size_t) nsamples * size * sizeof(double));
+    }
+    MPI_Gather((void *) samples, nsamples, MPI_DOUBLE,
+               all, nsamples, MPI_DOUBLE, root, comm);
+    if (rank == root)
+    {
+        bench_stats_local(all, nsamples * size, st);
+        free(all);
+    }
+}
+
+/* Reduce a single per-rank value to its maximum on root; the usual way to
+   time a collective is the slowest rank. */
+static inline double bench_max_time(double t, int root, MPI_Comm comm)
+{
+    double tmax = 0.0;
+    MPI_Reduce(&t, &tmax, 1, MPI_DOUBLE, MPI_MAX, root, comm);
+    return tmax;
+}
+
+/* Parse "4096", "64K", "1MiB", "2G" ... into a byte count; -1 on error */
+static inline long long bench_parse_size(const char *str)
+{
+    char *end;
+    long long v;
+
+    if (str == NULL) return -1;
+    v = strtoll(str, &end, 10);
+    if (end == str || v < 0) return -1;
+    switch (toupper((unsigned char) *end))
+    {
+    case 'K': v <<= 10; end++; break;
+    case 'M': v <<= 20; end++; break;
+    case 'G': v <<= 30; end++; break;
+    default: break;
+    }
+    if (*end == 'i') end++;
+    if (*end == 'B' || *end == 'b') end++;
+    return (*end == '\0') ? v : -1;
+}
+
+/* Format a byte count as "64K", "1M", "512" etc. into buf */
+static inline const char *bench_fmt_size(long long bytes, char *buf, size_t len)
+{
+    if (bytes >= (1LL << 30) && bytes % (1LL << 30) == 0)
+        snprintf(buf, len, "%lldG", bytes >> 30);
+    else if (bytes >= (1LL << 20) && bytes % (1LL << 20) == 0)
+        snprintf(buf, len, "%lldM", bytes >> 20);
+    else if (bytes >= (1LL << 10) && bytes % (1LL << 10) == 0)
+        snprintf(buf, len, "%lldK", bytes >> 10);
+    else
+        snprintf(buf, len, "%lld", bytes);
+    return buf;
+}
+
+/* Bandwidth in MB/s (10^6 bytes) for bytes moved in seconds */
+static inline double bench_mbps(double bytes, double seconds)
+{
+    return (seconds > 0.0) ? bytes / seconds / 1.0e6 : 0.0;
+}
+
+/*
+* Non-commutative test operator for MPI_Op_create(bench_affine_op, 0, ...):
+* composition of affine maps x -> a*x + b, one (a, b) pair of doubles per
+* element. inout = in then inout: (a1, b1) then (a2, b2) is
+* x -> a2*(a1*x + b1) + b2. With small integers and a = +-1 the results
+* are exact in any association, so algorithms can be compared bit for bit.
+*/
+static inline void bench_affine_op(void *in, void *inout, int *len, MPI_Datatype *dtype)
+{
+    const double *p = (const double *) in;
+    double *q = (double *) inout;
+    int i;
+
+    (void) dtype;
+    for (i=0; i<*len; i++)
+    {
+        q[2*i+1] = q[2*i] * p[2*i+1] + q[2*i+1];
+        q[2*i] = q[2*i] * p[2*i];
+    }
+}
+
+/* Look for "-name value" on the command line; returns value or NULL */
+static inline const char *bench_arg(int argc, char **argv, const char *name)
+{
+    int i;
+    for (i=1; i<argc-1; i++)
+    {
+        if (strcmp(argv[i], name) == 0) return argv[i+1];
+    }
+    return NULL;
+}
+
+/* Look for a bare "-flag" on the command line */
+static inline int bench_flag(int argc, char **argv, const char *name)
+{
+    int i;
+    for (i=1; i<argc; i++)
+    {
+        if (strcmp(argv[i], name) == 0) return 1;
+    }
+    return 0;
+}
+
+static inline long long bench_arg_size(int argc, char **argv, const char *name, long long dflt)
+{
+    long long v = bench_parse_size(bench_arg(argc, argv, name));
+    return (v < 0) ? dflt : v;
+}
+
+static inline int bench_arg_int(int argc, char **argv, const char *name, int dflt)
+{
+    const char *s = bench_arg(argc, argv, name);
+    return (s != NULL) ? atoi(s) : dflt;
+}
+
+#endif /* BENCH_UTIL_H */
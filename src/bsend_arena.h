@@ -0,0 +1,201 @@
+/*
+bsend_arena.h
+
+   Managed buffer for buffered-mode sends. The arena is sized from the
+   message classes the program declares (MPI_Pack_size plus
+   MPI_BSEND_OVERHEAD per message), attached with MPI_Buffer_attach, and
+   grown by detach/reattach instead of letting an MPI_Bsend overflow the
+   attached space.
+
+Usage
+
+   bsend_arena_t a;
+   bsend_arena_init(&a, MPI_COMM_WORLD, 256*1024*1024);
+   bsend_arena_declare(&a, 64, MPI_DOUBLE, 32);        32 small events
+   bsend_arena_declare(&a, 65536, MPI_DOUBLE, 4);      4 large events
+   bsend_arena_attach(&a);
+   for (step=0; step<nsteps; step++)
+   {
+       ... bsend_arena_send(&a, buf, count, type, dest, tag, comm) ...
+       bsend_arena_sync(&a);
+   }
+   bsend_arena_print(&a, stdout, "events");
+   bsend_arena_free(&a);
+
+Remarks
+
+   MPI does not report how much of the attached buffer is in use; space
+   is only known to be free again once MPI_Buffer_detach returns, which
+   blocks until every buffered message has been transmitted. The arena
+   therefore charges each send its packed size plus MPI_BSEND_OVERHEAD
+   and assumes none of it is released until the next detach. When a send
+   would not fit, the arena stalls: it detaches (waiting for the
+   buffered traffic to drain), grows if allowed, reattaches and sends.
+   That stall blocks until the receivers have matched what is
+   outstanding, so the receivers must keep making progress while the
+   sender bursts (e.g. a producer/consumer split); a stall while every
+   process is still sending can deadlock exactly as a full MPI_Bsend
+   would fail.
+
+   bsend_arena_sync marks a safe point, typically the end of a burst or
+   timestep. It drains the buffer, and if the high-water mark since the
+   last safe point came within grow_at of the capacity (or the interval
+   stalled), reattaches at twice the high-water mark, up to max_bytes.
+
+   There is one attached buffer per process, so there should be one
+   arena per process and nothing else may call MPI_Buffer_attach while
+   it is attached. All sizes are int, as in MPI_Buffer_attach.
+*/
+
+#ifndef BSEND_ARENA_H
+#define BSEND_ARENA_H
+
+#include "mpi.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct
+{
+    MPI_Comm comm;          /* communicator used for MPI_Pack_size */
+    char *buf;
+    int size;               /* attached bytes */
+    int max_bytes;          /* growth limit; == size disables growth */
+    int used;               /* bytes charged since the last drain */
+    double grow_at;         /* grow at a safe point when hwm > grow_at*size */
+    int stalled;            /* a stall happened since the last safe point */
+
+    /* statistics */
+    long long nsend;
+    long long bytes;        /* payload bytes sent through the arena */
+    int hwm;                /* largest 'used' ever seen */
+    int interval_hwm;       /* largest 'used' since the last safe point */
+    long long nstall;
+    double stall_time;
+    long long ngrow;
+    long long nsync;
+} bsend_arena_t;
+
+static inline void bsend_arena_init(bsend_arena_t *a, MPI_Comm comm, int max_bytes)
+{
+    a->comm = comm;
+    a->buf = NULL;
+    a->size = 0;
+    a->max_bytes = max_bytes;
+    a->used = 0;
+    a->grow_at = 0.75;
+    a->stalled = 0;
+    a->nsend = a->bytes = a->nstall = a->ngrow = a->nsync = 0;
+    a->hwm = a->interval_hwm = 0;
+    a->stall_time = 0.0;
+}
+
+/* Bytes one buffered send of count x type takes from the attached buffer */
+static inline int bsend_arena_cost(bsend_arena_t *a, int count, MPI_Datatype type)
+{
+    int pack;
+    MPI_Pack_size(count, type, a->comm, &pack);
+    return pack + MPI_BSEND_OVERHEAD;
+}
+
+/* Reserve room for max_outstanding messages of count x type; call before attach */
+static inline void bsend_arena_declare(bsend_arena_t *a, int count, MPI_Datatype type,
+                                       int max_outstanding)
+{
+    a->size += max_outstanding * bsend_arena_cost(a, count, type);
+    if (a->max_bytes < a->size) a->max_bytes = a->size;
+}
+
+static inline int bsend_arena_attach(bsend_arena_t *a)
+{
+    if (a->size < MPI_BSEND_OVERHEAD) a->size = MPI_BSEND_OVERHEAD;
+    a->buf = (char *) malloc(a->size);
+    if (a->buf == NULL) return MPI_ERR_NO_MEM;
+    a->used = 0;
+    return MPI_Buffer_attach(a->buf, a->size);
+}
+
+/* Drain, then reattach at newsize (or the same size if newsize <= size) */
+static inline void bsend_arena_drain(bsend_arena_t *a, int newsize)
+{
+    void *old;
+    int oldsize;
+
+    MPI_Buffer_detach(&old, &oldsize);
+    a->used = 0;
+    if (newsize > a->max_bytes) newsize = a->max_bytes;
+    if (newsize > a->size)
+    {
+        char *nbuf = (char *) malloc(newsize);
+        if (nbuf != NULL)
+        {
+            free(a->buf);
+            a->buf  = nbuf;
+            a->size = newsize;
+            a->ngrow++;
+        }
+    }
+    MPI_Buffer_attach(a->buf, a->size);
+}
+
+static inline int bsend_arena_send(bsend_arena_t *a, const void *buf, int count, MPI_Datatype type,
+                                   int dest, int tag, MPI_Comm comm)
+{
+    int need = bsend_arena_cost(a, count, type);
+
+    if (a->used + need > a->size)
+    {
+        double t0 = MPI_Wtime();
+        int want = 2 * a->size;
+        if (want < need) want = need;
+        bsend_arena_drain(a, want);
+        a->stall_time += MPI_Wtime() - t0;
+        a->nstall++;
+        a->stalled = 1;
+        if (need > a->size) return MPI_ERR_BUFFER;
+    }
+    a->used += need;
+    if (a->used > a->interval_hwm) a->interval_hwm = a->used;
+    if (a->used > a->hwm) a->hwm = a->used;
+    a->nsend++;
+    a->bytes += need - MPI_BSEND_OVERHEAD;
+    return MPI_Bsend((void *) buf, count, type, dest, tag, comm);
+}
+
+/* Safe point: drain the buffer and grow it if the last interval ran close to full */
+static inline void bsend_arena_sync(bsend_arena_t *a)
+{
+    int want = a->size;
+
+    if (a->stalled || a->interval_hwm > a->grow_at * a->size)
+    {
+        want = 2 * a->interval_hwm;
+        if (want < 2 * a->size && a->stalled) want = 2 * a->size;
+    }
+    bsend_arena_drain(a, want);
+    a->interval_hwm = 0;
+    a->stalled = 0;
+    a->nsync++;
+}
+
+static inline void bsend_arena_print(const bsend_arena_t *a, FILE *fp, const char *label)
+{
+    fprintf(fp, "%s: %lld sends, %lld bytes, size %d (max %d), hwm %d, "
+            "%lld stalls (%.3f ms), %lld grows, %lld safe points\n",
+            label, a->nsend, a->bytes, a->size, a->max_bytes, a->hwm,
+            a->nstall, a->stall_time * 1e3, a->ngrow, a->nsync);
+    fflush(fp);
+}
+
+static inline void bsend_arena_free(bsend_arena_t *a)
+{
+    void *old;
+    int oldsize;
+
+    if (a->buf == NULL) return;
+    MPI_Buffer_detach(&old, &oldsize);
+    free(a->buf);
+    a->buf = NULL;
+    a->size = 0;
+}
+
+#endif /* BSEND_ARENA_H */
@@ -0,0 +1,394 @@
+/*
+cart_plan.h
+
+   Cartesian decomposition planner. Instead of MPI_Dims_create's
+   balanced factorization of the process count alone, it looks at the
+   global grid extents and at which ranks share a node, picks the
+   process grid with the lowest predicted halo exchange time, and lays
+   the ranks out so that every node holds a compact sub-block of the
+   grid.
+
+Usage
+
+   int n[3] = { 1024, 256, 64 }, periods[3] = { 1, 1, 1 };
+   cart_model_t model;
+   cart_plan_t plan;
+   MPI_Comm cart;
+
+   cart_model_calibrate(MPI_COMM_WORLD, 0, &model);          optional
+   cart_plan(MPI_COMM_WORLD, 3, n, periods, 1, sizeof(double), 0, &model, &plan);
+   cart_plan_create(MPI_COMM_WORLD, &plan, periods, &cart);
+   ... plan.dims, plan.predicted; cart has coordinates as planned ...
+   cart_plan_free(&plan);
+
+Parameters (cart_plan)
+
+   ndims, n, periods
+          [in] 2 or 3 dimensions, global grid extents in cells, and
+          whether each dimension is periodic
+
+   ghost, elemsize
+          [in] ghost width in cells and bytes per cell; a face message
+          carries ghost layers of the neighbouring block's face
+
+   ppn
+          [in] ranks per node; 0 finds the nodes with
+          MPI_Comm_split_type(MPI_COMM_TYPE_SHARED). A positive value
+          treats each run of ppn consecutive ranks as a node, which
+          lets a single machine stand in for a cluster.
+
+   model
+          [in] cost of a message of b bytes: alpha + b / beta seconds,
+          with separate alpha and beta within a node and between
+          nodes; NULL uses CART_MODEL_DEFAULT. cart_model_calibrate
+          measures them with ping-pongs from rank 0.
+
+Remarks
+
+   The planner enumerates every factorization of the node count into
+   ndims node-grid extents and of the ranks per node into ndims
+   per-node extents. Dimension d is split over
+   dims[d] = node_dims[d] * inner[d] ranks; node k owns the inner block
+   at position node_dims-coordinate(k), and its i-th rank the cell
+   inner-coordinate(i) of that block. Blocks are split as evenly as
+   possible (cart_block). For each candidate the cost of exchanging the
+   2*ndims faces is summed per rank with the model, and the plan with
+   the lowest maximum over the ranks wins. Long, thin domains therefore
+   get cut across their long dimension, and the node blocks are chosen
+   so that few faces cross node boundaries.
+
+   cart_plan_cost evaluates any mapping of ranks to coordinates with the
+   same model, so the default MPI_Dims_create layout can be compared
+   (see bench_cart_plan). All nodes must hold the same number of ranks
+   for the two-level enumeration; otherwise the planner treats the job
+   as one node and only the surface area matters.
+
+   cart_plan_create builds the communicator with MPI_Comm_split keyed
+   on the planned rank order and MPI_Cart_create without reordering,
+   so the coordinates of every process are exactly those planned.
+   cart_plan and cart_plan_create are collective.
+*/
+
+#ifndef CART_PLAN_H
+#define CART_PLAN_H
+
+#include "mpi.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+    double alpha_intra, beta_intra;     /* seconds per message, bytes per second */
+    double alpha_inter, beta_inter;
+} cart_model_t;
+
+#define CART_MODEL_DEFAULT { 1.0e-6, 5.0e9, 3.0e-6, 1.0e9 }
+
+#define CART_CAL_SMALL_REPS 200
+#define CART_CAL_LARGE_REPS 20
+#define CART_CAL_LARGE      (1 << 20)
+
+typedef struct
+{
+    int ndims, size;
+    int dims[3], node_dims[3], inner[3];
+    int nnodes, ppn;
+    int *node_of, *local_of;    /* node and index within it of every rank of comm */
+    int *coords;                /* planned coordinates of every rank of comm, ndims each */
+    double predicted;           /* seconds per exchange, slowest rank */
+    double halo_bytes;          /* bytes sent by the busiest rank */
+    double inter_bytes;         /* bytes crossing node boundaries, all ranks */
+} cart_plan_t;
+
+/* Block r of n cells split over p: the first n % p blocks get one extra */
+static inline int cart_block(int n, int p, int r)
+{
+    return n / p + (r < n % p);
+}
+
+static inline void cart_unravel(int idx, int ndims, const int *dims, int *c)
+{
+    int d;
+    for (d=ndims-1; d>=0; d--)
+    {
+        c[d] = idx % dims[d];
+        idx /= dims[d];
+    }
+}
+
+static inline int cart_ravel(const int *c, int ndims, const int *dims)
+{
+    int d, idx = 0;
+    for (d=0; d<ndims; d++) idx = idx * dims[d] + c[d];
+    return idx;
+}
+
+/*
+* Predicted exchange time for ranks placed at coords[r*ndims..] on a
+* dims grid; node[r] says where rank r runs. Returns the slowest rank's
+* time and optionally the busiest rank's bytes and the inter-node total.
+*/
+static inline double cart_plan_cost(int ndims, const int *n, const int *dims, const int *periods,
+                                    int ghost, int elemsize, int size, const int *coords,
+                                    const int *node, const cart_model_t *model,
+                                    double *halo_bytes, double *inter_bytes)
+{
+    int r, d, e, s, c[3], *rank_at;
+    double t, bytes, face, tmax = 0.0, hmax = 0.0, inter = 0.0;
+
+    rank_at = (int *) malloc(size * sizeof(int));
+    for (r=0; r<size; r++) rank_at[cart_ravel(coords + r * ndims, ndims, dims)] = r;
+
+    for (r=0; r<size; r++)
+    {
+        t = bytes = 0.0;
+        for (d=0; d<ndims; d++)
+        {
+            face = (double) ghost * elemsize;
+            for (e=0; e<ndims; e++)
+                if (e != d) face *= cart_block(n[e], dims[e], coords[r * ndims + e]);
+            for (s=-1; s<=1; s+=2)
+            {
+                int nb;
+                memcpy(c, coords + r * ndims, ndims * sizeof(int));
+                c[d] += s;
+                if (c[d] < 0 || c[d] >= dims[d])
+                {
+                    if (!periods[d]) continue;
+                    c[d] = (c[d] + dims[d]) % dims[d];
+                }
+                /* A rank that is its own neighbour still sends itself the face */
+                nb = rank_at[cart_ravel(c, ndims, dims)];
+                bytes += face;
+                if (node[nb] != node[r])
+                {
+                    t += model->alpha_inter + face / model->beta_inter;
+                    inter += face;
+                }
+                else
+                {
+                    t += model->alpha_intra + face / model->beta_intra;
+                }
+            }
+        }
+        if (t > tmax) tmax = t;
+        if (bytes > hmax) hmax = bytes;
+    }
+    free(rank_at);
+    if (halo_bytes) *halo_bytes = hmax;
+    if (inter_bytes) *inter_bytes = inter;
+    return tmax;
+}
+
+/* Coordinates of every rank for node grid nd and per-node grid in */
+static inline void cart_plan_place(cart_plan_t *p, const int *nd, const int *in, int *coords)
+{
+    int r, d, nc[3], lc[3];
+    for (r=0; r<p->size; r++)
+    {
+        cart_unravel(p->nnodes > 1 ? p->node_of[r] : 0, p->ndims, nd, nc);
+        cart_unravel(p->local_of[r], p->ndims, in, lc);
+        for (d=0; d<p->ndims; d++) coords[r * p->ndims + d] = nc[d] * in[d] + lc[d];
+    }
+}
+
+/* Next ordered factorization into ndims factors, odometer style; start from { 1, ..., 1, total } */
+static inline int cart_next_factors(int ndims, int *f)
+{
+    int d, e, k, rest;
+    for (d=ndims-2; d>=0; d--)
+    {
+        for (rest=1, e=d; e<ndims; e++) rest *= f[e];
+        for (k=f[d]+1; k<=rest; k++)
+        {
+            if (rest % k) continue;
+            f[d] = k;
+            for (e=d+1; e<ndims-1; e++) f[e] = 1;
+            f[ndims-1] = rest / k;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Which node every rank is on, from ppn or from shared-memory domains */
+static inline void cart_find_nodes(MPI_Comm comm, int ppn, int *node_of)
+{
+    int rank, size, lrank, node;
+    MPI_Comm shm, leaders;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    if (ppn > 0)
+    {
+        node = rank / ppn;
+    }
+    else
+    {
+        MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &shm);
+        MPI_Comm_rank(shm, &lrank);
+        MPI_Comm_split(comm, lrank == 0 ? 0 : MPI_UNDEFINED, rank, &leaders);
+        node = 0;
+        if (lrank == 0) MPI_Comm_rank(leaders, &node);
+        MPI_Bcast(&node, 1, MPI_INT, 0, shm);
+        if (lrank == 0) MPI_Comm_free(&leaders);
+        MPI_Comm_free(&shm);
+    }
+    MPI_Allgather(&node, 1, MPI_INT, node_of, 1, MPI_INT, comm);
+}
+
+/* Ping-pong between rank 0 and the first rank on its node, and the first rank off it */
+static inline void cart_model_calibrate(MPI_Comm comm, int ppn, cart_model_t *model)
+{
+    int rank, size, r, k, big, it, reps, n, peer[2] = { -1, -1 }, *node_of;
+    double t, res[4];
+    char *buf;
+    cart_model_t dflt = CART_MODEL_DEFAULT;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    node_of = (int *) malloc(size * sizeof(int));
+    cart_find_nodes(comm, ppn, node_of);
+    for (r=1; r<size; r++)
+    {
+        k = (node_of[r] == node_of[0]) ? 0 : 1;
+        if (peer[k] < 0) peer[k] = r;
+    }
+    buf = (char *) calloc(CART_CAL_LARGE, 1);
+    res[0] = dflt.alpha_intra;
+    res[1] = dflt.beta_intra;
+    res[2] = dflt.alpha_inter;
+    res[3] = dflt.beta_inter;
+
+    for (k=0; k<2; k++)
+    {
+        if (peer[k] < 0 || (rank != 0 && rank != peer[k])) continue;
+        r = (rank == 0) ? peer[k] : 0;
+        for (big=0; big<2; big++)
+        {
+            n = big ? CART_CAL_LARGE : 8;
+            reps = big ? CART_CAL_LARGE_REPS : CART_CAL_SMALL_REPS;
+            MPI_Sendrecv_replace(buf, n, MPI_BYTE, r, 0, r, 0, comm, MPI_STATUS_IGNORE);
+            t = MPI_Wtime();
+            for (it=0; it<reps; it++)
+            {
+                if (rank == 0)
+                {
+                    MPI_Send(buf, n, MPI_BYTE, r, 0, comm);
+                    MPI_Recv(buf, n, MPI_BYTE, r, 0, comm, MPI_STATUS_IGNORE);
+                }
+                else
+                {
+                    MPI_Recv(buf, n, MPI_BYTE, r, 0, comm, MPI_STATUS_IGNORE);
+                    MPI_Send(buf, n, MPI_BYTE, r, 0, comm);
+                }
+            }
+            t = (MPI_Wtime() - t) / reps / 2;
+            if (!big) res[2*k] = t;
+            else if (t > res[2*k]) res[2*k+1] = n / (t - res[2*k]);
+        }
+    }
+    /* Without an off-node peer, inter-node messages cost what on-node ones do */
+    if (rank == 0 && peer[1] < 0)
+    {
+        res[2] = res[0];
+        res[3] = res[1];
+    }
+    MPI_Bcast(res, 4, MPI_DOUBLE, 0, comm);
+    model->alpha_intra = res[0];
+    model->beta_intra  = res[1];
+    model->alpha_inter = res[2];
+    model->beta_inter  = res[3];
+    free(buf);
+    free(node_of);
+}
+
+static inline int cart_plan(MPI_Comm comm, int ndims, const int *n, const int *periods, int ghost,
+                            int elemsize, int ppn, const cart_model_t *model, cart_plan_t *p)
+{
+    int r, d, nd[3], in[3], *count, *coords;
+    double t, best = -1.0;
+    cart_model_t dflt = CART_MODEL_DEFAULT;
+
+    if (ndims < 2 || ndims > 3) return MPI_ERR_DIMS;
+    if (model == NULL) model = &dflt;
+    memset(p, 0, sizeof(*p));
+    p->ndims = ndims;
+    MPI_Comm_size(comm, &p->size);
+    p->node_of  = (int *) malloc(p->size * sizeof(int));
+    p->local_of = (int *) malloc(p->size * sizeof(int));
+    p->coords   = (int *) malloc(p->size * ndims * sizeof(int));
+    coords      = (int *) malloc(p->size * ndims * sizeof(int));
+    count       = (int *) calloc(p->size, sizeof(int));
+    cart_find_nodes(comm, ppn, p->node_of);
+
+    /* Number the ranks within each node; fall back to one node if they differ in size */
+    for (r=0; r<p->size; r++)
+    {
+        p->local_of[r] = count[p->node_of[r]]++;
+        if (p->node_of[r] + 1 > p->nnodes) p->nnodes = p->node_of[r] + 1;
+    }
+    p->ppn = p->size / p->nnodes;
+    for (r=0; r<p->nnodes; r++)
+        if (count[r] != p->ppn) p->ppn = 0;
+    if (p->ppn == 0)
+    {
+        for (r=0; r<p->size; r++) p->local_of[r] = r;
+        p->ppn = p->size;
+        p->nnodes = 1;
+    }
+
+    /* Every node grid times every per-node grid */
+    for (d=0; d<ndims; d++) nd[d] = 1;
+    nd[ndims-1] = p->nnodes;
+    do
+    {
+        for (d=0; d<ndims; d++) in[d] = 1;
+        in[ndims-1] = p->ppn;
+        do
+        {
+            int dims[3];
+            for (d=0; d<ndims; d++) dims[d] = nd[d] * in[d];
+            cart_plan_place(p, nd, in, coords);
+            t = cart_plan_cost(ndims, n, dims, periods, ghost, elemsize, p->size, coords,
+                               p->node_of, model, NULL, NULL);
+            if (best < 0.0 || t < best * (1.0 - 1e-9))
+            {
+                best = t;
+                memcpy(p->dims, dims, sizeof(dims));
+                memcpy(p->node_dims, nd, sizeof(nd));
+                memcpy(p->inner, in, sizeof(in));
+                memcpy(p->coords, coords, p->size * ndims * sizeof(int));
+            }
+        } while (cart_next_factors(ndims, in));
+    } while (cart_next_factors(ndims, nd));
+
+    p->predicted = cart_plan_cost(ndims, n, p->dims, periods, ghost, elemsize, p->size, p->coords,
+                                  p->node_of, model, &p->halo_bytes, &p->inter_bytes);
+    free(coords);
+    free(count);
+    return MPI_SUCCESS;
+}
+
+static inline int cart_plan_create(MPI_Comm comm, const cart_plan_t *p, const int *periods,
+                                   MPI_Comm *cart)
+{
+    int rank, key, err;
+    MPI_Comm tmp;
+
+    MPI_Comm_rank(comm, &rank);
+    key = cart_ravel(p->coords + rank * p->ndims, p->ndims, p->dims);
+    MPI_Comm_split(comm, 0, key, &tmp);
+    err = MPI_Cart_create(tmp, p->ndims, p->dims, periods, 0, cart);
+    MPI_Comm_free(&tmp);
+    return err;
+}
+
+static inline void cart_plan_free(cart_plan_t *p)
+{
+    free(p->node_of);
+    free(p->local_of);
+    free(p->coords);
+}
+
+#endif /* CART_PLAN_H */
@@ -0,0 +1,173 @@
+/*
+graph_exchange.h
+
+   Sparse neighbour exchange over an MPI_Graph_create topology. Every
+   edge of the process graph gets an MPI_Type_create_indexed_block
+   datatype for the elements sent along it and one for the elements
+   received; the exchange is a set of persistent requests built once,
+   so each step only calls MPI_Startall and MPI_Waitall.
+
+Usage
+
+   Build the graph from each rank's own neighbour list (the global
+   index/edges arrays are assembled with MPI_Allgatherv):
+
+   MPI_Comm graph;
+   gx_graph_create(MPI_COMM_WORLD, nnbrs, nbrs, 0, &graph);
+
+   For neighbour k (in MPI_Graph_neighbors order), send the elements
+   sendbuf[sendidx[k][0..sendcnt[k]-1]] and receive into
+   recvbuf[recvidx[k][0..recvcnt[k]-1]]:
+
+   gx_t g;
+   gx_create(graph, sendcnt, sendidx, recvcnt, recvidx, MPI_DOUBLE, u, u, &g);
+   for (step=0; step<nsteps; step++)
+   {
+       gx_start(&g);
+       ... work on owned cells ...
+       gx_wait(&g);
+       ... work that needs the ghosts ...
+   }
+   gx_free(&g);
+
+Remarks
+
+   sendbuf and recvbuf may be the same array (owned cells followed by
+   ghost cells is the usual layout) as long as no element is both sent
+   and received. They are captured by the persistent requests, as in
+   halo.h: change their contents between steps, not the pointers.
+
+   The neighbour lists must be symmetric (j lists i whenever i lists
+   j) and free of duplicates, and the elements of an edge must be
+   listed in the same order on both ends; sorting them by global id
+   does that. Messages use tag GX_TAG. A rank may list itself.
+
+   gx_graph_create passes reorder to MPI_Graph_create. With reorder=1
+   a rank's data belongs to its old rank, so the caller has to move it
+   or rebuild its lists; the examples here use reorder=0.
+
+   g->counts, g->displs, g->stypes and g->rtypes are laid out for
+   MPI_Neighbor_alltoallw on the graph communicator (MPI-3), which
+   bench_graph uses for comparison.
+*/
+
+#ifndef GRAPH_EXCHANGE_H
+#define GRAPH_EXCHANGE_H
+
+#include "mpi.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define GX_TAG 5151
+
+typedef struct
+{
+    MPI_Comm comm;
+    int nnbrs;
+    int *nbrs;
+    int *counts;                /* 1 for every edge, for MPI_Neighbor_alltoallw */
+    MPI_Aint *displs;           /* 0 for every edge */
+    MPI_Datatype *stypes, *rtypes;
+    MPI_Request *reqs;          /* receives, then sends */
+    long long send_elems, recv_elems;
+} gx_t;
+
+/* Collective: a graph communicator from each rank's neighbour list */
+static inline int gx_graph_create(MPI_Comm comm, int nnbrs, const int *nbrs, int reorder,
+                                  MPI_Comm *graph)
+{
+    int i, size, *counts, *displs, *index, *edges, err;
+
+    MPI_Comm_size(comm, &size);
+    counts = (int *) malloc(size * sizeof(int));
+    displs = (int *) malloc(size * sizeof(int));
+    index  = (int *) malloc(size * sizeof(int));
+    MPI_Allgather(&nnbrs, 1, MPI_INT, counts, 1, MPI_INT, comm);
+    for (i=0; i<size; i++)
+    {
+        displs[i] = i ? displs[i-1] + counts[i-1] : 0;
+        index[i] = displs[i] + counts[i];
+    }
+    edges = (int *) malloc((index[size-1] + 1) * sizeof(int));
+    MPI_Allgatherv(nbrs, nnbrs, MPI_INT, edges, counts, displs, MPI_INT, comm);
+
+    err = MPI_Graph_create(comm, size, index, edges, reorder, graph);
+    free(counts);
+    free(displs);
+    free(index);
+    free(edges);
+    return err;
+}
+
+static inline int gx_create(MPI_Comm graph, const int *sendcnt, int *const *sendidx,
+                            const int *recvcnt, int *const *recvidx, MPI_Datatype elemtype,
+                            void *sendbuf, void *recvbuf, gx_t *g)
+{
+    int k, rank, topo;
+
+    memset(g, 0, sizeof(*g));
+    MPI_Topo_test(graph, &topo);
+    if (topo != MPI_GRAPH) return MPI_ERR_TOPOLOGY;
+    MPI_Comm_rank(graph, &rank);
+    MPI_Graph_neighbors_count(graph, rank, &g->nnbrs);
+
+    g->comm   = graph;
+    g->nbrs   = (int *) malloc((g->nnbrs + 1) * sizeof(int));
+    g->counts = (int *) malloc((g->nnbrs + 1) * sizeof(int));
+    g->displs = (MPI_Aint *) malloc((g->nnbrs + 1) * sizeof(MPI_Aint));
+    g->stypes = (MPI_Datatype *) malloc((2 * g->nnbrs + 1) * sizeof(MPI_Datatype));
+    g->rtypes = g->stypes + g->nnbrs;
+    g->reqs   = (MPI_Request *) malloc((2 * g->nnbrs + 1) * sizeof(MPI_Request));
+    MPI_Graph_neighbors(graph, rank, g->nnbrs, g->nbrs);
+
+    for (k=0; k<g->nnbrs; k++)
+    {
+        g->counts[k] = 1;
+        g->displs[k] = 0;
+        MPI_Type_create_indexed_block(sendcnt[k], 1, sendidx[k], elemtype, &g->stypes[k]);
+        MPI_Type_create_indexed_block(recvcnt[k], 1, recvidx[k], elemtype, &g->rtypes[k]);
+        MPI_Type_commit(&g->stypes[k]);
+        MPI_Type_commit(&g->rtypes[k]);
+        g->send_elems += sendcnt[k];
+        g->recv_elems += recvcnt[k];
+    }
+    for (k=0; k<g->nnbrs; k++)
+        MPI_Recv_init(recvbuf, 1, g->rtypes[k], g->nbrs[k], GX_TAG, graph, &g->reqs[k]);
+    for (k=0; k<g->nnbrs; k++)
+        MPI_Send_init(sendbuf, 1, g->stypes[k], g->nbrs[k], GX_TAG, graph, &g->reqs[g->nnbrs + k]);
+    return MPI_SUCCESS;
+}
+
+static inline void gx_start(gx_t *g)
+{
+    MPI_Startall(2 * g->nnbrs, g->reqs);
+}
+
+static inline void gx_wait(gx_t *g)
+{
+    MPI_Waitall(2 * g->nnbrs, g->reqs, MPI_STATUSES_IGNORE);
+}
+
+static inline void gx_exchange(gx_t *g)
+{
+    gx_start(g);
+    gx_wait(g);
+}
+
+static inline void gx_free(gx_t *g)
+{
+    int k;
+    for (k=0; k<2*g->nnbrs; k++) MPI_Request_free(&g->reqs[k]);
+    for (k=0; k<g->nnbrs; k++)
+    {
+        MPI_Type_free(&g->stypes[k]);
+        MPI_Type_free(&g->rtypes[k]);
+    }
+    free(g->nbrs);
+    free(g->counts);
+    free(g->displs);
+    free(g->stypes);
+    free(g->reqs);
+}
+
+#endif /* GRAPH_EXCHANGE_H */
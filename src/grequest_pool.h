@@ -0,0 +1,185 @@
+/*
+grequest_pool.h
+
+   A small thread pool whose tasks are MPI requests. task_pool_submit
+   queues a function for a pthread worker and returns an MPI_Request made
+   with MPI_Grequest_start; the worker calls MPI_Grequest_complete when
+   the function returns. Task requests can be mixed freely with
+   MPI_Isend/MPI_Irecv requests in MPI_Wait, MPI_Waitall, MPI_Waitsome,
+   MPI_Test and friends.
+
+Usage
+
+   MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+   task_pool_t pool;
+   task_pool_init(&pool, 2);
+
+   MPI_Request reqs[3];
+   MPI_Irecv(rbuf, n, MPI_BYTE, left, 0, comm, &reqs[0]);
+   MPI_Isend(sbuf, n, MPI_BYTE, right, 0, comm, &reqs[1]);
+   task_pool_submit(&pool, compress, &job, &reqs[2]);
+   MPI_Waitall(3, reqs, MPI_STATUSES_IGNORE);
+
+   task_pool_finalize(&pool);
+
+Remarks
+
+   Workers call MPI_Grequest_complete from their own threads, so MPI must
+   be initialized with MPI_THREAD_MULTIPLE; task_pool_init returns
+   MPI_ERR_OTHER otherwise. As MPI_Grequest_start notes, MPI has no hook
+   for advancing a generalized request from inside wait or test, which is
+   exactly why the completion comes from a separate thread here.
+
+   Tasks run in submission order on the first free worker. A running or
+   queued task cannot be cancelled: MPI_Cancel on a task request is
+   accepted but the task still runs to completion. The status of a
+   completed task has MPI_SOURCE and MPI_TAG set to MPI_UNDEFINED and a
+   count of zero.
+
+   task_pool_finalize waits for queued tasks to finish before joining the
+   workers. Every task request must still be completed by a wait or test
+   (or freed with MPI_Request_free) as usual.
+*/
+
+#ifndef GREQUEST_POOL_H
+#define GREQUEST_POOL_H
+
+#include "mpi.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+typedef void (task_fn)(void *arg);
+
+typedef struct task_s
+{
+    task_fn *fn;
+    void *arg;
+    MPI_Request req;
+    struct task_s *next;
+} task_t;
+
+typedef struct
+{
+    pthread_t *threads;
+    int nthreads;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    task_t *head, *tail;
+    int shutdown;
+    long long nrun;
+} task_pool_t;
+
+static inline int task_query_fn(void *extra_state, MPI_Status *status)
+{
+    (void) extra_state;
+    status->MPI_SOURCE = MPI_UNDEFINED;
+    status->MPI_TAG = MPI_UNDEFINED;
+    MPI_Status_set_cancelled(status, 0);
+    MPI_Status_set_elements(status, MPI_BYTE, 0);
+    return MPI_SUCCESS;
+}
+
+static inline int task_free_fn(void *extra_state)
+{
+    free(extra_state);
+    return MPI_SUCCESS;
+}
+
+static inline int task_cancel_fn(void *extra_state, int complete)
+{
+    (void) extra_state;
+    (void) complete;
+    return MPI_SUCCESS;
+}
+
+static inline void *task_worker(void *arg)
+{
+    task_pool_t *pool = (task_pool_t *) arg;
+    task_t *t;
+    MPI_Request req;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->head == NULL && !pool->shutdown)
+        {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+        if (pool->head == NULL)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        t = pool->head;
+        pool->head = t->next;
+        if (pool->head == NULL) pool->tail = NULL;
+        pool->nrun++;
+        pthread_mutex_unlock(&pool->lock);
+
+        t->fn(t->arg);
+        /* The waiter may free t as soon as the request completes */
+        req = t->req;
+        MPI_Grequest_complete(req);
+    }
+    return NULL;
+}
+
+static inline int task_pool_init(task_pool_t *pool, int nthreads)
+{
+    int i, provided;
+
+    MPI_Query_thread(&provided);
+    if (provided != MPI_THREAD_MULTIPLE || nthreads < 1) return MPI_ERR_OTHER;
+
+    pool->nthreads = nthreads;
+    pool->head = pool->tail = NULL;
+    pool->shutdown = 0;
+    pool->nrun = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+    pool->threads = (pthread_t *) malloc(nthreads * sizeof(pthread_t));
+    for (i=0; i<nthreads; i++)
+    {
+        pthread_create(&pool->threads[i], NULL, task_worker, pool);
+    }
+    return MPI_SUCCESS;
+}
+
+static inline int task_pool_submit(task_pool_t *pool, task_fn *fn, void *arg, MPI_Request *request)
+{
+    task_t *t = (task_t *) malloc(sizeof(task_t));
+
+    if (t == NULL) return MPI_ERR_NO_MEM;
+    t->fn = fn;
+    t->arg = arg;
+    t->next = NULL;
+    MPI_Grequest_start(task_query_fn, task_free_fn, task_cancel_fn, t, &t->req);
+    *request = t->req;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail) pool->tail->next = t;
+    else pool->head = t;
+    pool->tail = t;
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+    return MPI_SUCCESS;
+}
+
+static inline void task_pool_finalize(task_pool_t *pool)
+{
+    int i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+    for (i=0; i<pool->nthreads; i++)
+    {
+        pthread_join(pool->threads[i], NULL);
+    }
+    free(pool->threads);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->cond);
+}
+
+#endif /* GREQUEST_POOL_H */
@@ -0,0 +1,266 @@
+/*
+halo.h
+
+   Persistent-request halo exchange for 2D and 3D Cartesian
+   decompositions. All sends and receives for every neighbour (faces,
+   edges and corners) are built once with MPI_Send_init/MPI_Recv_init;
+   each timestep only calls MPI_Startall and MPI_Waitall.
+
+Usage
+
+   halo_t h;
+   int n[3] = { 64, 64, 64 };
+   double *u = malloc((64+2)*(64+2)*(64+2) * sizeof(double));
+
+   halo_create(cart, n, 1, MPI_DOUBLE, u, 0, &h);
+   for (step=0; step<nsteps; step++)
+   {
+       halo_start(&h);
+       ... update cells that do not need ghosts ...
+       halo_wait(&h);
+       ... update the rest ...
+   }
+   halo_free(&h);
+
+Parameters
+
+   cart
+          [in] communicator with a 2D or 3D Cartesian topology
+          (MPI_Cart_create). Neighbours outside a non-periodic dimension
+          are MPI_PROC_NULL and their ghosts are left untouched.
+
+   nlocal
+          [in] interior extent of the local block in each dimension
+
+   ghost
+          [in] ghost width; must not exceed any interior extent
+
+   elemtype
+          [in] contiguous datatype of one field element
+
+   field
+          [in/out] local block of (nlocal[d] + 2*ghost) elements per
+          dimension, C order (last dimension contiguous)
+
+   flags
+          [in] 0 or a combination of
+          HALO_PACKED      pack/unpack through contiguous buffers with
+                           row memcpy instead of sending MPI_Type_create_subarray
+                           types straight from the field
+          HALO_FACES_ONLY  exchange with the 2*ndims face neighbours only
+                           (5-point or 7-point stencils)
+
+Remarks
+
+   Messages are tagged with the direction they travel, so a process may be
+   its own neighbour in a periodic dimension of extent 1 or 2. The field
+   pointer is captured by the persistent requests; swap the contents,
+   not the pointer, between timesteps or build one halo_t per buffer.
+*/
+
+#ifndef HALO_H
+#define HALO_H
+
+#include "mpi.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define HALO_PACKED     1
+#define HALO_FACES_ONLY 2
+#define HALO_MAX_NBRS   26
+
+typedef struct
+{
+    MPI_Comm comm;
+    int ndims;
+    int ghost;
+    int flags;
+    int nlocal[3];
+    int full[3];
+    int elemsize;
+    char *field;
+
+    int nnbr;
+    int nbr[HALO_MAX_NBRS];
+    int dir[HALO_MAX_NBRS][3];
+    int sstart[HALO_MAX_NBRS][3], rstart[HALO_MAX_NBRS][3], sub[HALO_MAX_NBRS][3];
+    MPI_Datatype stype[HALO_MAX_NBRS], rtype[HALO_MAX_NBRS];
+    char *sbuf[HALO_MAX_NBRS], *rbuf[HALO_MAX_NBRS];
+    int bytes[HALO_MAX_NBRS];
+    MPI_Request reqs[2*HALO_MAX_NBRS];
+} halo_t;
+
+/* Direction index in 0..3^ndims-1, so that -d has index (3^ndims-1) - index(d) */
+static inline int halo_dir_index(const int *d, int ndims)
+{
+    int k, idx = 0;
+    for (k=0; k<ndims; k++) idx = idx * 3 + (d[k] + 1);
+    return idx;
+}
+
+/* Copy a sub-block between the field and a contiguous buffer, one row at a time */
+static inline void halo_copy(halo_t *h, const int *start, const int *sub, char *buf, int pack)
+{
+    int i, j, nd = h->ndims, es = h->elemsize;
+    int n0 = (nd == 3) ? sub[0] : 1;
+    int n1 = sub[nd-2];
+    size_t row = (size_t) sub[nd-1] * es;
+
+    for (i=0; i<n0; i++)
+    {
+        for (j=0; j<n1; j++)
+        {
+            size_t off;
+            if (nd == 3)
+                off = (((size_t) (start[0] + i) * h->full[1] + start[1] + j) * h->full[2] + start[2]) * es;
+            else
+                off = ((size_t) (start[0] + j) * h->full[1] + start[1]) * es;
+            if (pack) memcpy(buf, h->field + off, row);
+            else      memcpy(h->field + off, buf, row);
+            buf += row;
+        }
+    }
+}
+
+static inline int halo_create(MPI_Comm cart, const int *nlocal, int ghost, MPI_Datatype elemtype,
+                              void *field, int flags, halo_t *h)
+{
+    int dims[3], periods[3], coords[3], topo, k, idx, ntot, i;
+    int d[3] = { 0, 0, 0 };
+    MPI_Aint lb, extent;
+
+    memset(h, 0, sizeof(*h));
+    MPI_Topo_test(cart, &topo);
+    if (topo != MPI_CART) return MPI_ERR_TOPOLOGY;
+    MPI_Cartdim_get(cart, &h->ndims);
+    if (h->ndims != 2 && h->ndims != 3) return MPI_ERR_DIMS;
+    MPI_Cart_get(cart, h->ndims, dims, periods, coords);
+    MPI_Type_get_extent(elemtype, &lb, &extent);
+
+    h->comm     = cart;
+    h->ghost    = ghost;
+    h->flags    = flags;
+    h->field    = (char *) field;
+    h->elemsize = (int) extent;
+    for (k=0; k<h->ndims; k++)
+    {
+        if (ghost > nlocal[k]) return MPI_ERR_ARG;
+        h->nlocal[k] = nlocal[k];
+        h->full[k]   = nlocal[k] + 2 * ghost;
+    }
+
+    ntot = (h->ndims == 3) ? 27 : 9;
+    for (idx=0; idx<ntot; idx++)
+    {
+        int nz = 0, c[3], rank, n = h->nnbr, t = idx;
+
+        for (k=h->ndims-1; k>=0; k--)
+        {
+            d[k] = t % 3 - 1;
+            t /= 3;
+            nz += (d[k] != 0);
+        }
+        if (nz == 0 || ((flags & HALO_FACES_ONLY) && nz > 1)) continue;
+
+        rank = 0;
+        for (k=0; k<h->ndims; k++)
+        {
+            c[k] = coords[k] + d[k];
+            if (c[k] < 0 || c[k] >= dims[k])
+            {
+                if (!periods[k]) rank = MPI_PROC_NULL;
+                c[k] = (c[k] + dims[k]) % dims[k];
+            }
+        }
+        if (rank != MPI_PROC_NULL) MPI_Cart_rank(cart, c, &rank);
+        h->nbr[n] = rank;
+
+        /* Send our interior edge towards d, receive into the ghost on side d */
+        for (k=0; k<h->ndims; k++)
+        {
+            h->dir[n][k] = d[k];
+            h->sub[n][k] = (d[k] == 0) ? nlocal[k] : ghost;
+            h->sstart[n][k] = (d[k] > 0) ? nlocal[k] : ghost;
+            h->rstart[n][k] = (d[k] < 0) ? 0 : (d[k] > 0) ? ghost + nlocal[k] : ghost;
+        }
+        MPI_Type_create_subarray(h->ndims, h->full, h->sub[n], h->sstart[n], MPI_ORDER_C,
+                                 elemtype, &h->stype[n]);
+        MPI_Type_create_subarray(h->ndims, h->full, h->sub[n], h->rstart[n], MPI_ORDER_C,
+                                 elemtype, &h->rtype[n]);
+        MPI_Type_commit(&h->stype[n]);
+        MPI_Type_commit(&h->rtype[n]);
+
+        h->bytes[n] = h->elemsize;
+        for (k=0; k<h->ndims; k++) h->bytes[n] *= h->sub[n][k];
+        h->nnbr++;
+    }
+
+    for (i=0; i<h->nnbr; i++)
+    {
+        int sendtag = halo_dir_index(h->dir[i], h->ndims);
+        int recvtag = ntot - 1 - sendtag;
+
+        if (flags & HALO_PACKED)
+        {
+            h->sbuf[i] = (char *) malloc(h->bytes[i]);
+            h->rbuf[i] = (char *) malloc(h->bytes[i]);
+            MPI_Recv_init(h->rbuf[i], h->bytes[i], MPI_BYTE, h->nbr[i], recvtag, cart, &h->reqs[i]);
+            MPI_Send_init(h->sbuf[i], h->bytes[i], MPI_BYTE, h->nbr[i], sendtag, cart,
+                          &h->reqs[h->nnbr + i]);
+        }
+        else
+        {
+            MPI_Recv_init(h->field, 1, h->rtype[i], h->nbr[i], recvtag, cart, &h->reqs[i]);
+            MPI_Send_init(h->field, 1, h->stype[i], h->nbr[i], sendtag, cart, &h->reqs[h->nnbr + i]);
+        }
+    }
+    return MPI_SUCCESS;
+}
+
+static inline void halo_start(halo_t *h)
+{
+    int i;
+    if (h->flags & HALO_PACKED)
+    {
+        for (i=0; i<h->nnbr; i++)
+        {
+            if (h->nbr[i] != MPI_PROC_NULL) halo_copy(h, h->sstart[i], h->sub[i], h->sbuf[i], 1);
+        }
+    }
+    MPI_Startall(2 * h->nnbr, h->reqs);
+}
+
+static inline void halo_wait(halo_t *h)
+{
+    int i;
+    MPI_Waitall(2 * h->nnbr, h->reqs, MPI_STATUSES_IGNORE);
+    if (h->flags & HALO_PACKED)
+    {
+        for (i=0; i<h->nnbr; i++)
+        {
+            if (h->nbr[i] != MPI_PROC_NULL) halo_copy(h, h->rstart[i], h->sub[i], h->rbuf[i], 0);
+        }
+    }
+}
+
+static inline void halo_exchange(halo_t *h)
+{
+    halo_start(h);
+    halo_wait(h);
+}
+
+static inline void halo_free(halo_t *h)
+{
+    int i;
+    for (i=0; i<2*h->nnbr; i++) MPI_Request_free(&h->reqs[i]);
+    for (i=0; i<h->nnbr; i++)
+    {
+        MPI_Type_free(&h->stype[i]);
+        MPI_Type_free(&h->rtype[i]);
+        free(h->sbuf[i]);
+        free(h->rbuf[i]);
+    }
+    h->nnbr = 0;
+}
+
+#endif /* HALO_H */
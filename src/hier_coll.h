@@ -0,0 +1,344 @@
+/*
+hier_coll.h
+
+   Two-level (node-aware) collectives. Ranks are grouped into nodes by
+   hashing MPI_Get_processor_name, each node's lowest rank joins a
+   leaders communicator, and bcast, reduce, allreduce and barrier run
+   as an intra-node stage through a shared-memory segment, one
+   collective among the leaders, and an intra-node fan-out. Only the
+   leaders' stage crosses the network, once per node instead of once
+   per rank.
+
+Usage
+
+   hier_t h;
+   hier_create(MPI_COMM_WORLD, 0, 0, &h);         nodes by host name
+   hier_bcast(&h, buf, count, MPI_DOUBLE, root);
+   hier_reduce(&h, in, out, count, MPI_DOUBLE, MPI_SUM, root);
+   hier_allreduce(&h, MPI_IN_PLACE, x, count, MPI_DOUBLE, MPI_SUM);
+   hier_barrier(&h);
+   hier_free(&h);
+
+   The arguments have the meaning of the flat collectives on the
+   communicator given to hier_create, and every rank of it must call.
+
+Remarks
+
+   hier_create(comm, ppn, seg_bytes, &h): ppn > 0 groups consecutive
+   ranks ppn at a time instead of by host, to try node layouts on one
+   machine. seg_bytes is each rank's share of the node segment
+   (0: HIER_SEG_BYTES); longer messages go through it in chunks.
+
+   Host names are hashed to pick an MPI_Comm_split color; ranks whose
+   names collide in the hash are told apart by comparing the names
+   within the color. The segment is an MPI_Win_allocate_shared window
+   on the node communicator, kept in an MPI_Win_lock_all epoch for the
+   lifetime of h and synchronized with MPI_Win_sync and node barriers.
+   If the ranks of a "node" cannot actually share memory (checked with
+   MPI_Comm_split_type), or the datatype is not contiguous, the
+   intra-node stages fall back to MPI_Bcast/MPI_Reduce on the node
+   communicator.
+
+   Reductions are combined within a node in shared memory, with every
+   node rank reducing its own slice of each chunk. Ranks of a node are
+   generally not consecutive in comm, so the order of operands is only
+   that of comm for nodes of consecutive ranks; non-commutative
+   operations therefore go straight to the flat collective.
+
+   h->nnodes, h->node_id and h->node_rank describe the layout; node_of
+   and local_of give node and node rank for every rank of comm.
+*/
+
+#ifndef HIER_COLL_H
+#define HIER_COLL_H
+
+#include "mpi.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define HIER_SEG_BYTES (64*1024)
+#define HIER_TAG 7373
+
+typedef struct
+{
+    MPI_Comm comm, node, leaders;       /* leaders: MPI_COMM_NULL except on node rank 0 */
+    int rank, size, node_rank, node_size, node_id, nnodes;
+    int *node_of, *local_of;
+    int shm;
+    MPI_Win win;
+    char **slot;                        /* every node rank's part of the segment */
+    MPI_Aint seg_bytes;
+    char *tmp;                          /* leader scratch for hier_reduce */
+    size_t tmp_bytes;
+} hier_t;
+
+/* FNV-1a */
+static inline unsigned hier_hash(const char *s)
+{
+    unsigned h = 2166136261u;
+    while (*s) h = (h ^ (unsigned char) *s++) * 16777619u;
+    return h;
+}
+
+static inline void hier_split_node(MPI_Comm comm, int ppn, MPI_Comm *node)
+{
+    int rank, gsize, len, first;
+    char name[MPI_MAX_PROCESSOR_NAME], *names;
+    MPI_Comm group;
+
+    MPI_Comm_rank(comm, &rank);
+    if (ppn > 0)
+    {
+        MPI_Comm_split(comm, rank / ppn, rank, node);
+        return;
+    }
+    memset(name, 0, sizeof(name));
+    MPI_Get_processor_name(name, &len);
+    MPI_Comm_split(comm, (int) (hier_hash(name) & 0x7fffffff), rank, &group);
+
+    /* Same hash, maybe different hosts: split again by the first rank with my name */
+    MPI_Comm_size(group, &gsize);
+    names = (char *) malloc((size_t) gsize * MPI_MAX_PROCESSOR_NAME);
+    MPI_Allgather(name, MPI_MAX_PROCESSOR_NAME, MPI_CHAR, names, MPI_MAX_PROCESSOR_NAME, MPI_CHAR, group);
+    for (first=0; first<gsize; first++)
+        if (strncmp(names + (size_t) first * MPI_MAX_PROCESSOR_NAME, name, MPI_MAX_PROCESSOR_NAME) == 0) break;
+    MPI_Comm_split(group, first, rank, node);
+    free(names);
+    MPI_Comm_free(&group);
+}
+
+static inline int hier_create(MPI_Comm comm, int ppn, MPI_Aint seg_bytes, hier_t *h)
+{
+    int i, info[2], shared_size, ok, disp_unit, *all;
+    MPI_Aint bytes;
+    MPI_Comm shm;
+    char *base;
+
+    memset(h, 0, sizeof(*h));
+    h->comm = comm;
+    h->seg_bytes = seg_bytes > 0 ? seg_bytes : HIER_SEG_BYTES;
+    MPI_Comm_rank(comm, &h->rank);
+    MPI_Comm_size(comm, &h->size);
+
+    hier_split_node(comm, ppn, &h->node);
+    MPI_Comm_rank(h->node, &h->node_rank);
+    MPI_Comm_size(h->node, &h->node_size);
+    MPI_Comm_split(comm, h->node_rank == 0 ? 0 : MPI_UNDEFINED, h->rank, &h->leaders);
+    if (h->leaders != MPI_COMM_NULL)
+    {
+        MPI_Comm_rank(h->leaders, &info[0]);
+        MPI_Comm_size(h->leaders, &info[1]);
+    }
+    MPI_Bcast(info, 2, MPI_INT, 0, h->node);
+    h->node_id = info[0];
+    h->nnodes = info[1];
+
+    all = (int *) malloc(2 * h->size * sizeof(int));
+    h->node_of = (int *) malloc(h->size * sizeof(int));
+    h->local_of = (int *) malloc(h->size * sizeof(int));
+    info[0] = h->node_id;
+    info[1] = h->node_rank;
+    MPI_Allgather(info, 2, MPI_INT, all, 2, MPI_INT, comm);
+    for (i=0; i<h->size; i++)
+    {
+        h->node_of[i] = all[2*i];
+        h->local_of[i] = all[2*i+1];
+    }
+    free(all);
+
+    /* The segment only if the whole node is one shared-memory domain */
+    MPI_Comm_split_type(h->node, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &shm);
+    MPI_Comm_size(shm, &shared_size);
+    MPI_Comm_free(&shm);
+    ok = (shared_size == h->node_size);
+    MPI_Allreduce(&ok, &h->shm, 1, MPI_INT, MPI_LAND, h->node);
+    if (h->shm && h->node_size > 1)
+    {
+        MPI_Win_allocate_shared(h->seg_bytes, 1, MPI_INFO_NULL, h->node, &base, &h->win);
+        h->slot = (char **) malloc(h->node_size * sizeof(char *));
+        for (i=0; i<h->node_size; i++)
+            MPI_Win_shared_query(h->win, i, &bytes, &disp_unit, &h->slot[i]);
+        MPI_Win_lock_all(MPI_MODE_NOCHECK, h->win);
+    }
+    else
+    {
+        h->shm = 0;
+    }
+    return MPI_SUCCESS;
+}
+
+static inline void hier_free(hier_t *h)
+{
+    if (h->shm)
+    {
+        MPI_Win_unlock_all(h->win);
+        MPI_Win_free(&h->win);
+        free(h->slot);
+    }
+    if (h->leaders != MPI_COMM_NULL) MPI_Comm_free(&h->leaders);
+    MPI_Comm_free(&h->node);
+    free(h->node_of);
+    free(h->local_of);
+    free(h->tmp);
+}
+
+/* Make the node's segment writes visible to each other */
+static inline void hier_sync(hier_t *h)
+{
+    MPI_Win_sync(h->win);
+    MPI_Barrier(h->node);
+    MPI_Win_sync(h->win);
+}
+
+/* Elements of type per segment chunk, or 0 if the segment cannot carry type */
+static inline int hier_chunk(const hier_t *h, MPI_Datatype type, int *tsize)
+{
+    MPI_Aint lb, extent, tlb, textent;
+
+    MPI_Type_size(type, tsize);
+    MPI_Type_get_extent(type, &lb, &extent);
+    MPI_Type_get_true_extent(type, &tlb, &textent);
+    if (!h->shm || *tsize == 0 || tlb != 0 || textent != *tsize || extent != *tsize) return 0;
+    if (*tsize > h->seg_bytes) return 0;
+    return (int) (h->seg_bytes / *tsize);
+}
+
+/* Leader scratch for count elements of type, as a buffer address */
+static inline void *hier_scratch(hier_t *h, int count, MPI_Datatype type)
+{
+    MPI_Aint lb, extent, tlb, textent;
+    size_t bytes;
+
+    MPI_Type_get_extent(type, &lb, &extent);
+    MPI_Type_get_true_extent(type, &tlb, &textent);
+    bytes = count > 0 ? (size_t) (count - 1) * extent + textent : 1;
+    if (bytes > h->tmp_bytes)
+    {
+        free(h->tmp);
+        h->tmp = (char *) malloc(bytes);
+        h->tmp_bytes = bytes;
+    }
+    return h->tmp - tlb;
+}
+
+/* Intra-node fan-out of node rank 0's buf */
+static inline void hier_node_bcast(hier_t *h, void *buf, int count, MPI_Datatype type)
+{
+    int chunk, tsize, off, n;
+
+    if (h->node_size == 1) return;
+    chunk = hier_chunk(h, type, &tsize);
+    if (chunk == 0)
+    {
+        MPI_Bcast(buf, count, type, 0, h->node);
+        return;
+    }
+    for (off=0; off<count; off+=chunk)
+    {
+        n = (count - off < chunk) ? count - off : chunk;
+        if (h->node_rank == 0) memcpy(h->slot[0], (char *) buf + (size_t) off * tsize, (size_t) n * tsize);
+        hier_sync(h);
+        if (h->node_rank != 0) memcpy((char *) buf + (size_t) off * tsize, h->slot[0], (size_t) n * tsize);
+        MPI_Barrier(h->node);           /* slot 0 is free again */
+    }
+}
+
+/* Intra-node reduction of sendbuf into node rank 0's recvbuf */
+static inline void hier_node_reduce(hier_t *h, const void *sendbuf, void *recvbuf, int count,
+                                    MPI_Datatype type, MPI_Op op)
+{
+    int chunk, tsize, off, n, lo, hi, i, last = h->node_size - 1;
+
+    chunk = hier_chunk(h, type, &tsize);
+    if (chunk == 0 || h->node_size == 1)
+    {
+        if (h->node_rank == 0 && sendbuf == recvbuf) sendbuf = MPI_IN_PLACE;
+        MPI_Reduce(sendbuf, recvbuf, count, type, op, 0, h->node);
+        return;
+    }
+    for (off=0; off<count; off+=chunk)
+    {
+        n = (count - off < chunk) ? count - off : chunk;
+        memcpy(h->slot[h->node_rank], (const char *) sendbuf + (size_t) off * tsize, (size_t) n * tsize);
+        hier_sync(h);
+
+        /* Every node rank folds its slice of all slots into the last slot */
+        lo = (int) ((long long) n * h->node_rank / h->node_size);
+        hi = (int) ((long long) n * (h->node_rank + 1) / h->node_size);
+        if (hi > lo)
+            for (i=last-1; i>=0; i--)
+                MPI_Reduce_local(h->slot[i] + (size_t) lo * tsize, h->slot[last] + (size_t) lo * tsize,
+                                 hi - lo, type, op);
+        hier_sync(h);
+
+        if (h->node_rank == 0) memcpy((char *) recvbuf + (size_t) off * tsize, h->slot[last], (size_t) n * tsize);
+        MPI_Barrier(h->node);           /* the slots are free again */
+    }
+}
+
+static inline int hier_bcast(hier_t *h, void *buf, int count, MPI_Datatype type, int root)
+{
+    int rnode = h->node_of[root], rlocal = h->local_of[root];
+
+    /* The root hands the data to its leader, the leaders broadcast, the nodes fan out */
+    if (rlocal != 0 && h->node_id == rnode)
+    {
+        if (h->node_rank == rlocal) MPI_Send(buf, count, type, 0, HIER_TAG, h->node);
+        else if (h->node_rank == 0) MPI_Recv(buf, count, type, rlocal, HIER_TAG, h->node, MPI_STATUS_IGNORE);
+    }
+    if (h->leaders != MPI_COMM_NULL && h->nnodes > 1) MPI_Bcast(buf, count, type, rnode, h->leaders);
+    hier_node_bcast(h, buf, count, type);
+    return MPI_SUCCESS;
+}
+
+static inline int hier_reduce(hier_t *h, const void *sendbuf, void *recvbuf, int count, MPI_Datatype type,
+                              MPI_Op op, int root)
+{
+    int commute, rnode = h->node_of[root], rlocal = h->local_of[root];
+    void *part = NULL;
+
+    MPI_Op_commutative(op, &commute);
+    if (!commute) return MPI_Reduce(sendbuf, recvbuf, count, type, op, root, h->comm);
+    if (sendbuf == MPI_IN_PLACE) sendbuf = recvbuf;
+
+    /* The node's partial result lands in recvbuf on a root that leads its node, else in scratch */
+    if (h->node_rank == 0) part = (h->rank == root) ? recvbuf : hier_scratch(h, count, type);
+    hier_node_reduce(h, sendbuf, part, count, type, op);
+    if (h->leaders != MPI_COMM_NULL && h->nnodes > 1)
+    {
+        if (h->node_id == rnode) MPI_Reduce(MPI_IN_PLACE, part, count, type, op, rnode, h->leaders);
+        else MPI_Reduce(part, NULL, count, type, op, rnode, h->leaders);
+    }
+    if (rlocal != 0 && h->node_id == rnode)
+    {
+        if (h->node_rank == 0) MPI_Send(part, count, type, rlocal, HIER_TAG, h->node);
+        else if (h->node_rank == rlocal) MPI_Recv(recvbuf, count, type, 0, HIER_TAG, h->node, MPI_STATUS_IGNORE);
+    }
+    return MPI_SUCCESS;
+}
+
+static inline int hier_allreduce(hier_t *h, const void *sendbuf, void *recvbuf, int count, MPI_Datatype type,
+                                 MPI_Op op)
+{
+    int commute;
+
+    MPI_Op_commutative(op, &commute);
+    if (!commute) return MPI_Allreduce(sendbuf, recvbuf, count, type, op, h->comm);
+    if (sendbuf == MPI_IN_PLACE) sendbuf = recvbuf;
+
+    hier_node_reduce(h, sendbuf, recvbuf, count, type, op);
+    if (h->leaders != MPI_COMM_NULL && h->nnodes > 1)
+        MPI_Allreduce(MPI_IN_PLACE, recvbuf, count, type, op, h->leaders);
+    hier_node_bcast(h, recvbuf, count, type);
+    return MPI_SUCCESS;
+}
+
+static inline int hier_barrier(hier_t *h)
+{
+    MPI_Barrier(h->node);
+    if (h->leaders != MPI_COMM_NULL && h->nnodes > 1) MPI_Barrier(h->leaders);
+    MPI_Barrier(h->node);
+    return MPI_SUCCESS;
+}
+
+#endif /* HIER_COLL_H */
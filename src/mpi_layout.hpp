@@ -0,0 +1,320 @@
+/*
+mpi_layout.hpp
+
+   Header-only C++17 layer that describes a memory layout once, at
+   compile time, and derives both the MPI datatype and specialized
+   pack/unpack routines from that description. A send can then go out
+   either as the library datatype or as a packed MPI_BYTE buffer filled
+   by code the compiler has unrolled for exactly this layout.
+
+Usage
+
+   struct Partstruct { char c; double d[6]; char b[7]; };
+
+   using part_layout = mpi_layout::struct_layout<Partstruct,
+       MPI_LAYOUT_FIELD(Partstruct, c),
+       MPI_LAYOUT_FIELD(Partstruct, d),
+       MPI_LAYOUT_FIELD(Partstruct, b)>;
+
+   MPI_Send(p, n, part_layout::datatype(), 1, 0, comm);        library
+   mpi_layout::send<part_layout>(p, n, 1, 0, comm,
+                                 mpi_layout::transfer::packed);  unrolled
+
+   using col_layout = mpi_layout::vector_layout<double, 3, 8>;  3 of every 8
+   using box_layout = mpi_layout::box_layout<double, 4, 4, 4, 64, 64>;
+
+Remarks
+
+   Every layout L provides value_type, packed_size (payload bytes of one
+   instance), stride (value_type elements from one instance to the
+   next), datatype(), pack(in, count, out) and unpack(in, count, out).
+
+   struct_layout lists the members to transfer with MPI_LAYOUT_FIELD;
+   members may be basic types or arrays of them. Offsets come from
+   offsetof, so they are compile-time constants; members that are
+   adjacent in memory and in the list are merged into one copy, and
+   the copies of one element are expanded with constant sizes, which
+   the compiler turns into plain loads and stores. The datatype is
+   MPI_Type_create_struct resized to sizeof(S), so count consecutive
+   elements of an array can be sent at once.
+
+   vector_layout<T, BlockLen, Stride> is BlockLen elements out of every
+   Stride; box_layout<T, N0, N1, N2, F1, F2> is an N0 x N1 x N2 box in
+   a C array whose last two extents are F1 and F2 (the first extent is
+   N0, so consecutive boxes are consecutive arrays).
+
+   datatype() builds and commits the type on its first call, so it must
+   be called after MPI_Init; the type is kept until the program ends.
+   The packed transfer sends raw bytes and therefore assumes both sides
+   share the same representation, as any homogeneous cluster does;
+   sender and receiver must use the same transfer mode.
+*/
+
+#ifndef MPI_LAYOUT_HPP
+#define MPI_LAYOUT_HPP
+
+#include "mpi.h"
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace mpi_layout
+{
+
+template <typename T> struct basic_type;
+
+#define MPI_LAYOUT_BASIC(T, M) \
+    template <> struct basic_type<T> { static MPI_Datatype get() { return M; } };
+MPI_LAYOUT_BASIC(char, MPI_CHAR)
+MPI_LAYOUT_BASIC(signed char, MPI_SIGNED_CHAR)
+MPI_LAYOUT_BASIC(unsigned char, MPI_UNSIGNED_CHAR)
+MPI_LAYOUT_BASIC(short, MPI_SHORT)
+MPI_LAYOUT_BASIC(unsigned short, MPI_UNSIGNED_SHORT)
+MPI_LAYOUT_BASIC(int, MPI_INT)
+MPI_LAYOUT_BASIC(unsigned, MPI_UNSIGNED)
+MPI_LAYOUT_BASIC(long, MPI_LONG)
+MPI_LAYOUT_BASIC(unsigned long, MPI_UNSIGNED_LONG)
+MPI_LAYOUT_BASIC(long long, MPI_LONG_LONG)
+MPI_LAYOUT_BASIC(unsigned long long, MPI_UNSIGNED_LONG_LONG)
+MPI_LAYOUT_BASIC(float, MPI_FLOAT)
+MPI_LAYOUT_BASIC(double, MPI_DOUBLE)
+MPI_LAYOUT_BASIC(long double, MPI_LONG_DOUBLE)
+#undef MPI_LAYOUT_BASIC
+
+/* One struct member: its type, byte offset and number of basic elements */
+template <typename T, std::size_t Offset>
+struct field
+{
+    using member_type = T;
+    using elem_type = std::remove_all_extents_t<T>;
+    static constexpr std::size_t offset = Offset;
+    static constexpr std::size_t size = sizeof(T);
+    static constexpr int count = (int) (sizeof(T) / sizeof(elem_type));
+};
+
+#define MPI_LAYOUT_FIELD(S, m) ::mpi_layout::field<decltype(S::m), offsetof(S, m)>
+
+/* A single copy: len bytes from src in the element to dst in the packed record */
+struct run
+{
+    std::size_t src, dst, len;
+};
+
+template <typename... F>
+constexpr std::size_t count_runs()
+{
+    constexpr std::size_t off[] = { F::offset... }, len[] = { F::size... };
+    std::size_t n = 0, end = 0;
+    for (std::size_t i = 0; i < sizeof...(F); i++)
+    {
+        if (i == 0 || off[i] != end) n++;
+        end = off[i] + len[i];
+    }
+    return n;
+}
+
+template <typename... F>
+constexpr std::array<run, count_runs<F...>()> make_runs()
+{
+    constexpr std::size_t off[] = { F::offset... }, len[] = { F::size... };
+    std::array<run, count_runs<F...>()> r{};
+    std::size_t n = 0, end = 0, dst = 0;
+    for (std::size_t i = 0; i < sizeof...(F); i++)
+    {
+        if (i == 0 || off[i] != end) r[n++] = run{ off[i], dst, len[i] };
+        else r[n-1].len += len[i];
+        end = off[i] + len[i];
+        dst += len[i];
+    }
+    return r;
+}
+
+template <typename S, typename... F>
+struct struct_layout
+{
+    static_assert(sizeof...(F) > 0, "struct_layout needs at least one field");
+    static_assert(std::is_trivially_copyable<S>::value, "struct_layout needs a trivially copyable type");
+
+    using value_type = S;
+    static constexpr std::size_t packed_size = (F::size + ...);
+    static constexpr std::size_t stride = 1;
+    static constexpr auto runs = make_runs<F...>();
+
+    static MPI_Datatype datatype()
+    {
+        static MPI_Datatype type = build();
+        return type;
+    }
+
+    static void pack(const S *in, std::size_t count, void *out)
+    {
+        char *o = static_cast<char *>(out);
+        for (std::size_t i = 0; i < count; i++, o += packed_size)
+            copy_out(reinterpret_cast<const char *>(in + i), o, std::make_index_sequence<runs.size()>{});
+    }
+
+    static void unpack(const void *in, std::size_t count, S *out)
+    {
+        const char *p = static_cast<const char *>(in);
+        for (std::size_t i = 0; i < count; i++, p += packed_size)
+            copy_in(p, reinterpret_cast<char *>(out + i), std::make_index_sequence<runs.size()>{});
+    }
+
+private:
+    template <std::size_t... I>
+    static void copy_out(const char *s, char *d, std::index_sequence<I...>)
+    {
+        (std::memcpy(d + runs[I].dst, s + runs[I].src, runs[I].len), ...);
+    }
+
+    template <std::size_t... I>
+    static void copy_in(const char *s, char *d, std::index_sequence<I...>)
+    {
+        (std::memcpy(d + runs[I].src, s + runs[I].dst, runs[I].len), ...);
+    }
+
+    static MPI_Datatype build()
+    {
+        int blocklens[] = { F::count... };
+        MPI_Aint disps[] = { (MPI_Aint) F::offset... };
+        MPI_Datatype types[] = { basic_type<typename F::elem_type>::get()... };
+        MPI_Datatype tmp, type;
+
+        MPI_Type_create_struct((int) sizeof...(F), blocklens, disps, types, &tmp);
+        MPI_Type_create_resized(tmp, 0, sizeof(S), &type);
+        MPI_Type_free(&tmp);
+        MPI_Type_commit(&type);
+        return type;
+    }
+};
+
+template <typename T, std::size_t BlockLen, std::size_t Stride>
+struct vector_layout
+{
+    static_assert(BlockLen > 0 && BlockLen <= Stride, "vector_layout needs 0 < BlockLen <= Stride");
+
+    using value_type = T;
+    static constexpr std::size_t packed_size = BlockLen * sizeof(T);
+    static constexpr std::size_t stride = Stride;
+
+    /* One block, resized to the stride: count blocks make the vector */
+    static MPI_Datatype datatype()
+    {
+        static MPI_Datatype type = build();
+        return type;
+    }
+
+    static void pack(const T *in, std::size_t count, void *out)
+    {
+        T *o = static_cast<T *>(out);
+        for (std::size_t i = 0; i < count; i++)
+            for (std::size_t k = 0; k < BlockLen; k++) o[i * BlockLen + k] = in[i * Stride + k];
+    }
+
+    static void unpack(const void *in, std::size_t count, T *out)
+    {
+        const T *p = static_cast<const T *>(in);
+        for (std::size_t i = 0; i < count; i++)
+            for (std::size_t k = 0; k < BlockLen; k++) out[i * Stride + k] = p[i * BlockLen + k];
+    }
+
+private:
+    static MPI_Datatype build()
+    {
+        MPI_Datatype tmp, type;
+        MPI_Type_contiguous((int) BlockLen, basic_type<T>::get(), &tmp);
+        MPI_Type_create_resized(tmp, 0, (MPI_Aint) (Stride * sizeof(T)), &type);
+        MPI_Type_free(&tmp);
+        MPI_Type_commit(&type);
+        return type;
+    }
+};
+
+template <typename T, std::size_t N0, std::size_t N1, std::size_t N2, std::size_t F1, std::size_t F2>
+struct box_layout
+{
+    static_assert(N1 <= F1 && N2 <= F2, "box_layout box must fit in the array");
+
+    using value_type = T;
+    static constexpr std::size_t packed_size = N0 * N1 * N2 * sizeof(T);
+    static constexpr std::size_t stride = N0 * F1 * F2;
+
+    static MPI_Datatype datatype()
+    {
+        static MPI_Datatype type = build();
+        return type;
+    }
+
+    static void pack(const T *in, std::size_t count, void *out)
+    {
+        T *o = static_cast<T *>(out);
+        for (std::size_t b = 0; b < count; b++, in += stride)
+            for (std::size_t i = 0; i < N0; i++)
+                for (std::size_t j = 0; j < N1; j++, o += N2)
+                    for (std::size_t k = 0; k < N2; k++) o[k] = in[(i * F1 + j) * F2 + k];
+    }
+
+    static void unpack(const void *in, std::size_t count, T *out)
+    {
+        const T *p = static_cast<const T *>(in);
+        for (std::size_t b = 0; b < count; b++, out += stride)
+            for (std::size_t i = 0; i < N0; i++)
+                for (std::size_t j = 0; j < N1; j++, p += N2)
+                    for (std::size_t k = 0; k < N2; k++) out[(i * F1 + j) * F2 + k] = p[k];
+    }
+
+private:
+    static MPI_Datatype build()
+    {
+        int sizes[3] = { (int) N0, (int) F1, (int) F2 };
+        int subs[3] = { (int) N0, (int) N1, (int) N2 };
+        int starts[3] = { 0, 0, 0 };
+        MPI_Datatype type;
+        MPI_Type_create_subarray(3, sizes, subs, starts, MPI_ORDER_C, basic_type<T>::get(), &type);
+        MPI_Type_commit(&type);
+        return type;
+    }
+};
+
+enum class transfer { datatype, packed };
+
+/* Per-thread buffer reused by the packed transfers */
+inline std::vector<char> &scratch(std::size_t bytes)
+{
+    static thread_local std::vector<char> buf;
+    if (buf.size() < bytes) buf.resize(bytes);
+    return buf;
+}
+
+template <typename L>
+int send(const typename L::value_type *buf, int count, int dest, int tag, MPI_Comm comm, transfer how)
+{
+    if (how == transfer::datatype) return MPI_Send(buf, count, L::datatype(), dest, tag, comm);
+    std::vector<char> &tmp = scratch(count * L::packed_size);
+    L::pack(buf, count, tmp.data());
+    return MPI_Send(tmp.data(), (int) (count * L::packed_size), MPI_BYTE, dest, tag, comm);
+}
+
+template <typename L>
+int recv(typename L::value_type *buf, int count, int source, int tag, MPI_Comm comm, transfer how,
+         MPI_Status *status)
+{
+    if (how == transfer::datatype) return MPI_Recv(buf, count, L::datatype(), source, tag, comm, status);
+    std::vector<char> &tmp = scratch(count * L::packed_size);
+    MPI_Status st;
+    if (status == MPI_STATUS_IGNORE) status = &st;
+    int err = MPI_Recv(tmp.data(), (int) (count * L::packed_size), MPI_BYTE, source, tag, comm, status);
+    if (err != MPI_SUCCESS) return err;
+    /* Only the elements that arrived: a shorter message leaves the rest of buf alone, as MPI_Recv does */
+    int n;
+    MPI_Get_count(status, MPI_BYTE, &n);
+    L::unpack(tmp.data(), n / L::packed_size, buf);
+    return MPI_SUCCESS;
+}
+
+} // namespace mpi_layout
+
+#endif /* MPI_LAYOUT_HPP */
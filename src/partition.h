@@ -0,0 +1,186 @@
+/*
+partition.h
+
+   Prefix-sum based load balancing. Every rank's place in the global
+   order of items comes from one MPI_Exscan of its local count (or
+   weight), so no rank gathers the whole distribution; the items are
+   then moved with alltoallv_engine.h so that each rank ends up with an
+   equal share of the count or of the weight, still in global order.
+   The same offsets give parallel stream compaction: filter locally,
+   then number the survivors globally.
+
+Usage
+
+   long long offset, total;
+   part_offsets(n, &offset, &total, comm);    my items are offset..offset+n-1
+
+   part_plan_t p;
+   part_plan_block(n, &p, comm);              or part_plan_weighted(n, w, &p, comm)
+   items_new = malloc(p.nrecv * sizeof(item));
+   part_move(&p, items, item_type, items_new);
+   part_plan_free(&p);
+
+   m = part_compact(items, n, item_type, keep, kept, &offset, &total, comm);
+                                              kept[i] has global index offset + i
+
+Remarks
+
+   Items are elements of one MPI datatype, addressed by its extent like
+   the elements of an MPI_Alltoallv buffer. Local counts are int, global
+   counts and offsets long long.
+
+   part_plan_block gives rank r the items with global index in
+   [part_block_start(r), part_block_start(r+1)), i.e. total/size each
+   with the remainder spread over the first ranks. part_plan_weighted
+   sends an item to the rank whose slice of the total weight holds the
+   middle of the item's own weight, which balances the weight to within
+   the heaviest item per rank; weights must be non-negative, and if
+   they are all zero the plan is part_plan_block's. Both keep the
+   global order, so every rank sends one contiguous run to each of a
+   contiguous range of ranks and the send buffer needs no reordering;
+   the receive counts are exchanged with a2av_counts.
+
+   part_move uses A2AV_AUTO; p->alg can be set beforehand to force an
+   algorithm. part_compact copies items by extent (the datatype must be
+   contiguous) into out, which must hold n items and may be in itself.
+*/
+
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include "mpi.h"
+#include <stdlib.h>
+#include <string.h>
+#include "alltoallv_engine.h"
+
+typedef struct
+{
+    MPI_Comm comm;
+    int size, rank, alg;
+    long long offset, total;            /* my first item's global index, all items */
+    int *sendcounts, *sdispls, *recvcounts, *rdispls;
+    int nsend, nrecv;
+} part_plan_t;
+
+/* Collective: exclusive prefix and total of n over comm */
+static inline int part_offsets(long long n, long long *offset, long long *total, MPI_Comm comm)
+{
+    int rank;
+
+    MPI_Comm_rank(comm, &rank);
+    *offset = 0;
+    MPI_Exscan(&n, offset, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    if (rank == 0) *offset = 0;         /* MPI_Exscan leaves rank 0's result undefined */
+    return MPI_Allreduce(&n, total, 1, MPI_LONG_LONG, MPI_SUM, comm);
+}
+
+/* First global index owned by rank r when total items are split evenly over size ranks */
+static inline long long part_block_start(int r, long long total, int size)
+{
+    return r * (total / size) + (r < total % size ? r : total % size);
+}
+
+static inline void part_plan_init(int n, part_plan_t *p, MPI_Comm comm)
+{
+    memset(p, 0, sizeof(*p));
+    p->comm = comm;
+    p->nsend = n;
+    p->alg = A2AV_AUTO;
+    MPI_Comm_size(comm, &p->size);
+    MPI_Comm_rank(comm, &p->rank);
+    p->sendcounts = (int *) calloc(4 * (size_t) p->size, sizeof(int));
+    p->sdispls = p->sendcounts + p->size;
+    p->recvcounts = p->sdispls + p->size;
+    p->rdispls = p->recvcounts + p->size;
+}
+
+/* Send displacements from the counts, receive side from the peers */
+static inline void part_plan_finish(part_plan_t *p)
+{
+    int r;
+    for (r=0; r<p->size; r++) p->sdispls[r] = r ? p->sdispls[r-1] + p->sendcounts[r-1] : 0;
+    p->nrecv = a2av_counts(p->sendcounts, p->recvcounts, p->rdispls, p->comm);
+}
+
+/* Collective: equal counts per rank */
+static inline int part_plan_block(int n, part_plan_t *p, MPI_Comm comm)
+{
+    long long lo, hi, start, end;
+    int r;
+
+    part_plan_init(n, p, comm);
+    part_offsets(n, &p->offset, &p->total, comm);
+
+    /* Overlap of my range [offset, offset+n) with every rank's block */
+    for (r=0; r<p->size && n > 0; r++)
+    {
+        start = part_block_start(r, p->total, p->size);
+        end = part_block_start(r + 1, p->total, p->size);
+        lo = p->offset > start ? p->offset : start;
+        hi = p->offset + n < end ? p->offset + n : end;
+        if (hi > lo) p->sendcounts[r] = (int) (hi - lo);
+    }
+    part_plan_finish(p);
+    return MPI_SUCCESS;
+}
+
+/* Collective: equal weight per rank, to within the heaviest item */
+static inline int part_plan_weighted(int n, const double *w, part_plan_t *p, MPI_Comm comm)
+{
+    double mine = 0.0, before = 0.0, total, mid;
+    int i, r;
+
+    for (i=0; i<n; i++) mine += w[i];
+    MPI_Allreduce(&mine, &total, 1, MPI_DOUBLE, MPI_SUM, comm);
+    if (total <= 0.0) return part_plan_block(n, p, comm);
+
+    part_plan_init(n, p, comm);
+    part_offsets(n, &p->offset, &p->total, comm);
+    MPI_Exscan(&mine, &before, 1, MPI_DOUBLE, MPI_SUM, comm);
+    if (p->rank == 0) before = 0.0;
+
+    for (i=0; i<n; i++)
+    {
+        mid = before + 0.5 * w[i];
+        r = (int) (mid / total * p->size);
+        if (r < 0) r = 0;
+        if (r >= p->size) r = p->size - 1;
+        p->sendcounts[r]++;
+        before += w[i];
+    }
+    part_plan_finish(p);
+    return MPI_SUCCESS;
+}
+
+/* Collective: send p->nsend items of type from sendbuf, receive p->nrecv into recvbuf */
+static inline int part_move(const part_plan_t *p, const void *sendbuf, MPI_Datatype type, void *recvbuf)
+{
+    return a2av_alltoallv(sendbuf, p->sendcounts, p->sdispls, type, recvbuf, p->recvcounts, p->rdispls,
+                          type, p->comm, p->alg);
+}
+
+static inline void part_plan_free(part_plan_t *p)
+{
+    free(p->sendcounts);
+}
+
+/* Collective: copy the items with keep[i] != 0 to out; returns their count */
+static inline int part_compact(const void *in, int n, MPI_Datatype type, const char *keep, void *out,
+                               long long *offset, long long *total, MPI_Comm comm)
+{
+    MPI_Aint lb, extent;
+    int i, m = 0;
+
+    MPI_Type_get_extent(type, &lb, &extent);
+    for (i=0; i<n; i++)
+    {
+        if (!keep[i]) continue;
+        if (m != i || in != out)
+            memmove((char *) out + (size_t) m * extent, (const char *) in + (size_t) i * extent, extent);
+        m++;
+    }
+    part_offsets(m, offset, total, comm);
+    return m;
+}
+
+#endif /* PARTITION_H */
@@ -0,0 +1,352 @@
+/*
+reduce_scatter_engine.h
+
+   User-level MPI_Reduce_scatter with three algorithms and an automatic
+   choice between them, for any recvcounts and any communicator size:
+
+   RS_HALVING   recursive halving: log2(p) MPI_Sendrecv steps, each
+                exchanging the half of the remaining blocks the partner
+                keeps. A non-power-of-two p first folds 2*(p - 2^k) ranks
+                pairwise and unfolds them at the end. Few messages, and
+                the owner of a large block receives it only log2(p)
+                times.
+   RS_PAIRWISE  p-1 steps; in step k every rank sends the block of
+                rank+k to it and receives its own block from rank-k.
+                Every element travels once, straight from sendbuf.
+   RS_RING      p-1 steps around the ring; each rank forwards the partial
+                result of one block to rank+1. Only neighbour traffic,
+                but a step lasts as long as its largest block.
+
+Usage
+
+   rs_reduce_scatter(sendbuf, recvbuf, recvcounts, MPI_DOUBLE, MPI_SUM,
+                     comm, RS_AUTO);
+
+Remarks
+
+   The arguments have the meaning they have for MPI_Reduce_scatter,
+   including MPI_IN_PLACE (the input is then taken from recvbuf and
+   the result is left at its start). Zero recvcounts are allowed;
+   zero-length messages are not sent.
+
+   Halving and ring combine contributions in an order that depends on
+   the algorithm, so they require a commutative op; with a
+   non-commutative one they run the pairwise algorithm, which
+   accumulates the ranks below and above its own separately and
+   combines them in rank order at the end (one extra block of memory).
+
+   RS_AUTO decides from recvcounts, datatype and op alone, which are the
+   same on every rank: pairwise for non-commutative ops and for large
+   (more than RS_HALVING_BYTES in total) balanced blocks, halving
+   otherwise; a block more than RS_SKEW times the average counts as
+   skewed. Ring is only used when asked for.
+
+   Work buffers are allocated per call from the datatype's extent.
+   Messages use tag RS_TAG on comm.
+*/
+
+#ifndef REDUCE_SCATTER_ENGINE_H
+#define REDUCE_SCATTER_ENGINE_H
+
+#include "mpi.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define RS_AUTO     0
+#define RS_HALVING  1
+#define RS_PAIRWISE 2
+#define RS_RING     3
+
+#define RS_TAG           5353
+#define RS_HALVING_BYTES (512*1024)
+#define RS_SKEW          4
+
+static inline const char *rs_name(int alg)
+{
+    switch (alg)
+    {
+    case RS_HALVING:  return "halving";
+    case RS_PAIRWISE: return "pairwise";
+    case RS_RING:     return "ring";
+    default:          return "auto";
+    }
+}
+
+/* Buffer for count elements of type, and the address to free it with */
+static inline char *rs_alloc(int count, MPI_Datatype type, void **mem)
+{
+    MPI_Aint lb, extent, tlb, textent;
+    MPI_Type_get_extent(type, &lb, &extent);
+    MPI_Type_get_true_extent(type, &tlb, &textent);
+    *mem = malloc(count > 0 ? (size_t) (count - 1) * extent + textent : 1);
+    return (char *) *mem - tlb;
+}
+
+static inline void rs_copy(const void *src, void *dst, int count, MPI_Datatype type)
+{
+    if (src == dst || count == 0) return;
+    MPI_Sendrecv(src, count, type, 0, RS_TAG, dst, count, type, 0, RS_TAG, MPI_COMM_SELF, MPI_STATUS_IGNORE);
+}
+
+/* Block displacements (in elements) from the counts; returns the total */
+static inline int rs_displs(const int *recvcounts, int size, int *displs)
+{
+    int i, total = 0;
+    for (i=0; i<size; i++)
+    {
+        displs[i] = total;
+        total += recvcounts[i];
+    }
+    return total;
+}
+
+static inline int rs_choose(const int *recvcounts, MPI_Datatype type, MPI_Op op, MPI_Comm comm)
+{
+    int i, size, tsize, commute, maxc = 0;
+    long long total = 0;
+
+    MPI_Comm_size(comm, &size);
+    MPI_Type_size(type, &tsize);
+    MPI_Op_commutative(op, &commute);
+    if (!commute) return RS_PAIRWISE;
+    for (i=0; i<size; i++)
+    {
+        total += recvcounts[i];
+        if (recvcounts[i] > maxc) maxc = recvcounts[i];
+    }
+    if (total * tsize > RS_HALVING_BYTES && (long long) maxc * size <= RS_SKEW * total) return RS_PAIRWISE;
+    return RS_HALVING;
+}
+
+static inline int rs_pairwise(const void *sendbuf, void *recvbuf, const int *recvcounts, MPI_Datatype type,
+                              MPI_Op op, MPI_Comm comm)
+{
+    int k, rank, size, dst, src, n, commute, upper, first, have_lo = 0, have_hi = 0, *displs;
+    MPI_Aint lb, extent;
+    void *mem[3];
+    char *lo, *hi, *tmp, *acc, *in;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    MPI_Type_get_extent(type, &lb, &extent);
+    MPI_Op_commutative(op, &commute);
+    if (sendbuf == MPI_IN_PLACE) sendbuf = recvbuf;
+    displs = (int *) malloc(size * sizeof(int));
+    rs_displs(recvcounts, size, displs);
+    n = recvcounts[rank];
+
+    /*
+    * hi collects the ranks above me, received from p-1 downwards, as
+    * x[src] op hi; lo the ranks below, received from rank-1 downwards,
+    * as x[src] op lo. A commutative op folds everything into hi.
+    */
+    lo  = rs_alloc(n, type, &mem[0]);
+    hi  = rs_alloc(n, type, &mem[1]);
+    tmp = rs_alloc(n, type, &mem[2]);
+    for (k=1; k<size; k++)
+    {
+        dst = (rank + k) % size;
+        src = (rank - k + size) % size;
+        upper = (src > rank || commute);
+        acc = upper ? hi : lo;
+        first = upper ? !have_hi : !have_lo;
+        MPI_Sendrecv((const char *) sendbuf + displs[dst] * extent, recvcounts[dst], type,
+                     recvcounts[dst] ? dst : MPI_PROC_NULL, RS_TAG,
+                     first ? acc : tmp, n, type, n ? src : MPI_PROC_NULL, RS_TAG, comm, MPI_STATUS_IGNORE);
+        if (n > 0 && !first) MPI_Reduce_local(tmp, acc, n, type, op);
+        if (upper) have_hi = 1;
+        else have_lo = 1;
+    }
+
+    /* result = lo op x[rank] op hi, built in hi */
+    in = (char *) sendbuf + displs[rank] * extent;
+    if (n > 0)
+    {
+        if (have_hi) MPI_Reduce_local(in, hi, n, type, op);
+        else rs_copy(in, hi, n, type);
+        if (have_lo) MPI_Reduce_local(lo, hi, n, type, op);
+        rs_copy(hi, recvbuf, n, type);
+    }
+    free(mem[0]);
+    free(mem[1]);
+    free(mem[2]);
+    free(displs);
+    return MPI_SUCCESS;
+}
+
+static inline int rs_ring(const void *sendbuf, void *recvbuf, const int *recvcounts, MPI_Datatype type,
+                          MPI_Op op, MPI_Comm comm)
+{
+    int k, i, rank, size, left, right, sb, rb, maxc = 0, commute, *displs;
+    MPI_Aint lb, extent;
+    void *mem[2];
+    char *cur, *next, *cswap;
+
+    MPI_Op_commutative(op, &commute);
+    if (!commute) return rs_pairwise(sendbuf, recvbuf, recvcounts, type, op, comm);
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    MPI_Type_get_extent(type, &lb, &extent);
+    if (sendbuf == MPI_IN_PLACE) sendbuf = recvbuf;
+    displs = (int *) malloc(size * sizeof(int));
+    rs_displs(recvcounts, size, displs);
+    for (i=0; i<size; i++) if (recvcounts[i] > maxc) maxc = recvcounts[i];
+    left = (rank - 1 + size) % size;
+    right = (rank + 1) % size;
+
+    /* Step k forwards the partial of block rank-k-1 and receives that of block rank-k-2 */
+    cur  = rs_alloc(maxc, type, &mem[0]);
+    next = rs_alloc(maxc, type, &mem[1]);
+    for (k=0; k<size-1; k++)
+    {
+        sb = (rank - k - 1 + size) % size;
+        rb = (rank - k - 2 + size) % size;
+        MPI_Sendrecv(k == 0 ? (char *) sendbuf + displs[sb] * extent : cur, recvcounts[sb], type,
+                     recvcounts[sb] ? right : MPI_PROC_NULL, RS_TAG,
+                     next, recvcounts[rb], type, recvcounts[rb] ? left : MPI_PROC_NULL, RS_TAG, comm,
+                     MPI_STATUS_IGNORE);
+        if (recvcounts[rb])
+            MPI_Reduce_local((char *) sendbuf + displs[rb] * extent, next, recvcounts[rb], type, op);
+        cswap = cur; cur = next; next = cswap;
+    }
+    if (size == 1) rs_copy(sendbuf, cur, recvcounts[0], type);
+    rs_copy(cur, recvbuf, recvcounts[rank], type);
+    free(mem[0]);
+    free(mem[1]);
+    free(displs);
+    return MPI_SUCCESS;
+}
+
+static inline int rs_halving(const void *sendbuf, void *recvbuf, const int *recvcounts, MPI_Datatype type,
+                             MPI_Op op, MPI_Comm comm)
+{
+    int i, rank, size, pof2, rem, newrank, newdst, dst, mask, send_idx, recv_idx, last_idx;
+    int send_cnt, recv_cnt, total, commute, *displs, *newcnts, *newdisps;
+    MPI_Aint lb, extent;
+    void *mem[2];
+    char *res, *tmp;
+
+    MPI_Op_commutative(op, &commute);
+    if (!commute) return rs_pairwise(sendbuf, recvbuf, recvcounts, type, op, comm);
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    MPI_Type_get_extent(type, &lb, &extent);
+    if (sendbuf == MPI_IN_PLACE) sendbuf = recvbuf;
+    displs = (int *) malloc(3 * (size_t) size * sizeof(int));
+    newcnts = displs + size;
+    newdisps = newcnts + size;
+    total = rs_displs(recvcounts, size, displs);
+
+    res = rs_alloc(total, type, &mem[0]);
+    tmp = rs_alloc(total, type, &mem[1]);
+    rs_copy(sendbuf, res, total, type);
+
+    /* Fold the first 2*rem ranks pairwise so that a power of two remains */
+    for (pof2=1; pof2*2<=size; pof2*=2);
+    rem = size - pof2;
+    if (rank < 2 * rem)
+    {
+        if (rank % 2 == 0)
+        {
+            MPI_Send(res, total, type, rank + 1, RS_TAG, comm);
+            newrank = -1;
+        }
+        else
+        {
+            MPI_Recv(tmp, total, type, rank - 1, RS_TAG, comm, MPI_STATUS_IGNORE);
+            if (total) MPI_Reduce_local(tmp, res, total, type, op);
+            newrank = rank / 2;
+        }
+    }
+    else
+    {
+        newrank = rank - rem;
+    }
+
+    if (newrank != -1)
+    {
+        /* New rank i owns the blocks of old ranks 2i and 2i+1 (i < rem) or i+rem */
+        for (i=0; i<pof2; i++)
+        {
+            if (i < rem)
+            {
+                newcnts[i] = recvcounts[2*i] + recvcounts[2*i+1];
+                newdisps[i] = displs[2*i];
+            }
+            else
+            {
+                newcnts[i] = recvcounts[i+rem];
+                newdisps[i] = displs[i+rem];
+            }
+        }
+
+        send_idx = recv_idx = 0;
+        last_idx = pof2;
+        for (mask=pof2/2; mask>0; mask>>=1)
+        {
+            newdst = newrank ^ mask;
+            dst = (newdst < rem) ? newdst * 2 + 1 : newdst + rem;
+            send_cnt = recv_cnt = 0;
+            if (newrank < newdst)
+            {
+                send_idx = recv_idx + mask;
+                for (i=send_idx; i<last_idx; i++) send_cnt += newcnts[i];
+                for (i=recv_idx; i<send_idx; i++) recv_cnt += newcnts[i];
+            }
+            else
+            {
+                recv_idx = send_idx + mask;
+                for (i=send_idx; i<recv_idx; i++) send_cnt += newcnts[i];
+                for (i=recv_idx; i<last_idx; i++) recv_cnt += newcnts[i];
+            }
+            MPI_Sendrecv(res + newdisps[send_idx] * extent, send_cnt, type, send_cnt ? dst : MPI_PROC_NULL,
+                         RS_TAG, tmp + newdisps[recv_idx] * extent, recv_cnt, type,
+                         recv_cnt ? dst : MPI_PROC_NULL, RS_TAG, comm, MPI_STATUS_IGNORE);
+            if (recv_cnt)
+                MPI_Reduce_local(tmp + newdisps[recv_idx] * extent, res + newdisps[recv_idx] * extent,
+                                 recv_cnt, type, op);
+            send_idx = recv_idx;
+            last_idx = recv_idx + mask;
+        }
+    }
+
+    /* Unfold: the odd rank of a folded pair hands the even one its block */
+    if (rank < 2 * rem)
+    {
+        if (rank % 2)
+        {
+            if (recvcounts[rank-1])
+                MPI_Send(res + displs[rank-1] * extent, recvcounts[rank-1], type, rank - 1, RS_TAG, comm);
+        }
+        else if (recvcounts[rank])
+        {
+            MPI_Recv(tmp, recvcounts[rank], type, rank + 1, RS_TAG, comm, MPI_STATUS_IGNORE);
+            rs_copy(tmp, res + displs[rank] * extent, recvcounts[rank], type);
+        }
+    }
+    rs_copy(res + displs[rank] * extent, recvbuf, recvcounts[rank], type);
+
+    free(mem[0]);
+    free(mem[1]);
+    free(displs);
+    return MPI_SUCCESS;
+}
+
+static inline int rs_reduce_scatter(const void *sendbuf, void *recvbuf, const int *recvcounts,
+                                    MPI_Datatype type, MPI_Op op, MPI_Comm comm, int alg)
+{
+    if (alg == RS_AUTO) alg = rs_choose(recvcounts, type, op, comm);
+    switch (alg)
+    {
+    case RS_HALVING:
+        return rs_halving(sendbuf, recvbuf, recvcounts, type, op, comm);
+    case RS_PAIRWISE:
+        return rs_pairwise(sendbuf, recvbuf, recvcounts, type, op, comm);
+    case RS_RING:
+        return rs_ring(sendbuf, recvbuf, recvcounts, type, op, comm);
+    default:
+        return MPI_ERR_ARG;
+    }
+}
+
+#endif /* REDUCE_SCATTER_ENGINE_H */
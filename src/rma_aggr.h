@@ -0,0 +1,307 @@
+/*
+rma_aggr.h
+
+   Origin-side aggregation of small accumulate and put updates. Updates
+   of single elements are collected per target rank; a flush sorts them
+   by displacement, combines updates of the same element locally and
+   sends everything for one target as a single MPI_Accumulate whose
+   target datatype is an MPI_Type_create_hindexed over the touched
+   elements.
+
+Usage
+
+   aggr_t a;
+   aggr_init(win, MPI_DOUBLE, MPI_SUM, 4096, AGGR_PASSIVE, &a);
+
+   MPI_Win_lock_all(0, win);
+   for (...) aggr_add(&a, target, disp, &value);
+   aggr_flush(&a);                        everything issued and complete
+   MPI_Win_unlock_all(win);
+
+   With active target synchronization:
+
+   aggr_init(win, MPI_DOUBLE, MPI_SUM, 4096, AGGR_ACTIVE, &a);
+   MPI_Win_fence(0, win);
+   for (...) aggr_add(&a, target, disp, &value);
+   aggr_fence(&a, 0);                     aggr_flush + MPI_Win_fence + aggr_release
+
+   aggr_free(&a);
+
+Remarks
+
+   elemtype must be a predefined datatype and op a predefined operation
+   valid for MPI_Accumulate; MPI_REPLACE turns the updates into puts
+   with accumulate's element-wise atomicity. disp is in units of the
+   target window's disp_unit, as for MPI_Accumulate, and addresses one
+   element.
+
+   Updates of the same element are combined with MPI_Reduce_local
+   before they leave the origin; for MPI_REPLACE the one added last
+   wins. The target receives one accumulate per flush with the
+   combined values in displacement order.
+
+   Targets typically apply an indexed accumulate block by block, so
+   many one-element blocks cost almost as much as separate calls. For
+   MPI_SUM, gaps of up to AGGR_GAP elements between touched elements are
+   therefore filled with zeros and sent as part of one longer block
+   (all-zero bytes are 0 for every predefined type MPI_SUM accepts).
+
+   A target's updates are flushed when threshold of them have been
+   collected (0: only on aggr_flush) and by aggr_flush. The values of a
+   flush must stay untouched until the operation completes:
+
+   AGGR_PASSIVE  the caller holds a passive-target epoch on every target
+                 it adds to (MPI_Win_lock_all, or MPI_Win_lock); each
+                 flush is completed with MPI_Win_flush on its target
+                 before the layer reuses the memory.
+   AGGR_ACTIVE   the caller holds a fence or start/complete epoch; the
+                 flushed values are kept until aggr_release, which the
+                 caller invokes once the epoch has been closed
+                 (aggr_fence does all three steps).
+
+   aggr_add, aggr_flush and aggr_fence return MPI_ERR_NO_MEM when a
+   buffer cannot grow or be allocated for a flush; the updates
+   collected so far are kept and can be flushed again.
+
+   a->updates counts aggr_add calls, a->elements the elements sent after
+   combining, a->padding the zeros added to fill gaps and a->calls the
+   MPI_Accumulate calls issued.
+*/
+
+#ifndef RMA_AGGR_H
+#define RMA_AGGR_H
+
+#include "mpi.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define AGGR_PASSIVE 0
+#define AGGR_ACTIVE  1
+
+#define AGGR_GAP     8
+
+struct aggr_entry
+{
+    MPI_Aint disp;
+    int seq;                /* position in the target's value buffer */
+};
+
+typedef struct
+{
+    int n, cap;
+    struct aggr_entry *entries;
+    char *values;
+} aggr_target_t;
+
+typedef struct
+{
+    MPI_Win win;
+    MPI_Datatype type;
+    MPI_Op op;
+    int size, elemsize, disp_unit, threshold, mode;
+    aggr_target_t *targets;
+    char **inflight;        /* AGGR_ACTIVE: flushed values awaiting aggr_release */
+    int ninflight, capinflight;
+    long long updates, elements, padding, calls;
+} aggr_t;
+
+static inline int aggr_init(MPI_Win win, MPI_Datatype elemtype, MPI_Op op, int threshold, int mode,
+                            aggr_t *a)
+{
+    MPI_Group group;
+    int *unit, flag;
+
+    memset(a, 0, sizeof(*a));
+    a->win = win;
+    a->type = elemtype;
+    a->op = op;
+    a->threshold = threshold;
+    a->mode = mode;
+    MPI_Type_size(elemtype, &a->elemsize);
+    MPI_Win_get_attr(win, MPI_WIN_DISP_UNIT, &unit, &flag);
+    a->disp_unit = flag ? *unit : 1;
+    MPI_Win_get_group(win, &group);
+    MPI_Group_size(group, &a->size);
+    MPI_Group_free(&group);
+
+    a->targets = (aggr_target_t *) calloc(a->size, sizeof(aggr_target_t));
+    return a->targets ? MPI_SUCCESS : MPI_ERR_NO_MEM;
+}
+
+static inline int aggr_entry_cmp(const void *x, const void *y)
+{
+    const struct aggr_entry *p = (const struct aggr_entry *) x, *q = (const struct aggr_entry *) y;
+    if (p->disp != q->disp) return p->disp < q->disp ? -1 : 1;
+    return p->seq - q->seq;
+}
+
+/* Sort, combine and issue target t's updates into *outp, the combined values buffer */
+static inline int aggr_issue(aggr_t *a, int t, char **outp)
+{
+    aggr_target_t *tg = &a->targets[t];
+    int i, m = 0, gap, nruns = 0, sz = a->elemsize, fill = (a->op == MPI_SUM) ? AGGR_GAP : 0;
+    int *blocklens;
+    MPI_Aint *displs, byte, end;
+    MPI_Datatype ttype;
+    char *out;
+
+    out = (char *) malloc((size_t) tg->n * (fill + 1) * sz);
+    blocklens = (int *) malloc(tg->n * sizeof(int));
+    displs = (MPI_Aint *) malloc(tg->n * sizeof(MPI_Aint));
+    if (out == NULL || blocklens == NULL || displs == NULL)
+    {
+        /* The updates stay collected for the next flush */
+        free(out);
+        free(blocklens);
+        free(displs);
+        return MPI_ERR_NO_MEM;
+    }
+    qsort(tg->entries, tg->n, sizeof(struct aggr_entry), aggr_entry_cmp);
+
+    for (i=0; i<tg->n; i++)
+    {
+        const char *v = tg->values + (size_t) tg->entries[i].seq * sz;
+        if (i > 0 && tg->entries[i].disp == tg->entries[i-1].disp)
+        {
+            /* Same element: fold into the value already in out */
+            if (a->op == MPI_REPLACE) memcpy(out + (size_t) (m-1) * sz, v, sz);
+            else MPI_Reduce_local(v, out + (size_t) (m-1) * sz, 1, a->type, a->op);
+            continue;
+        }
+        byte = tg->entries[i].disp * a->disp_unit;
+        end = nruns ? displs[nruns-1] + (MPI_Aint) blocklens[nruns-1] * sz : 0;
+        gap = (nruns && byte > end && (byte - end) % sz == 0) ? (int) ((byte - end) / sz) : -1;
+        if (gap > 0 && gap <= fill)
+        {
+            memset(out + (size_t) m * sz, 0, (size_t) gap * sz);
+            m += gap;
+            blocklens[nruns-1] += gap;
+            a->padding += gap;
+            gap = 0;
+        }
+        if (gap == 0)
+        {
+            blocklens[nruns-1]++;
+        }
+        else
+        {
+            displs[nruns] = byte;
+            blocklens[nruns++] = 1;
+        }
+        memcpy(out + (size_t) m * sz, v, sz);
+        m++;
+        a->elements++;
+    }
+
+    MPI_Type_create_hindexed(nruns, blocklens, displs, a->type, &ttype);
+    MPI_Type_commit(&ttype);
+    MPI_Accumulate(out, m, a->type, t, 0, 1, ttype, a->op, a->win);
+    MPI_Type_free(&ttype);
+    free(blocklens);
+    free(displs);
+
+    a->calls++;
+    tg->n = 0;
+    *outp = out;
+    return MPI_SUCCESS;
+}
+
+static inline int aggr_flush_target(aggr_t *a, int t)
+{
+    char *out, **inflight;
+    int cap, err;
+
+    if (a->targets[t].n == 0) return MPI_SUCCESS;
+    if (a->mode == AGGR_ACTIVE && a->ninflight == a->capinflight)
+    {
+        /* Room to keep the values first: once issued they cannot be dropped */
+        cap = a->capinflight ? 2 * a->capinflight : 16;
+        inflight = (char **) realloc(a->inflight, cap * sizeof(char *));
+        if (inflight == NULL) return MPI_ERR_NO_MEM;
+        a->inflight = inflight;
+        a->capinflight = cap;
+    }
+    err = aggr_issue(a, t, &out);
+    if (err != MPI_SUCCESS) return err;
+    if (a->mode == AGGR_PASSIVE)
+    {
+        MPI_Win_flush(t, a->win);
+        free(out);
+        return MPI_SUCCESS;
+    }
+    a->inflight[a->ninflight++] = out;
+    return MPI_SUCCESS;
+}
+
+static inline int aggr_add(aggr_t *a, int target, MPI_Aint disp, const void *value)
+{
+    aggr_target_t *tg = &a->targets[target];
+    struct aggr_entry *entries;
+    char *values;
+    int cap;
+
+    if (tg->n == tg->cap)
+    {
+        /* Each block is kept as it was until both have grown */
+        cap = tg->cap ? 2 * tg->cap : 64;
+        entries = (struct aggr_entry *) realloc(tg->entries, cap * sizeof(struct aggr_entry));
+        if (entries == NULL) return MPI_ERR_NO_MEM;
+        tg->entries = entries;
+        values = (char *) realloc(tg->values, (size_t) cap * a->elemsize);
+        if (values == NULL) return MPI_ERR_NO_MEM;
+        tg->values = values;
+        tg->cap = cap;
+    }
+    tg->entries[tg->n].disp = disp;
+    tg->entries[tg->n].seq = tg->n;
+    memcpy(tg->values + (size_t) tg->n * a->elemsize, value, a->elemsize);
+    tg->n++;
+    a->updates++;
+
+    if (a->threshold > 0 && tg->n >= a->threshold) return aggr_flush_target(a, target);
+    return MPI_SUCCESS;
+}
+
+/* Issue every target's pending updates (and, for AGGR_PASSIVE, complete them) */
+static inline int aggr_flush(aggr_t *a)
+{
+    int t, err, first = MPI_SUCCESS;
+    for (t=0; t<a->size; t++)
+    {
+        err = aggr_flush_target(a, t);
+        if (first == MPI_SUCCESS) first = err;
+    }
+    return first;
+}
+
+/* AGGR_ACTIVE: free the values of earlier flushes once their epoch is closed */
+static inline void aggr_release(aggr_t *a)
+{
+    int i;
+    for (i=0; i<a->ninflight; i++) free(a->inflight[i]);
+    a->ninflight = 0;
+}
+
+static inline int aggr_fence(aggr_t *a, int assertion)
+{
+    int err, ferr;
+    ferr = aggr_flush(a);
+    err = MPI_Win_fence(assertion, a->win);
+    aggr_release(a);
+    return ferr != MPI_SUCCESS ? ferr : err;
+}
+
+static inline void aggr_free(aggr_t *a)
+{
+    int t;
+    aggr_release(a);
+    for (t=0; t<a->size; t++)
+    {
+        free(a->targets[t].entries);
+        free(a->targets[t].values);
+    }
+    free(a->targets);
+    free(a->inflight);
+}
+
+#endif /* RMA_AGGR_H */
@@ -0,0 +1,301 @@
+/*
+rma_dht.h
+
+   One-sided distributed hash table with fixed-size values. Every rank
+   owns a slice of the buckets in a window over MPI_Alloc_mem memory;
+   lookups and updates are MPI_Get/MPI_Put under passive-target locks,
+   so the owner's CPU is not involved in serving them.
+
+Usage
+
+   dht_t d;
+   dht_create(MPI_COMM_WORLD, 1 << 16, sizeof(record_t), &d);   collective
+
+   dht_put(&d, key, &rec);
+   if (dht_get(&d, key, &rec) > 0) ... found ...
+
+   Batched, one lock epoch per owner rank for the whole batch:
+
+   dht_put_batch(&d, n, keys, recs);
+   nfound = dht_get_batch(&d, n, keys, recs, found);
+
+   dht_free(&d);                                                collective
+
+Remarks
+
+   A key (any uint64_t but DHT_EMPTY_KEY) hashes to an owner rank and to
+   a bucket of DHT_SLOTS slots there; each slot is the key followed by
+   vlen bytes of value. A lookup reads the whole bucket with one MPI_Get
+   under MPI_LOCK_SHARED, so readers of one owner proceed concurrently.
+   An update takes MPI_LOCK_EXCLUSIVE, reads the bucket, MPI_Win_flush,
+   changes it locally and writes it back before MPI_Win_unlock, which
+   makes the read-modify-write atomic with respect to every other
+   dht_* call. It costs two round trips against one for a lookup.
+
+   The batch calls sort their operations by owner and bucket, open one
+   epoch per owner that has work, fetch each distinct bucket once and,
+   for updates, write each one back once. Operations on the same key
+   within a put batch are applied in order. Batching amortizes the
+   lock/unlock round trips, which dominate at small values, over the
+   whole batch.
+
+   dht_put_batch returns MPI_ERR_ARG for DHT_EMPTY_KEY and
+   MPI_ERR_NO_MEM when its work arrays cannot grow; nothing is written
+   then. dht_get_batch returns the number of keys found, or -1 when its
+   work arrays cannot grow, with found[] cleared either way before any
+   lookup; dht_get returns 1, 0 or -1 accordingly.
+
+   The table behaves as a cache: a put into a full bucket evicts the
+   slot chosen by the key's hash and increments d->evictions, so later
+   lookups of the evicted key miss. Size nbuckets so that the expected
+   load stays well below DHT_SLOTS per bucket if that matters.
+
+   Locks are taken on the local rank as well, so a rank's own slice is
+   only ever accessed through the window. The dht_* calls other than
+   create and free are not collective, but Open MPI and MPICH may need
+   the target to enter MPI now and then to progress passive-target
+   epochs; a rank that computes for long stretches without MPI calls can
+   delay the others.
+*/
+
+#ifndef RMA_DHT_H
+#define RMA_DHT_H
+
+#include "mpi.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DHT_SLOTS     4
+#define DHT_EMPTY_KEY UINT64_MAX
+
+typedef struct
+{
+    MPI_Comm comm;
+    MPI_Win win;
+    int size, rank;
+    long nbuckets;              /* per rank */
+    int vlen, slot_bytes, bucket_bytes;
+    char *table;                /* local slice, MPI_Alloc_mem */
+    /* scratch for the batch calls */
+    int cap;
+    struct dht_op *ops;
+    int *slot;
+    char *buckets;
+    long long evictions;
+} dht_t;
+
+struct dht_op
+{
+    int owner, index;
+    long bucket;
+    uint64_t hash;
+};
+
+/* splitmix64 finalizer: spreads consecutive keys over owners and buckets */
+static inline uint64_t dht_hash(uint64_t key)
+{
+    key += 0x9e3779b97f4a7c15ULL;
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+    return key ^ (key >> 31);
+}
+
+static inline int dht_create(MPI_Comm comm, long nbuckets, int vlen, dht_t *d)
+{
+    MPI_Aint bytes;
+    long b;
+    int s, err;
+
+    if (nbuckets <= 0 || vlen < 0) return MPI_ERR_ARG;
+    memset(d, 0, sizeof(*d));
+    d->comm = comm;
+    MPI_Comm_size(comm, &d->size);
+    MPI_Comm_rank(comm, &d->rank);
+    d->nbuckets = nbuckets;
+    d->vlen = vlen;
+    /* Keep the keys 8-byte aligned in every slot */
+    d->slot_bytes = (int) ((sizeof(uint64_t) + vlen + 7) & ~(size_t) 7);
+    d->bucket_bytes = DHT_SLOTS * d->slot_bytes;
+
+    bytes = (MPI_Aint) nbuckets * d->bucket_bytes;
+    err = MPI_Alloc_mem(bytes, MPI_INFO_NULL, &d->table);
+    if (err != MPI_SUCCESS) return err;
+    for (b=0; b<nbuckets; b++)
+        for (s=0; s<DHT_SLOTS; s++)
+            *(uint64_t *) (d->table + b * d->bucket_bytes + s * d->slot_bytes) = DHT_EMPTY_KEY;
+
+    return MPI_Win_create(d->table, bytes, 1, MPI_INFO_NULL, comm, &d->win);
+}
+
+static inline void dht_free(dht_t *d)
+{
+    MPI_Win_free(&d->win);
+    MPI_Free_mem(d->table);
+    free(d->ops);
+    free(d->slot);
+    free(d->buckets);
+}
+
+static inline int dht_op_cmp(const void *a, const void *b)
+{
+    const struct dht_op *x = (const struct dht_op *) a, *y = (const struct dht_op *) b;
+    if (x->owner != y->owner) return x->owner < y->owner ? -1 : 1;
+    if (x->bucket != y->bucket) return x->bucket < y->bucket ? -1 : 1;
+    return x->index - y->index;
+}
+
+/* Sort the n operations by owner, bucket and position in the batch */
+static inline int dht_plan(dht_t *d, int n, const uint64_t *keys)
+{
+    int i;
+    uint64_t h;
+
+    if (n > d->cap)
+    {
+        free(d->ops);
+        free(d->slot);
+        free(d->buckets);
+        d->ops = (struct dht_op *) malloc(n * sizeof(struct dht_op));
+        d->slot = (int *) malloc(n * sizeof(int));
+        d->buckets = (char *) malloc((size_t) n * d->bucket_bytes);
+        d->cap = (d->ops && d->slot && d->buckets) ? n : 0;
+        if (d->cap == 0) return MPI_ERR_NO_MEM;
+    }
+    for (i=0; i<n; i++)
+    {
+        h = dht_hash(keys[i]);
+        d->ops[i].owner = (int) (h % (uint64_t) d->size);
+        d->ops[i].bucket = (long) ((h / (uint64_t) d->size) % (uint64_t) d->nbuckets);
+        d->ops[i].index = i;
+        d->ops[i].hash = h;
+    }
+    qsort(d->ops, n, sizeof(struct dht_op), dht_op_cmp);
+    return MPI_SUCCESS;
+}
+
+/*
+* Fetch the distinct buckets of ops[first..last) (all on one owner) into
+* d->buckets, one per distinct bucket, and note in d->slot[] which copy
+* each operation uses. The caller holds the lock.
+*/
+static inline int dht_fetch(dht_t *d, int first, int last)
+{
+    int i, nb = 0;
+
+    for (i=first; i<last; i++)
+    {
+        if (i == first || d->ops[i].bucket != d->ops[i-1].bucket)
+        {
+            MPI_Get(d->buckets + (size_t) nb * d->bucket_bytes, d->bucket_bytes, MPI_BYTE,
+                    d->ops[i].owner, (MPI_Aint) d->ops[i].bucket * d->bucket_bytes,
+                    d->bucket_bytes, MPI_BYTE, d->win);
+            nb++;
+        }
+        d->slot[i] = nb - 1;
+    }
+    return nb;
+}
+
+/* Returns how many of the n keys were found, or -1 if out of memory; found may be NULL */
+static inline int dht_get_batch(dht_t *d, int n, const uint64_t *keys, void *values, int *found)
+{
+    int i, j, s, first, nfound = 0;
+    char *bucket, *sl;
+
+    if (n <= 0) return 0;
+    if (found) memset(found, 0, n * sizeof(int));
+    if (dht_plan(d, n, keys) != MPI_SUCCESS) return -1;
+
+    for (first=0; first<n; first=i)
+    {
+        for (i=first; i<n && d->ops[i].owner == d->ops[first].owner; i++) ;
+
+        MPI_Win_lock(MPI_LOCK_SHARED, d->ops[first].owner, 0, d->win);
+        dht_fetch(d, first, i);
+        MPI_Win_unlock(d->ops[first].owner, d->win);
+
+        for (j=first; j<i; j++)
+        {
+            int op = d->ops[j].index, hit = 0;
+            bucket = d->buckets + (size_t) d->slot[j] * d->bucket_bytes;
+            for (s=0; s<DHT_SLOTS && !hit; s++)
+            {
+                sl = bucket + s * d->slot_bytes;
+                if (*(uint64_t *) sl != keys[op]) continue;
+                memcpy((char *) values + (size_t) op * d->vlen, sl + sizeof(uint64_t), d->vlen);
+                hit = 1;
+            }
+            if (found) found[op] = hit;
+            nfound += hit;
+        }
+    }
+    return nfound;
+}
+
+static inline int dht_put_batch(dht_t *d, int n, const uint64_t *keys, const void *values)
+{
+    int i, j, s, first, owner, err;
+    char *bucket, *sl;
+
+    if (n <= 0) return MPI_SUCCESS;
+    for (i=0; i<n; i++)
+        if (keys[i] == DHT_EMPTY_KEY) return MPI_ERR_ARG;
+    err = dht_plan(d, n, keys);
+    if (err != MPI_SUCCESS) return err;
+
+    for (first=0; first<n; first=i)
+    {
+        owner = d->ops[first].owner;
+        for (i=first; i<n && d->ops[i].owner == owner; i++) ;
+
+        MPI_Win_lock(MPI_LOCK_EXCLUSIVE, owner, 0, d->win);
+        dht_fetch(d, first, i);
+        MPI_Win_flush(owner, d->win);
+
+        for (j=first; j<i; j++)
+        {
+            int op = d->ops[j].index, hit = -1, empty = -1;
+            bucket = d->buckets + (size_t) d->slot[j] * d->bucket_bytes;
+            for (s=0; s<DHT_SLOTS; s++)
+            {
+                uint64_t k = *(uint64_t *) (bucket + s * d->slot_bytes);
+                if (k == keys[op]) { hit = s; break; }
+                if (k == DHT_EMPTY_KEY && empty < 0) empty = s;
+            }
+            if (hit < 0 && empty >= 0) hit = empty;
+            if (hit < 0)
+            {
+                /* Full: evict a slot picked by bits of the hash unused for placement */
+                hit = (int) ((d->ops[j].hash >> 48) % DHT_SLOTS);
+                d->evictions++;
+            }
+            sl = bucket + hit * d->slot_bytes;
+            *(uint64_t *) sl = keys[op];
+            memcpy(sl + sizeof(uint64_t), (const char *) values + (size_t) op * d->vlen, d->vlen);
+        }
+
+        for (j=first; j<i; j++)
+        {
+            if (j > first && d->ops[j].bucket == d->ops[j-1].bucket) continue;
+            MPI_Put(d->buckets + (size_t) d->slot[j] * d->bucket_bytes, d->bucket_bytes, MPI_BYTE,
+                    owner, (MPI_Aint) d->ops[j].bucket * d->bucket_bytes,
+                    d->bucket_bytes, MPI_BYTE, d->win);
+        }
+        MPI_Win_unlock(owner, d->win);
+    }
+    return MPI_SUCCESS;
+}
+
+/* Single-key forms: one lock epoch each */
+static inline int dht_get(dht_t *d, uint64_t key, void *value)
+{
+    return dht_get_batch(d, 1, &key, value, NULL);
+}
+
+static inline int dht_put(dht_t *d, uint64_t key, const void *value)
+{
+    return dht_put_batch(d, 1, &key, value);
+}
+
+#endif /* RMA_DHT_H */
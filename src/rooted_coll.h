@@ -0,0 +1,496 @@
+/*
+rooted_coll.h
+
+   User-level gather, gatherv, scatter and scatterv with two algorithms
+   and an automatic choice between them, for any communicator size:
+
+   RC_BINOMIAL  binomial tree over ranks relative to the root. Every
+                rank coalesces the packed data of its subtree into
+                chunks passed up as they fill (gather), or passes each
+                child its subtree's part (scatter); the root handles
+                about ceil(log2(p)) messages instead of p-1, so many
+                small blocks cost log2(p) latencies. Each byte travels
+                up to log2(p) hops.
+   RC_LINEAR    direct messages between the root and every rank, with
+                at most RC_WINDOW outstanding at the root. Every byte
+                travels once, straight from or into the user buffers.
+
+Usage
+
+   rc_gather(sendbuf, n, sendtype, recvbuf, n, recvtype, root, comm,
+             RC_AUTO);
+   rc_gatherv(sendbuf, n, sendtype, recvbuf, recvcounts, displs,
+              recvtype, root, comm, RC_AUTO);
+   rc_scatter(sendbuf, n, sendtype, recvbuf, n, recvtype, root, comm,
+              RC_AUTO);
+   rc_scatterv(sendbuf, sendcounts, displs, sendtype, recvbuf, n,
+               recvtype, root, comm, RC_AUTO);
+
+Remarks
+
+   The arguments have the meaning they have for the MPI functions,
+   including which are significant only at the root and MPI_IN_PLACE at
+   the root (sendbuf of a gather, recvbuf of a scatter). Datatypes may
+   be non-contiguous; only type signatures need to match.
+
+   The tree carries MPI_Pack'ed bytes in rank order relative to the
+   root. Gather messages are sized with MPI_Mprobe and start with the
+   number of blocks they hold, so intermediate ranks never need the
+   counts; each rank forwards its subtree in chunks of whole blocks up
+   to RC_CHUNK bytes as they arrive, and the root unpacks every chunk
+   into place. The extra memory of a gather is one or two chunks (or
+   the largest block) at any rank, whatever p is: a gatherv of millions
+   of tiny blocks needs neither p requests nor p receive buffers at the
+   root. rc_staged_max records the largest amount held. A scatter
+   message is preceded by the packed size of every rank in the subtree;
+   besides that size array, a scatter holds its largest subtree's data.
+
+   The linear gather holds senders back until the root has posted their
+   receive (a zero-byte clear-to-send message, tag RC_TAG+1), so a few
+   thousand eager messages cannot all land in the root's unexpected
+   queue at once; ranks with nothing to send are skipped on both sides.
+
+   RC_AUTO decides from arguments that are the same on every rank. For
+   gather and scatter that is the block size: binomial below
+   RC_LINEAR_BYTES per rank on more than two ranks, linear otherwise.
+   Only the root knows the counts of gatherv and scatterv, so they
+   choose from the communicator size alone, binomial from
+   RC_TREE_PROCS ranks up; pass RC_LINEAR for large blocks.
+
+   Messages use tags RC_TAG and RC_TAG+1 on comm.
+*/
+
+#ifndef ROOTED_COLL_H
+#define ROOTED_COLL_H
+
+#include "mpi.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define RC_AUTO     0
+#define RC_BINOMIAL 1
+#define RC_LINEAR   2
+
+#define RC_TAG          6161
+#define RC_WINDOW       32
+#define RC_LINEAR_BYTES (16*1024)
+#define RC_TREE_PROCS   8
+#define RC_CHUNK        (64*1024)
+
+/* Largest gather staging memory this rank has held at once, in bytes; reset it to measure */
+static long long rc_staged_max = 0;
+
+static inline const char *rc_name(int alg)
+{
+    switch (alg)
+    {
+    case RC_BINOMIAL: return "binomial";
+    case RC_LINEAR:   return "linear";
+    default:          return "auto";
+    }
+}
+
+/* Count and displacement of rank r: from the arrays, or n each and r*n when they are NULL */
+static inline int rc_count(const int *counts, int n, int r)
+{
+    return counts ? counts[r] : n;
+}
+
+static inline MPI_Aint rc_displ(const int *displs, int n, int r)
+{
+    return displs ? displs[r] : (MPI_Aint) r * n;
+}
+
+static inline int rc_choose(long long block_bytes, int varying, MPI_Comm comm)
+{
+    int size;
+    MPI_Comm_size(comm, &size);
+    if (varying) return size >= RC_TREE_PROCS ? RC_BINOMIAL : RC_LINEAR;
+    return (size > 2 && block_bytes < RC_LINEAR_BYTES) ? RC_BINOMIAL : RC_LINEAR;
+}
+
+/* The root's own block, between its send and receive buffers */
+static inline void rc_self(const void *sendbuf, int scount, MPI_Datatype stype, void *recvbuf, int rcount,
+                           MPI_Datatype rtype)
+{
+    MPI_Sendrecv(sendbuf, scount, stype, 0, RC_TAG, recvbuf, rcount, rtype, 0, RC_TAG, MPI_COMM_SELF,
+                 MPI_STATUS_IGNORE);
+}
+
+static inline int rc_gather_linear(const void *sendbuf, int sendcnt, MPI_Datatype sendtype, void *recvbuf,
+                                   const int *recvcounts, int recvcnt, const int *displs, MPI_Datatype recvtype,
+                                   int root, MPI_Comm comm)
+{
+    int rank, size, tsize, i, r, n, slot, nposted = 0;
+    MPI_Aint lb, extent;
+    MPI_Request req[2*RC_WINDOW];
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    if (rank != root)
+    {
+        MPI_Type_size(sendtype, &tsize);
+        if ((long long) sendcnt * tsize == 0) return MPI_SUCCESS;
+        MPI_Recv(NULL, 0, MPI_BYTE, root, RC_TAG + 1, comm, MPI_STATUS_IGNORE);
+        return MPI_Send(sendbuf, sendcnt, sendtype, root, RC_TAG, comm);
+    }
+
+    MPI_Type_size(recvtype, &tsize);
+    MPI_Type_get_extent(recvtype, &lb, &extent);
+    if (sendbuf != MPI_IN_PLACE)
+        rc_self(sendbuf, sendcnt, sendtype, (char *) recvbuf + rc_displ(displs, recvcnt, root) * extent,
+                rc_count(recvcounts, recvcnt, root), recvtype);
+
+    /* req[slot] is a receive, req[RC_WINDOW+slot] the clear-to-send that went with it */
+    for (i=0; i<RC_WINDOW; i++) req[i] = req[RC_WINDOW+i] = MPI_REQUEST_NULL;
+    for (i=1; i<size; i++)
+    {
+        r = (root + i) % size;
+        n = rc_count(recvcounts, recvcnt, r);
+        if ((long long) n * tsize == 0) continue;
+        if (nposted < RC_WINDOW)
+        {
+            slot = nposted++;
+        }
+        else
+        {
+            MPI_Waitany(RC_WINDOW, req, &slot, MPI_STATUS_IGNORE);
+            MPI_Wait(&req[RC_WINDOW+slot], MPI_STATUS_IGNORE);
+        }
+        MPI_Irecv((char *) recvbuf + rc_displ(displs, recvcnt, r) * extent, n, recvtype, r, RC_TAG, comm,
+                  &req[slot]);
+        MPI_Isend(NULL, 0, MPI_BYTE, r, RC_TAG + 1, comm, &req[RC_WINDOW+slot]);
+    }
+    return MPI_Waitall(2 * RC_WINDOW, req, MPI_STATUSES_IGNORE);
+}
+
+/* Grow *buf to need bytes, keeping its contents; counts toward rc_staged_max with other bytes held */
+static inline int rc_reserve(char **buf, int *cap, int need, int other)
+{
+    char *tmp;
+
+    if (need <= *cap) return MPI_SUCCESS;
+    tmp = (char *) realloc(*buf, need);
+    if (!tmp) return MPI_ERR_NO_MEM;
+    *buf = tmp;
+    *cap = need;
+    if ((long long) need + other > rc_staged_max) rc_staged_max = (long long) need + other;
+    return MPI_SUCCESS;
+}
+
+static inline int rc_gather_binomial(const void *sendbuf, int sendcnt, MPI_Datatype sendtype, void *recvbuf,
+                                     const int *recvcounts, int recvcnt, const int *displs,
+                                     MPI_Datatype recvtype, int root, MPI_Comm comm)
+{
+    int rank, size, vr, mask, parent, child, cn, got, k, nk, j, r, err, hdr, bytes, len, upos, ocap, rcap;
+    MPI_Aint lb, extent;
+    MPI_Message msg;
+    MPI_Status status;
+    char *obuf = NULL, *rbuf = NULL;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    MPI_Pack_size(1, MPI_INT, comm, &hdr);
+    vr = (rank - root + size) % size;
+    ocap = rcap = 0;
+
+    if (vr == 0)
+    {
+        /* Unpack every chunk into place as it arrives: child by child, in rank order */
+        MPI_Type_get_extent(recvtype, &lb, &extent);
+        if (sendbuf != MPI_IN_PLACE)
+            rc_self(sendbuf, sendcnt, sendtype, (char *) recvbuf + rc_displ(displs, recvcnt, root) * extent,
+                    rc_count(recvcounts, recvcnt, root), recvtype);
+        for (mask=1; mask<size; mask<<=1)
+        {
+            child = (mask + root) % size;
+            cn = (size - mask < mask) ? size - mask : mask;
+            for (j=mask; j<mask+cn; j+=nk)
+            {
+                MPI_Mprobe(child, RC_TAG, comm, &msg, &status);
+                MPI_Get_count(&status, MPI_PACKED, &bytes);
+                if (rc_reserve(&rbuf, &rcap, bytes, 0) != MPI_SUCCESS)
+                {
+                    free(rbuf);
+                    return MPI_ERR_NO_MEM;
+                }
+                MPI_Mrecv(rbuf, bytes, MPI_PACKED, &msg, MPI_STATUS_IGNORE);
+                upos = 0;
+                MPI_Unpack(rbuf, bytes, &upos, &nk, 1, MPI_INT, comm);
+                for (k=0, upos=hdr; k<nk; k++)
+                {
+                    r = (j + k + root) % size;
+                    MPI_Unpack(rbuf, bytes, &upos, (char *) recvbuf + rc_displ(displs, recvcnt, r) * extent,
+                               rc_count(recvcounts, recvcnt, r), recvtype, comm);
+                }
+            }
+        }
+        free(rbuf);
+        return MPI_SUCCESS;
+    }
+
+    /*
+     * Mine, then the children's subtrees in increasing size: rank order relative to the root.
+     * Each message is a packed rank count followed by that many blocks; blocks are coalesced up
+     * to RC_CHUNK bytes, and a larger one travels alone.
+     */
+    for (mask=1; !(vr & mask); mask<<=1);
+    parent = (vr - mask + root) % size;
+    MPI_Pack_size(sendcnt, sendtype, comm, &bytes);
+    if (rc_reserve(&obuf, &ocap, hdr + (bytes > RC_CHUNK ? bytes : RC_CHUNK), 0) != MPI_SUCCESS)
+        return MPI_ERR_NO_MEM;
+    len = hdr;
+    MPI_Pack(sendbuf, sendcnt, sendtype, obuf, ocap, &len, comm);
+    k = 1;
+    err = MPI_SUCCESS;
+    for (mask=1; !(vr & mask) && err == MPI_SUCCESS; mask<<=1)
+    {
+        if (vr + mask >= size) break;
+        child = (vr + mask + root) % size;
+        cn = (size - vr - mask < mask) ? size - vr - mask : mask;
+        for (got=0; got<cn && err == MPI_SUCCESS; got+=nk)
+        {
+            MPI_Mprobe(child, RC_TAG, comm, &msg, &status);
+            MPI_Get_count(&status, MPI_PACKED, &bytes);
+            if (rc_reserve(&rbuf, &rcap, bytes, ocap) != MPI_SUCCESS)
+            {
+                err = MPI_ERR_NO_MEM;
+                break;
+            }
+            MPI_Mrecv(rbuf, bytes, MPI_PACKED, &msg, MPI_STATUS_IGNORE);
+            upos = 0;
+            MPI_Unpack(rbuf, bytes, &upos, &nk, 1, MPI_INT, comm);
+            bytes -= hdr;
+            if (k > 0 && len + bytes > hdr + RC_CHUNK)
+            {
+                upos = 0;
+                MPI_Pack(&k, 1, MPI_INT, obuf, hdr, &upos, comm);
+                err = MPI_Send(obuf, len, MPI_PACKED, parent, RC_TAG, comm);
+                len = hdr;
+                k = 0;
+            }
+            if (bytes > RC_CHUNK)
+            {
+                err = MPI_Send(rbuf, hdr + bytes, MPI_PACKED, parent, RC_TAG, comm);
+                continue;
+            }
+            memcpy(obuf + len, rbuf + hdr, bytes);
+            len += bytes;
+            k += nk;
+        }
+    }
+    if (k > 0 && err == MPI_SUCCESS)
+    {
+        upos = 0;
+        MPI_Pack(&k, 1, MPI_INT, obuf, hdr, &upos, comm);
+        err = MPI_Send(obuf, len, MPI_PACKED, parent, RC_TAG, comm);
+    }
+    free(obuf);
+    free(rbuf);
+    return err;
+}
+
+static inline int rc_scatter_linear(const void *sendbuf, const int *sendcounts, int sendcnt, const int *displs,
+                                    MPI_Datatype sendtype, void *recvbuf, int recvcnt, MPI_Datatype recvtype,
+                                    int root, MPI_Comm comm)
+{
+    int rank, size, tsize, i, r, n, slot, nposted = 0;
+    MPI_Aint lb, extent;
+    MPI_Request req[RC_WINDOW];
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    if (rank != root)
+    {
+        MPI_Type_size(recvtype, &tsize);
+        if ((long long) recvcnt * tsize == 0) return MPI_SUCCESS;
+        return MPI_Recv(recvbuf, recvcnt, recvtype, root, RC_TAG, comm, MPI_STATUS_IGNORE);
+    }
+
+    MPI_Type_size(sendtype, &tsize);
+    MPI_Type_get_extent(sendtype, &lb, &extent);
+    if (recvbuf != MPI_IN_PLACE)
+        rc_self((const char *) sendbuf + rc_displ(displs, sendcnt, root) * extent,
+                rc_count(sendcounts, sendcnt, root), sendtype, recvbuf, recvcnt, recvtype);
+    for (i=0; i<RC_WINDOW; i++) req[i] = MPI_REQUEST_NULL;
+    for (i=1; i<size; i++)
+    {
+        r = (root + i) % size;
+        n = rc_count(sendcounts, sendcnt, r);
+        if ((long long) n * tsize == 0) continue;
+        if (nposted < RC_WINDOW) slot = nposted++;
+        else MPI_Waitany(RC_WINDOW, req, &slot, MPI_STATUS_IGNORE);
+        MPI_Isend((const char *) sendbuf + rc_displ(displs, sendcnt, r) * extent, n, sendtype, r, RC_TAG, comm,
+                  &req[slot]);
+    }
+    return MPI_Waitall(RC_WINDOW, req, MPI_STATUSES_IGNORE);
+}
+
+static inline int rc_scatter_binomial(const void *sendbuf, const int *sendcounts, int sendcnt,
+                                      const int *displs, MPI_Datatype sendtype, void *recvbuf, int recvcnt,
+                                      MPI_Datatype recvtype, int root, MPI_Comm comm)
+{
+    int rank, size, vr, mask, top, nsub, j, r, cn, off, len, pos, bytes, cap, bufcap, *sizes;
+    MPI_Aint lb, extent;
+    char *buf;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    vr = (rank - root + size) % size;
+    for (top=1; top<size && !(vr & top); top<<=1);
+    nsub = (size - vr < top) ? size - vr : top;
+    sizes = (int *) malloc(nsub * sizeof(int));
+
+    if (vr == 0)
+    {
+        /* Pack and send one child's subtree at a time, the largest first */
+        MPI_Type_get_extent(sendtype, &lb, &extent);
+        if (recvbuf != MPI_IN_PLACE)
+            rc_self((const char *) sendbuf + rc_displ(displs, sendcnt, root) * extent,
+                    rc_count(sendcounts, sendcnt, root), sendtype, recvbuf, recvcnt, recvtype);
+        buf = NULL;
+        bufcap = 0;
+        for (mask=top>>1; mask>0; mask>>=1)
+        {
+            if (mask >= size) continue;
+            cn = (size - mask < mask) ? size - mask : mask;
+            for (j=0, cap=0; j<cn; j++)
+            {
+                MPI_Pack_size(rc_count(sendcounts, sendcnt, (mask + j + root) % size), sendtype, comm, &bytes);
+                cap += bytes;
+            }
+            if (cap > bufcap)
+            {
+                free(buf);
+                buf = (char *) malloc(cap);
+                bufcap = cap;
+            }
+            for (j=0, pos=0; j<cn; j++)
+            {
+                r = (mask + j + root) % size;
+                sizes[j] = pos;
+                MPI_Pack((const char *) sendbuf + rc_displ(displs, sendcnt, r) * extent,
+                         rc_count(sendcounts, sendcnt, r), sendtype, buf, cap, &pos, comm);
+                sizes[j] = pos - sizes[j];
+            }
+            MPI_Send(sizes, cn, MPI_INT, (mask + root) % size, RC_TAG, comm);
+            MPI_Send(buf, pos, MPI_PACKED, (mask + root) % size, RC_TAG, comm);
+        }
+        free(buf);
+        free(sizes);
+        return MPI_SUCCESS;
+    }
+
+    /* My subtree: vr .. vr+nsub-1, packed sizes first */
+    MPI_Recv(sizes, nsub, MPI_INT, (vr - top + root) % size, RC_TAG, comm, MPI_STATUS_IGNORE);
+    for (j=0, bytes=0; j<nsub; j++) bytes += sizes[j];
+    buf = (char *) malloc(bytes > 0 ? bytes : 1);
+    MPI_Recv(buf, bytes, MPI_PACKED, (vr - top + root) % size, RC_TAG, comm, MPI_STATUS_IGNORE);
+    for (mask=top>>1; mask>0; mask>>=1)
+    {
+        if (mask >= nsub) continue;
+        cn = (nsub - mask < mask) ? nsub - mask : mask;
+        for (j=0, off=0; j<mask; j++) off += sizes[j];
+        for (j=0, len=0; j<cn; j++) len += sizes[mask+j];
+        MPI_Send(sizes + mask, cn, MPI_INT, (vr + mask + root) % size, RC_TAG, comm);
+        MPI_Send(buf + off, len, MPI_PACKED, (vr + mask + root) % size, RC_TAG, comm);
+    }
+    pos = 0;
+    MPI_Unpack(buf, sizes[0], &pos, recvbuf, recvcnt, recvtype, comm);
+    free(buf);
+    free(sizes);
+    return MPI_SUCCESS;
+}
+
+static inline int rc_gather_any(const void *sendbuf, int sendcnt, MPI_Datatype sendtype, void *recvbuf,
+                                const int *recvcounts, int recvcnt, const int *displs, MPI_Datatype recvtype,
+                                int root, MPI_Comm comm, int alg)
+{
+    switch (alg)
+    {
+    case RC_BINOMIAL:
+        return rc_gather_binomial(sendbuf, sendcnt, sendtype, recvbuf, recvcounts, recvcnt, displs, recvtype,
+                                  root, comm);
+    case RC_LINEAR:
+        return rc_gather_linear(sendbuf, sendcnt, sendtype, recvbuf, recvcounts, recvcnt, displs, recvtype,
+                                root, comm);
+    default:
+        return MPI_ERR_ARG;
+    }
+}
+
+static inline int rc_scatter_any(const void *sendbuf, const int *sendcounts, int sendcnt, const int *displs,
+                                 MPI_Datatype sendtype, void *recvbuf, int recvcnt, MPI_Datatype recvtype,
+                                 int root, MPI_Comm comm, int alg)
+{
+    switch (alg)
+    {
+    case RC_BINOMIAL:
+        return rc_scatter_binomial(sendbuf, sendcounts, sendcnt, displs, sendtype, recvbuf, recvcnt, recvtype,
+                                   root, comm);
+    case RC_LINEAR:
+        return rc_scatter_linear(sendbuf, sendcounts, sendcnt, displs, sendtype, recvbuf, recvcnt, recvtype,
+                                 root, comm);
+    default:
+        return MPI_ERR_ARG;
+    }
+}
+
+static inline int rc_gather(const void *sendbuf, int sendcnt, MPI_Datatype sendtype, void *recvbuf, int recvcnt,
+                            MPI_Datatype recvtype, int root, MPI_Comm comm, int alg)
+{
+    int rank, tsize;
+    long long bytes;
+
+    MPI_Comm_rank(comm, &rank);
+    if (rank == root)
+    {
+        MPI_Type_size(recvtype, &tsize);
+        bytes = (long long) recvcnt * tsize;
+    }
+    else
+    {
+        MPI_Type_size(sendtype, &tsize);
+        bytes = (long long) sendcnt * tsize;
+    }
+    if (alg == RC_AUTO) alg = rc_choose(bytes, 0, comm);
+    return rc_gather_any(sendbuf, sendcnt, sendtype, recvbuf, NULL, recvcnt, NULL, recvtype, root, comm, alg);
+}
+
+static inline int rc_gatherv(const void *sendbuf, int sendcnt, MPI_Datatype sendtype, void *recvbuf,
+                             const int *recvcounts, const int *displs, MPI_Datatype recvtype, int root,
+                             MPI_Comm comm, int alg)
+{
+    if (alg == RC_AUTO) alg = rc_choose(0, 1, comm);
+    return rc_gather_any(sendbuf, sendcnt, sendtype, recvbuf, recvcounts, 0, displs, recvtype, root, comm, alg);
+}
+
+static inline int rc_scatter(const void *sendbuf, int sendcnt, MPI_Datatype sendtype, void *recvbuf, int recvcnt,
+                             MPI_Datatype recvtype, int root, MPI_Comm comm, int alg)
+{
+    int rank, tsize;
+    long long bytes;
+
+    MPI_Comm_rank(comm, &rank);
+    if (rank == root)
+    {
+        MPI_Type_size(sendtype, &tsize);
+        bytes = (long long) sendcnt * tsize;
+    }
+    else
+    {
+        MPI_Type_size(recvtype, &tsize);
+        bytes = (long long) recvcnt * tsize;
+    }
+    if (alg == RC_AUTO) alg = rc_choose(bytes, 0, comm);
+    return rc_scatter_any(sendbuf, NULL, sendcnt, NULL, sendtype, recvbuf, recvcnt, recvtype, root, comm, alg);
+}
+
+static inline int rc_scatterv(const void *sendbuf, const int *sendcounts, const int *displs, MPI_Datatype sendtype,
+                              void *recvbuf, int recvcnt, MPI_Datatype recvtype, int root, MPI_Comm comm, int alg)
+{
+    if (alg == RC_AUTO) alg = rc_choose(0, 1, comm);
+    return rc_scatter_any(sendbuf, sendcounts, 0, displs, sendtype, recvbuf, recvcnt, recvtype, root, comm, alg);
+}
+
+#endif /* ROOTED_COLL_H */
@@ -0,0 +1,289 @@
+/*
+scan_engine.h
+
+   User-level inclusive scan (MPI_Scan semantics) with two algorithms,
+   an automatic choice between them, and a segmented variant:
+
+   SCAN_RECDBL    ceil(log2(p)) steps of MPI_Sendrecv with rank^2^k; the
+                  whole vector moves in every step, so it is the choice
+                  for short vectors where latency dominates.
+   SCAN_PIPELINE  a chain 0 -> 1 -> ... -> p-1 carrying the running
+                  prefix in segments of SCAN_SEG_BYTES; each rank
+                  combines a segment and forwards it while the next one
+                  is in flight, so every link carries the vector once
+                  and long vectors approach link bandwidth after the
+                  pipeline fills.
+
+Usage
+
+   scan_scan(sendbuf, recvbuf, count, MPI_DOUBLE, op, comm, SCAN_AUTO);
+
+   Segmented: flags[i] != 0 on rank r starts a new segment at r for
+   element i, so recvbuf[i] combines the ranks s..r with s the highest
+   rank <= r whose flag for i is set (0 if none):
+
+   scan_segmented(sendbuf, flags, recvbuf, count, MPI_DOUBLE, op, comm,
+                  SCAN_AUTO);
+
+Remarks
+
+   The arguments have the meaning they have for MPI_Scan, including
+   MPI_IN_PLACE as sendbuf. op may be predefined or from MPI_Op_create,
+   commutative or not: operands are always combined in rank order
+   (MPI_Reduce_local(lower, higher)), and recursive doubling checks
+   MPI_Op_commutative only to skip a copy.
+
+   The segmented scan applies (f1, x1) + (f2, x2) = (f1|f2, f2 ? x2 :
+   x1 op x2), which is associative but never commutative, element by
+   element; the flags travel as MPI_CHAR messages next to the data.
+
+   SCAN_AUTO picks from count, datatype and communicator size alone,
+   which are the same on every rank, so no agreement step is needed:
+   the pipeline when the bytes on its critical path, vector plus one
+   segment per hop, are fewer than the vector times ceil(log2(p)).
+
+   Work buffers are allocated per call from the datatype's true extent.
+   Messages use tags SCAN_TAG and SCAN_TAG+1 on comm.
+*/
+
+#ifndef SCAN_ENGINE_H
+#define SCAN_ENGINE_H
+
+#include "mpi.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SCAN_AUTO     0
+#define SCAN_RECDBL   1
+#define SCAN_PIPELINE 2
+
+#define SCAN_TAG       4747
+#define SCAN_SEG_BYTES (32*1024)
+
+static inline const char *scan_name(int alg)
+{
+    switch (alg)
+    {
+    case SCAN_RECDBL:   return "recdbl";
+    case SCAN_PIPELINE: return "pipeline";
+    default:            return "auto";
+    }
+}
+
+/* Buffer for count elements of type, and the address to free it with */
+static inline void *scan_alloc(int count, MPI_Datatype type, void **mem)
+{
+    MPI_Aint lb, extent, tlb, textent;
+    MPI_Type_get_extent(type, &lb, &extent);
+    MPI_Type_get_true_extent(type, &tlb, &textent);
+    *mem = malloc(count > 0 ? (size_t) (count - 1) * extent + textent : 1);
+    return (char *) *mem - tlb;
+}
+
+static inline void scan_copy(const void *src, void *dst, int count, MPI_Datatype type)
+{
+    MPI_Aint lb, extent, tlb, textent;
+    int tsize;
+
+    if (src == dst || count == 0) return;
+    MPI_Type_size(type, &tsize);
+    MPI_Type_get_extent(type, &lb, &extent);
+    MPI_Type_get_true_extent(type, &tlb, &textent);
+    if (extent == tsize && textent == tsize)
+        memcpy((char *) dst + tlb, (const char *) src + tlb, (size_t) count * tsize);
+    else MPI_Sendrecv(src, count, type, 0, SCAN_TAG, dst, count, type, 0, SCAN_TAG, MPI_COMM_SELF,
+                      MPI_STATUS_IGNORE);
+}
+
+/* hi = lo op hi over count elements; with flags, elements whose hi flag is set keep hi */
+static inline void scan_combine(const void *lo, const char *lof, void *hi, char *hif, int count,
+                                MPI_Datatype type, MPI_Op op)
+{
+    MPI_Aint lb, extent;
+    int i, j;
+
+    if (hif == NULL)
+    {
+        if (count > 0) MPI_Reduce_local(lo, hi, count, type, op);
+        return;
+    }
+    MPI_Type_get_extent(type, &lb, &extent);
+    for (i=0; i<count; i=j)
+    {
+        for (j=i; j<count && !hif[j]; j++);
+        if (j > i)
+            MPI_Reduce_local((const char *) lo + i * extent, (char *) hi + i * extent, j - i, type, op);
+        for (; j<count && hif[j]; j++);
+    }
+    for (i=0; i<count; i++) hif[i] |= lof[i];
+}
+
+static inline int scan_choose(int count, MPI_Datatype type, MPI_Comm comm)
+{
+    int size, tsize, log2p = 0;
+    double bytes;
+
+    MPI_Comm_size(comm, &size);
+    MPI_Type_size(type, &tsize);
+    while ((1 << log2p) < size) log2p++;
+    bytes = (double) count * tsize;
+    if (size > 2 && bytes + (double) (size - 2) * SCAN_SEG_BYTES < bytes * log2p) return SCAN_PIPELINE;
+    return SCAN_RECDBL;
+}
+
+static inline int scan_recdbl(const void *sendbuf, const char *flags, void *recvbuf, int count,
+                              MPI_Datatype type, MPI_Op op, MPI_Comm comm)
+{
+    int rank, size, mask, dst, commute;
+    void *pmem, *tmem, *partial, *tmp, *swap;
+    char *fmem = NULL, *pf = NULL, *tf = NULL, *rf = NULL, *cswap;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    MPI_Op_commutative(op, &commute);
+    if (flags) commute = 0;
+    if (sendbuf != MPI_IN_PLACE) scan_copy(sendbuf, recvbuf, count, type);
+    partial = scan_alloc(count, type, &pmem);
+    tmp = scan_alloc(count, type, &tmem);
+    scan_copy(recvbuf, partial, count, type);
+    if (flags)
+    {
+        fmem = pf = (char *) malloc(3 * (size_t) count + 1);
+        tf = pf + count;
+        rf = tf + count;
+        memcpy(pf, flags, count);
+        memcpy(rf, flags, count);
+    }
+
+    /* recvbuf: prefix up to me; partial: combination of my whole 2^k block so far */
+    for (mask=1; mask<size; mask<<=1)
+    {
+        dst = rank ^ mask;
+        if (dst >= size) continue;
+        MPI_Sendrecv(partial, count, type, dst, SCAN_TAG, tmp, count, type, dst, SCAN_TAG, comm,
+                     MPI_STATUS_IGNORE);
+        if (flags)
+            MPI_Sendrecv(pf, count, MPI_CHAR, dst, SCAN_TAG + 1, tf, count, MPI_CHAR, dst, SCAN_TAG + 1,
+                         comm, MPI_STATUS_IGNORE);
+        if (rank > dst)
+        {
+            /* tmp is the block below mine */
+            scan_combine(tmp, tf, partial, pf, count, type, op);
+            if (flags)
+            {
+                /* rf still holds the flags of recvbuf before this step; pf was just updated */
+                scan_combine(tmp, tf, recvbuf, rf, count, type, op);
+            }
+            else
+            {
+                MPI_Reduce_local(tmp, recvbuf, count, type, op);
+            }
+        }
+        else if (commute)
+        {
+            MPI_Reduce_local(tmp, partial, count, type, op);
+        }
+        else
+        {
+            /* The block above: partial = partial op tmp, computed into tmp */
+            scan_combine(partial, pf, tmp, tf, count, type, op);
+            swap = partial; partial = tmp; tmp = swap;
+            swap = pmem; pmem = tmem; tmem = swap;
+            cswap = pf; pf = tf; tf = cswap;
+        }
+    }
+    free(pmem);
+    free(tmem);
+    free(fmem);
+    return MPI_SUCCESS;
+}
+
+static inline int scan_pipeline(const void *sendbuf, const char *flags, void *recvbuf, int count,
+                                MPI_Datatype type, MPI_Op op, MPI_Comm comm)
+{
+    int rank, size, tsize, seg, nseg, s, n, off, nsent = 0;
+    MPI_Aint lb, extent;
+    MPI_Request rreq[2], *sreq;
+    void *mem[2], *tmp[2];
+    char *myf = NULL, *tf[2] = { NULL, NULL };
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    MPI_Type_size(type, &tsize);
+    MPI_Type_get_extent(type, &lb, &extent);
+    if (sendbuf != MPI_IN_PLACE) scan_copy(sendbuf, recvbuf, count, type);
+    if (size == 1 || count == 0) return MPI_SUCCESS;
+
+    seg = tsize > 0 && tsize < SCAN_SEG_BYTES ? SCAN_SEG_BYTES / tsize : 1;
+    if (seg > count) seg = count;
+    nseg = (count + seg - 1) / seg;
+    sreq = (MPI_Request *) malloc(2 * (size_t) nseg * sizeof(MPI_Request));
+    tmp[0] = scan_alloc(seg, type, &mem[0]);
+    tmp[1] = scan_alloc(seg, type, &mem[1]);
+    if (flags)
+    {
+        myf = (char *) malloc((size_t) count + 2 * (size_t) seg);
+        tf[0] = myf + count;
+        tf[1] = tf[0] + seg;
+        memcpy(myf, flags, count);
+    }
+
+    if (rank > 0)
+    {
+        n = (count < seg) ? count : seg;
+        MPI_Irecv(tmp[0], n, type, rank - 1, SCAN_TAG, comm, &rreq[0]);
+        if (flags) MPI_Irecv(tf[0], n, MPI_CHAR, rank - 1, SCAN_TAG + 1, comm, &rreq[1]);
+    }
+    for (s=0; s<nseg; s++)
+    {
+        off = s * seg;
+        n = (count - off < seg) ? count - off : seg;
+        if (rank > 0)
+        {
+            MPI_Waitall(flags ? 2 : 1, rreq, MPI_STATUSES_IGNORE);
+            if (s + 1 < nseg)
+            {
+                /* The next segment lands in the other buffer while this one is combined */
+                int n1 = (count - off - seg < seg) ? count - off - seg : seg;
+                MPI_Irecv(tmp[(s+1)%2], n1, type, rank - 1, SCAN_TAG, comm, &rreq[0]);
+                if (flags) MPI_Irecv(tf[(s+1)%2], n1, MPI_CHAR, rank - 1, SCAN_TAG + 1, comm, &rreq[1]);
+            }
+            scan_combine(tmp[s%2], tf[s%2], (char *) recvbuf + off * extent, flags ? myf + off : NULL, n,
+                         type, op);
+        }
+        if (rank < size - 1)
+        {
+            MPI_Isend((char *) recvbuf + off * extent, n, type, rank + 1, SCAN_TAG, comm, &sreq[nsent++]);
+            if (flags) MPI_Isend(myf + off, n, MPI_CHAR, rank + 1, SCAN_TAG + 1, comm, &sreq[nsent++]);
+        }
+    }
+    MPI_Waitall(nsent, sreq, MPI_STATUSES_IGNORE);
+    free(sreq);
+    free(mem[0]);
+    free(mem[1]);
+    free(myf);
+    return MPI_SUCCESS;
+}
+
+static inline int scan_segmented(const void *sendbuf, const char *flags, void *recvbuf, int count,
+                                 MPI_Datatype type, MPI_Op op, MPI_Comm comm, int alg)
+{
+    if (alg == SCAN_AUTO) alg = scan_choose(count, type, comm);
+    switch (alg)
+    {
+    case SCAN_RECDBL:
+        return scan_recdbl(sendbuf, flags, recvbuf, count, type, op, comm);
+    case SCAN_PIPELINE:
+        return scan_pipeline(sendbuf, flags, recvbuf, count, type, op, comm);
+    default:
+        return MPI_ERR_ARG;
+    }
+}
+
+static inline int scan_scan(const void *sendbuf, void *recvbuf, int count, MPI_Datatype type, MPI_Op op,
+                            MPI_Comm comm, int alg)
+{
+    return scan_segmented(sendbuf, NULL, recvbuf, count, type, op, comm, alg);
+}
+
+#endif /* SCAN_ENGINE_H */
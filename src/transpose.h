@@ -0,0 +1,229 @@
+/*
+transpose.h
+
+   Distributed transpose with MPI_Alltoallw and no local packing. The
+   send side of every peer is a subarray of the input block; the receive
+   side is a column type built with MPI_Type_create_resized, which writes
+   the incoming elements straight into their transposed positions. The
+   whole redistribution is a single MPI_Alltoallw call.
+
+Usage
+
+   2D, rows to columns: each of p ranks holds nx/p rows of an nx x ny
+   matrix and ends up with ny/p rows of its ny x nx transpose.
+
+   transpose_t t;
+   transpose_create_2d(comm, nx, ny, MPI_DOUBLE, &t);
+   in  = malloc(t.in_count * sizeof(double));      nxl x ny
+   out = malloc(t.out_count * sizeof(double));     nyl x nx
+   transpose_execute(&t, in, out);
+   transpose_free(&t);
+
+   3D pencils (as in parallel FFTs), on a p1 x p2 process grid with
+   row_comm holding the p1 ranks of one z slab:
+
+   int xpencil[3] = { nzl, nyl, nx };               z, y, x; x contiguous
+   int x2y[3]     = { 0, 2, 1 };                    out is z, x, y
+   transpose_create(row_comm, xpencil, 2, 1, ny, x2y, MPI_DOUBLE, &t);
+
+Parameters (transpose_create)
+
+   comm
+          [in] the ranks taking part; block r of every split axis
+          belongs to rank r of comm
+
+   n
+          [in] extents of the local input block, C order (axis 2
+          contiguous)
+
+   from
+          [in] input axis that is complete locally and gets split
+          across comm
+
+   to
+          [in] input axis that is split across comm and gets gathered
+
+   nto
+          [in] global extent of axis to; rank r of comm holds block r
+          of it (transpose_block), which must match n[to]
+
+   perm
+          [in] memory order of the output: output axis k is input axis
+          perm[k]. { 0, 1, 2 } redistributes without transposing.
+
+   elemtype
+          [in] datatype of one element; must be contiguous
+
+Remarks
+
+   Blocks are distributed as evenly as possible, the first nto % p ranks
+   getting one extra element (transpose_block). The output block has
+   out_n[k] elements along output axis k; in and out must not overlap.
+
+   The datatypes and displacements are built once by transpose_create
+   and reused by every transpose_execute. The geometry (n, out_n,
+   out_stride) is kept in the transpose_t so that a caller can do the
+   same exchange by hand, as bench_transpose does for comparison.
+*/
+
+#ifndef TRANSPOSE_H
+#define TRANSPOSE_H
+
+#include "mpi.h"
+#include <stdlib.h>
+
+typedef struct
+{
+    MPI_Comm comm;
+    int size, rank;
+    int n[3];               /* local input extents */
+    int from, to, nto;
+    int perm[3];
+    int out_n[3];           /* local output extents, output axis order */
+    int out_stride[3];      /* output stride (elements) of each input axis */
+    long long in_count, out_count;
+    int elemsize;
+    int *scounts, *rcounts, *sdispls, *rdispls;
+    MPI_Datatype *stypes, *rtypes;
+} transpose_t;
+
+/* Block r of n elements split over p: the first n % p blocks get one extra */
+static inline void transpose_block(int n, int p, int r, int *off, int *len)
+{
+    int base = n / p, rem = n % p;
+    *len = base + (r < rem);
+    *off = r * base + (r < rem ? r : rem);
+}
+
+static inline int transpose_create(MPI_Comm comm, const int *n, int from, int to, int nto,
+                                   const int *perm, MPI_Datatype elemtype, transpose_t *t)
+{
+    int a, k, r, off, len, toff, tlen, myoff, mylen, sub[3], start[3], stride;
+    MPI_Aint lb, extent;
+    MPI_Datatype col, tmp;
+
+    if (from == to || from < 0 || from > 2 || to < 0 || to > 2) return MPI_ERR_ARG;
+    MPI_Comm_size(comm, &t->size);
+    MPI_Comm_rank(comm, &t->rank);
+    MPI_Type_get_extent(elemtype, &lb, &extent);
+
+    t->comm = comm;
+    t->from = from;
+    t->to = to;
+    t->nto = nto;
+    t->elemsize = (int) extent;
+    transpose_block(n[from], t->size, t->rank, &myoff, &mylen);
+    transpose_block(nto, t->size, t->rank, &toff, &tlen);
+    if (tlen != n[to]) return MPI_ERR_ARG;
+
+    t->in_count = t->out_count = 1;
+    for (a=0; a<3; a++)
+    {
+        t->n[a] = n[a];
+        t->perm[a] = perm[a];
+        t->in_count *= n[a];
+    }
+    for (k=0; k<3; k++)
+    {
+        a = perm[k];
+        t->out_n[k] = (a == from) ? mylen : (a == to) ? nto : n[a];
+        t->out_count *= t->out_n[k];
+    }
+    stride = 1;
+    for (k=2; k>=0; k--)
+    {
+        t->out_stride[perm[k]] = stride;
+        stride *= t->out_n[k];
+    }
+
+    t->scounts = (int *) malloc(4 * t->size * sizeof(int));
+    t->rcounts = t->scounts + t->size;
+    t->sdispls = t->rcounts + t->size;
+    t->rdispls = t->sdispls + t->size;
+    t->stypes  = (MPI_Datatype *) malloc(2 * t->size * sizeof(MPI_Datatype));
+    t->rtypes  = t->stypes + t->size;
+
+    for (r=0; r<t->size; r++)
+    {
+        /* Send: our input block restricted to r's share of axis from */
+        transpose_block(n[from], t->size, r, &off, &len);
+        for (a=0; a<3; a++)
+        {
+            sub[a] = (a == from) ? len : n[a];
+            start[a] = (a == from) ? off : 0;
+        }
+        t->sdispls[r] = 0;
+        t->scounts[r] = (sub[0] * sub[1] * sub[2] != 0);
+        if (t->scounts[r] == 0)
+        {
+            t->stypes[r] = elemtype;
+        }
+        else
+        {
+            MPI_Type_create_subarray(3, n, sub, start, MPI_ORDER_C, elemtype, &t->stypes[r]);
+            MPI_Type_commit(&t->stypes[r]);
+        }
+
+        /*
+        * Receive: r sends its elements in its own C order (axis 2
+        * fastest). Each level is the level below resized to the output
+        * stride of that input axis and repeated, so element (i0,i1,i2)
+        * of r's block lands at sum(i_a * out_stride[a]).
+        */
+        transpose_block(nto, t->size, r, &off, &len);
+        for (a=0; a<3; a++) sub[a] = (a == from) ? mylen : (a == to) ? len : n[a];
+        t->rdispls[r] = off * t->out_stride[to] * t->elemsize;
+        t->rcounts[r] = (sub[0] * sub[1] * sub[2] != 0);
+        if (t->rcounts[r] == 0)
+        {
+            t->rtypes[r] = elemtype;
+            continue;
+        }
+        col = elemtype;
+        for (a=2; a>=0; a--)
+        {
+            MPI_Type_create_resized(col, 0, (MPI_Aint) t->out_stride[a] * t->elemsize, &tmp);
+            if (col != elemtype) MPI_Type_free(&col);
+            MPI_Type_contiguous(sub[a], tmp, &col);
+            MPI_Type_free(&tmp);
+        }
+        t->rtypes[r] = col;
+        MPI_Type_commit(&t->rtypes[r]);
+    }
+    return MPI_SUCCESS;
+}
+
+/* nx x ny matrix with rows split over comm -> its ny x nx transpose, rows split */
+static inline int transpose_create_2d(MPI_Comm comm, int nx, int ny, MPI_Datatype elemtype,
+                                      transpose_t *t)
+{
+    int size, rank, off, len, n[3], perm[3] = { 0, 2, 1 };
+
+    MPI_Comm_size(comm, &size);
+    MPI_Comm_rank(comm, &rank);
+    transpose_block(nx, size, rank, &off, &len);
+    n[0] = 1;
+    n[1] = len;
+    n[2] = ny;
+    return transpose_create(comm, n, 2, 1, nx, perm, elemtype, t);
+}
+
+static inline int transpose_execute(transpose_t *t, const void *in, void *out)
+{
+    return MPI_Alltoallw(in, t->scounts, t->sdispls, t->stypes,
+                         out, t->rcounts, t->rdispls, t->rtypes, t->comm);
+}
+
+static inline void transpose_free(transpose_t *t)
+{
+    int r;
+    for (r=0; r<t->size; r++)
+    {
+        if (t->scounts[r]) MPI_Type_free(&t->stypes[r]);
+        if (t->rcounts[r]) MPI_Type_free(&t->rtypes[r]);
+    }
+    free(t->stypes);
+    free(t->scounts);
+}
+
+#endif /* TRANSPOSE_H */
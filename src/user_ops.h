@@ -0,0 +1,319 @@
+/*
+user_ops.h
+
+   Registry of vectorized user reduction operators for MPI_Op_create.
+   One MPI_User_function per operation inspects *dtype and dispatches to
+   a typed kernel; each typed kernel is compiled for AVX-512, AVX2 and
+   the SSE2 baseline and the best one supported by the running CPU is
+   chosen once in user_ops_init.
+
+Operations and datatypes
+
+   USER_OP_SUM, USER_OP_PROD, USER_OP_MIN, USER_OP_MAX
+          Element-wise on MPI_INT/MPI_INT32_T, MPI_LONG_LONG/MPI_INT64_T,
+          MPI_FLOAT and MPI_DOUBLE.
+
+   USER_OP_MAXLOC
+          (value, index) pairs using the predefined pair types MPI_2INT,
+          MPI_LONG_INT, MPI_FLOAT_INT and MPI_DOUBLE_INT; ties keep the
+          lower index, as MPI_MAXLOC does. The int64 variant assumes an
+          LP64 platform where long is 64 bits.
+
+   USER_OP_SUMSQ
+          Fused (sum, sum of squares) pairs. Each element is a pair of the
+          base type; fill it with (x, x*x) locally and a single reduction
+          yields both moments, e.g. for a global mean and variance. The
+          pair datatypes are created by user_ops_init; get them from
+          user_ops_type.
+
+Usage
+
+   MPI_Init(&argc, &argv);
+   user_ops_init();
+   MPI_Allreduce(in, out, n, MPI_DOUBLE, user_ops_get(USER_OP_SUM), comm);
+   MPI_Allreduce(pin, pout, n, user_ops_type(USER_OP_SUMSQ, USER_T_DOUBLE),
+                 user_ops_get(USER_OP_SUMSQ), comm);
+   user_ops_finalize();
+   MPI_Finalize();
+
+Remarks
+
+   All operations are registered as commutative. The kernels follow the
+   MPI convention inoutvec[i] = invec[i] op inoutvec[i]; MPI never passes
+   overlapping in and inout buffers, which lets the kernels be declared
+   restrict and vectorized without runtime alias checks.
+
+   user_ops_force_isa lowers the dispatch level, so the same kernels can
+   be timed at each instruction set on one machine. On non-x86 targets
+   only the generic build of each kernel exists.
+
+   An unsupported *dtype aborts the job: a reduction function cannot
+   return an error (see MPI_Op_create).
+*/
+
+#ifndef USER_OPS_H
+#define USER_OPS_H
+
+#include "mpi.h"
+#include <stdio.h>
+#include <stdint.h>
+
+typedef enum
+{
+    USER_OP_SUM, USER_OP_PROD, USER_OP_MIN, USER_OP_MAX, USER_OP_MAXLOC, USER_OP_SUMSQ,
+    USER_OP_COUNT
+} user_op_kind;
+
+typedef enum
+{
+    USER_T_INT32, USER_T_INT64, USER_T_FLOAT, USER_T_DOUBLE,
+    USER_T_COUNT
+} user_type_kind;
+
+typedef enum
+{
+    USER_ISA_GENERIC, USER_ISA_SSE2, USER_ISA_AVX2, USER_ISA_AVX512,
+    USER_ISA_COUNT
+} user_isa_kind;
+
+static const char *user_op_names[USER_OP_COUNT] = { "sum", "prod", "min", "max", "maxloc", "sumsq" };
+static const char *user_type_names[USER_T_COUNT] = { "int32", "int64", "float", "double" };
+static const char *user_isa_names[USER_ISA_COUNT] = { "generic", "sse2", "avx2", "avx512" };
+
+typedef void (user_kernel_fn)(const void *in, void *inout, int n);
+
+typedef struct { int32_t v; int i; } user_pair_int32;
+typedef struct { long    v; int i; } user_pair_int64;
+typedef struct { float   v; int i; } user_pair_float;
+typedef struct { double  v; int i; } user_pair_double;
+
+#define USER_OP_ADD(a, b) ((a) + (b))
+#define USER_OP_MUL(a, b) ((a) * (b))
+#define USER_OP_LT(a, b)  ((a) < (b) ? (a) : (b))
+#define USER_OP_GT(a, b)  ((a) > (b) ? (a) : (b))
+
+/* Element-wise kernel: inout[i] = in[i] OP inout[i] */
+#define USER_DEFINE_EW(NAME, T, OP, ATTR)                                   \
+    ATTR static void NAME(const void *vin, void *vinout, int n)             \
+    {                                                                       \
+        const T *__restrict in = (const T *) vin;                           \
+        T *__restrict inout = (T *) vinout;                                 \
+        int i;                                                              \
+        for (i=0; i<n; i++) inout[i] = OP(in[i], inout[i]);                 \
+    }
+
+/* MAXLOC kernel on (value, index) pairs */
+#define USER_DEFINE_MAXLOC(NAME, P, ATTR)                                   \
+    ATTR static void NAME(const void *vin, void *vinout, int n)             \
+    {                                                                       \
+        const P *__restrict in = (const P *) vin;                           \
+        P *__restrict inout = (P *) vinout;                                 \
+        int i;                                                              \
+        for (i=0; i<n; i++)                                                 \
+        {                                                                   \
+            int take = in[i].v > inout[i].v ||                              \
+                       (in[i].v == inout[i].v && in[i].i < inout[i].i);     \
+            inout[i].v = take ? in[i].v : inout[i].v;                       \
+            inout[i].i = take ? in[i].i : inout[i].i;                       \
+        }                                                                   \
+    }
+
+/* One kernel per (op, type) for a given ISA suffix and target attribute */
+#define USER_DEFINE_ISA(SFX, ATTR)                                          \
+    USER_DEFINE_EW(user_k_sum_int32_##SFX,  int32_t, USER_OP_ADD, ATTR)     \
+    USER_DEFINE_EW(user_k_sum_int64_##SFX,  int64_t, USER_OP_ADD, ATTR)     \
+    USER_DEFINE_EW(user_k_sum_float_##SFX,  float,   USER_OP_ADD, ATTR)     \
+    USER_DEFINE_EW(user_k_sum_double_##SFX, double,  USER_OP_ADD, ATTR)     \
+    USER_DEFINE_EW(user_k_prod_int32_##SFX,  int32_t, USER_OP_MUL, ATTR)    \
+    USER_DEFINE_EW(user_k_prod_int64_##SFX,  int64_t, USER_OP_MUL, ATTR)    \
+    USER_DEFINE_EW(user_k_prod_float_##SFX,  float,   USER_OP_MUL, ATTR)    \
+    USER_DEFINE_EW(user_k_prod_double_##SFX, double,  USER_OP_MUL, ATTR)    \
+    USER_DEFINE_EW(user_k_min_int32_##SFX,  int32_t, USER_OP_LT, ATTR)      \
+    USER_DEFINE_EW(user_k_min_int64_##SFX,  int64_t, USER_OP_LT, ATTR)      \
+    USER_DEFINE_EW(user_k_min_float_##SFX,  float,   USER_OP_LT, ATTR)      \
+    USER_DEFINE_EW(user_k_min_double_##SFX, double,  USER_OP_LT, ATTR)      \
+    USER_DEFINE_EW(user_k_max_int32_##SFX,  int32_t, USER_OP_GT, ATTR)      \
+    USER_DEFINE_EW(user_k_max_int64_##SFX,  int64_t, USER_OP_GT, ATTR)      \
+    USER_DEFINE_EW(user_k_max_float_##SFX,  float,   USER_OP_GT, ATTR)      \
+    USER_DEFINE_EW(user_k_max_double_##SFX, double,  USER_OP_GT, ATTR)      \
+    USER_DEFINE_MAXLOC(user_k_maxloc_int32_##SFX,  user_pair_int32,  ATTR)  \
+    USER_DEFINE_MAXLOC(user_k_maxloc_int64_##SFX,  user_pair_int64,  ATTR)  \
+    USER_DEFINE_MAXLOC(user_k_maxloc_float_##SFX,  user_pair_float,  ATTR)  \
+    USER_DEFINE_MAXLOC(user_k_maxloc_double_##SFX, user_pair_double, ATTR)  \
+    static user_kernel_fn *user_table_##SFX[USER_OP_COUNT][USER_T_COUNT] =  \
+    {                                                                       \
+        { user_k_sum_int32_##SFX, user_k_sum_int64_##SFX,                   \
+          user_k_sum_float_##SFX, user_k_sum_double_##SFX },                \
+        { user_k_prod_int32_##SFX, user_k_prod_int64_##SFX,                 \
+          user_k_prod_float_##SFX, user_k_prod_double_##SFX },              \
+        { user_k_min_int32_##SFX, user_k_min_int64_##SFX,                   \
+          user_k_min_float_##SFX, user_k_min_double_##SFX },                \
+        { user_k_max_int32_##SFX, user_k_max_int64_##SFX,                   \
+          user_k_max_float_##SFX, user_k_max_double_##SFX },                \
+        { user_k_maxloc_int32_##SFX, user_k_maxloc_int64_##SFX,             \
+          user_k_maxloc_float_##SFX, user_k_maxloc_double_##SFX },          \
+        /* sum+sumsq pairs reduce as a sum over 2n elements */              \
+        { user_k_sum_int32_##SFX, user_k_sum_int64_##SFX,                   \
+          user_k_sum_float_##SFX, user_k_sum_double_##SFX }                 \
+    };
+
+#if defined(__GNUC__)
+#define USER_VEC_ATTR(isa) __attribute__((target(isa), optimize("tree-vectorize")))
+#define USER_GENERIC_ATTR  __attribute__((optimize("tree-vectorize")))
+#else
+#define USER_GENERIC_ATTR
+#endif
+
+USER_DEFINE_ISA(generic, USER_GENERIC_ATTR)
+#if defined(__GNUC__) && defined(__x86_64__)
+#define USER_OPS_X86 1
+USER_DEFINE_ISA(sse2,   USER_VEC_ATTR("sse2"))
+USER_DEFINE_ISA(avx2,   USER_VEC_ATTR("avx2"))
+USER_DEFINE_ISA(avx512, USER_VEC_ATTR("avx512f,avx512dq,avx512bw,avx512vl"))
+#endif
+
+static user_kernel_fn *(*user_active)[USER_T_COUNT] = user_table_generic;
+static user_isa_kind user_isa_best = USER_ISA_GENERIC;
+static user_isa_kind user_isa_cur  = USER_ISA_GENERIC;
+static MPI_Op user_mpi_ops[USER_OP_COUNT];
+static MPI_Datatype user_sumsq_types[USER_T_COUNT];
+
+/* Map *dtype to the type index for op; -1 if the op does not take it */
+static inline int user_ops_type_index(user_op_kind op, MPI_Datatype dtype)
+{
+    int t;
+    if (op == USER_OP_MAXLOC)
+    {
+        if (dtype == MPI_2INT)        return USER_T_INT32;
+        if (dtype == MPI_LONG_INT)    return USER_T_INT64;
+        if (dtype == MPI_FLOAT_INT)   return USER_T_FLOAT;
+        if (dtype == MPI_DOUBLE_INT)  return USER_T_DOUBLE;
+        return -1;
+    }
+    if (op == USER_OP_SUMSQ)
+    {
+        for (t=0; t<USER_T_COUNT; t++)
+        {
+            if (dtype == user_sumsq_types[t]) return t;
+        }
+        return -1;
+    }
+    if (dtype == MPI_INT || dtype == MPI_INT32_T)         return USER_T_INT32;
+    if (dtype == MPI_LONG_LONG || dtype == MPI_INT64_T)   return USER_T_INT64;
+    if (sizeof(long) == 8 && dtype == MPI_LONG)           return USER_T_INT64;
+    if (dtype == MPI_FLOAT)                               return USER_T_FLOAT;
+    if (dtype == MPI_DOUBLE)                              return USER_T_DOUBLE;
+    return -1;
+}
+
+static inline void user_ops_dispatch(user_op_kind op, void *in, void *inout, int *len,
+                                     MPI_Datatype *dtype)
+{
+    int t = user_ops_type_index(op, *dtype);
+    if (t < 0)
+    {
+        fprintf(stderr, "user_ops: unsupported datatype for %s\n", user_op_names[op]);
+        fflush(stderr);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    user_active[op][t](in, inout, (op == USER_OP_SUMSQ) ? 2 * *len : *len);
+}
+
+static void user_ops_sum_fn(void *in, void *inout, int *len, MPI_Datatype *dtype)
+{ user_ops_dispatch(USER_OP_SUM, in, inout, len, dtype); }
+static void user_ops_prod_fn(void *in, void *inout, int *len, MPI_Datatype *dtype)
+{ user_ops_dispatch(USER_OP_PROD, in, inout, len, dtype); }
+static void user_ops_min_fn(void *in, void *inout, int *len, MPI_Datatype *dtype)
+{ user_ops_dispatch(USER_OP_MIN, in, inout, len, dtype); }
+static void user_ops_max_fn(void *in, void *inout, int *len, MPI_Datatype *dtype)
+{ user_ops_dispatch(USER_OP_MAX, in, inout, len, dtype); }
+static void user_ops_maxloc_fn(void *in, void *inout, int *len, MPI_Datatype *dtype)
+{ user_ops_dispatch(USER_OP_MAXLOC, in, inout, len, dtype); }
+static void user_ops_sumsq_fn(void *in, void *inout, int *len, MPI_Datatype *dtype)
+{ user_ops_dispatch(USER_OP_SUMSQ, in, inout, len, dtype); }
+
+static MPI_User_function *user_ops_fns[USER_OP_COUNT] =
+{
+    user_ops_sum_fn, user_ops_prod_fn, user_ops_min_fn,
+    user_ops_max_fn, user_ops_maxloc_fn, user_ops_sumsq_fn
+};
+
+/* Select the kernel table for isa, clamped to what the CPU supports */
+static inline user_isa_kind user_ops_force_isa(user_isa_kind isa)
+{
+    if (isa > user_isa_best) isa = user_isa_best;
+    switch (isa)
+    {
+#ifdef USER_OPS_X86
+    case USER_ISA_AVX512: user_active = user_table_avx512; break;
+    case USER_ISA_AVX2:   user_active = user_table_avx2;   break;
+    case USER_ISA_SSE2:   user_active = user_table_sse2;   break;
+#endif
+    default:              user_active = user_table_generic; isa = USER_ISA_GENERIC; break;
+    }
+    user_isa_cur = isa;
+    return isa;
+}
+
+static inline user_isa_kind user_ops_isa(void) { return user_isa_cur; }
+static inline user_isa_kind user_ops_isa_best(void) { return user_isa_best; }
+
+/* Direct access to the active kernel, e.g. for local combining or timing */
+static inline user_kernel_fn *user_ops_kernel(user_op_kind op, user_type_kind t)
+{
+    return user_active[op][t];
+}
+
+static inline int user_ops_init(void)
+{
+    static const MPI_Datatype base[USER_T_COUNT] = { MPI_INT32_T, MPI_INT64_T, MPI_FLOAT, MPI_DOUBLE };
+    int i;
+
+#ifdef USER_OPS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq") &&
+        __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl"))
+        user_isa_best = USER_ISA_AVX512;
+    else if (__builtin_cpu_supports("avx2"))
+        user_isa_best = USER_ISA_AVX2;
+    else
+        user_isa_best = USER_ISA_SSE2;
+#endif
+    user_ops_force_isa(user_isa_best);
+
+    for (i=0; i<USER_T_COUNT; i++)
+    {
+        MPI_Type_contiguous(2, base[i], &user_sumsq_types[i]);
+        MPI_Type_commit(&user_sumsq_types[i]);
+    }
+    for (i=0; i<USER_OP_COUNT; i++)
+    {
+        MPI_Op_create(user_ops_fns[i], 1, &user_mpi_ops[i]);
+    }
+    return MPI_SUCCESS;
+}
+
+static inline void user_ops_finalize(void)
+{
+    int i;
+    for (i=0; i<USER_OP_COUNT; i++) MPI_Op_free(&user_mpi_ops[i]);
+    for (i=0; i<USER_T_COUNT; i++) MPI_Type_free(&user_sumsq_types[i]);
+}
+
+static inline MPI_Op user_ops_get(user_op_kind op)
+{
+    return user_mpi_ops[op];
+}
+
+/* Datatype to pass with op for elements of base type t */
+static inline MPI_Datatype user_ops_type(user_op_kind op, user_type_kind t)
+{
+    static const MPI_Datatype plain[USER_T_COUNT]  = { MPI_INT32_T, MPI_INT64_T, MPI_FLOAT, MPI_DOUBLE };
+    static const MPI_Datatype maxloc[USER_T_COUNT] = { MPI_2INT, MPI_LONG_INT, MPI_FLOAT_INT, MPI_DOUBLE_INT };
+
+    if (op == USER_OP_MAXLOC) return maxloc[t];
+    if (op == USER_OP_SUMSQ)  return user_sumsq_types[t];
+    return plain[t];
+}
+
+#endif /* USER_OPS_H */